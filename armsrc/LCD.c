@@ -164,68 +164,159 @@ void LCDSetXY(unsigned char x, unsigned char y)
   }	
 }
 
-void LCDSetPixel(unsigned char x, unsigned char y, unsigned char color)
+// Open a RAM window from (xs,ys) to (xe,ye) inclusive and start writing
+// to it: every LCDSend() after this is one pixel, filled in left to right
+// and top to bottom, so a block costs 7 SPI words plus one per pixel
+// instead of 8 per pixel through LCDSetPixel().
+void LCDSetWindow(unsigned char xs, unsigned char ys, unsigned char xe, unsigned char ye)
 {
-	LCDSetXY(x,y);				// Set position
 	if ((LCD_id & 0xFFFFFF) == 0xFFFFFF) //No ID read -> EPSON
-    LCDSend(ERAMWR);			// Now write the pixel to the display
-  else  LCDSend(PRAMWR);			// Now write the pixel to the display
-	LCDSend(color);				// Write the data in the specified Color
+  {
+  	LCDSend(ECASET);			// column start/end ram
+  	LCDSend(xs);
+  	LCDSend(xe);
+  	LCDSend(EPASET);			// page start/end ram
+  	LCDSend(ys);
+  	LCDSend(ye);
+  	LCDSend(ERAMWR);
+  }
+  else {
+  	LCDSend(PCASET);			// column start/end ram
+  	LCDSend(xs);
+  	LCDSend(xe);
+  	LCDSend(PPASET);			// page start/end ram
+  	LCDSend(ys);
+  	LCDSend(ye);
+  	LCDSend(PRAMWR);
+  }
 }
 
-void LCDFill (unsigned char xs,unsigned char ys,unsigned char width,unsigned char height, unsigned char color)
-{
-    unsigned char i,j;
+//-----------------------------------------------------------------------------
+// Drawing. Every primitive opens one RAM window on the area it covers and
+// sends it a pixel row at a time. There is no copy of the panel in RAM, a
+// whole one would take 17 KB; each row only remembers the colour it was
+// last cleared to and the columns drawn on since. That is enough to leave
+// out fills of areas that have the colour already, like the status lines
+// the menu clears on every cursor move.
+//-----------------------------------------------------------------------------
 
-    for (i=0;i < height;i++)	// Number of horizontal lines
-    {
-		LCDSetXY(xs,ys+i);		// Goto start of fill area (Top Left)
-	if ((LCD_id & 0xFFFFFF) == 0xFFFFFF) //No ID read -> EPSON
-    LCDSend(ERAMWR);			// Write to displa
-  else LCDSend(PRAMWR);		// Write to display
+// Pixel rows as 9 bit SPI words for the PDC, one being sent while the
+// other is filled
+static unsigned short LCDrow[2][LCD_XRES];
 
-		for (j=0;j < width;j++)	// pixels per line
-			LCDSend(color);
-    }
-}
+typedef struct {
+	unsigned char bg;			// colour the whole row was filled with
+	unsigned char xs, xe;		// columns drawn on since, none if xs > xe
+} lcd_span_t;
 
-void LCDString (char *lcd_string, const char *font_style,unsigned char x, unsigned char y, unsigned char fcolor, unsigned char bcolor)
+static lcd_span_t LCDspan[LCD_YRES];
+
+static void LCDSpanClear(lcd_span_t *s, unsigned char color)
 {
-	unsigned int  i;
-	unsigned char mask=0, px, py, xme, yme, offset;
-	const char *data;
+	s->bg = color;
+	s->xs = LCD_XRES;
+	s->xe = 0;
+}
 
-	data = font_style;			// point to the start of the font table
+// Columns xs to xe of the row are drawn on
+static void LCDSpanAdd(lcd_span_t *s, int xs, int xe)
+{
+	if (xs < s->xs) s->xs = xs;
+	if (xe > s->xe) s->xe = xe;
+}
 
-	xme = *data;				// get font x width
-	data++;
-	yme = *data;				// get font y length
-	data++;
-	offset = *data;				// get data bytes per font
+// Columns xs to xe of the row are filled with color
+static void LCDSpanFill(lcd_span_t *s, int xs, int xe, unsigned char color)
+{
+	if (xs == 0 && xe == LCD_XRES - 1)
+		LCDSpanClear(s, color);
+	else if (color == s->bg && xs <= s->xs && xe >= s->xe)
+		LCDSpanClear(s, color);
+	else if (color != s->bg)
+		LCDSpanAdd(s, xs, xe);
+}
 
-	do
-	{
-		// point to data in table to be loaded
-		data =  (font_style + offset) + (offset * (int)(*lcd_string - 32));
+// Columns xs to xe of the row have color already
+static int LCDSpanHas(const lcd_span_t *s, int xs, int xe, unsigned char color)
+{
+	return color == s->bg && (xe < s->xs || xs > s->xe);
+}
 
-		for (i=0;i < yme;i++) {
-			mask |=0x80;
+void LCDSetPixel(unsigned char x, unsigned char y, unsigned char color)
+{
+	LCDFill(x, y, 1, 1, color);
+}
 
-			for (px=x; px < (x + xme); px++) {
-				py= y + i;
+void LCDFill (unsigned char xs,unsigned char ys,unsigned char width,unsigned char height, unsigned char color)
+{
+	unsigned short *row = LCDrow[0];
+	int x, y, xe, ye, y0, y1;
+
+	xe = xs + width;
+	ye = ys + height;
+	if (xe > LCD_XRES) xe = LCD_XRES;
+	if (ye > LCD_YRES) ye = LCD_YRES;
+	if (xs >= xe || ys >= ye)
+		return;
+
+	// only the rows that do not have the colour yet go out
+	for (y0 = ys; y0 < ye && LCDSpanHas(&LCDspan[y0], xs, xe - 1, color); y0++)
+		;
+	for (y1 = ye - 1; y1 > y0 && LCDSpanHas(&LCDspan[y1], xs, xe - 1, color); y1--)
+		;
+	for (y = ys; y < ye; y++)
+		LCDSpanFill(&LCDspan[y], xs, xe - 1, color);
+	if (y0 == ye)
+		return;
+
+	SpiBegin(SPI_LCD_MODE);
+	LCDSetWindow(xs, y0, xe - 1, y1);
+	// 9th bit set for data, as LCDSend() does it; all rows are the same
+	for (x = xs; x < xe; x++)
+		row[x - xs] = 0x100 | color;
+	for (y = y0; y <= y1; y++)
+		SpiWrite(row, xe - xs);
+	SpiEnd();
+}
 
-				if (*data & mask)	LCDSetPixel (px,py,fcolor);
-				else				LCDSetPixel (px,py,bcolor);
+// Characters that would not fit on the line are dropped.
+void LCDString (char *lcd_string, const char *font_style,unsigned char x, unsigned char y, unsigned char fcolor, unsigned char bcolor)
+{
+	unsigned short *row;
+	unsigned int  i, n, len, rows;
+	unsigned char mask, px, xme, yme, offset;
+	const char *data;
 
+	xme = font_style[0];			// get font x width
+	yme = font_style[1];			// get font y length
+	offset = font_style[2];			// get data bytes per font
+
+	for (len = 0; lcd_string[len] != '\0'; len++)
+		;
+	if (x + len * xme > LCD_XRES)
+		len = (x < LCD_XRES) ? (LCD_XRES - x) / xme : 0;
+	rows = (y + yme > LCD_YRES) ? LCD_YRES - y : yme;
+	if (len == 0 || y >= LCD_YRES)
+		return;
+
+	SpiBegin(SPI_LCD_MODE);
+	LCDSetWindow(x, y, x + len * xme - 1, y + rows - 1);
+	for (i=0;i < rows;i++) {
+		row = LCDrow[i & 1];
+		for (n=0;n < len;n++) {
+			// row i of the glyph
+			data = (font_style + offset) + (offset * (int)(lcd_string[n] - 32)) + i;
+
+			mask = 0x80;
+			for (px=0; px < xme; px++) {
+				row[n * xme + px] = 0x100 | ((*data & mask) ? fcolor : bcolor);
 				mask>>=1;
 			}
-			data++;
 		}
-		x+=xme;
-
-		lcd_string++;						// next character in string
-
-	} while(*lcd_string !='\0');			// keep spitting chars out until end of string
+		SpiWrite(row, len * xme);
+		LCDSpanAdd(&LCDspan[y + i], x, x + len * xme - 1);
+	}
+	SpiEnd();
 }
 
 
@@ -236,63 +327,36 @@ void LCDString (char *lcd_string, const char *font_style,unsigned char x, unsign
 //Return: None
 //Description: This function will read the first 2 bytes in the image
 //             which should WIDTH then HEIGHT.
-//             Then it will set the working area on LCD and 
-//             loop a calculated amount of times grabbing data from image
-//             and placing it on LCD from LEFT to RIGHT then TOP to BOTTOM
+//             Then it will write the image to the LCD
+//             from LEFT to RIGHT then TOP to BOTTOM; what lies beyond
+//             the edge of the panel is left out
 //********************************************************************
 void LCDWriteBMP(unsigned char *bmp, unsigned char x, unsigned char y)
 {
-unsigned char height, width;
-unsigned int maxPix;
-unsigned int xmin, xmax, ymin, ymax;
-
-    maxPix = 0;
-
-    //maxPix = (width * height);
-    width = *bmp++;
-    height = *bmp++;
-
-    maxPix = height;
-    maxPix = maxPix * width ;
-
-    xmin = x;
-    xmax = x + width;
-    ymin = y;
-    ymax = y + height;
-
-	if ((LCD_id & 0xFFFFFF) == 0xFFFFFF) //No ID read -> EPSON
-  {
-  	LCDSend(ECASET);			// column start/end ram
-  	LCDSend(xmin);				// Start Column to display to
-  	LCDSend(xmax);				// End Column to display to	
-	
-  	LCDSend(EPASET);			// page start/end ram
-  	LCDSend(ymin);				// Start Page to display to
-  	LCDSend(ymax);				// End Page to display to
-
-    LCDSend(ERAMWR);
-  }
-  else {	
-  	LCDSend(PCASET);			// column start/end ram
-  	LCDSend(xmin);				// Start Column to display to
-  	LCDSend(xmax);				// End Column to display to	
-	
-  	LCDSend(PPASET);			// page start/end ram
-  	LCDSend(ymin);				// Start Page to display to
-  	LCDSend(ymax);				// End Page to display to
-
-    LCDSend(PRAMWR);
-  }	
-
-#ifdef BIT8
-unsigned int j;
-    for(j = 0; j < maxPix-1; j++) {
-        LCDSend(*bmp++);
-    }
-#endif
+	unsigned short *row;
+	unsigned char height, width;
+	int i, j, w, h;
+
+	width = *bmp++;
+	height = *bmp++;
+
+	w = (x + width > LCD_XRES) ? LCD_XRES - x : width;
+	h = (y + height > LCD_YRES) ? LCD_YRES - y : height;
+	if (w <= 0 || h <= 0)
+		return;
+
+	SpiBegin(SPI_LCD_MODE);
+	LCDSetWindow(x, y, x + w - 1, y + h - 1);
+	for (j = 0; j < h; j++, bmp += width) {
+		row = LCDrow[j & 1];
+		for (i = 0; i < w; i++)
+			row[i] = 0x100 | bmp[i];
+		SpiWrite(row, w);
+		LCDSpanAdd(&LCDspan[y + j], x, x + w - 1);
+	}
+	SpiEnd();
 }
 
-
 void LCDReset(void)
 {
 //CEX: Removed aliasing of LED names with LCD 
@@ -482,8 +546,14 @@ void LCDInit(void)
 //	//falta inicializacin EPSON	
 //  }		
 
-	i=LCD_XRES*LCD_YRES;
-	while(i--) LCDSend(0xFF);
+	SpiBegin(SPI_LCD_MODE);
+	for (i = 0; i < LCD_XRES; i++)
+		LCDrow[0][i] = 0x100 | 0xFF;
+	for (i = 0; i < LCD_YRES; i++)
+		SpiWrite(LCDrow[0], LCD_XRES);
+	SpiEnd();
+	for (i = 0; i < LCD_YRES; i++)
+		LCDSpanClear(&LCDspan[i], 0xFF);
 
   //********************
   //TEST show LCD id
@@ -174,6 +174,7 @@ void LCDSend(unsigned int data);
 void LCDInit(void);
 void LCDReset(void);
 void LCDSetXY(unsigned char x, unsigned char y);
+void LCDSetWindow(unsigned char xs, unsigned char ys, unsigned char xe, unsigned char ye);
 void LCDSetPixel(unsigned char x, unsigned char y, unsigned char color);
 void LCDString (char *lcd_string, const char *font_style,unsigned char x, unsigned char y, unsigned char fcolor, unsigned char bcolor);
 void LCDFill (unsigned char xs,unsigned char ys,unsigned char width,unsigned char height, unsigned char color);
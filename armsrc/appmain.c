@@ -15,6 +15,12 @@
 #include "util.h"
 #include "printf.h"
 #include "msd.h"
+#include "snoopstats.h"
+#include "usbstream.h"
+#include "sdlog.h"
+#include "sdcache.h"
+#include "iso14443a.h"
+#include "bigbuf.h"
 
 
 
@@ -74,8 +80,10 @@ unsigned char widehkimg[] = 	{0x02, 0x0D, 0x12, 0xEA, 0x00,
 
 void BufferClear(void)
 {
-	memset(BigBuf,0,sizeof(BigBuf));
-	Dbprintf("Buffer cleared (%i bytes)",sizeof(BigBuf));
+	// up to the emulator memory, which has its own command to clear it
+	BigBufReset();
+	memset(BigBuf,0,BigBufAvail());
+	Dbprintf("Buffer cleared (%i bytes)",BigBufAvail());
 }
 
 void ToSendReset(void)
@@ -226,7 +234,8 @@ void MeasureAntennaTuning(void)
 	UsbCommand c;
 
 	DbpString("Measuring antenna characteristics, please wait.");
-	memset(BigBuf,0,sizeof(BigBuf));
+	BigBufReset();
+	memset(BigBuf,0,BigBufAvail());
 
 /*
  * Sweeps the useful LF range of the proxmark from
@@ -293,11 +302,14 @@ void MeasureAntennaTuningHf(void)
 void SimulateTagHfListen(void)
 {
 	uint8_t *dest = (uint8_t *)BigBuf;
-	int n = sizeof(BigBuf);
+	int n;
 	uint8_t v = 0;
 	int i;
 	int p = 0;
 
+	BigBufReset();
+	n = BigBufAvail();
+
 	// We're using this mode just so that I can test it out; the simulated
 	// tag mode would work just as well and be simpler.
 	FpgaWriteConfWord(FPGA_MAJOR_MODE_HF_READER_RX_XCORR | FPGA_HF_READER_RX_XCORR_848_KHZ | FPGA_HF_READER_RX_XCORR_SNOOP);
@@ -373,6 +385,30 @@ void SendVersion(void)
 }
 
 #ifdef WITH_LF
+// A command that came in during an LF simulation, run once the simulation
+// has returned rather than from within its USB poll
+static UsbCommand lfSimDeferred;
+static int lfSimDeferredLen;
+
+static void LfSimDeferredPoll(void)
+{
+	int len = lfSimDeferredLen;
+
+	if(!len) return;
+	lfSimDeferredLen = 0;
+	UsbPacketReceived((uint8_t *)&lfSimDeferred, len);
+}
+
+// Note a HID tag that was read in TAGS.TXT on the microSD card
+static void LogHIDTag(int high, int low)
+{
+	char line[24];
+
+	if(!(high | low)) return;
+	sprintf(line, "HID %X%08X %05d", high, low, (low>>1)&0xFFFF);
+	SdLogTagId(line);
+}
+
 // samy's sniff and repeat routine
 void SamyRun()
 {
@@ -397,12 +433,16 @@ void SamyRun()
 	int selected = 0;
 	int playing = 0;
 
+	// the recordings below go to BigBuf
+	SdLogFlush();
+
 	// Turn on selected LED
 	LED(selected + 1, 0);
 
 	for (;;)
 	{
 		UsbPoll(FALSE);
+		LfSimDeferredPoll();
 		WDT_HIT();
 
 		// Was our button held down or pressed?
@@ -428,6 +468,7 @@ void SamyRun()
 
 			CmdHIDdemodFSK(1, &high[selected], &low[selected], 0);
 			Dbprintf("Recorded %x %x %x", selected, high[selected], low[selected]);
+			LogHIDTag(high[selected], low[selected]);
 
 			LEDsoff();
 			LED(selected + 1, 0);
@@ -629,21 +670,50 @@ void ListenReaderField(int limit)
 	}
 }
 
+static void BigBufDownloadDone(void)
+{
+	LED_B_OFF();
+}
+
 void UsbPacketReceived(uint8_t *packet, int len)
 {
 	UsbCommand *c = (UsbCommand *)packet;
 	UsbCommand ack;
 	ack.cmd = CMD_ACK;
 #ifdef WITH_LF
-  int IDhigh, IDlow, i; //For ProxBrute attack
+  int IDhigh, IDlow; //For ProxBrute attack
+#endif
+
+	// a capture still being logged to the card is read from BigBuf, which
+	// the command may well reuse
+	SdLogFlush();
+
+#ifdef WITH_LF
+	// during an LF simulation only a new descriptor may come in and take
+	// over; anything else would leave it waiting on an SSC set up for
+	// something else, or change the samples it plays, so it ends first.
+	// The command waits until the simulation has returned, so that it does
+	// not run, or start another one, a frame deeper on the stack.
+	if(LfSimBusy() && c->cmd != CMD_SIMULATE_TAG_125K_DESC) {
+		if(len > (int)sizeof(lfSimDeferred)) len = sizeof(lfSimDeferred);
+		memcpy(&lfSimDeferred, packet, len);
+		lfSimDeferredLen = len;
+		LfSimCancel();
+		return;
+	}
 #endif
 
 	switch(c->cmd) {
 #ifdef WITH_LF
-		case CMD_ACQUIRE_RAW_ADC_SAMPLES_125K:
-			AcquireRawAdcSamples125k(c->arg[0]);
+		case CMD_ACQUIRE_RAW_ADC_SAMPLES_125K: {
+			// ACK with the bytes used and the samples they cover
+			uint32_t samples;
+			ack.arg[0] = AcquireLfSamples125k(c->arg[0], c->arg[1], c->arg[2], &samples);
+			ack.arg[1] = samples;
+			ack.arg[2] = 0;
 			UsbSendPacket((uint8_t*)&ack, sizeof(ack));
 			break;
+		}
 #endif
 
 #ifdef WITH_LF
@@ -772,7 +842,7 @@ void UsbPacketReceived(uint8_t *packet, int len)
 
 #ifdef WITH_ISO14443b
 		case CMD_SNOOP_ISO_14443:
-			SnoopIso14443();
+			SnoopIso14443(c->arg[0]);
 			break;
 #endif
 
@@ -785,7 +855,7 @@ void UsbPacketReceived(uint8_t *packet, int len)
 #ifdef WITH_ISO14443a
 		// Makes use of ISO14443a FPGA Firmware
 		case CMD_SNOOP_ICLASS:
-			SnoopIClass();
+			SnoopIClass(c->arg[0]);
 			break;
 #endif
 
@@ -821,6 +891,10 @@ void UsbPacketReceived(uint8_t *packet, int len)
 		case CMD_HID_DEMOD_FSK:
 			CmdHIDdemodFSK(0, 0, 0, 1);				// Demodulate HID tag
 			break;
+
+		case CMD_EM410X_DEMOD:
+			CmdEM410xdemod(0, 0, 0, 1);				// Demodulate EM410x tag
+			break;
 #endif
 
 #ifdef WITH_LF
@@ -834,7 +908,18 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			CopyHIDtoT5567(c->arg[0], c->arg[1]);					// Clone HID tag by ID to T55x7
 			break;
 
-		case CMD_HID_BRUTE:  // Find a valid tag ID by brute forcing, starting at a readed tag
+		case CMD_T55XX_WRITE_CARD:
+			CmdT55xxWriteCard(c->arg[0], c->d.asBytes, &ack);		// Write and verify a T55x7 card
+			UsbSendPacket((uint8_t*)&ack, sizeof(ack));
+			break;
+
+		case CMD_HID_BRUTE:  // Find a valid tag ID by brute forcing
+			if (HID_BRUTE_MODE(c->arg[0]) != HID_BRUTE_READ) {
+				HidBrute(HID_BRUTE_MODE(c->arg[0]), c->d.asDwords[1], c->arg[1], c->arg[2],
+					(int)c->d.asDwords[0], HID_BRUTE_DWELL(c->arg[0]), 1, HidBruteStatus);
+				break;
+			}
+			// starting at a readed tag
 			DbpString("Reading card to start from...");
 			CmdHIDdemodFSK(1, &IDhigh, &IDlow, 0); // Read a tag to start from
 			Dbprintf("Read %x%08x", IDhigh, IDlow);
@@ -842,15 +927,9 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			while (!BUTTON_PRESS()); // wait for button to be pressed to start trying IDs
 			while (BUTTON_PRESS()); // wait for button to be released to start trying IDs
 			SpinDelay(200); // avoid switch bounces
-			for (i=IDlow-1;i>0;i--) {
-				if(BUTTON_PRESS()) {
-          DbpString("Told to Stop");
-          break;
-    			}
-				Dbprintf("Trying ID %x%08x", IDhigh, i);
-				CmdHIDsimTAGProxBrute(IDhigh, i, 0); // Try ID
-				SpinDelay(500);
-			}
+			if (IDlow > 1)
+				HidBrute(HID_BRUTE_RANGE, IDhigh, IDlow-1, 1, -1,
+					HID_BRUTE_DWELL(c->arg[0]), 1, HidBruteStatus);
 			break;
 #endif
 
@@ -889,7 +968,11 @@ void UsbPacketReceived(uint8_t *packet, int len)
 
 		case CMD_DOWNLOADED_SIM_SAMPLES_125K: {
 			uint8_t *b = (uint8_t *)BigBuf;
-			memcpy(b+c->arg[0], c->d.asBytes, 48);
+			// the first piece of a new upload; the rest stops short of
+			// the emulator memory
+			if(c->arg[0] == 0) BigBufReset();
+			if(c->arg[0] + 48 <= (uint32_t)BigBufAvail())
+				memcpy(b+c->arg[0], c->d.asBytes, 48);
 			//Dbprintf("copied 48 bytes to %i",b+c->arg[0]);
 			UsbSendPacket((uint8_t*)&ack, sizeof(ack));
 			break;
@@ -901,6 +984,12 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			SimulateTagLowFrequency(c->arg[0], c->arg[1], 1);
 			LED_A_OFF();
 			break;
+
+		case CMD_SIMULATE_TAG_125K_DESC:
+			LED_A_ON();
+			SimulateTagLowFrequencyDesc(c->arg[0], c->arg[1], c->arg[2], c->d.asBytes, 1);
+			LED_A_OFF();
+			break;
 #endif
 
 		case CMD_READ_MEM:
@@ -924,6 +1013,29 @@ void UsbPacketReceived(uint8_t *packet, int len)
 			SendVersion();
 			break;
 
+		case CMD_SNOOP_STATS:
+			SnoopStatsSend(c->arg[0]);
+			break;
+
+		case CMD_SD_CACHE_STATS:
+			sd_cache_stats_send(c->arg[0]);
+			break;
+
+		case CMD_DOWNLOAD_BIGBUF: {
+			// arg[0] offset, arg[1] length in bytes, arg[2] an id for the
+			// chunks to carry. Goes out in the background from the main
+			// loop, as CMD_DOWNLOADED_BIGBUF. A download still going is
+			// one the client gave up on.
+			uint32_t offset = c->arg[0], len = c->arg[1];
+			if(offset > BIGBUF_SIZE) offset = BIGBUF_SIZE;
+			if(len > BIGBUF_SIZE - offset) len = BIGBUF_SIZE - offset;
+			UsbStreamCancel();
+			LED_B_ON();
+			UsbStreamStart(CMD_DOWNLOADED_BIGBUF, offset, ((uint8_t *)BigBuf) + offset, len,
+				c->arg[2], BigBufDownloadDone);
+			break;
+		}
+
 #ifdef WITH_LF
 		case CMD_LF_SIMULATE_BIDIR:
 			SimulateTagLowFrequencyBidir(c->arg[0], c->arg[1]);
@@ -1029,7 +1141,7 @@ void PrepBuffer()
 {
 	int i, max, min;
 	uint8_t *dest = (uint8_t *)BigBuf;
-	int n = sizeof(BigBuf);
+	int n = BigBufAvail();
 
 	max=127;
 	min=127;
@@ -1046,10 +1158,22 @@ void PrepBuffer()
 }
 
 #ifdef WITH_LCD
+// ProxBrute progress, see HidBrute()
+static void HidBruteLcd(uint32_t hi, uint32_t lo, uint32_t tried, int done)
+{
+	char TagID[18];
+
+	sprintf(TagID,"TAG: %X%08X",(int)hi,(int)lo);
+	LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
+	sprintf(TagID,"ID: %05d",(int)(lo>>1)&0xFFFF);
+	LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*10,BLACK,WHITE );
+	if (done)
+		LCDString("STOP      ",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
+}
+
 void Action_Button(void)
 {
 	char TagID[18];
-	int i;
 	
 	switch (CButton) {
 		// Center
@@ -1061,7 +1185,7 @@ void Action_Button(void)
       LCDFill(0, 1+8*(curY-1), 6, 8, WHITE );
       LCDFill(0, 1+8* 8, 132, 8, WHITE);
       LCDFill(0, 1+8* 10, 132, 8, WHITE);
-			if(curY<2) curY=6;
+			if(curY<2) curY=7;
 			else curY--;
       if (curY>4) LCDFill(0, 1+8* 9, 132, 8, WHITE);
       LCDString("* ",(char *)&FONT6x8,1,1+8*(curY-1),GREEN  ,WHITE );
@@ -1072,7 +1196,7 @@ void Action_Button(void)
       LCDFill(0, 1+8*(curY-1), 6, 8, WHITE );
       LCDFill(0, 1+8* 8, 132, 8, WHITE);
       LCDFill(0, 1+8* 10, 132, 8, WHITE);
-			if(curY>5) curY=1;
+			if(curY>6) curY=1;
 			else curY++;
       if (curY>4) LCDFill(0, 1+8* 9, 132, 8, WHITE);
       LCDString("* ",(char *)&FONT6x8,1,1+8*(curY-1),GREEN  ,WHITE );
@@ -1082,6 +1206,8 @@ void Action_Button(void)
 		// Right
 		case 5:
 			PWMC_Beep(1,10000,50);
+			// all of these use BigBuf, get the last capture onto the card first
+			SdLogFlush();
 			switch (curY) {
 				case 1:
           LCDString("Reading HID tag...",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
@@ -1093,6 +1219,7 @@ void Action_Button(void)
           LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
           sprintf(TagID,"ID: %05d",(HIDlow>>1)&0xFFFF);
           LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*10,BLACK,WHITE );
+          LogHIDTag(HIDhigh, HIDlow);
 					break;
 				case 2:
           LCDString("Replaying HID tag...",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
@@ -1119,33 +1246,43 @@ void Action_Button(void)
           LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
           sprintf(TagID,"ID: %05d",(HIDlow>>1)&0xFFFF);
           LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*10,BLACK,WHITE );
+          LogHIDTag(HIDhigh, HIDlow);
           LCDString("Press button to start",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
 			    while (!BUTTON_PRESS()); // wait for button to be pressed to start trying IDs
 			    while (BUTTON_PRESS()); // wait for button to be released to start trying IDs
 			    SpinDelay(200); // avoid switch bounces
           LCDString("Trying...            ",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
-			    for (i=HIDlow-1;i>0;i--) {
-    				if(BUTTON_PRESS()) {
-           		LCDString("STOP      ",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
-              break;
-    	  		}
-            sprintf(TagID,"TAG: %X%08X",HIDhigh,i);
-            LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
-            sprintf(TagID,"ID: %05d",(i>>1)&0xFFFF);
-            LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*10,BLACK,WHITE );
-	    			CmdHIDsimTAGProxBrute(HIDhigh, i, 0); // Try ID
-	  			SpinDelay(500);
-	    		}
+			    if (HIDlow > 1)
+			      HidBrute(HID_BRUTE_RANGE, HIDhigh, HIDlow-1, 1, -1, 0, 0, HidBruteLcd);
 			    break;
 				case 5:
           LCDString("Reading raw tag...",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
 					AcquireRawAdcSamples125k(0);
-					PrepBuffer();
 	        PWMC_Beep(1,10000,50);
+          // the samples go to the card from the main loop, and are only
+          // thresholded for replay once they are out
+          if (SdLogSamples((uint8_t *)BigBuf, BigBufAvail(), PrepBuffer))
+            sprintf(TagID,"SD: %s",SdLogName());
+          else {
+            PrepBuffer();
+            sprintf(TagID,"SD: no card");
+          }
+          LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
 					break;
 				case 6:
           LCDString("Replaying raw tag...",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
-					SimulateTagLowFrequency(sizeof(BigBuf),0, 1);
+					SimulateTagLowFrequency(BigBufAvail(),0, 1);
+					break;
+				case 7:
+          LCDString("Sniffing 14443A...",(char *)&FONT6x8,2,1+8*8,BLACK,WHITE );
+          LCDFill(0, 1+8* 9, 132, 8, WHITE);
+					SnoopIso14443a();
+	        PWMC_Beep(1,10000,50);
+          if (SdLogTrace((uint8_t *)BigBuf, iso14a_get_tracelen(), NULL))
+            sprintf(TagID,"SD: %s",SdLogName());
+          else
+            sprintf(TagID,"SD: no card");
+          LCDString((char*)&TagID,(char *)&FONT6x8,2+6*4,1+8*9,BLACK,WHITE );
 					break;
 			}
 
@@ -1213,6 +1350,7 @@ void  __attribute__((noreturn)) AppMain(void)
         LCDString("  ProxBrute HID tag  ",(char *)&FONT6x8,1,1+8*3,CYAN,WHITE );
         LCDString("  Read raw tag       ",(char *)&FONT6x8,1,1+8*4,YELLOW,WHITE );
         LCDString("  Replay raw tag     ",(char *)&FONT6x8,1,1+8*5,BLUE,WHITE );
+        LCDString("  Sniff 14443A       ",(char *)&FONT6x8,1,1+8*6,BLACK,WHITE );
 
 #endif
 
@@ -1222,6 +1360,11 @@ void  __attribute__((noreturn)) AppMain(void)
 
 	for(;;) {
 		UsbPoll(FALSE);
+#ifdef WITH_LF
+		LfSimDeferredPoll();
+#endif
+		UsbStreamPoll();
+		SdLogPoll();
 		Check_Button();
 #ifdef WITH_LCD
 		Action_Button();
@@ -17,8 +17,10 @@
 typedef unsigned char byte_t;
 
 // The large multi-purpose buffer, typically used to hold A/D samples,
-// maybe processed in some way.
-uint32_t BigBuf[8000];
+// maybe processed in some way. Modes that need several buffers at once
+// carve it up with bigbuf.h.
+#define BIGBUF_SIZE	32000
+uint32_t BigBuf[BIGBUF_SIZE / sizeof(uint32_t)];
 
 // This may be used (sparingly) to declare a function to be copied to
 // and executed from RAM
@@ -41,6 +43,8 @@ void ToSendReset(void);
 void ListenReaderField(int limit);
 void AcquireRawAdcSamples125k(int at134khz);
 void DoAcquisition125k(void);
+int AcquireLfSamples125k(int at134khz, uint32_t format, int decimation, uint32_t *samples);
+int DoAcquisitionLf(uint32_t format, int decimation, uint32_t *samples);
 extern int ToSendMax;
 extern uint8_t ToSend[];
 extern uint32_t BigBuf[];
@@ -53,11 +57,19 @@ void FpgaGatherVersion(char *dst, int len);
 void FpgaSetupSsc(void);
 void SetupSpi(int mode);
 void FpgaSetupSscDma(uint8_t *buf, int len);
+void FpgaSetupSscDmaHalves(uint8_t *buf, int len);
 void SetAdcMuxFor(uint32_t whichGpio);
 
 /// spi.h
 unsigned int spi_com(unsigned int channel, unsigned int dout, unsigned char last);
 void SetupSpi(int mode);
+void SpiBegin(int channel);
+void SpiEnd(void);
+void SpiWait(void);
+unsigned int SpiXfer(unsigned int dout);
+void SpiSend(unsigned int dout);
+void SpiWrite(const void *buf, int n);
+void SpiTransfer(const void *tx, void *rx, int n);
 
 // Definitions for the FPGA commands.
 #define FPGA_CMD_SET_CONFREG						(1<<12)
@@ -96,11 +108,22 @@ void WriteTItag(uint32_t idhi, uint32_t idlo, uint16_t crc);
 void AcquireTiType(void);
 void AcquireRawBitsTI(void);
 void SimulateTagLowFrequency(int period, int gap, int ledcontrol);
+void SimulateTagLowFrequencyDesc(uint32_t arg0, uint32_t arg1, uint32_t arg2,
+	uint8_t *data, int ledcontrol);
+int LfSimBusy(void);
+void LfSimCancel(void);
 void CmdHIDsimTAG(int hi, int lo, int ledcontrol);
 void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol);
+void CmdEM410xdemod(int findone, int *high, int *low, int ledcontrol);
 void SimulateTagLowFrequencyBidir(int divisor, int max_bitlen);
 void CopyHIDtoT5567(int hi, int lo);
-void CmdHIDsimTAGProxBrute(int hi, int lo, int ledcontrol);
+uint32_t T55xxWriteCard(uint32_t *blocks, int n, int retries, int verify, int *writes);
+void CmdT55xxWriteCard(uint32_t arg0, uint8_t *data, UsbCommand *ack);
+// told how far HidBrute() got: the ID on air, IDs tried, 1 at the end
+typedef void (*hid_brute_report_t)(uint32_t hi, uint32_t lo, uint32_t tried, int done);
+void HidBrute(int mode, uint32_t hi, uint32_t start, uint32_t end, int step,
+	int dwell, int ledcontrol, hid_brute_report_t report);
+void HidBruteStatus(uint32_t hi, uint32_t lo, uint32_t tried, int done);
 
 /// iso14443.h
 void SimulateIso14443Tag(void);
@@ -108,7 +131,7 @@ void AcquireRawAdcSamplesIso14443(uint32_t parameter);
 void ReadSRI512Iso14443(uint32_t parameter);
 void ReadSRIX4KIso14443(uint32_t parameter);
 void ReadSTMemoryIso14443(uint32_t parameter,uint32_t dwLast);
-void RAMFUNC SnoopIso14443(void);
+void RAMFUNC SnoopIso14443(int dmaSize);
 
 /// iso14443a.h
 void RAMFUNC SnoopIso14443a(void);
@@ -139,7 +162,7 @@ void DirectTag15693Command(uint32_t datalen,uint32_t speed, uint32_t recv, uint8
 void SetDebugIso15693(uint32_t flag);
 
 /// iclass.h
-void RAMFUNC SnoopIClass(void);
+void RAMFUNC SnoopIClass(int dmaSize);
 
 /// util.h
 #define LED_RED 1
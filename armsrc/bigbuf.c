@@ -0,0 +1,131 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Named regions of BigBuf, see bigbuf.h
+//-----------------------------------------------------------------------------
+
+#include "proxmark3.h"
+#include "apps.h"
+#include "bigbuf.h"
+
+typedef struct {
+	uint16_t offset;
+	uint16_t len;		// 0 if not allocated
+} bigbuf_region_t;
+
+static bigbuf_region_t regions[BB_REGIONS] = {
+	[BB_EML] = { BIGBUF_SIZE - BIGBUF_EML_LEN, BIGBUF_EML_LEN }
+};
+
+static const char *region_names[BB_REGIONS] = {
+	"trace", "recv cmd", "recv res", "dma", "mifare", "mifare send",
+	"sim resp", "eml",
+	"legic log", "15693 answer"
+};
+
+// Regions that keep their place (and contents) across BigBufReset(); they
+// are there from boot on, above everything else
+#define PERSISTENT(r)	((r) == BB_EML)
+
+// Free space is [bottom, top)
+static int bottom = 0;
+static int top = BIGBUF_SIZE - BIGBUF_EML_LEN;
+
+void BigBufReset(void)
+{
+	int r;
+
+	bottom = 0;
+	top = BIGBUF_SIZE;
+	for(r = 0; r < BB_REGIONS; r++) {
+		if(!regions[r].len) continue;
+		if(PERSISTENT(r)) {
+			if(regions[r].offset < top) top = regions[r].offset;
+		} else {
+			regions[r].len = 0;
+		}
+	}
+}
+
+// Returns the region, allocating it on first use. Asking again for a region
+// that is already there returns it as is if it is big enough.
+uint8_t *BigBufAlloc(int region, int len)
+{
+	int offset;
+
+	len = (len + 3) & ~3;
+
+	if(regions[region].len) {
+		if(regions[region].len >= len)
+			return ((uint8_t *)BigBuf) + regions[region].offset;
+		Dbprintf("BigBuf: %s already allocated with %d bytes, need %d",
+			region_names[region], regions[region].len, len);
+		BigBufDump();
+		return NULL;
+	}
+
+	if(len <= 0 || len > top - bottom) {
+		Dbprintf("BigBuf: no room for %s, %d bytes (%d free)",
+			region_names[region], len, top - bottom);
+		BigBufDump();
+		return NULL;
+	}
+
+	if(region == BB_TRACE) {
+		offset = bottom;
+		bottom += len;
+	} else {
+		top -= len;
+		offset = top;
+	}
+	regions[region].offset = offset;
+	regions[region].len = len;
+
+	return ((uint8_t *)BigBuf) + offset;
+}
+
+// A power of two sized DMA ring, as large as possible up to *len but
+// leaving reserve bytes free (for the trace). *len is set to what was
+// actually allocated.
+uint8_t *BigBufAllocRing(int region, int *len, int reserve)
+{
+	int size = *len;
+
+	while(size > 4 && size > top - bottom - reserve)
+		size >>= 1;
+	if(size != *len)
+		Dbprintf("BigBuf: %s cut down to %d bytes", region_names[region], size);
+	*len = size;
+
+	return BigBufAlloc(region, size);
+}
+
+uint8_t *BigBufRegion(int region)
+{
+	if(!regions[region].len) return NULL;
+	return ((uint8_t *)BigBuf) + regions[region].offset;
+}
+
+int BigBufRegionLen(int region)
+{
+	return regions[region].len;
+}
+
+int BigBufAvail(void)
+{
+	return top - bottom;
+}
+
+void BigBufDump(void)
+{
+	int r;
+
+	for(r = 0; r < BB_REGIONS; r++) {
+		if(!regions[r].len) continue;
+		Dbprintf("  %-12s %5d - %5d", region_names[r],
+			regions[r].offset, regions[r].offset + regions[r].len - 1);
+	}
+	Dbprintf("  %d bytes free", top - bottom);
+}
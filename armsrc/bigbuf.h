@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Named regions of BigBuf.
+//
+// The trace is kept at the bottom of BigBuf, where the client expects to
+// find it; everything else is stacked down from the top. A mode calls
+// BigBufReset() when it starts and then asks for the regions it needs, in
+// the sizes it needs; a request that would run into the trace (or the
+// other way round) is refused instead of silently overlapping.
+//
+// The mifare emulator memory has the top BIGBUF_EML_LEN bytes to itself
+// from boot on, so that it keeps its contents whatever runs in between.
+// The modes that use BigBuf whole, LF capture and the like, call
+// BigBufReset() too and stop BigBufAvail() bytes in.
+//-----------------------------------------------------------------------------
+
+#ifndef __BIGBUF_H
+#define __BIGBUF_H
+
+#include <stdint.h>
+
+// room kept for the mifare emulator memory (CARD_MEMORY_LEN)
+#define BIGBUF_EML_LEN		1024
+
+enum {
+	BB_TRACE = 0,		// frame log, always at offset 0
+	BB_RECV_CMD,		// reader -> tag frame being received
+	BB_RECV_RES,		// tag -> reader frame being received
+	BB_DMA,				// SSC receive DMA ring
+	BB_MIFARE,			// mifare reader answers, emulator receive buffer
+	BB_MIFARE_SEND,		// mifare emulator send buffer
+	BB_SIM_RESP,		// precoded responses of a simulated tag
+	BB_EML,				// mifare emulator card memory, fixed at the top
+	BB_LEGIC_LOG,		// legic simulation log
+	BB_15693_ANSWER,	// iso15693 reader answers
+	BB_REGIONS
+};
+
+void BigBufReset(void);
+uint8_t *BigBufAlloc(int region, int len);
+uint8_t *BigBufAllocRing(int region, int *len, int reserve);
+uint8_t *BigBufRegion(int region);
+int BigBufRegionLen(int region);
+int BigBufAvail(void);
+void BigBufDump(void);
+
+#endif /* __BIGBUF_H */
@@ -4,8 +4,18 @@
 /* This is a stub disk I/O module that acts as front end of the existing */
 /* disk I/O modules and attach it to FatFs module with common interface. */
 /*-----------------------------------------------------------------------*/
+/* Drive 0 is the microSD card, through msd.c. Multi sector requests go  */
+/* to the card as one multiple block command, single sectors through the */
+/* sector cache (sdcache.c), which CTRL_SYNC writes back.                */
+/*-----------------------------------------------------------------------*/
 
 #include "diskio.h"
+#include "msd.h"
+#include "sdcache.h"
+
+static volatile
+DSTATUS Stat = STA_NOINIT;	/* Disk status */
+
 
 /*-----------------------------------------------------------------------*/
 /* Inidialize a Drive                                                    */
@@ -14,13 +24,20 @@ DSTATUS disk_initialize (
 	BYTE drv				/* Physical drive nmuber (0..) */
 )
 {
-//	DSTATUS stat;
-//	int result;
+	if (drv) return STA_NOINIT;			/* Supports only single drive */
+
+	sd_cache_invalidate();				/* Could be another card */
+	if (sd_card_detect() != SD_OK) {
+		Stat = STA_NOINIT | STA_NODISK;
+		return Stat;
+	}
 
-//	stat = ATA_disk_initialize();
-//	return stat;
+	if (sd_init() == SD_OK)
+		Stat &= ~STA_NOINIT;
+	else
+		Stat |= STA_NOINIT;
 
-	return STA_NOINIT;
+	return Stat;
 }
 
 
@@ -32,13 +49,8 @@ DSTATUS disk_status (
 	BYTE drv		/* Physical drive nmuber (0..) */
 )
 {
-//	DSTATUS stat;
-//	int result;
-
-//	stat = ATA_disk_status();
-//	return stat;
-
-	return STA_NOINIT;
+	if (drv) return STA_NOINIT;			/* Supports only single drive */
+	return Stat;
 }
 
 
@@ -53,13 +65,10 @@ DRESULT disk_read (
 	BYTE count		/* Number of sectors to read (1..255) */
 )
 {
-//	DRESULT res;
-//	int result;
-
-//	res = ATA_disk_read(buff, sector, count);
-//	return res;
+	if (drv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-	return RES_PARERR;
+	return sd_cache_read(sector, buff, count) == SD_OK ? RES_OK : RES_ERROR;
 }
 
 
@@ -75,13 +84,11 @@ DRESULT disk_write (
 	BYTE count			/* Number of sectors to write (1..255) */
 )
 {
-//	DRESULT res;
-//	int result;
-
-//	result = ATA_disk_write(buff, sector, count);
-//	return res;
+	if (drv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+	if (Stat & STA_PROTECT) return RES_WRPRT;
 
-	return RES_PARERR;
+	return sd_cache_write(sector, buff, count) == SD_OK ? RES_OK : RES_ERROR;
 }
 #endif /* _READONLY */
 
@@ -96,12 +103,25 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-//	DRESULT res;
-//	int result;
+	if (drv) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+
+	switch (ctrl) {
+	case CTRL_SYNC :		/* Write back the cache; writes wait for the card */
+		return sd_cache_sync() == SD_OK ? RES_OK : RES_ERROR;
 
-//	result = ATA_disk_ioctl(ctrl, buff);
-//	return res;
+	case GET_SECTOR_COUNT :	/* Number of sectors on the card */
+		*(DWORD*)buff = sd_numsectors;
+		return RES_OK;
+
+	case GET_SECTOR_SIZE :
+		*(WORD*)buff = 512;
+		return RES_OK;
+
+	case GET_BLOCK_SIZE :	/* Erase block size unknown, in sectors */
+		*(DWORD*)buff = 1;
+		return RES_OK;
+	}
 
 	return RES_PARERR;
 }
-
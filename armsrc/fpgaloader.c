@@ -12,6 +12,7 @@
 #include "proxmark3.h"
 #include "apps.h"
 #include "util.h"
+#include "fpgaunpack.h"
 
 //-----------------------------------------------------------------------------
 // Set up the Serial Peripheral Interface as master
@@ -79,24 +80,56 @@ void FpgaSetupSscDma(uint8_t *buf, int len)
 
 }
 
-static void DownloadFPGA_byte(unsigned char w)
+//-----------------------------------------------------------------------------
+// Same, but double buffered: the PDC fills the first half of buf and then
+// chains to the second. Once it has moved on, PDC_RNCR reads zero and the
+// finished half can be decoded in one go; the caller then hands it back
+// through PDC_RNPR/PDC_RNCR, before the PDC runs out of the other half.
+//-----------------------------------------------------------------------------
+void FpgaSetupSscDmaHalves(uint8_t *buf, int len)
 {
-#define SEND_BIT(x) { if(w & (1<<x) ) HIGH(GPIO_FPGA_DIN); else LOW(GPIO_FPGA_DIN); HIGH(GPIO_FPGA_CCLK); LOW(GPIO_FPGA_CCLK); }
-	SEND_BIT(7);
-	SEND_BIT(6);
-	SEND_BIT(5);
-	SEND_BIT(4);
-	SEND_BIT(3);
-	SEND_BIT(2);
-	SEND_BIT(1);
-	SEND_BIT(0);
+	AT91C_BASE_PDC_SSC->PDC_RPR = (uint32_t) buf;
+	AT91C_BASE_PDC_SSC->PDC_RCR = len / 2;
+	AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) (buf + len / 2);
+	AT91C_BASE_PDC_SSC->PDC_RNCR = len / 2;
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTEN | AT91C_PDC_TXTDIS;
 }
 
-// Download the fpga image starting at FpgaImage and with length FpgaImageLen bytes
-// If bytereversal is set: reverse the byte order in each 4-byte word
-static void DownloadFPGA(const char *FpgaImage, int FpgaImageLen, int bytereversal)
+// The bitstream goes out a 32 bit word at a time, first bit in bit 31.
+// With output writes enabled for DIN and CCLK only, one write to PIO_ODSR
+// puts the next bit on DIN (PA30, one below bit 31 of the word) and takes
+// CCLK low in the same go; raising CCLK clocks it into the FPGA.
+#define SEND_BIT() { pio->PIO_ODSR = (w >> 1) & GPIO_FPGA_DIN; pio->PIO_SODR = GPIO_FPGA_CCLK; w <<= 1; }
+
+static void DownloadFPGA_word(uint32_t w)
+{
+	AT91PS_PIO pio = AT91C_BASE_PIOA;
+
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+	SEND_BIT(); SEND_BIT(); SEND_BIT(); SEND_BIT();
+}
+
+// The top bits of w, for what is left at the end of a bitstream
+static void DownloadFPGA_bits(uint32_t w, int bits)
+{
+	AT91PS_PIO pio = AT91C_BASE_PIOA;
+
+	while(bits--)
+		SEND_BIT();
+}
+
+// Power up the FPGA and put it in configuration mode, ready for
+// DownloadFPGA_word(). Returns FALSE (leaving both red LEDs on) if it
+// does not come up.
+static int DownloadFPGA_start(void)
 {
-	int i=0;
+	int i;
 
 	AT91C_BASE_PIOA->PIO_OER = GPIO_NVDD_ON;
 	AT91C_BASE_PIOA->PIO_PER = GPIO_NVDD_ON;
@@ -144,25 +177,20 @@ static void DownloadFPGA(const char *FpgaImage, int FpgaImageLen, int byterevers
 	if (i==0){
 		LED_C_ON();
 		LED_D_ON();
-		return;
+		return FALSE;
 	}
 
-	if(bytereversal) {
-		/* This is only supported for uint32_t aligned images */
-		if( ((int)FpgaImage % sizeof(uint32_t)) == 0 ) {
-			i=0;
-			while(FpgaImageLen-->0)
-				DownloadFPGA_byte(FpgaImage[(i++)^0x3]);
-			/* Explanation of the magic in the above line:
-			 * i^0x3 inverts the lower two bits of the integer i, counting backwards
-			 * for each 4 byte increment. The generated sequence of (i++)^3 is
-			 * 3 2 1 0 7 6 5 4 11 10 9 8 15 14 13 12 etc. pp.
-			 */
-		}
-	} else {
-		while(FpgaImageLen-->0)
-			DownloadFPGA_byte(*FpgaImage++);
-	}
+	AT91C_BASE_PIOA->PIO_OWER = GPIO_FPGA_CCLK | GPIO_FPGA_DIN;
+	return TRUE;
+}
+
+// Clock the FPGA on until it says it is configured
+static void DownloadFPGA_finish(void)
+{
+	int i;
+
+	AT91C_BASE_PIOA->PIO_OWDR = GPIO_FPGA_CCLK | GPIO_FPGA_DIN;
+	LOW(GPIO_FPGA_CCLK);
 
 	// continue to clock FPGA until ready signal goes high
 	i=100000;
@@ -179,6 +207,47 @@ static void DownloadFPGA(const char *FpgaImage, int FpgaImageLen, int byterevers
 	LED_D_OFF();
 }
 
+// Download the fpga image starting at FpgaImage and with length FpgaImageLen bytes
+// If bytereversal is set: reverse the byte order in each 4-byte word
+static void DownloadFPGA(const char *FpgaImage, int FpgaImageLen, int bytereversal)
+{
+	const uint8_t *p = (const uint8_t *)FpgaImage;
+
+	if(!DownloadFPGA_start()) return;
+
+	if(bytereversal) {
+		/* This is only supported for uint32_t aligned images: then each
+		 * little endian word in flash is exactly what goes out, MSB first */
+		if( ((int)FpgaImage % sizeof(uint32_t)) == 0 ) {
+			for(; FpgaImageLen >= 4; FpgaImageLen -= 4, p += 4)
+				DownloadFPGA_word(*(const uint32_t *)p);
+		}
+	} else {
+		for(; FpgaImageLen >= 4; FpgaImageLen -= 4, p += 4)
+			DownloadFPGA_word(((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+		while(FpgaImageLen-- > 0)
+			DownloadFPGA_bits((uint32_t)*p++ << 24, 8);
+	}
+
+	DownloadFPGA_finish();
+}
+
+// Same for a bitstream packed by tools/fpgacompress.pl, unpacked on the way
+static void DownloadFPGA_packed(const char *z, int zlen)
+{
+	if(!DownloadFPGA_start()) return;
+
+	if(FpgaUnpack((const uint8_t *)z, zlen, DownloadFPGA_word, DownloadFPGA_bits) < 0) {
+		// damaged image, the FPGA will not come up
+		AT91C_BASE_PIOA->PIO_OWDR = GPIO_FPGA_CCLK | GPIO_FPGA_DIN;
+		LED_C_ON();
+		LED_D_ON();
+		return;
+	}
+
+	DownloadFPGA_finish();
+}
+
 static char *bitparse_headers_start;
 static char *bitparse_bitstream_end;
 static int bitparse_initialized;
@@ -186,7 +255,8 @@ static int bitparse_initialized;
  * 00 09 0f f0 0f f0 0f f0 0f f0 00 00 01
  * After that the format is 1 byte section type (ASCII character), 2 byte length
  * (big endian), <length> bytes content. Except for section 'e' which has 4 bytes
- * length.
+ * length, and our own section 'z' (the packed form of 'e' that the build puts
+ * in flash, see tools/fpgacompress.pl), which has too.
  */
 static const char _bitparse_fixed_header[] = {0x00, 0x09, 0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x00, 0x00, 0x01};
 static int bitparse_init(void * start_address, void *end_address)
@@ -213,13 +283,14 @@ int bitparse_find_section(char section_name, char **section_start, unsigned int
 	while(pos < bitparse_bitstream_end) {
 		char current_name = *pos++;
 		unsigned int current_length = 0;
-		if(current_name < 'a' || current_name > 'e') {
+		if((current_name < 'a' || current_name > 'e') && current_name != 'z') {
 			/* Strange section name, abort */
 			break;
 		}
 		current_length = 0;
 		switch(current_name) {
 		case 'e':
+		case 'z':
 			/* Four byte length field */
 			current_length += (*pos++) << 24;
 			current_length += (*pos++) << 16;
@@ -228,7 +299,7 @@ int bitparse_find_section(char section_name, char **section_start, unsigned int
 			current_length += (*pos++) << 0;
 		}
 
-		if(current_name != 'e' && current_length > 255) {
+		if(current_name != 'e' && current_name != 'z' && current_length > 255) {
 			/* Maybe a parse error */
 			break;
 		}
@@ -262,6 +333,11 @@ void FpgaDownloadAndGo(void)
 		 */
 		char *bitstream_start;
 		unsigned int bitstream_length;
+		if(bitparse_find_section('z', &bitstream_start, &bitstream_length)) {
+			DownloadFPGA_packed(bitstream_start, bitstream_length);
+
+			return; /* All done */
+		}
 		if(bitparse_find_section('e', &bitstream_start, &bitstream_length)) {
 			DownloadFPGA(bitstream_start, bitstream_length, 0);
 
@@ -285,7 +361,8 @@ void FpgaGatherVersion(char *dst, int len)
 	char *fpga_info;
 	unsigned int fpga_info_len;
 	dst[0] = 0;
-	if(!bitparse_find_section('e', &fpga_info, &fpga_info_len)) {
+	if(!bitparse_find_section('z', &fpga_info, &fpga_info_len)
+	   && !bitparse_find_section('e', &fpga_info, &fpga_info_len)) {
 		strncat(dst, "FPGA image: legacy image without version information", len-1);
 	} else {
 		strncat(dst, "FPGA image built", len-1);
@@ -318,9 +395,8 @@ void FpgaGatherVersion(char *dst, int len)
 //-----------------------------------------------------------------------------
 void FpgaSendCommand(uint16_t cmd, uint16_t v)
 {
-	SetupSpi(SPI_FPGA_MODE);
-	while ((AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY) == 0);		// wait for the transfer to complete
-	AT91C_BASE_SPI->SPI_TDR = AT91C_SPI_LASTXFER | cmd | v;		// send the data
+	SpiBegin(SPI_FPGA_MODE);
+	SpiSend(AT91C_SPI_LASTXFER | cmd | v);		// send the data, don't wait for it
 }
 //-----------------------------------------------------------------------------
 // Write the FPGA setup word (that determines what mode the logic is in, read
@@ -0,0 +1,65 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Unpacking of the compressed FPGA bitstream, see fpgaunpack.h
+//-----------------------------------------------------------------------------
+
+#include "fpgaunpack.h"
+
+int FpgaUnpack(const uint8_t *z, int zlen, void (*put)(uint32_t w), void (*tail)(uint32_t w, int bits))
+{
+	const uint8_t *end = z + zlen;
+	uint32_t acc = 0;
+	int len, done = 0, nacc = 0, lits, zeros;
+
+	if(zlen < 4) return -1;
+	len = ((uint32_t)z[0] << 24) | (z[1] << 16) | (z[2] << 8) | z[3];
+	z += 4;
+
+	while(z < end) {
+		lits = *z >> 5;
+		zeros = *z++ & 0x1f;
+		if(lits == 7) {
+			if(z >= end) return -1;
+			lits += *z++;
+		}
+		if(lits > end - z || done + lits > len) return -1;
+		done += lits;
+		while(lits--) {
+			acc = (acc << 8) | *z++;
+			if(++nacc == 4) {
+				put(acc);
+				nacc = 0;
+			}
+		}
+
+		if(zeros == 31) {
+			if(end - z < 2) return -1;
+			zeros = (z[0] << 8) | z[1];
+			z += 2;
+		}
+		if(done + zeros > len) return -1;
+		done += zeros;
+		// finish the word under way, then whole words of zeros
+		while(zeros && nacc) {
+			acc <<= 8;
+			zeros--;
+			if(++nacc == 4) {
+				put(acc);
+				nacc = 0;
+			}
+		}
+		if(nacc == 0) {
+			for(; zeros >= 4; zeros -= 4)
+				put(0);
+			acc = 0;
+			nacc = zeros;
+		}
+	}
+
+	if(done != len) return -1;
+	if(nacc) tail(acc << (32 - 8 * nacc), 8 * nacc);
+	return len;
+}
@@ -0,0 +1,23 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Unpacking of the FPGA bitstream that tools/fpgacompress.pl stored in
+// section 'z' of the .bit image in flash (see there for the format).
+//-----------------------------------------------------------------------------
+
+#ifndef __FPGAUNPACK_H
+#define __FPGAUNPACK_H
+
+#include <stdint.h>
+
+// Unpack the contents of a 'z' section, handing the bitstream to put() one
+// big endian 32 bit word at a time (the first bit to send in bit 31). What
+// is left over at the end, if the length is not a multiple of four, goes
+// to tail() as the top bits of a word. Returns the length of the
+// bitstream, or -1 if the section is damaged; anything unpacked up to that
+// point has already gone out.
+int FpgaUnpack(const uint8_t *z, int zlen, void (*put)(uint32_t w), void (*tail)(uint32_t w, int bits));
+
+#endif /* __FPGAUNPACK_H */
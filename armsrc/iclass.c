@@ -45,6 +45,8 @@
 #include "util.h"
 
 #include "iclass.h"
+#include "iso14443a.h"
+#include "snoopstats.h"
 
 static uint8_t *trace = (uint8_t *) BigBuf;
 static int traceLen = 0;
@@ -87,13 +89,6 @@ static const uint8_t OddByteParity[256] = {
 //static const uint8_t MajorityNibble[16] = { 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 0, 1, 1, 1, 1, 1 };
 //static const uint8_t MajorityNibble[16] =   { 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
 
-// BIG CHANGE - UNDERSTAND THIS BEFORE WE COMMIT
-#define RECV_CMD_OFFSET   3032
-#define RECV_RES_OFFSET   3096
-#define DMA_BUFFER_OFFSET 3160
-#define DMA_BUFFER_SIZE   4096
-#define TRACE_LENGTH      3000
-
 
 //-----------------------------------------------------------------------------
 // The software UART that receives commands from the reader, and its state
@@ -719,14 +714,8 @@ static RAMFUNC int ManchesterDecoding(int v)
 // triggering so that we start recording at the point that the tag is moved
 // near the reader.
 //-----------------------------------------------------------------------------
-void RAMFUNC SnoopIClass(void)
+void RAMFUNC SnoopIClass(int dmaSize)
 {
-//	#define RECV_CMD_OFFSET 	2032	// original (working as of 21/2/09) values
-//	#define RECV_RES_OFFSET		2096	// original (working as of 21/2/09) values
-//	#define DMA_BUFFER_OFFSET	2160	// original (working as of 21/2/09) values
-//	#define DMA_BUFFER_SIZE 	4096	// original (working as of 21/2/09) values
-//	#define TRACE_LENGTH	 	2000	// original (working as of 21/2/09) values
-
     // We won't start recording the frames that we acquire until we trigger;
     // a good trigger condition to get started is probably when we see a
     // response from the tag.
@@ -735,9 +724,9 @@ void RAMFUNC SnoopIClass(void)
     // The command (reader -> tag) that we're receiving.
 	// The length of a received command will in most cases be no more than 18 bytes.
 	// So 32 should be enough!
-    uint8_t *receivedCmd = (((uint8_t *)BigBuf) + RECV_CMD_OFFSET);
+    uint8_t *receivedCmd;
     // The response (tag -> reader) that we're receiving.
-    uint8_t *receivedResponse = (((uint8_t *)BigBuf) + RECV_RES_OFFSET);
+    uint8_t *receivedResponse;
 
     // As we receive stuff, we copy it from receivedCmd or receivedResponse
     // into trace, along with its length and other annotations.
@@ -745,30 +734,47 @@ void RAMFUNC SnoopIClass(void)
     
     traceLen = 0; // uncommented to fix ISSUE 15 - gerhard - jan2011
 
-    // The DMA buffer, used to stream samples from the FPGA
-    int8_t *dmaBuf = ((int8_t *)BigBuf) + DMA_BUFFER_OFFSET;
-    int lastRxCounter;
-    int8_t *upTo;
+    // The DMA ring, used to stream samples from the FPGA. The PDC fills it
+    // one half at a time; readHalf is the half we decode next.
+    int8_t *dmaBuf;
+    int8_t *readHalf = NULL;
+    int dmaHalf;
+    int8_t *upTo = NULL;
+    int left = 0;
     int smpl;
+    int behindBy;
     int maxBehindBy = 0;
+    int traceSize, traceMax;
 
     // Count of samples received so far, so that we can include timing
     // information in the trace buffer.
     int samples = 0;
     rsamples = 0;
 
-    memset(trace, 0x44, RECV_CMD_OFFSET);
+    // The ring gets the size the client asked for, the trace what is left
+    dmaSize = SnoopDmaSize(dmaSize, DMA_BUFFER_SIZE);
+    BigBufReset();
+    receivedCmd = BigBufAlloc(BB_RECV_CMD, RECV_CMD_SIZE);
+    receivedResponse = BigBufAlloc(BB_RECV_RES, RECV_RES_SIZE);
+    dmaBuf = (int8_t *)BigBufAllocRing(BB_DMA, &dmaSize, SNOOP_TRACE_MIN);
+    traceSize = BigBufAvail();
+    if(traceSize > TRACE_SIZE) traceSize = TRACE_SIZE;
+    trace = BigBufAlloc(BB_TRACE, traceSize);
+    if(!trace || !receivedCmd || !receivedResponse || !dmaBuf) return;
+    dmaHalf = dmaSize / 2;
+    // room for one more frame once we are over the limit
+    traceMax = traceSize - 9 - RECV_RES_SIZE;
+
+    memset(trace, 0x44, traceSize);
 
     // Set up the demodulator for tag -> reader responses.
     Demod.output = receivedResponse;
     Demod.len = 0;
     Demod.state = DEMOD_UNSYNCD;
 
-    // Setup for the DMA.
+    // Setup for the DMA, double buffered
     FpgaSetupSsc();
-    upTo = dmaBuf;
-    lastRxCounter = DMA_BUFFER_SIZE;
-    FpgaSetupSscDma((uint8_t *)dmaBuf, DMA_BUFFER_SIZE);
+    FpgaSetupSscDmaHalves((uint8_t *)dmaBuf, dmaSize);
 
     // And the reader -> tag commands
     memset(&Uart, 0, sizeof(Uart));
@@ -782,36 +788,56 @@ void RAMFUNC SnoopIClass(void)
     FpgaWriteConfWord(FPGA_MAJOR_MODE_HF_ISO14443A | FPGA_HF_ISO14443A_SNIFFER);
     SetAdcMuxFor(GPIO_MUXSEL_HIPKD);
 
+    SnoopStatsStart(CMD_SNOOP_ICLASS, dmaSize, dmaHalf);
+
     int div = 0;
     //int div2 = 0;
     int decbyte = 0;
     int decbyter = 0;
+    uint32_t statsMark = 0;
 
-    // And now we loop, receiving samples.
+    // And now we loop, receiving samples. A whole half of the ring is
+    // decoded back to back; the PDC is only looked at in between.
     for(;;) {
-        LED_A_ON();
-        WDT_HIT();
-        int behindBy = (lastRxCounter - AT91C_BASE_PDC_SSC->PDC_RCR) &
-                                (DMA_BUFFER_SIZE-1);
-        if(behindBy > maxBehindBy) {
-            maxBehindBy = behindBy;
-            if(behindBy > 400) {
-                Dbprintf("blew circular buffer! behindBy=0x%x", behindBy);
-                goto done;
+        if(left == 0) {
+            if(readHalf) {
+                SnoopStatsEnd(statsMark);
+                // Hand the half back to the PDC. If it already ran out of
+                // the other one as well, it has stopped and we lost samples.
+                behindBy = dmaSize - AT91C_BASE_PDC_SSC->PDC_RCR;
+                if(behindBy > maxBehindBy) maxBehindBy = behindBy;
+                if(AT91C_BASE_PDC_SSC->PDC_RCR == 0) {
+                    Dbprintf("blew circular buffer! behindBy=0x%x", behindBy);
+                    snoop_stats.flags |= SNOOP_STATS_BLEW;
+                    goto done;
+                }
+                AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) readHalf;
+                AT91C_BASE_PDC_SSC->PDC_RNCR = dmaHalf;
+                readHalf = (readHalf == dmaBuf) ? dmaBuf + dmaHalf : dmaBuf;
+            } else {
+                readHalf = dmaBuf;
             }
+
+            LED_A_ON();
+            for(;;) {
+                WDT_HIT();
+                if(BUTTON_PRESS()) {
+                    DbpString("cancelled_a");
+                    goto done;
+                }
+                // RNCR is cleared when the PDC chains to the other half,
+                // i.e. once readHalf is complete
+                if(AT91C_BASE_PDC_SSC->PDC_RNCR == 0) break;
+                SnoopStatsIdle();
+            }
+            LED_A_OFF();
+
+            statsMark = SnoopStatsBegin(dmaSize - AT91C_BASE_PDC_SSC->PDC_RCR);
+            upTo = readHalf;
+            left = dmaHalf;
         }
-        if(behindBy < 1) continue;
-
-	LED_A_OFF();
-        smpl = upTo[0];
-        upTo++;
-        lastRxCounter -= 1;
-        if(upTo - dmaBuf > DMA_BUFFER_SIZE) {
-            upTo -= DMA_BUFFER_SIZE;
-            lastRxCounter += DMA_BUFFER_SIZE;
-            AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) upTo;
-            AT91C_BASE_PDC_SSC->PDC_RNCR = DMA_BUFFER_SIZE;
-        }
+        smpl = *upTo++;
+        left--;
 
         //samples += 4;
 	samples += 1;
@@ -851,7 +877,8 @@ void RAMFUNC SnoopIClass(void)
 			trace[traceLen++] = Uart.byteCnt;
 			memcpy(trace+traceLen, receivedCmd, Uart.byteCnt);
 			traceLen += Uart.byteCnt;
-			if(traceLen > TRACE_LENGTH) break;
+			SnoopStatsFrame();
+			if(traceLen > traceMax) break;
 		    //}
 		    /* And ready to receive another command. */
 		    Uart.state = STATE_UNSYNCD;
@@ -883,7 +910,8 @@ void RAMFUNC SnoopIClass(void)
 		    trace[traceLen++] = Demod.len;
 		    memcpy(trace+traceLen, receivedResponse, Demod.len);
 		    traceLen += Demod.len;
-		    if(traceLen > TRACE_LENGTH) break;
+		    SnoopStatsFrame();
+		    if(traceLen > traceMax) break;
 
 		    triggered = TRUE;
 
@@ -898,13 +926,9 @@ void RAMFUNC SnoopIClass(void)
 		decbyte = 0x00;
 	}
 	//}
-
-        if(BUTTON_PRESS()) {
-            DbpString("cancelled_a");
-            goto done;
-        }
     }
 
+    snoop_stats.flags |= SNOOP_STATS_TRACE_FULL;
     DbpString("COMMAND FINISHED");
 
     Dbprintf("%x %x %x", maxBehindBy, Uart.state, Uart.byteCnt);
@@ -912,6 +936,7 @@ void RAMFUNC SnoopIClass(void)
 
 done:
     AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTDIS;
+    SnoopStatsStop(maxBehindBy);
     Dbprintf("%x %x %x", maxBehindBy, Uart.state, Uart.byteCnt);
     Dbprintf("%x %x %x", Uart.byteCntMax, traceLen, (int)Uart.output[0]);
     LED_A_OFF();
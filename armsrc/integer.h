@@ -32,8 +32,10 @@ typedef unsigned long	DWORD;
 // typedef enum { FALSE = 0, TRUE } BOOL;
 #include <stdbool.h>
 typedef bool BOOL;
+#ifndef FALSE		/* proxmark3.h has them too */
 #define FALSE false
 #define TRUE true
+#endif
 
 
 #endif
@@ -15,6 +15,8 @@
 #include "util.h"
 
 #include "iso14443crc.h"
+#include "snoopstats.h"
+#include "bigbuf.h"
 
 //static void GetSamplesFor14443(int weTx, int n);
 
@@ -338,17 +340,20 @@ void SimulateIso14443Tag(void)
     uint8_t *resp;
     int respLen;
 
-    uint8_t *resp1 = (((uint8_t *)BigBuf) + 800);
+    BigBufReset();
+    // Room for a whole ToSend[]
+    uint8_t *resp1 = BigBufAlloc(BB_SIM_RESP, 512);
     int resp1Len;
 
-    uint8_t *receivedCmd = (uint8_t *)BigBuf;
+    uint8_t *receivedCmd = BigBufAlloc(BB_RECV_CMD, 100);
     int len;
 
     int i;
 
     int cmdsRecvd = 0;
 
-    memset(receivedCmd, 0x44, 400);
+    if(!resp1 || !receivedCmd) return;
+    memset(receivedCmd, 0x44, 100);
 
     CodeIso14443bAsTag(response1, sizeof(response1));
     memcpy(resp1, ToSend, ToSendMax); resp1Len = ToSendMax;
@@ -637,19 +642,24 @@ static void GetSamplesFor14443Demod(int weTx, int n, int quiet)
 
     int samples = 0;
 
+    // The demodulated frame goes at the bottom of BigBuf, where the client
+    // looks for it
+    BigBufReset();
+    Demod.output = BigBufAlloc(BB_TRACE, 1024);
+    Uart.output = BigBufAlloc(BB_RECV_CMD, 100);
+    dmaBuf = (int8_t *)BigBufAlloc(BB_DMA, DMA_BUFFER_SIZE);
+    if(!Demod.output || !Uart.output || !dmaBuf) return;
+
     // Clear out the state of the "UART" that receives from the tag.
-    memset(BigBuf, 0x44, 400);
-    Demod.output = (uint8_t *)BigBuf;
+    memset(Demod.output, 0x44, 400);
     Demod.len = 0;
     Demod.state = DEMOD_UNSYNCD;
 
     // And the UART that receives from the reader
-    Uart.output = (((uint8_t *)BigBuf) + 1024);
     Uart.byteCntMax = 100;
     Uart.state = STATE_UNSYNCD;
 
     // Setup for the DMA.
-    dmaBuf = (int8_t *)(BigBuf + 32);
     upTo = dmaBuf;
     lastRxCounter = DMA_BUFFER_SIZE;
     FpgaSetupSscDma((uint8_t *)dmaBuf, DMA_BUFFER_SIZE);
@@ -1023,13 +1033,14 @@ void ReadSTMemoryIso14443(uint32_t parameter,uint32_t dwLast)
 // near the reader.
 //-----------------------------------------------------------------------------
 /*
- * Memory usage for this function, (within BigBuf)
- * 0-4095 : Demodulated samples receive (4096 bytes) - DEMOD_TRACE_SIZE
- * 4096-6143 : Last Received command, 2048 bytes (reader->tag) - READER_TAG_BUFFER_SIZE
- * 6144-8191 : Last Received command, 2048 bytes(tag->reader) - TAG_READER_BUFFER_SIZE
- * 8192-9215 : DMA Buffer, 1024 bytes (samples) - DMA_BUFFER_SIZE
+ * Memory usage for this function, (within BigBuf, see bigbuf.h)
+ * trace    : Demodulated samples receive (up to 4096 bytes) - DEMOD_TRACE_SIZE
+ * recv cmd : Last Received command, 2048 bytes (reader->tag) - READER_TAG_BUFFER_SIZE
+ * recv res : Last Received command, 2048 bytes(tag->reader) - TAG_READER_BUFFER_SIZE
+ * dma      : DMA Buffer, dmaSize bytes (samples), 1024 by default - DMA_BUFFER_SIZE
+ * A large DMA ring is taken out of the trace.
  */
-void RAMFUNC SnoopIso14443(void)
+void RAMFUNC SnoopIso14443(int dmaSize)
 {
     // We won't start recording the frames that we acquire until we trigger;
     // a good trigger condition to get started is probably when we see a
@@ -1037,28 +1048,49 @@ void RAMFUNC SnoopIso14443(void)
     int triggered = TRUE;
 
     // The command (reader -> tag) that we're working on receiving.
-    uint8_t *receivedCmd = (uint8_t *)(BigBuf) + DEMOD_TRACE_SIZE;
+    uint8_t *receivedCmd;
     // The response (tag -> reader) that we're working on receiving.
-    uint8_t *receivedResponse = (uint8_t *)(BigBuf) + DEMOD_TRACE_SIZE + READER_TAG_BUFFER_SIZE;
+    uint8_t *receivedResponse;
 
     // As we receive stuff, we copy it from receivedCmd or receivedResponse
     // into trace, along with its length and other annotations.
-    uint8_t *trace = (uint8_t *)BigBuf;
+    uint8_t *trace;
     int traceLen = 0;
+    int traceSize, traceMax;
 
-    // The DMA buffer, used to stream samples from the FPGA.
-    int8_t *dmaBuf = (int8_t *)(BigBuf) + DEMOD_TRACE_SIZE + READER_TAG_BUFFER_SIZE + TAG_READER_BUFFER_SIZE;
-    int lastRxCounter;
-    int8_t *upTo;
+    // The DMA ring, used to stream samples from the FPGA. The PDC fills it
+    // one half at a time; readHalf is the half we decode next.
+    int8_t *dmaBuf;
+    int8_t *readHalf = NULL;
+    int dmaHalf;
+    int8_t *upTo = NULL;
+    int left = 0;
     int ci, cq;
+    int behindBy;
     int maxBehindBy = 0;
+    uint32_t statsMark = 0;
 
     // Count of samples received so far, so that we can include timing
     // information in the trace buffer.
     int samples = 0;
 
+    // The ring gets the size the client asked for, the trace what is left
+    dmaSize = SnoopDmaSize(dmaSize, DMA_BUFFER_SIZE);
+    BigBufReset();
+    receivedCmd = BigBufAlloc(BB_RECV_CMD, READER_TAG_BUFFER_SIZE);
+    receivedResponse = BigBufAlloc(BB_RECV_RES, TAG_READER_BUFFER_SIZE);
+    dmaBuf = (int8_t *)BigBufAllocRing(BB_DMA, &dmaSize, SNOOP_TRACE_MIN);
+    traceSize = BigBufAvail();
+    if(traceSize > DEMOD_TRACE_SIZE) traceSize = DEMOD_TRACE_SIZE;
+    trace = BigBufAlloc(BB_TRACE, traceSize);
+    if(!trace || !receivedCmd || !receivedResponse || !dmaBuf) return;
+    dmaHalf = dmaSize / 2;
+    // room for one more frame (its length is logged in a byte) once we
+    // are over the limit
+    traceMax = traceSize - 9 - 256;
+
     // Initialize the trace buffer
-    memset(trace, 0x44, DEMOD_TRACE_SIZE);
+    memset(trace, 0x44, traceSize);
 
     // Set up the demodulator for tag -> reader responses.
     Demod.output = receivedResponse;
@@ -1073,10 +1105,10 @@ void RAMFUNC SnoopIso14443(void)
 
 	// Print some debug information about the buffer sizes
 	Dbprintf("Snooping buffers initialized:");
-	Dbprintf("  Trace: %i bytes", DEMOD_TRACE_SIZE);
+	Dbprintf("  Trace: %i bytes", traceSize);
 	Dbprintf("  Reader -> tag: %i bytes", READER_TAG_BUFFER_SIZE);
 	Dbprintf("  tag -> Reader: %i bytes", TAG_READER_BUFFER_SIZE);
-	Dbprintf("  DMA: %i bytes", DMA_BUFFER_SIZE);
+	Dbprintf("  DMA: %i bytes", dmaSize);
 
 
     // And put the FPGA in the appropriate mode
@@ -1087,37 +1119,56 @@ void RAMFUNC SnoopIso14443(void)
     	FPGA_HF_READER_RX_XCORR_SNOOP);
     SetAdcMuxFor(GPIO_MUXSEL_HIPKD);
 
-    // Setup for the DMA.
+    // Setup for the DMA, double buffered
     FpgaSetupSsc();
-    upTo = dmaBuf;
-    lastRxCounter = DMA_BUFFER_SIZE;
-    FpgaSetupSscDma((uint8_t *)dmaBuf, DMA_BUFFER_SIZE);
+    FpgaSetupSscDmaHalves((uint8_t *)dmaBuf, dmaSize);
+    SnoopStatsStart(CMD_SNOOP_ISO_14443, dmaSize, dmaHalf);
 		
     LED_A_ON();
 		
-    // And now we loop, receiving samples.
+    // And now we loop, receiving samples. A whole half of the ring is
+    // decoded back to back; the PDC is only looked at in between.
     for(;;) {
-    	int behindBy = (lastRxCounter - AT91C_BASE_PDC_SSC->PDC_RCR) &
-                                (DMA_BUFFER_SIZE-1);
-        if(behindBy > maxBehindBy) {
-            maxBehindBy = behindBy;
-            if(behindBy > (DMA_BUFFER_SIZE-2)) { // TODO: understand whether we can increase/decrease as we want or not?
-                Dbprintf("blew circular buffer! behindBy=0x%x", behindBy);
-                goto done;
+        if(left == 0) {
+            if(readHalf) {
+                SnoopStatsEnd(statsMark);
+                // Hand the half back to the PDC. If it already ran out of
+                // the other one as well, it has stopped and we lost samples.
+                behindBy = dmaSize - AT91C_BASE_PDC_SSC->PDC_RCR;
+                if(behindBy > maxBehindBy) maxBehindBy = behindBy;
+                if(AT91C_BASE_PDC_SSC->PDC_RCR == 0) {
+                    Dbprintf("blew circular buffer! behindBy=0x%x", behindBy);
+                    snoop_stats.flags |= SNOOP_STATS_BLEW;
+                    goto done;
+                }
+                AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) readHalf;
+                AT91C_BASE_PDC_SSC->PDC_RNCR = dmaHalf;
+                readHalf = (readHalf == dmaBuf) ? dmaBuf + dmaHalf : dmaBuf;
+            } else {
+                readHalf = dmaBuf;
+            }
+
+            for(;;) {
+                WDT_HIT();
+                if(BUTTON_PRESS()) {
+                    DbpString("cancelled");
+                    goto done;
+                }
+                // RNCR is cleared when the PDC chains to the other half,
+                // i.e. once readHalf is complete
+                if(AT91C_BASE_PDC_SSC->PDC_RNCR == 0) break;
+                SnoopStatsIdle();
             }
+
+            statsMark = SnoopStatsBegin(dmaSize - AT91C_BASE_PDC_SSC->PDC_RCR);
+            upTo = readHalf;
+            left = dmaHalf;
         }
-        if(behindBy < 2) continue;
 
         ci = upTo[0];
         cq = upTo[1];
         upTo += 2;
-        lastRxCounter -= 2;
-        if(upTo - dmaBuf > DMA_BUFFER_SIZE) {
-            upTo -= DMA_BUFFER_SIZE;
-            lastRxCounter += DMA_BUFFER_SIZE;
-            AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) upTo;
-            AT91C_BASE_PDC_SSC->PDC_RNCR = DMA_BUFFER_SIZE;
-        }
+        left -= 2;
 
         samples += 2;
 
@@ -1134,7 +1185,8 @@ void RAMFUNC SnoopIso14443(void)
                 trace[traceLen++] = Uart.byteCnt; \
                 memcpy(trace+traceLen, receivedCmd, Uart.byteCnt); \
                 traceLen += Uart.byteCnt; \
-                if(traceLen > 1000) break; \
+                SnoopStatsFrame(); \
+                if(traceLen > traceMax) break; \
             } \
             /* And ready to receive another command. */ \
             memset(&Uart, 0, sizeof(Uart)); \
@@ -1172,7 +1224,9 @@ void RAMFUNC SnoopIso14443(void)
             trace[traceLen++] = Demod.len;
             memcpy(trace+traceLen, receivedResponse, Demod.len);
             traceLen += Demod.len;
-            if(traceLen > DEMOD_TRACE_SIZE) {
+            SnoopStatsFrame();
+            if(traceLen > traceMax) {
+				snoop_stats.flags |= SNOOP_STATS_TRACE_FULL;
 				DbpString("Reached trace limit");
 				goto done;
 			}
@@ -1185,16 +1239,12 @@ void RAMFUNC SnoopIso14443(void)
             memset(&Demod, 0, sizeof(Demod));
             Demod.output = receivedResponse;
             Demod.state = DEMOD_UNSYNCD;
-        }
-		WDT_HIT();
-
-        if(BUTTON_PRESS()) {
-            DbpString("cancelled");
-            goto done;
         }
     }
+    snoop_stats.flags |= SNOOP_STATS_TRACE_FULL;
 
 done:
+	SnoopStatsStop(maxBehindBy);
 	LED_A_OFF();
 	LED_B_OFF();
 	LED_C_OFF();
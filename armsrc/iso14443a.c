@@ -18,6 +18,7 @@
 #include "iso14443a.h"
 #include "crapto1.h"
 #include "mifareutil.h"
+#include "snoopstats.h"
 
 static uint8_t *trace = (uint8_t *) BigBuf;
 static int traceLen = 0;
@@ -64,9 +65,20 @@ void iso14a_set_trigger(int enable) {
 	trigger = enable;
 }
 
+// A reader command starts from an empty BigBuf, whatever ran before it
+// (a snoop gives the trace and DMA ring all of it); the trace keeps its
+// place at the bottom, and its contents unless cleared
+static void iso14a_reader_bigbuf(void) {
+	BigBufReset();
+	trace = BigBufAlloc(BB_TRACE, TRACE_SIZE);
+}
 void iso14a_clear_tracelen(void) {
+	iso14a_reader_bigbuf();
 	traceLen = 0;
 }
+int iso14a_get_tracelen(void) {
+	return traceLen;
+}
 void iso14a_set_tracing(int enable) {
 	tracing = enable;
 }
@@ -100,8 +112,8 @@ void AppendCrc14443a(uint8_t* data, int len)
 
 int LogTrace(const uint8_t * btBytes, int iLen, int iSamples, uint32_t dwParity, int bReader)
 {
-  // Return when trace is full
-  if (traceLen >= TRACE_LENGTH) return FALSE;
+  // Return when trace is full (or BigBuf had no room for it)
+  if (trace == NULL || traceLen >= TRACE_LENGTH) return FALSE;
 
   // Trace the random, i'm curious
   rsamples += iSamples;
@@ -617,12 +629,6 @@ static RAMFUNC int ManchesterDecoding(int v)
 //-----------------------------------------------------------------------------
 void RAMFUNC SnoopIso14443a(void)
 {
-//	#define RECV_CMD_OFFSET 	2032	// original (working as of 21/2/09) values
-//	#define RECV_RES_OFFSET		2096	// original (working as of 21/2/09) values
-//	#define DMA_BUFFER_OFFSET	2160	// original (working as of 21/2/09) values
-//	#define DMA_BUFFER_SIZE 	4096	// original (working as of 21/2/09) values
-//	#define TRACE_LENGTH	 	2000	// original (working as of 21/2/09) values
-
     // We won't start recording the frames that we acquire until we trigger;
     // a good trigger condition to get started is probably when we see a
     // response from the tag.
@@ -631,9 +637,9 @@ void RAMFUNC SnoopIso14443a(void)
     // The command (reader -> tag) that we're receiving.
 	// The length of a received command will in most cases be no more than 18 bytes.
 	// So 32 should be enough!
-    uint8_t *receivedCmd = (((uint8_t *)BigBuf) + RECV_CMD_OFFSET);
+    uint8_t *receivedCmd;
     // The response (tag -> reader) that we're receiving.
-    uint8_t *receivedResponse = (((uint8_t *)BigBuf) + RECV_RES_OFFSET);
+    uint8_t *receivedResponse;
 
     // As we receive stuff, we copy it from receivedCmd or receivedResponse
     // into trace, along with its length and other annotations.
@@ -642,7 +648,7 @@ void RAMFUNC SnoopIso14443a(void)
     traceLen = 0; // uncommented to fix ISSUE 15 - gerhard - jan2011
 
     // The DMA buffer, used to stream samples from the FPGA
-    int8_t *dmaBuf = ((int8_t *)BigBuf) + DMA_BUFFER_OFFSET;
+    int8_t *dmaBuf;
     int lastRxCounter;
     int8_t *upTo;
     int smpl;
@@ -653,7 +659,14 @@ void RAMFUNC SnoopIso14443a(void)
     int samples = 0;
     int rsamples = 0;
 
-    memset(trace, 0x44, RECV_CMD_OFFSET);
+    BigBufReset();
+    trace = BigBufAlloc(BB_TRACE, TRACE_SIZE);
+    receivedCmd = BigBufAlloc(BB_RECV_CMD, RECV_CMD_SIZE);
+    receivedResponse = BigBufAlloc(BB_RECV_RES, RECV_RES_SIZE);
+    dmaBuf = (int8_t *)BigBufAlloc(BB_DMA, DMA_BUFFER_SIZE);
+    if(!trace || !receivedCmd || !receivedResponse || !dmaBuf) return;
+
+    memset(trace, 0x44, TRACE_SIZE);
 
     // Set up the demodulator for tag -> reader responses.
     Demod.output = receivedResponse;
@@ -678,6 +691,7 @@ void RAMFUNC SnoopIso14443a(void)
     FpgaWriteConfWord(FPGA_MAJOR_MODE_HF_ISO14443A | FPGA_HF_ISO14443A_SNIFFER);
     SetAdcMuxFor(GPIO_MUXSEL_HIPKD);
 
+    SnoopStatsStart(CMD_SNOOP_ISO_14443a, DMA_BUFFER_SIZE, 1);
 
     // And now we loop, receiving samples.
     for(;;) {
@@ -689,12 +703,17 @@ void RAMFUNC SnoopIso14443a(void)
             maxBehindBy = behindBy;
             if(behindBy > 400) {
                 Dbprintf("blew circular buffer! behindBy=0x%x", behindBy);
+                snoop_stats.flags |= SNOOP_STATS_BLEW;
                 goto done;
             }
         }
-        if(behindBy < 1) continue;
+        if(behindBy < 1) {
+            SnoopStatsIdle();
+            continue;
+        }
 
 	LED_A_OFF();
+        uint32_t statsMark = SnoopStatsBegin(behindBy);
         smpl = upTo[0];
         upTo++;
         lastRxCounter -= 1;
@@ -721,6 +740,7 @@ void RAMFUNC SnoopIso14443a(void)
                 trace[traceLen++] = Uart.byteCnt;
                 memcpy(trace+traceLen, receivedCmd, Uart.byteCnt);
                 traceLen += Uart.byteCnt;
+                SnoopStatsFrame();
                 if(traceLen > TRACE_LENGTH) break;
             }
             /* And ready to receive another command. */
@@ -748,6 +768,7 @@ void RAMFUNC SnoopIso14443a(void)
             trace[traceLen++] = Demod.len;
             memcpy(trace+traceLen, receivedResponse, Demod.len);
             traceLen += Demod.len;
+            SnoopStatsFrame();
             if(traceLen > TRACE_LENGTH) break;
 
             triggered = TRUE;
@@ -759,12 +780,15 @@ void RAMFUNC SnoopIso14443a(void)
             LED_C_OFF();
         }
 
+        SnoopStatsEnd(statsMark);
+
         if(BUTTON_PRESS()) {
             DbpString("cancelled_a");
             goto done;
         }
     }
 
+    snoop_stats.flags |= SNOOP_STATS_TRACE_FULL;
     DbpString("COMMAND FINISHED");
 
     Dbprintf("%x %x %x", maxBehindBy, Uart.state, Uart.byteCnt);
@@ -772,6 +796,7 @@ void RAMFUNC SnoopIso14443a(void)
 
 done:
     AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTDIS;
+    SnoopStatsStop(maxBehindBy);
     Dbprintf("%x %x %x", maxBehindBy, Uart.state, Uart.byteCnt);
     Dbprintf("%x %x %x", Uart.byteCntMax, traceLen, (int)Uart.output[0]);
     LED_A_OFF();
@@ -1015,36 +1040,40 @@ ComputeCrc14443(CRC_14443_A, response3a, 1, &response3a[1], &response3a[2]);
 	// 166 bytes, since every bit that needs to be send costs us a byte
 	//
 
+    BigBufReset();
+    uint8_t *respBuf = BigBufAlloc(BB_SIM_RESP, SIM_RESP_SLOTS * SIM_RESP_SLOT);
+    uint8_t *receivedCmd = BigBufAlloc(BB_RECV_CMD, 100);
+    if(!respBuf || !receivedCmd) return;
+
     // Respond with card type
-    uint8_t *resp1 = (((uint8_t *)BigBuf) + 800);
+    uint8_t *resp1 = respBuf;
     int resp1Len;
 
     // Anticollision cascade1 - respond with uid
-    uint8_t *resp2 = (((uint8_t *)BigBuf) + 970);
+    uint8_t *resp2 = respBuf + 1 * SIM_RESP_SLOT;
     int resp2Len;
 
     // Anticollision cascade2 - respond with 2nd half of uid if asked
     // we're only going to be asked if we set the 1st byte of the UID (during cascade1) to 0x88
-    uint8_t *resp2a = (((uint8_t *)BigBuf) + 1140);
+    uint8_t *resp2a = respBuf + 2 * SIM_RESP_SLOT;
     int resp2aLen;
 
     // Acknowledge select - cascade 1
-    uint8_t *resp3 = (((uint8_t *)BigBuf) + 1310);
+    uint8_t *resp3 = respBuf + 3 * SIM_RESP_SLOT;
     int resp3Len;
 
     // Acknowledge select - cascade 2
-    uint8_t *resp3a = (((uint8_t *)BigBuf) + 1480);
+    uint8_t *resp3a = respBuf + 4 * SIM_RESP_SLOT;
     int resp3aLen;
 
     // Response to a read request - not implemented atm
-    uint8_t *resp4 = (((uint8_t *)BigBuf) + 1550);
+    uint8_t *resp4 = respBuf + 5 * SIM_RESP_SLOT;
     int resp4Len;
 
     // Authenticate response - nonce
-    uint8_t *resp5 = (((uint8_t *)BigBuf) + 1720);
+    uint8_t *resp5 = respBuf + 6 * SIM_RESP_SLOT;
     int resp5Len;
 
-    uint8_t *receivedCmd = (uint8_t *)BigBuf;
     int len;
 
     int i;
@@ -1063,7 +1092,7 @@ ComputeCrc14443(CRC_14443_A, response3a, 1, &response3a[1], &response3a[2]);
 
 	int fdt_indicator;
 
-    memset(receivedCmd, 0x44, 400);
+    memset(receivedCmd, 0x44, 100);
 
 	// Prepare the responses of the anticollision phase
 	// there will be not enough time to do this at the moment the reader sends it REQA
@@ -1694,7 +1723,7 @@ int iso14443a_select_card(uint8_t * uid_ptr, iso14a_card_select_t * resp_data, u
 	uint8_t sel_uid[]    = { 0x93,0x70,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
 	uint8_t rats[]       = { 0xE0,0x80,0x00,0x00 }; // FSD=256, FSDI=8, CID=0
 
-	uint8_t* resp = (((uint8_t *)BigBuf) + 3560);	// was 3560 - tied to other size changes
+	uint8_t* resp = mifare_get_bigbufptr();
 
 	uint8_t sak = 0x04; // cascade uid
 	int cascade_level = 0;
@@ -1703,6 +1732,7 @@ int iso14443a_select_card(uint8_t * uid_ptr, iso14a_card_select_t * resp_data, u
 	
 	// clear uid
 	memset(uid_ptr, 0, 8);
+	if (!resp) return 0;
 
 	// Broadcast for a card, WUPA (0x52) will force response from all cards in the field
 	ReaderTransmitShort(wupa);
@@ -1813,6 +1843,7 @@ void ReaderIso14443a(UsbCommand * c, UsbCommand * ack)
 	if(param & ISO14A_REQUEST_TRIGGER) iso14a_set_trigger(1);
 
 	if(param & ISO14A_CONNECT) {
+		iso14a_reader_bigbuf();
 		iso14443a_setup();
 		ack->arg[0] = iso14443a_select_card(ack->d.asBytes, (iso14a_card_select_t *) (ack->d.asBytes+12), NULL);
 		UsbSendPacket((void *)ack, sizeof(UsbCommand));
@@ -1859,10 +1890,17 @@ void ReaderMifare(uint32_t parameter)
 	uint8_t mf_auth[]    = { 0x60,0x00,0xf5,0x7b };
 	uint8_t mf_nr_ar[]   = { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
 
-	uint8_t* receivedAnswer = (((uint8_t *)BigBuf) + 3560);	// was 3560 - tied to other size changes
+	BigBufReset();
+	uint8_t* receivedAnswer = mifare_get_bigbufptr();
 	traceLen = 0;
 	tracing = false;
 
+	if (!receivedAnswer) {
+		UsbCommand ack = {CMD_ACK, {0, 0, 0}};
+		UsbSendPacket((uint8_t *)&ack, sizeof(UsbCommand));
+		return;
+	}
+
 	iso14443a_setup();
 
 	LED_A_ON();
@@ -2004,8 +2042,11 @@ void Mifare1ksim(uint8_t arg0, uint8_t arg1, uint8_t arg2, uint8_t *datain)
 	struct Crypto1State *pcs;
 	pcs = &mpcs;
 	
+	// the emulator memory keeps its place, everything else goes
+	BigBufReset();
 	uint8_t* receivedCmd = eml_get_bigbufptr_recbuf();
 	uint8_t *response = eml_get_bigbufptr_sendbuf();
+	if (!receivedCmd || !response || !eml_get_bigbufptr_cardmem()) return;
 	
 	static uint8_t rATQA[] = {0x04, 0x00}; // Mifare classic 1k 4BUID
 
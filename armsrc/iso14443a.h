@@ -13,18 +13,21 @@
 #ifndef __ISO14443A_H
 #define __ISO14443A_H
 #include "common.h"
+#include "bigbuf.h"
 
-// BIG CHANGE - UNDERSTAND THIS BEFORE WE COMMIT
-#define RECV_CMD_OFFSET    3032
-#define RECV_RES_OFFSET    3096
-#define DMA_BUFFER_OFFSET  3160
+// Sizes of the BigBuf regions used by the 14443A (and iClass) modes
+#define RECV_CMD_SIZE      64
+#define RECV_RES_SIZE      64
 #define DMA_BUFFER_SIZE    4096
 #define TRACE_LENGTH       3000
-// mifare reader                      over DMA buffer (SnoopIso14443a())!!!
-#define MIFARE_BUFF_OFFSET 3560  //              \/   \/   \/
+// TRACE_LENGTH is checked after a frame went in, leave room for one more
+#define TRACE_SIZE         (TRACE_LENGTH + 9 + RECV_RES_SIZE)
+// mifare reader answers, and the emulator's receive and send buffers
+#define MIFARE_BUFF_SIZE   512
+// simulated tag: precoded responses, 166 bytes each (see SimulateIso14443aTag)
+#define SIM_RESP_SLOT      170
+#define SIM_RESP_SLOTS     7
 // card emulator memory
-#define EML_RESPONSES      4000
-#define CARD_MEMORY        6000
 #define CARD_MEMORY_LEN    1024
 
 typedef struct nestedVector { uint32_t nt, ks1; } nestedVector;
@@ -44,6 +47,7 @@ extern int iso14443a_select_card(uint8_t * uid_ptr, iso14a_card_select_t * resp_
 extern void iso14a_set_trigger(int enable);
 
 extern void iso14a_clear_tracelen(void);
+extern int iso14a_get_tracelen(void);
 extern void iso14a_set_tracing(int enable);
 extern int LogTrace(const uint8_t * btBytes, int iLen, int iSamples, uint32_t dwParity, int bReader);
 
@@ -61,10 +61,14 @@
 #include "util.h"
 #include "apps.h"
 #include "iso15693tools.h"
+#include "bigbuf.h"
 
 
 #define arraylen(x) (sizeof(x)/sizeof((x)[0]))
 
+// Reader answers are kept in BigBuf (BB_15693_ANSWER), 100 bytes each
+#define ISO15693_ANSWER_SIZE  300
+
 ///////////////////////////////////////////////////////////////////////
 // ISO 15693 Part 2 - Air Interface
 // This section basicly contains transmission and receiving of bits
@@ -875,8 +879,9 @@ int SendDataTag(uint8_t *send, int sendlen, int init, int speed, uint8_t **recv)
 	LED_D_OFF();
 	
 	int answerLen=0;
-	uint8_t *answer = (((uint8_t *)BigBuf) + 3660);
-	if (recv!=NULL) memset(BigBuf + 3660, 0, 100);
+	uint8_t *answer = BigBufAlloc(BB_15693_ANSWER, ISO15693_ANSWER_SIZE);
+	if (answer == NULL) return 0;
+	if (recv!=NULL) memset(answer, 0, 100);
 
 	if (init) Iso15693InitReader();
 	
@@ -998,11 +1003,11 @@ void ReaderIso15693(uint32_t parameter)
 
 //DbpString(parameter);
 
-	//uint8_t *answer0 = (((uint8_t *)BigBuf) + 3560); // allow 100 bytes per reponse (way too much)
-	uint8_t *answer1 = (((uint8_t *)BigBuf) + 3660); //
-	uint8_t *answer2 = (((uint8_t *)BigBuf) + 3760);
-	uint8_t *answer3 = (((uint8_t *)BigBuf) + 3860);
-	//uint8_t *TagUID= (((uint8_t *)BigBuf) + 3960);		// where we hold the uid for hi15reader
+	// allow 100 bytes per reponse (way too much)
+	uint8_t *answer1 = BigBufAlloc(BB_15693_ANSWER, ISO15693_ANSWER_SIZE);
+	if (answer1 == NULL) return;
+	uint8_t *answer2 = answer1 + 100;
+	uint8_t *answer3 = answer1 + 200;
 //	int answerLen0 = 0;
 	int answerLen1 = 0;
 	int answerLen2 = 0;
@@ -1010,7 +1015,7 @@ void ReaderIso15693(uint32_t parameter)
 	int i=0; // counter
 
 	// Blank arrays
-	memset(BigBuf + 3660, 0, 300);
+	memset(answer1, 0, ISO15693_ANSWER_SIZE);
 
 	// Setup SSC
 	FpgaSetupSsc();
@@ -1156,8 +1161,9 @@ void SimTagIso15693(uint32_t parameter)
 	LED_C_OFF();
 	LED_D_OFF();
 
-	uint8_t *answer1 = (((uint8_t *)BigBuf) + 3660); //
+	uint8_t *answer1 = BigBufAlloc(BB_15693_ANSWER, ISO15693_ANSWER_SIZE);
 	int answerLen1 = 0;
+	if (answer1 == NULL) return;
 
 	// Blank arrays
 	memset(answer1, 0, 100);
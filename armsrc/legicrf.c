@@ -13,6 +13,7 @@
 #include "util.h"
 
 #include "legicrf.h"
+#include "bigbuf.h"
 #include "legic_prng.h"
 #include "crc.h"
 
@@ -29,6 +30,7 @@ static enum {
 
 static crc_t    legic_crc;
 static int      legic_read_count;
+static uint8_t  *legic_log;
 static uint32_t legic_prng_bc;
 static uint32_t legic_prng_iv;
 
@@ -73,7 +75,9 @@ static void setup_timer(void)
 #define SIM_SHIFT    900   /* prng_time+SIM_SHIFT shift of delayed start */
 
 #define SESSION_IV 0x55
-#define OFFSET_LOG 1024
+// Simulation log: read addresses at 0, prng counts at 128, prng timer
+// values at 256 and frame lengths at 384
+#define LEGIC_LOG_SIZE 512
 
 #define FUZZ_EQUAL(value, target, fuzz) ((value) > ((target)-(fuzz)) && (value) < ((target)+(fuzz)))
 
@@ -98,12 +102,12 @@ static uint32_t get_key_stream(int skip, int count)
 
   /* Write Time Data into LOG */
   if(count == 6) { i = -1; } else { i = legic_read_count; }
-  ((uint8_t*)BigBuf)[OFFSET_LOG+128+i] = legic_prng_count();
-  ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4]   = (legic_prng_bc >> 0) & 0xff;
-  ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+1] = (legic_prng_bc >> 8) & 0xff;
-  ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+2] = (legic_prng_bc >>16) & 0xff;
-  ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+3] = (legic_prng_bc >>24) & 0xff;
-  ((uint8_t*)BigBuf)[OFFSET_LOG+384+i] = count;
+  legic_log[128+i] = legic_prng_count();
+  legic_log[256+i*4]   = (legic_prng_bc >> 0) & 0xff;
+  legic_log[256+i*4+1] = (legic_prng_bc >> 8) & 0xff;
+  legic_log[256+i*4+2] = (legic_prng_bc >>16) & 0xff;
+  legic_log[256+i*4+3] = (legic_prng_bc >>24) & 0xff;
+  legic_log[384+i] = count;
 
   /* Generate KeyStream */
   for(i=0; i<count; i++) {
@@ -582,7 +586,7 @@ static void frame_handle_tag(struct legic_frame const * const f)
          int addr  = f->data ^ key; addr = addr >> 1;
          int data = ((uint8_t*)BigBuf)[addr];
          int hash = LegicCRC(addr, data, 11) << 8;
-         ((uint8_t*)BigBuf)[OFFSET_LOG+legic_read_count] = (uint8_t)addr;
+         legic_log[legic_read_count] = (uint8_t)addr;
          legic_read_count++;
 
          //Dbprintf("Data:%03.3x, key:%03.3x, addr: %03.3x, read_c:%u", f->data, key, addr, read_c);
@@ -617,19 +621,19 @@ static void frame_handle_tag(struct legic_frame const * const f)
       int i;
       Dbprintf("IV: %03.3x", legic_prng_iv);
       for(i = 0; i<legic_read_count; i++) {
-         Dbprintf("Read Nb: %u, Addr: %u", i, ((uint8_t*)BigBuf)[OFFSET_LOG+i]);
+         Dbprintf("Read Nb: %u, Addr: %u", i, legic_log[i]);
       }
 
       for(i = -1; i<legic_read_count; i++) {
          uint32_t t;
-         t  = ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4];
-         t |= ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+1] << 8;
-         t |= ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+2] <<16;
-         t |= ((uint8_t*)BigBuf)[OFFSET_LOG+256+i*4+3] <<24;
+         t  = legic_log[256+i*4];
+         t |= legic_log[256+i*4+1] << 8;
+         t |= legic_log[256+i*4+2] <<16;
+         t |= legic_log[256+i*4+3] <<24;
 
          Dbprintf("Cycles: %u, Frame Length: %u, Time: %u", 
-            ((uint8_t*)BigBuf)[OFFSET_LOG+128+i],
-            ((uint8_t*)BigBuf)[OFFSET_LOG+384+i],
+            legic_log[128+i],
+            legic_log[384+i],
             t);
       }
    }
@@ -673,6 +677,10 @@ void LegicRfSimulate(int phase, int frame, int reqresp)
    * seems to be 300us-ish.
    */
 
+   BigBufReset();
+   legic_log = BigBufAlloc(BB_LEGIC_LOG, LEGIC_LOG_SIZE);
+   if(legic_log == NULL) return;
+
    if(phase < 0) {
       int i;
       for(i=0; i<=reqresp; i++) {
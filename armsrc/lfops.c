@@ -13,8 +13,21 @@
 #include "util.h"
 #include "hitag2.h"
 #include "crc16.h"
+#include "bigbuf.h"
+#include "hidfsk.h"
+#include "em410xdemod.h"
+#include "lfsim.h"
+#include "lfsamples.h"
+#include "t55xx.h"
 
 void AcquireRawAdcSamples125k(int at134khz)
+{
+	AcquireLfSamples125k(at134khz, LF_SAMPLES_8BIT, 1, NULL);
+}
+
+// Capture in one of the lfsamples.h encodings; returns the number of bytes
+// of BigBuf used, and the number of ADC samples they cover in *samples.
+int AcquireLfSamples125k(int at134khz, uint32_t format, int decimation, uint32_t *samples)
 {
 	if (at134khz)
 		FpgaSendCommand(FPGA_CMD_SET_DIVISOR, 88); //134.8Khz
@@ -33,32 +46,54 @@ void AcquireRawAdcSamples125k(int at134khz)
 	FpgaSetupSsc();
 
 	// Now call the acquisition routine
-	DoAcquisition125k();
+	return DoAcquisitionLf(format, decimation, samples);
 }
 
 // split into two routines so we can avoid timing issues after sending commands //
 void DoAcquisition125k(void)
+{
+	DoAcquisitionLf(LF_SAMPLES_8BIT, 1, NULL);
+}
+
+// The samples are packed as they come in, until BigBuf is full or the
+// capture is as long as the client can show (LF_SAMPLES_MAX). A packed
+// capture can take several seconds, so the button cuts it short.
+int DoAcquisitionLf(uint32_t format, int decimation, uint32_t *samples)
 {
 	uint8_t *dest = (uint8_t *)BigBuf;
-	int n = sizeof(BigBuf);
-	int i;
+	int n;
+	lf_samples_t enc;
 
+	// all of BigBuf below the emulator memory
+	BigBufReset();
+	n = BigBufAvail();
 	memset(dest, 0, n);
-	i = 0;
+	LfSamplesInit(&enc, LF_SAMPLES_ENCODING(format), LF_SAMPLES_THRESHOLD(format),
+		decimation, dest, n);
 	for(;;) {
 		if (AT91C_BASE_SSC->SSC_SR & AT91C_SSC_TXRDY) {
 			AT91C_BASE_SSC->SSC_THR = 0x43;
 			LED_D_ON();
 		}
 		if (AT91C_BASE_SSC->SSC_SR & AT91C_SSC_RXRDY) {
-			dest[i] = (uint8_t)AT91C_BASE_SSC->SSC_RHR;
-			i++;
+			if (!LfSamplesPut(&enc, (uint8_t)AT91C_BASE_SSC->SSC_RHR)) break;
 			LED_D_OFF();
-			if (i >= n) break;
+			if (enc.encoding != LF_SAMPLES_8BIT || enc.decimation > 1) {
+				WDT_HIT();
+				if (BUTTON_PRESS()) break;
+			}
 		}
 	}
-	Dbprintf("buffer samples: %02x %02x %02x %02x %02x %02x %02x %02x ...",
-			dest[0], dest[1], dest[2], dest[3], dest[4], dest[5], dest[6], dest[7]);
+	n = LfSamplesFlush(&enc);
+	if (samples)
+		*samples = enc.samples;
+
+	if (enc.encoding == LF_SAMPLES_8BIT && enc.decimation == 1)
+		Dbprintf("buffer samples: %02x %02x %02x %02x %02x %02x %02x %02x ...",
+				dest[0], dest[1], dest[2], dest[3], dest[4], dest[5], dest[6], dest[7]);
+	else
+		Dbprintf("%d samples packed into %d bytes", enc.samples, n);
+	return n;
 }
 
 void ModThenAcquireRawAdcSamples125k(int delay_off, int period_0, int period_1, uint8_t *command)
@@ -141,7 +176,7 @@ void ReadTItag(void)
 	#define FREQHI 134200
 
 	signed char *dest = (signed char *)BigBuf;
-	int n = sizeof(BigBuf);
+	int n = BigBufAvail();
 //	int *dest = GraphBuffer;
 //	int n = GraphTraceLen;
 
@@ -295,7 +330,8 @@ void AcquireTiType(void)
 	#define TIBUFLEN 1250
 
 	// clear buffer
-	memset(BigBuf,0,sizeof(BigBuf));
+	BigBufReset();
+	memset(BigBuf,0,BigBufAvail());
 
 	// Set up the synchronous serial port
 	AT91C_BASE_PIOA->PIO_PDR = GPIO_SSC_DIN;
@@ -344,9 +380,11 @@ void AcquireTiType(void)
 	AT91C_BASE_PIOA->PIO_ASR = GPIO_SSC_DIN | GPIO_SSC_DOUT;
 
 	char *dest = (char *)BigBuf;
+	// one byte a sample, as far as they fit
 	n = TIBUFLEN*32;
+	if (n > BigBufAvail()) n = BigBufAvail() & ~31;
 	// unpack buffer
-	for (i=TIBUFLEN-1; i>=0; i--) {
+	for (i=n/32-1; i>=0; i--) {
 		for (j=0; j<32; j++) {
 			if(BigBuf[i] & (1 << j)) {
 				dest[--n] = 1;
@@ -428,59 +466,174 @@ void WriteTItag(uint32_t idhi, uint32_t idlo, uint16_t crc)
 	DbpString("Now use tiread to check");
 }
 
-void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
+//-----------------------------------------------------------------------------
+// LF tag simulation. In simulator mode the FPGA clocks the SSC with the
+// reader's carrier (TK) and takes the coil state from TD, so the SSC
+// transmitter shifts out one coil state per carrier cycle, kept fed by the
+// PDC from two small buffers. All there is left to do is fill in the next
+// buffer every LF_SIM_WORDS * 32 carrier cycles instead of watching every
+// clock edge, which leaves time for the button and for USB: another
+// descriptor sent meanwhile takes over at the end of the current repeat.
+//-----------------------------------------------------------------------------
+#define LF_SIM_WORDS	8
+
+#define SHORT_COIL()	LOW(GPIO_SSC_DOUT)
+#define OPEN_COIL()		HIGH(GPIO_SSC_DOUT)
+
+static uint32_t simBuf[2][LF_SIM_WORDS];
+static int simNextBuf;
+// what is simulated now and what comes next
+static lf_sim_t simDesc[2];
+static lf_sim_state_t *simRunning;
+
+static void LfSimFill(lf_sim_state_t *st, uint32_t *buf)
 {
 	int i;
-	uint8_t *tab = (uint8_t *)BigBuf;
+
+	for(i = 0; i < LF_SIM_WORDS; i++)
+		buf[i] = LfSimWord(st);
+}
+
+// Start shifting out st; 0 if a simulation is running already, i.e. this
+// comes from a command that came in during it
+static int LfSimSetup(lf_sim_state_t *st)
+{
+	if(simRunning)
+		return 0;
 
 	FpgaWriteConfWord(FPGA_MAJOR_MODE_LF_SIMULATOR);
+	FpgaSetupSsc();
 
-	AT91C_BASE_PIOA->PIO_PER = GPIO_SSC_DOUT | GPIO_SSC_CLK;
+	// clock comes from TK pin, outputs change on falling edge of TK, no
+	// framing, transmit continuously, 32 bits per word, MSB first
+	AT91C_BASE_SSC->SSC_TCMR = SSC_CLOCK_MODE_SELECT(2);
+	AT91C_BASE_SSC->SSC_TFMR = SSC_FRAME_MODE_BITS_IN_WORD(32) | AT91C_SSC_MSBF;
+
+	LfSimFill(st, simBuf[0]);
+	LfSimFill(st, simBuf[1]);
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_TXTDIS;
+	AT91C_BASE_PDC_SSC->PDC_TPR = (uint32_t) simBuf[0];
+	AT91C_BASE_PDC_SSC->PDC_TCR = LF_SIM_WORDS;
+	AT91C_BASE_PDC_SSC->PDC_TNPR = (uint32_t) simBuf[1];
+	AT91C_BASE_PDC_SSC->PDC_TNCR = LF_SIM_WORDS;
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_TXTEN;
+
+	simRunning = st;
+	// buffer that is free once the PDC moved on to the other one
+	simNextBuf = 0;
+	return 1;
+}
 
+// Fill in the next buffer if the PDC is done with it; returns the carrier
+// cycles that were added
+static int LfSimService(lf_sim_state_t *st, int ledcontrol)
+{
+	if(AT91C_BASE_PDC_SSC->PDC_TNCR)
+		return 0;
+
+	LfSimFill(st, simBuf[simNextBuf]);
+	AT91C_BASE_PDC_SSC->PDC_TNPR = (uint32_t) simBuf[simNextBuf];
+	AT91C_BASE_PDC_SSC->PDC_TNCR = LF_SIM_WORDS;
+	simNextBuf ^= 1;
+
+	if (ledcontrol) {
+		if (simNextBuf) LED_D_ON(); else LED_D_OFF();
+	}
+	return LF_SIM_WORDS * 32;
+}
+
+static void LfSimStop(int ledcontrol)
+{
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_TXTDIS;
+	// TD back to the PIO, where the bit banging simulators expect it
+	AT91C_BASE_PIOA->PIO_PER = GPIO_SSC_DOUT;
 	AT91C_BASE_PIOA->PIO_OER = GPIO_SSC_DOUT;
-	AT91C_BASE_PIOA->PIO_ODR = GPIO_SSC_CLK;
+	simRunning = 0;
+	if (ledcontrol)
+		LED_D_OFF();
+}
 
-#define SHORT_COIL()	LOW(GPIO_SSC_DOUT)
-#define OPEN_COIL()		HIGH(GPIO_SSC_DOUT)
+// Simulate until the button is pressed
+static void LfSimRun(lf_sim_state_t *st, int ledcontrol)
+{
+	if(!LfSimSetup(st))
+		return;
 
-	i = 0;
 	for(;;) {
-		while(!(AT91C_BASE_PIOA->PIO_PDSR & GPIO_SSC_CLK)) {
-			if(BUTTON_PRESS()) {
-				DbpString("Stopped");
-				return;
-			}
-			WDT_HIT();
+		WDT_HIT();
+		if(BUTTON_PRESS()) {
+			DbpString("Stopped");
+			break;
 		}
+		UsbPoll(FALSE);
+		// a command that came in meanwhile ended it
+		if(simRunning != st)
+			return;
+		LfSimService(st, ledcontrol);
+	}
 
-		if (ledcontrol)
-			LED_D_ON();
+	LfSimStop(ledcontrol);
+}
 
-		if(tab[i])
-			OPEN_COIL();
-		else
-			SHORT_COIL();
+// Commands are taken from within LfSimRun(); those are the only ones that
+// see a simulation running
+int LfSimBusy(void)
+{
+	return simRunning != 0;
+}
 
-		if (ledcontrol)
-			LED_D_OFF();
+// Stop the simulation running under the current command, for one that
+// needs the FPGA, the SSC or BigBuf for itself; LfSimRun() returns at its
+// next poll, and the command is run after it
+void LfSimCancel(void)
+{
+	if(!simRunning)
+		return;
+	DbpString("Simulation stopped");
+	LfSimStop(1);
+}
 
-		while(AT91C_BASE_PIOA->PIO_PDSR & GPIO_SSC_CLK) {
-			if(BUTTON_PRESS()) {
-				DbpString("Stopped");
-				return;
-			}
-			WDT_HIT();
-		}
+// The descriptor to fill in for the next simulation: not the one on air
+static lf_sim_t *LfSimFree(void)
+{
+	return &simDesc[simRunning && simRunning->sim == &simDesc[0]];
+}
 
-		i++;
-		if(i == period) {
-			i = 0;
-			if (gap) {
-				SHORT_COIL();
-				SpinDelayUs(gap);
-			}
-		}
+// Simulate s until the button is pressed, or if a simulation is running,
+// have s take over from it at the end of its current repeat
+static void LfSimPlay(lf_sim_t *s, int ledcontrol)
+{
+	lf_sim_state_t st;
+
+	if(simRunning) {
+		simRunning->next = s;
+		return;
 	}
+	LfSimStart(&st, s);
+	LfSimRun(&st, ledcontrol);
+}
+
+// Play period samples uploaded to BigBuf, with gap us in between
+void SimulateTagLowFrequency(int period, int gap, int ledcontrol)
+{
+	lf_sim_state_t st;
+
+	if(period > BigBufAvail()) period = BigBufAvail();
+	LfSimStartRaw(&st, (uint8_t *)BigBuf, period, gap);
+	LfSimRun(&st, ledcontrol);
+}
+
+// Simulate from a descriptor, see lfsim.h
+void SimulateTagLowFrequencyDesc(uint32_t arg0, uint32_t arg1, uint32_t arg2,
+	uint8_t *data, int ledcontrol)
+{
+	lf_sim_t *s = LfSimFree();
+
+	if(!LfSimInit(s, arg0, arg1, arg2, data)) {
+		DbpString("Bad simulation descriptor");
+		return;
+	}
+	LfSimPlay(s, ledcontrol);
 }
 
 /* Provides a framework for bidirectional LF tag communication
@@ -601,7 +754,7 @@ void SimulateTagLowFrequencyBidir(int divisor, int t0)
 					((char*)BigBuf)[i++] = frame_pos;
 					memcpy( ((char*)BigBuf)+i, frame, 7);
 					i+=7;
-					i = i % sizeof(BigBuf);
+					i = i % BigBufAvail();
 #endif
 					hitag_handle_frame(t0, frame_pos, frame);
 					memset(frame, 0, sizeof(frame));
@@ -676,116 +829,61 @@ static void hitag_handle_frame(int t0, int frame_len, char *frame)
 	hitag2_handle_command(frame, frame_len, hitag_cb, &t0);
 }
 
-// compose fc/8 fc/10 waveform
-static void fc(int c, int *n) {
-	uint8_t *dest = (uint8_t *)BigBuf;
-	int idx;
-
-	// for when we want an fc8 pattern every 4 logical bits
-	if(c==0) {
-		dest[((*n)++)]=1;
-		dest[((*n)++)]=1;
-		dest[((*n)++)]=0;
-		dest[((*n)++)]=0;
-		dest[((*n)++)]=0;
-		dest[((*n)++)]=0;
-		dest[((*n)++)]=0;
-		dest[((*n)++)]=0;
-	}
-	//	an fc/8  encoded bit is a bit pattern of  11000000  x6 = 48 samples
-	if(c==8) {
-		for (idx=0; idx<6; idx++) {
-			dest[((*n)++)]=1;
-			dest[((*n)++)]=1;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-		}
-	}
+// Fill in s to simulate a HID tag, see hidfsk.h
+static void HidSimDesc(lf_sim_t *s, uint32_t hi, uint32_t lo)
+{
+	uint8_t bits[HID_FSK_HALF_BITS / 8];
 
-	//	an fc/10 encoded bit is a bit pattern of 1110000000 x5 = 50 samples
-	if(c==10) {
-		for (idx=0; idx<5; idx++) {
-			dest[((*n)++)]=1;
-			dest[((*n)++)]=1;
-			dest[((*n)++)]=1;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-			dest[((*n)++)]=0;
-		}
-	}
+	HidFskBits(bits, hi, lo);
+	LfSimInit(s, LF_SIM_ARG0(LF_SIM_FSK, LF_SIM_NRZ, 0),
+		LF_SIM_ARG1(HID_FSK_CLOCK, HID_FSK_FC0, HID_FSK_FC1),
+		LF_SIM_ARG2(HID_FSK_HALF_BITS, 0), bits);
 }
 
-// prepare a waveform pattern in the buffer based on the ID given then
 // simulate a HID tag until the button is pressed
 void CmdHIDsimTAG(int hi, int lo, int ledcontrol)
 {
-	int n=0, i=0;
-	/*
-	 HID tag bitstream format
-	 The tag contains a 44bit unique code. This is sent out MSB first in sets of 4 bits
-	 A 1 bit is represented as 6 fc8 and 5 fc10 patterns
-	 A 0 bit is represented as 5 fc10 and 6 fc8 patterns
-	 A fc8 is inserted before every 4 bits
-	 A special start of frame pattern is used consisting a0b0 where a and b are neither 0
-	 nor 1 bits, they are special patterns (a = set of 12 fc8 and b = set of 10 fc10)
-	*/
+	lf_sim_t *s = LfSimFree();
 
 	if (hi>0xFFF) {
 		DbpString("Tags can only have 44 bits.");
 		return;
 	}
-	fc(0,&n);
-	// special start of frame marker containing invalid bit sequences
-	fc(8,  &n);	fc(8,  &n);	// invalid
-	fc(8,  &n);	fc(10, &n); // logical 0
-	fc(10, &n);	fc(10, &n); // invalid
-	fc(8,  &n);	fc(10, &n); // logical 0
-
-	WDT_HIT();
-	// manchester encode bits 43 to 32
-	for (i=11; i>=0; i--) {
-		if ((i%4)==3) fc(0,&n);
-		if ((hi>>i)&1) {
-			fc(10, &n);	fc(8,  &n);		// low-high transition
-		} else {
-			fc(8,  &n);	fc(10, &n);		// high-low transition
-		}
-	}
-
-	WDT_HIT();
-	// manchester encode bits 31 to 0
-	for (i=31; i>=0; i--) {
-		if ((i%4)==3) fc(0,&n);
-		if ((lo>>i)&1) {
-			fc(10, &n);	fc(8,  &n);		// low-high transition
-		} else {
-			fc(8,  &n);	fc(10, &n);		// high-low transition
-		}
-	}
+	HidSimDesc(s, hi, lo);
 
 	if (ledcontrol)
 		LED_A_ON();
-	SimulateTagLowFrequency(n, 0, ledcontrol);
+	LfSimPlay(s, ledcontrol);
 
 	if (ledcontrol)
 		LED_A_OFF();
 }
 
 
-// loop to capture raw HID waveform then FSK demodulate the TAG ID from it
-void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol)
+//-----------------------------------------------------------------------------
+// Continuous LF reading: the PDC keeps sampling into a ring in BigBuf while
+// the samples already in it are run through a demodulator, so nothing is
+// missed between reads. 16k samples is about 130ms at 125kHz, plenty for
+// sending a tag ID to the client.
+//-----------------------------------------------------------------------------
+#define LF_DMA_SIZE	16384
+
+typedef struct {
+	uint8_t *buf;
+	uint8_t *upTo;
+	int size;
+	int lastRxCounter;
+} lf_ring_t;
+
+// Last tag passed on by LfTagFound()
+static uint32_t lastTagType, lastTagHi, lastTagLo, lastTagTime;
+
+static int LfRingStart(lf_ring_t *r)
 {
-	uint8_t *dest = (uint8_t *)BigBuf;
-	int m=0, n=0, i=0, idx=0, found=0, lastval=0;
-	uint32_t hi=0, lo=0;
+	r->size = LF_DMA_SIZE;
+	BigBufReset();
+	r->buf = BigBufAllocRing(BB_DMA, &r->size, 0);
+	if(!r->buf) return 0;
 
 	FpgaSendCommand(FPGA_CMD_SET_DIVISOR, 95); //125Khz
 	FpgaWriteConfWord(FPGA_MAJOR_MODE_LF_READER);
@@ -796,182 +894,164 @@ void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol)
 	// Give it a bit of time for the resonant antenna to settle.
 	SpinDelay(50);
 
-	// Now set up the SSC to get the ADC samples that are now streaming at us.
+	// Now set up the SSC to get the ADC samples that are now streaming at us,
+	// and the PDC to put them in the ring.
 	FpgaSetupSsc();
+	r->upTo = r->buf;
+	r->lastRxCounter = r->size;
+	FpgaSetupSscDma(r->buf, r->size);
+
+	lastTagType = 0;
+	return 1;
+}
+
+// Samples waiting from r->upTo on; no further than the end of the ring, and
+// in small enough bites that the button is still looked at
+static int LfRingAvail(lf_ring_t *r)
+{
+	int n, behindBy;
+
+	if(AT91C_BASE_SSC->SSC_SR & (AT91C_SSC_TXRDY))
+		AT91C_BASE_SSC->SSC_THR = 0x43;
+
+	behindBy = (r->lastRxCounter - AT91C_BASE_PDC_SSC->PDC_RCR) & (r->size-1);
+	n = r->buf + r->size - r->upTo;
+	if(n > behindBy) n = behindBy;
+	if(n > 256) n = 256;
+	return n;
+}
+
+static void LfRingConsumed(lf_ring_t *r, int n)
+{
+	r->upTo += n;
+	r->lastRxCounter -= n;
+	if(r->upTo >= r->buf + r->size) {
+		r->upTo = r->buf;
+		r->lastRxCounter += r->size;
+		AT91C_BASE_PDC_SSC->PDC_RNPR = (uint32_t) r->upTo;
+		AT91C_BASE_PDC_SSC->PDC_RNCR = r->size;
+	}
+}
+
+static void LfRingStop(void)
+{
+	AT91C_BASE_PDC_SSC->PDC_PTCR = AT91C_PDC_RXTDIS;
+}
+
+// Send the client just the ID, not the samples. A tag held at the antenna
+// repeats its frame many times a second; it is passed on again once
+// LF_TAG_REPEAT_MS went by.
+static void LfTagFound(uint32_t type, uint32_t hi, uint32_t lo, uint32_t rssi)
+{
+	UsbCommand c = {CMD_LF_TAG_ID, {type, hi, lo}};
+	uint32_t now = GetTickCount();
+
+	if(type == lastTagType && hi == lastTagHi && lo == lastTagLo &&
+		now - lastTagTime < LF_TAG_REPEAT_MS)
+		return;
+	lastTagType = type;
+	lastTagHi = hi;
+	lastTagLo = lo;
+	lastTagTime = now;
+
+	c.d.asDwords[0] = now;
+	c.d.asDwords[1] = rssi;
+	UsbSendPacket((uint8_t *)&c, sizeof(c));
+}
+
+// loop to capture raw HID waveform and FSK demodulate the TAG ID from it
+void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol)
+{
+	lf_ring_t ring;
+	hid_fsk_t hid;
+	int n, i;
+
+	if(!LfRingStart(&ring)) return;
+	HidFskInit(&hid);
+
+	if (ledcontrol)
+		LED_A_ON();
 
 	for(;;) {
 		WDT_HIT();
-		if (ledcontrol)
-			LED_A_ON();
 		if(BUTTON_PRESS()) {
 			DbpString("Stopped");
-			if (ledcontrol)
-				LED_A_OFF();
-			return;
+			break;
 		}
 
-		i = 0;
-		m = sizeof(BigBuf);
-		memset(dest,128,m);
-		for(;;) {
-			if(AT91C_BASE_SSC->SSC_SR & (AT91C_SSC_TXRDY)) {
-				AT91C_BASE_SSC->SSC_THR = 0x43;
-				if (ledcontrol)
-					LED_D_ON();
-			}
-			if(AT91C_BASE_SSC->SSC_SR & (AT91C_SSC_RXRDY)) {
-				dest[i] = (uint8_t)AT91C_BASE_SSC->SSC_RHR;
-				// we don't care about actual value, only if it's more or less than a
-				// threshold essentially we capture zero crossings for later analysis
-				if(dest[i] < 127) dest[i] = 0; else dest[i] = 1;
-				i++;
-				if (ledcontrol)
-					LED_D_OFF();
-				if(i >= m) {
-					break;
-				}
+		n = LfRingAvail(&ring);
+		if (ledcontrol) {
+			if (n) LED_D_ON(); else LED_D_OFF();
+		}
+
+		for(i = 0; i < n; i++) {
+			if(!HidFskSample(&hid, ring.upTo[i]))
+				continue;
+			LfTagFound(LF_TAG_HID, hid.tagHi, hid.tagLo, hid.rssi);
+			/* if we're only looking for one tag */
+			if (findone)
+			{
+				*high = hid.tagHi;
+				*low = hid.tagLo;
+				goto done;
 			}
 		}
+		LfRingConsumed(&ring, n);
+	}
 
-		// FSK demodulator
+done:
+	LfRingStop();
+	if (ledcontrol) {
+		LED_A_OFF();
+		LED_D_OFF();
+	}
+}
 
-		// sync to first lo-hi transition
-		for( idx=1; idx<m; idx++) {
-			if (dest[idx-1]<dest[idx])
-				lastval=idx;
-				break;
-		}
-		WDT_HIT();
+// loop to read EM410x tags (ASK, Manchester, RF/64), same as the HID one;
+// high gets the top 8 bits of the 40 bit ID, low the other 32
+void CmdEM410xdemod(int findone, int *high, int *low, int ledcontrol)
+{
+	lf_ring_t ring;
+	em410x_demod_t em;
+	int n, i;
 
-		// count cycles between consecutive lo-hi transitions, there should be either 8 (fc/8)
-		// or 10 (fc/10) cycles but in practice due to noise etc we may end up with with anywhere
-		// between 7 to 11 cycles so fuzz it by treat anything <9 as 8 and anything else as 10
-		for( i=0; idx<m; idx++) {
-			if (dest[idx-1]<dest[idx]) {
-				dest[i]=idx-lastval;
-				if (dest[i] <= 8) {
-						dest[i]=1;
-				} else {
-						dest[i]=0;
-				}
+	if(!LfRingStart(&ring)) return;
+	Em410xDemodInit(&em, EM410X_DEFAULT_CLOCK);
 
-				lastval=idx;
-				i++;
-			}
-		}
-		m=i;
+	if (ledcontrol)
+		LED_A_ON();
+
+	for(;;) {
 		WDT_HIT();
+		if(BUTTON_PRESS()) {
+			DbpString("Stopped");
+			break;
+		}
 
-		// we now have a set of cycle counts, loop over previous results and aggregate data into bit patterns
-		lastval=dest[0];
-		idx=0;
-		i=0;
-		n=0;
-		for( idx=0; idx<m; idx++) {
-			if (dest[idx]==lastval) {
-				n++;
-			} else {
-				// a bit time is five fc/10 or six fc/8 cycles so figure out how many bits a pattern width represents,
-				// an extra fc/8 pattern preceeds every 4 bits (about 200 cycles) just to complicate things but it gets
-				// swallowed up by rounding
-				// expected results are 1 or 2 bits, any more and it's an invalid manchester encoding
-				// special start of frame markers use invalid manchester states (no transitions) by using sequences
-				// like 111000
-				if (dest[idx-1]) {
-					n=(n+1)/6;			// fc/8 in sets of 6
-				} else {
-					n=(n+1)/5;			// fc/10 in sets of 5
-				}
-				switch (n) {			// stuff appropriate bits in buffer
-					case 0:
-					case 1:	// one bit
-						dest[i++]=dest[idx-1];
-						break;
-					case 2: // two bits
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						break;
-					case 3: // 3 bit start of frame markers
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						break;
-					// When a logic 0 is immediately followed by the start of the next transmisson
-					// (special pattern) a pattern of 4 bit duration lengths is created.
-					case 4:
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						dest[i++]=dest[idx-1];
-						break;
-					default:	// this shouldn't happen, don't stuff any bits
-						break;
-				}
-				n=0;
-				lastval=dest[idx];
-			}
+		n = LfRingAvail(&ring);
+		if (ledcontrol) {
+			if (n) LED_D_ON(); else LED_D_OFF();
 		}
-		m=i;
-		WDT_HIT();
 
-		// final loop, go over previously decoded manchester data and decode into usable tag ID
-		// 111000 bit pattern represent start of frame, 01 pattern represents a 1 and 10 represents a 0
-		for( idx=0; idx<m-6; idx++) {
-			// search for a start of frame marker
-			if ( dest[idx] && dest[idx+1] && dest[idx+2] && (!dest[idx+3]) && (!dest[idx+4]) && (!dest[idx+5]) )
+		for(i = 0; i < n; i++) {
+			if(!Em410xDemodSample(&em, ring.upTo[i]))
+				continue;
+			LfTagFound(LF_TAG_EM410X, (uint32_t)(em.id >> 32), (uint32_t)em.id, em.rssi);
+			if (findone)
 			{
-				found=1;
-				idx+=6;
-				if (found && (hi|lo)) {
-					Dbprintf("TAG ID: %x%08x (%d)",
-						(unsigned int) hi, (unsigned int) lo, (unsigned int) (lo>>1) & 0xFFFF);
-					/* if we're only looking for one tag */
-					if (findone)
-					{
-						*high = hi;
-						*low = lo;
-						return;
-					}
-					hi=0;
-					lo=0;
-					found=0;
-				}
-			}
-			if (found) {
-				if (dest[idx] && (!dest[idx+1]) ) {
-					hi=(hi<<1)|(lo>>31);
-					lo=(lo<<1)|0;
-				} else if ( (!dest[idx]) && dest[idx+1]) {
-					hi=(hi<<1)|(lo>>31);
-					lo=(lo<<1)|1;
-				} else {
-					found=0;
-					hi=0;
-					lo=0;
-				}
-				idx++;
-			}
-			if ( dest[idx] && dest[idx+1] && dest[idx+2] && (!dest[idx+3]) && (!dest[idx+4]) && (!dest[idx+5]) )
-			{
-				found=1;
-				idx+=6;
-				if (found && (hi|lo)) {
-					Dbprintf("TAG ID: %x%08x (%d)",
-						(unsigned int) hi, (unsigned int) lo, (unsigned int) (lo>>1) & 0xFFFF);
-					/* if we're only looking for one tag */
-					if (findone)
-					{
-						*high = hi;
-						*low = lo;
-						return;
-					}
-					hi=0;
-					lo=0;
-					found=0;
-				}
+				*high = (uint32_t)(em.id >> 32);
+				*low = (uint32_t)em.id;
+				goto done;
 			}
 		}
-		WDT_HIT();
+		LfRingConsumed(&ring, n);
+	}
+
+done:
+	LfRingStop();
+	if (ledcontrol) {
+		LED_A_OFF();
+		LED_D_OFF();
 	}
 }
 
@@ -979,120 +1059,125 @@ void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol)
 //----------------------
 // ProxBRUTE routines
 
-void SimulateTagLowFrequencyBrute(int period, int gap, int ledcontrol)
+// ID number n of a sweep: the low word itself, or the 26 bit Wiegand card
+// n of facility code hi (even parity over the first 12 bits, odd over the
+// last 12), with the 0x2004000000 every 26 bit HID card carries
+static void HidBruteId(int mode, uint32_t hi, uint32_t n, uint32_t *idHi, uint32_t *idLo)
 {
-	int i, x;
-	uint8_t *tab = (uint8_t *)BigBuf;
-
-	FpgaWriteConfWord(FPGA_MAJOR_MODE_LF_SIMULATOR);
-
-	AT91C_BASE_PIOA->PIO_PER = GPIO_SSC_DOUT | GPIO_SSC_CLK;
-
-	AT91C_BASE_PIOA->PIO_OER = GPIO_SSC_DOUT;
-	AT91C_BASE_PIOA->PIO_ODR = GPIO_SSC_CLK;
-
-#define SHORT_COIL()	LOW(GPIO_SSC_DOUT)
-#define OPEN_COIL()		HIGH(GPIO_SSC_DOUT)
-
-	i = 0;
-	x = 0;
-	for(;;) {
-		while(!(AT91C_BASE_PIOA->PIO_PDSR & GPIO_SSC_CLK)) {
-			if(BUTTON_PRESS() || x == 20000 ) {
-				DbpString("Stopped");
-				return;
-			}
-			WDT_HIT();
-		}
-
-		if (ledcontrol)
-			LED_D_ON();
+	uint32_t w, p, i;
 
-		if(tab[i])
-			OPEN_COIL();
-		else
-			SHORT_COIL();
+	if(mode != HID_BRUTE_FC) {
+		*idHi = hi;
+		*idLo = n;
+		return;
+	}
 
-		if (ledcontrol)
-			LED_D_OFF();
+	w = ((hi & 0xff) << 16) | (n & 0xffff);
+	for(p = 0, i = 12; i < 24; i++)
+		p ^= (w >> i) & 1;
+	w = (p << 25) | (w << 1);
+	for(p = 1, i = 0; i < 12; i++)
+		p ^= (w >> (i + 1)) & 1;
+	*idHi = 0x20;
+	*idLo = 0x04000000 | w | p;
+}
 
-		while(AT91C_BASE_PIOA->PIO_PDSR & GPIO_SSC_CLK) {
-			if(BUTTON_PRESS() || x == 20000 ) {
-				DbpString("Stopped");
-				return;
-			}
-			WDT_HIT();
-		}
+// Tell the client how far the sweep got; done is 1 for the last one
+void HidBruteStatus(uint32_t hi, uint32_t lo, uint32_t tried, int done)
+{
+	UsbCommand c = {CMD_HID_BRUTE_STATUS, {hi, lo, tried}};
 
-		i++;
-		x++;
-		if(i == period) {
-			i = 0;
-			if (gap) {
-				SHORT_COIL();
-				SpinDelayUs(gap);
-			}
-		}
-	}
+	if(!UsbConnected())
+		return;
+	c.d.asDwords[0] = GetTickCount();
+	c.d.asDwords[1] = done;
+	UsbSendPacket((uint8_t *)&c, sizeof(c));
 }
 
-// prepare a waveform pattern in the buffer based on the ID given then
-// simulate a HID tag for a while or until the button is pressed
-void CmdHIDsimTAGProxBrute(int hi, int lo, int ledcontrol)
+// Simulate HID tags from start to end (both included) in steps of step,
+// each for dwell ms rounded up to whole frames, until the button is
+// pressed. The simulation does not stop between two of them: the next ID
+// is patched into the descriptor that is not on air, and takes over at the
+// end of a frame. report, if not NULL, is told about the ID on air every
+// HID_BRUTE_STATUS_MS, and about the last one when it is over.
+void HidBrute(int mode, uint32_t hi, uint32_t start, uint32_t end, int step,
+	int dwell, int ledcontrol, hid_brute_report_t report)
 {
-	int n=0, i=0;
-	/*
-	 HID tag bitstream format
-	 The tag contains a 44bit unique code. This is sent out MSB first in sets of 4 bits
-	 A 1 bit is represented as 6 fc8 and 5 fc10 patterns
-	 A 0 bit is represented as 5 fc10 and 6 fc8 patterns
-	 A fc8 is inserted before every 4 bits
-	 A special start of frame pattern is used consisting a0b0 where a and b are neither 0
-	 nor 1 bits, they are special patterns (a = set of 12 fc8 and b = set of 10 fc10)
-	*/
+	lf_sim_state_t st;
+	uint32_t ids[2][2], oldHi, oldLo, n = start, tried = 1, lastReport;
+	// carrier cycles, wrapping round after about 9.5 hours
+	uint32_t sent = 0, switchAt;
+	int queued = 0, cur;
 
-	if (hi>0xFFF) {
-		DbpString("Tags can only have 44 bits.");
+	if(simRunning)
 		return;
-	}
-	fc(0,&n);
-	// special start of frame marker containing invalid bit sequences
-	fc(8,  &n);	fc(8,  &n);	// invalid
-	fc(8,  &n);	fc(10, &n); // logical 0
-	fc(10, &n);	fc(10, &n); // invalid
-	fc(8,  &n);	fc(10, &n); // logical 0
-
-	WDT_HIT();
-	// manchester encode bits 43 to 32
-	for (i=11; i>=0; i--) {
-		if ((i%4)==3) fc(0,&n);
-		if ((hi>>i)&1) {
-			fc(10, &n);	fc(8,  &n);		// low-high transition
-		} else {
-			fc(8,  &n);	fc(10, &n);		// high-low transition
+	if(step == 0) step = 1;
+	if((end < start) != (step < 0)) step = -step;
+	if(dwell <= 0) dwell = HID_BRUTE_DWELL_MS;
+	// carrier cycles at 125kHz
+	dwell *= 125;
+
+	HidBruteId(mode, hi, n, &ids[0][0], &ids[0][1]);
+	HidSimDesc(&simDesc[0], ids[0][0], ids[0][1]);
+	simDesc[1] = simDesc[0];
+	ids[1][0] = ids[0][0];
+	ids[1][1] = ids[0][1];
+	cur = 0;
+
+	LfSimStart(&st, &simDesc[0]);
+	if(!LfSimSetup(&st))
+		return;
+	if (ledcontrol)
+		LED_A_ON();
+
+	switchAt = dwell;
+	lastReport = GetTickCount();
+	for(;;) {
+		WDT_HIT();
+		if(BUTTON_PRESS()) {
+			DbpString("Stopped");
+			break;
+		}
+		sent += LfSimService(&st, ledcontrol);
+
+		if(queued) {
+			// still waiting for the end of a frame
+			if(st.next)
+				continue;
+			queued = 0;
+			cur ^= 1;
+			switchAt = sent + dwell;
 		}
-	}
 
-	WDT_HIT();
-	// manchester encode bits 31 to 0
-	for (i=31; i>=0; i--) {
-		if ((i%4)==3) fc(0,&n);
-		if ((lo>>i)&1) {
-			fc(10, &n);	fc(8,  &n);		// low-high transition
-		} else {
-			fc(8,  &n);	fc(10, &n);		// high-low transition
+		if(report && GetTickCount() - lastReport >= HID_BRUTE_STATUS_MS) {
+			report(ids[cur][0], ids[cur][1], tried, 0);
+			lastReport = GetTickCount();
 		}
-	}
 
-	if (ledcontrol)
-		LED_A_ON();
-	SimulateTagLowFrequencyBrute(n, 0, ledcontrol); //Simulate for bruteforce attack
+		if((int32_t)(sent - switchAt) < 0)
+			continue;
+		// no further without wrapping round
+		if(step > 0 ? end - n < (uint32_t)step : n - end < (uint32_t)-step)
+			break;
+
+		n += step;
+		tried++;
+		// the other descriptor still has the ID before the current one
+		oldHi = ids[!cur][0];
+		oldLo = ids[!cur][1];
+		HidBruteId(mode, hi, n, &ids[!cur][0], &ids[!cur][1]);
+		HidFskPatch(simDesc[!cur].data, ids[!cur][0], ids[!cur][1], oldHi, oldLo);
+		st.next = &simDesc[!cur];
+		queued = 1;
+	}
 
+	LfSimStop(ledcontrol);
 	if (ledcontrol)
 		LED_A_OFF();
+	if(report)
+		report(ids[cur][0], ids[cur][1], tried, 1);
 }
 
-
 //----------------------
 // T5557/T5567 routines
 
@@ -1102,6 +1187,10 @@ void CmdHIDsimTAGProxBrute(int hi, int lo, int ledcontrol)
 #define write_0 150 //192
 #define write_1 400 //440 //432 for T55x7; 448 for E5550
 
+// Time a block gets to show up when it is read back, in ms: three times
+// round at RF/128, on top of the settling time of the field
+#define T55XX_VERIFY_MS 100
+
 //Write one bit to card
 void T5567WriteBit(int bit)
 {
@@ -1113,10 +1202,9 @@ void T5567WriteBit(int bit)
 	SpinDelayUs(write_gap);
 }
 
-//Write one card block in page 0, no lock
-void T5567WriteBlock(int Data, int Block)
+//Power up the card and send the start gap of a command
+static void T5567Start(void)
 {
-
 	/* Make sure the tag is reset */
 //	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
 //	SpinDelay(2500);
@@ -1131,6 +1219,12 @@ void T5567WriteBlock(int Data, int Block)
 	// now start writting
 	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
 	SpinDelayUs(start_gap);
+}
+
+//Write one card block in page 0, no lock
+void T5567WriteBlock(int Data, int Block)
+{
+	T5567Start();
 
   //Opcode
   T5567WriteBit(1);
@@ -1156,44 +1250,137 @@ void T5567WriteBlock(int Data, int Block)
 	
 }
 
+// Direct access read of a block: the card sends just that one over and over
+// once the field is back, which it has to be within the time the command
+// leaves for the first bit
+static void T5567ReadBlock(int Block)
+{
+	T5567Start();
+
+  //Opcode
+  T5567WriteBit(1);
+  T5567WriteBit(0); //Page 0
+  T5567WriteBit(0);
+
+  //Page 
+  for (int i=0;i<3;i++){
+     T5567WriteBit(Block&(1<<(2-i)));
+  }	
+}
+
+// Read block back and look for want in it, in the modulation of config
+// (see t55xx.h); 1 if it is there, 0 if not, -1 if config can not be read
+static int T55xxVerifyBlock(uint32_t config, int block, uint32_t want)
+{
+	t55xx_demod_t d;
+	lf_ring_t r;
+	uint32_t start;
+	int n, i, found = 0;
+
+	if(!T55xxDemodInit(&d, config, want))
+		return -1;
+
+	T5567ReadBlock(block);
+	if(!LfRingStart(&r))
+		return 0;
+	start = GetTickCount();
+	while(!found && GetTickCount() - start < T55XX_VERIFY_MS) {
+		WDT_HIT();
+		n = LfRingAvail(&r);
+		for(i = 0; i < n && !found; i++)
+			found = T55xxDemodSample(&d, r.upTo[i]);
+		LfRingConsumed(&r, n);
+	}
+	LfRingStop();
+	return found;
+}
+
+// Write n blocks to a card, starting with block 0, the configuration; it
+// goes in last, so that the card does not change over half way. With verify
+// each block is read back once they are all written, in the modulation of
+// the new configuration, and those that did not come back as written are
+// written again, up to retries times. Returns the blocks that came back as
+// a mask, or T55XX_UNVERIFIED if they could not be read back; *writes is
+// set to the number of block writes it took.
+uint32_t T55xxWriteCard(uint32_t *blocks, int n, int retries, int verify, int *writes)
+{
+	uint32_t ok = 0, all = (1 << n) - 1;
+	int try, b, i;
+
+	*writes = 0;
+	for(try = 0; try <= retries; try++) {
+		for(i = 1; i <= n; i++) {
+			b = i % n;
+			if(ok & (1 << b)) continue;
+			WDT_HIT();
+			T5567WriteBlock(blocks[b], b);
+			(*writes)++;
+		}
+		if(!verify)
+			break;
+
+		for(b = 0; b < n; b++) {
+			if(ok & (1 << b)) continue;
+			switch(T55xxVerifyBlock(blocks[0], b, blocks[b])) {
+				case 1:
+					ok |= 1 << b;
+					break;
+				case -1:
+					verify = 0;
+					break;
+			}
+			if(!verify) break;
+		}
+		if(!verify || ok == all || BUTTON_PRESS())
+			break;
+	}
+
+	FpgaWriteConfWord(FPGA_MAJOR_MODE_OFF);
+	return verify ? ok : T55XX_UNVERIFIED;
+}
+
+// Report how T55xxWriteCard() went
+static void T55xxResult(uint32_t ok, int n, int writes)
+{
+	if(ok == T55XX_UNVERIFIED)
+		Dbprintf("%d blocks written, not read back", writes);
+	else if(ok == (1u << n) - 1)
+		Dbprintf("DONE! %d blocks written, all read back", writes);
+	else
+		Dbprintf("%d blocks written, blocks %02x did not read back", writes, ((1 << n) - 1) & ~ok);
+}
+
 //Copy HID id to card and setup block 0 config
 void CopyHIDtoT5567(int hi, int lo)
 {
-	int data1, data2, data3;
+	uint32_t blocks[T55XX_BLOCKS], ok;
+	int n, writes;
 
   // ensure no more than 44 bits supplied
 	if (hi>0xFFF) {
 		DbpString("Tags can only have 44 bits.");
 		return;
 	}
-	
-	//Build the 3 data blocks for supplied 44bit ID
-	data1 = 0x1D000000; //load preamble
-	for (int i=0;i<12;i++){
-		if (hi & (1<<(11-i))) data1 |= (1<<(((11-i)*2)+1)); // 1 -> 10
-		else data1 |= (1<<((11-i)*2));                      // 0 -> 01
-	}
-	data2 = 0; 
-	for (int i=0;i<16;i++){
-		if (lo & (1<<(31-i))) data2 |= (1<<(((15-i)*2)+1)); // 1 -> 10
-		else data2 |= (1<<((15-i)*2));                      // 0 -> 01
-	}
-	data3 = 0; 
-	for (int i=0;i<16;i++){
-		if (lo & (1<<(15-i))) data3 |= (1<<(((15-i)*2)+1)); // 1 -> 10
-		else data3 |= (1<<((15-i)*2));                      // 0 -> 01
-	}
-
-	//Program the 3 data blocks for supplied 44bit ID
-	// and the block 0 for HID format
-  T5567WriteBlock(data1,1);
-  T5567WriteBlock(data2,2);
-  T5567WriteBlock(data3,3);
-  //Config for HID (RF/50;FSK2a;Maxblock=3)
-  T5567WriteBlock(0x00107060,0);
 
-	DbpString("DONE!");
+	//Build the config (RF/50;FSK2a;Maxblock=3) and the 3 data blocks for
+	//supplied 44bit ID, then program and read them back
+	n = T55xxHidBlocks(blocks, hi, lo);
+	ok = T55xxWriteCard(blocks, n, T55XX_DEFAULT_RETRIES, 1, &writes);
+	T55xxResult(ok, n, writes);
+}
 
+// CMD_T55XX_WRITE_CARD, see usb_cmd.h
+void CmdT55xxWriteCard(uint32_t arg0, uint8_t *data, UsbCommand *ack)
+{
+	uint32_t blocks[T55XX_BLOCKS], start = GetTickCount();
+	int n = T55XX_WRITE_BLOCKS(arg0), writes = 0;
+
+	if(n > T55XX_BLOCKS) n = T55XX_BLOCKS;
+	memcpy(blocks, data, n * sizeof(blocks[0]));
+	ack->arg[0] = n ? T55xxWriteCard(blocks, n, T55XX_WRITE_RETRIES(arg0),
+		!(arg0 & T55XX_WRITE_NO_VERIFY), &writes) : 0;
+	ack->arg[1] = writes;
+	ack->arg[2] = GetTickCount() - start;
 }	
 	
 
@@ -305,7 +305,7 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain)
 	struct Crypto1State mpcs = {0, 0};
 	struct Crypto1State *pcs;
 	pcs = &mpcs;
-	uint8_t* receivedAnswer = mifare_get_bigbufptr();
+	uint8_t* receivedAnswer;
 
 	//init
 	for (i = 0; i < NES_MAX_INFO + 1; i++) nvectorcount[i] = 11;  //  11 - empty block;
@@ -313,6 +313,13 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain)
 	// clear trace
 	iso14a_clear_tracelen();
   iso14a_set_tracing(false);
+
+	receivedAnswer = mifare_get_bigbufptr();
+	if (!receivedAnswer) {
+		ack.arg[0] = 1; // isEOF = 1, nothing found
+		UsbSendPacket((uint8_t *)&ack, sizeof(UsbCommand));
+		return;
+	}
 	
 	iso14443a_setup();
 
@@ -675,28 +682,28 @@ void MifareECardLoad(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datai
 				if (MF_DBGLEVEL >= 1)	Dbprintf("Read block 0 error");
 				break;
 			};
-			emlSetMem(dataoutbuf, sectorNo * 4 + 0, 1);
+			if (emlSetMem(dataoutbuf, sectorNo * 4 + 0, 1)) break;
 			
 			if(mifare_classic_readblock(pcs, cuid, sectorNo * 4 + 1, dataoutbuf)) {
 				if (MF_DBGLEVEL >= 1)	Dbprintf("Read block 1 error");
 				break;
 			};
-			emlSetMem(dataoutbuf, sectorNo * 4 + 1, 1);
+			if (emlSetMem(dataoutbuf, sectorNo * 4 + 1, 1)) break;
 
 			if(mifare_classic_readblock(pcs, cuid, sectorNo * 4 + 2, dataoutbuf)) {
 				if (MF_DBGLEVEL >= 1)	Dbprintf("Read block 2 error");
 				break;
 			};
-			emlSetMem(dataoutbuf, sectorNo * 4 + 2, 1);
+			if (emlSetMem(dataoutbuf, sectorNo * 4 + 2, 1)) break;
 
 			// get block 3 bytes 6-9
 			if(mifare_classic_readblock(pcs, cuid, sectorNo * 4 + 3, dataoutbuf)) {
 				if (MF_DBGLEVEL >= 1)	Dbprintf("Read block 3 error");
 				break;
 			};
-			emlGetMem(dataoutbuf2, sectorNo * 4 + 3, 1);
+			if (emlGetMem(dataoutbuf2, sectorNo * 4 + 3, 1)) break;
 			memcpy(&dataoutbuf2[6], &dataoutbuf[6], 4);
-			emlSetMem(dataoutbuf2,  sectorNo * 4 + 3, 1);
+			if (emlSetMem(dataoutbuf2,  sectorNo * 4 + 3, 1)) break;
 		}
 
 		if(mifare_classic_halt(pcs, cuid)) {
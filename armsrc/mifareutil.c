@@ -20,18 +20,19 @@
 
 int MF_DBGLEVEL = MF_DBG_ALL;
 
-// memory management
+// memory management, see bigbuf.h
 uint8_t* mifare_get_bigbufptr(void) {
-	return (((uint8_t *)BigBuf) + MIFARE_BUFF_OFFSET);	// was 3560 - tied to other size changes
+	return BigBufAlloc(BB_MIFARE, MIFARE_BUFF_SIZE);
 }
 uint8_t* eml_get_bigbufptr_sendbuf(void) {
-	return (((uint8_t *)BigBuf) + RECV_CMD_OFFSET);	
+	return BigBufAlloc(BB_MIFARE_SEND, MIFARE_BUFF_SIZE);
 }
 uint8_t* eml_get_bigbufptr_recbuf(void) {
-	return (((uint8_t *)BigBuf) + MIFARE_BUFF_OFFSET);
+	return BigBufAlloc(BB_MIFARE, MIFARE_BUFF_SIZE);
 }
+// the emulator memory is kept at the top of BigBuf from boot on, see bigbuf.h
 uint8_t* eml_get_bigbufptr_cardmem(void) {
-	return (((uint8_t *)BigBuf) + CARD_MEMORY);
+	return BigBufAlloc(BB_EML, CARD_MEMORY_LEN);
 }
 
 // crypto1 helpers
@@ -147,6 +148,7 @@ int mifare_classic_authex(struct Crypto1State *pcs, uint32_t uid, uint8_t blockN
 	
 	uint8_t mf_nr_ar[] = { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
 	uint8_t* receivedAnswer = mifare_get_bigbufptr();
+	if (!receivedAnswer) return 1;
 
 	// Transmit MIFARE_CLASSIC_AUTH
 	len = mifare_sendcmd_short(pcs, isNested, 0x60 + (keyType & 0x01), blockNo, receivedAnswer);
@@ -232,6 +234,7 @@ int mifare_classic_readblock(struct Crypto1State *pcs, uint32_t uid, uint8_t blo
 	uint8_t	bt[2];
 	
 	uint8_t* receivedAnswer = mifare_get_bigbufptr();
+	if (!receivedAnswer) return 1;
 	
 	// command MIFARE_CLASSIC_READBLOCK
 	len = mifare_sendcmd_short(pcs, 1, 0x30, blockNo, receivedAnswer);
@@ -265,6 +268,7 @@ int mifare_classic_writeblock(struct Crypto1State *pcs, uint32_t uid, uint8_t bl
 	
 	uint8_t d_block[18], d_block_enc[18];
 	uint8_t* receivedAnswer = mifare_get_bigbufptr();
+	if (!receivedAnswer) return 1;
 	
 	// command MIFARE_CLASSIC_WRITEBLOCK
 	len = mifare_sendcmd_short(pcs, 1, 0xA0, blockNo, receivedAnswer);
@@ -309,6 +313,7 @@ int mifare_classic_halt(struct Crypto1State *pcs, uint32_t uid)
 	
 	// Mifare HALT
 	uint8_t* receivedAnswer = mifare_get_bigbufptr();
+	if (!receivedAnswer) return 1;
 
 	len = mifare_sendcmd_short(pcs, 1, 0x50, 0x00, receivedAnswer);
 	if (len != 0) {
@@ -320,28 +325,53 @@ int mifare_classic_halt(struct Crypto1State *pcs, uint32_t uid)
 }
 
 // work with emulator memory
-void emlSetMem(uint8_t *data, int blockNum, int blocksCount) {
+// byteCount bytes of it from bytePtr on; NULL, and says why, if they are not
+// all there
+static uint8_t* emlRange(int bytePtr, int byteCount) {
 	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
+
+	if (!emCARD) return NULL;
+	if (bytePtr < 0 || byteCount < 0 || bytePtr + byteCount > CARD_MEMORY_LEN) {
+		Dbprintf("Emulator memory: %d bytes at %d out of range", byteCount, bytePtr);
+		return NULL;
+	}
+	return emCARD + bytePtr;
+}
+
+int emlSetMem(uint8_t *data, int blockNum, int blocksCount) {
+	uint8_t* mem = emlRange(blockNum * 16, blocksCount * 16);
 	
-	memcpy(emCARD + blockNum * 16, data, blocksCount * 16);
+	if (!mem) return 1;
+	memcpy(mem, data, blocksCount * 16);
+	return 0;
 }
 
-void emlGetMem(uint8_t *data, int blockNum, int blocksCount) {
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
+int emlGetMem(uint8_t *data, int blockNum, int blocksCount) {
+	uint8_t* mem = emlRange(blockNum * 16, blocksCount * 16);
 	
-	memcpy(data, emCARD + blockNum * 16, blocksCount * 16);
+	if (!mem) {
+		memset(data, 0, blocksCount * 16);
+		return 1;
+	}
+	memcpy(data, mem, blocksCount * 16);
+	return 0;
 }
 
-void emlGetMemBt(uint8_t *data, int bytePtr, int byteCount) {
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
+int emlGetMemBt(uint8_t *data, int bytePtr, int byteCount) {
+	uint8_t* mem = emlRange(bytePtr, byteCount);
 	
-	memcpy(data, emCARD + bytePtr, byteCount);
+	if (!mem) {
+		memset(data, 0, byteCount);
+		return 1;
+	}
+	memcpy(data, mem, byteCount);
+	return 0;
 }
 
 int emlCheckValBl(int blockNum) {
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
-	uint8_t* data = emCARD + blockNum * 16;
+	uint8_t* data = emlRange(blockNum * 16, 16);
 
+	if (!data) return 1;
 	if ((data[0] != (data[4] ^ 0xff)) || (data[0] != data[8]) ||
 			(data[1] != (data[5] ^ 0xff)) || (data[1] != data[9]) ||
 			(data[2] != (data[6] ^ 0xff)) || (data[2] != data[10]) ||
@@ -354,10 +384,9 @@ int emlCheckValBl(int blockNum) {
 }
 
 int emlGetValBl(uint32_t *blReg, uint8_t *blBlock, int blockNum) {
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
-	uint8_t* data = emCARD + blockNum * 16;
+	uint8_t* data = emlRange(blockNum * 16, 16);
 	
-	if (emlCheckValBl(blockNum)) {
+	if (!data || emlCheckValBl(blockNum)) {
 		return 1;
 	}
 	
@@ -368,9 +397,9 @@ int emlGetValBl(uint32_t *blReg, uint8_t *blBlock, int blockNum) {
 }
 
 int emlSetValBl(uint32_t blReg, uint8_t blBlock, int blockNum) {
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
-	uint8_t* data = emCARD + blockNum * 16;
+	uint8_t* data = emlRange(blockNum * 16, 16);
 	
+	if (!data) return 1;
 	memcpy(data + 0, &blReg, 4);
 	memcpy(data + 8, &blReg, 4);
 	blReg = blReg ^ 0xffffffff;
@@ -385,19 +414,20 @@ int emlSetValBl(uint32_t blReg, uint8_t blBlock, int blockNum) {
 }
 
 uint64_t emlGetKey(int sectorNum, int keyType) {
-	uint8_t key[6];
-	uint8_t* emCARD = eml_get_bigbufptr_cardmem();
+	uint8_t* key = emlRange(3 * 16 + sectorNum * 4 * 16 + keyType * 10, 6);
 	
-	memcpy(key, emCARD + 3 * 16 + sectorNum * 4 * 16 + keyType * 10, 6);
+	if (!key) return 0;
 	return bytes_to_num(key, 6);
 }
 
-void emlClearMem(void) {
+int emlClearMem(void) {
 	int i;
 	
 	const uint8_t trailer[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07, 0x80, 0x69, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 	const uint8_t empty[] =   {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 	const uint8_t uid[]   =   {0xe6, 0x84, 0x87, 0xf3, 0x16, 0x88, 0x04, 0x00, 0x46, 0x8e, 0x45, 0x55, 0x4d, 0x70, 0x41, 0x04};
+
+	if (!emlRange(0, CARD_MEMORY_LEN)) return 1;
 	// fill sectors data
 	for(i = 0; i < 16; i++) {
 		emlSetMem((uint8_t *)empty,   i * 4 + 0, 1);
@@ -407,6 +437,5 @@ void emlClearMem(void) {
 	}
 
 	// uid
-	emlSetMem((uint8_t *)uid, 0, 1);
-	return;
+	return emlSetMem((uint8_t *)uid, 0, 1);
 }
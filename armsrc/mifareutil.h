@@ -81,12 +81,15 @@ uint8_t mf_crypto1_encrypt4bit(struct Crypto1State *pcs, uint8_t data);
 uint8_t* mifare_get_bigbufptr(void);
 uint8_t* eml_get_bigbufptr_sendbuf(void);
 uint8_t* eml_get_bigbufptr_recbuf(void);
+uint8_t* eml_get_bigbufptr_cardmem(void);
 
 // emulator functions
-void emlClearMem(void);
-void emlSetMem(uint8_t *data, int blockNum, int blocksCount);
-void emlGetMem(uint8_t *data, int blockNum, int blocksCount);
-void emlGetMemBt(uint8_t *data, int bytePtr, int byteCount);
+// those returning int return 1 if the memory is not there or the blocks
+// are out of range
+int emlClearMem(void);
+int emlSetMem(uint8_t *data, int blockNum, int blocksCount);
+int emlGetMem(uint8_t *data, int blockNum, int blocksCount);
+int emlGetMemBt(uint8_t *data, int bytePtr, int byteCount);
 uint64_t emlGetKey(int sectorNum, int keyType);
 int emlGetValBl(uint32_t *blReg, uint8_t *blBlock, int blockNum);
 int emlSetValBl(uint32_t blReg, uint8_t blBlock, int blockNum);
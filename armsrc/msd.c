@@ -1,14 +1,13 @@
 #include "proxmark3.h"
 #include "apps.h"
+#include "util.h"
 #include "msd.h"
+#include "sdcache.h"
 
 unsigned char ver2_card = FALSE;  //!< Flag to indicate version 2.0 SD card
 unsigned char sdhc_card = FALSE;  //!< Flag to indicate version SDHC card
 unsigned int sd_numsectors; //!< Total number of sectors on card
-unsigned char sd_sectorbuffer[512];   //!< buffer to hold one sector of card
 
-// TODO fix timeouts
-unsigned int timeval = 0;
 /**
  * Return SD card present status.
  *
@@ -90,10 +89,10 @@ void sd_send_dummys(void)
  */
 unsigned char sd_get_response(void)
 {
-	unsigned int tmout = timeval + 1000;    // 1 second timeout
+	unsigned int tmout = GetTickCount() + 1000;    // 1 second timeout
     unsigned char b = 0xff;
 
-    while ((b == 0xff) && (timeval < tmout))
+    while ((b == 0xff) && (GetTickCount() < tmout))
     {
         b = spi_com(SPI_MSD_MODE,0xff,0);
     }
@@ -109,10 +108,10 @@ unsigned char sd_get_response(void)
  */
 unsigned char sd_get_datatoken(void)
 {
-	unsigned int tmout = timeval + 1000;    // 1 second timeout
+	unsigned int tmout = GetTickCount() + 1000;    // 1 second timeout
     unsigned char b = 0xff;
 
-    while ((b != SD_STARTBLOCK_READ) && (timeval < tmout))
+    while ((b != SD_STARTBLOCK_READ) && (GetTickCount() < tmout))
     {
         b = spi_com(SPI_MSD_MODE,0xff,0);
     }
@@ -412,7 +411,7 @@ unsigned int sd_info(void)
         l <<= 8;
         l |= spi_com(SPI_MSD_MODE,0xff,0);
 
-        l &= 0x0000ffff; // mask c_size field
+        l &= 0x003fffff; // mask c_size field
 
         unsigned int byte_size = ((l+1) * 524288L);
 
@@ -420,7 +419,7 @@ unsigned int sd_info(void)
         Dbprintf("card size %d, %d", byte_size , ((l+1)>>1));
 
         sd_send_dummys();
-        sd_numsectors = (byte_size / 512)-1;
+        sd_numsectors = (l+1) << 10;    // C_SIZE counts 512K units
 
         return byte_size;
     }
@@ -433,31 +432,47 @@ unsigned int sd_info(void)
 }
 
 /**
- * Read SD sector.
+ * Wait for the card
  *
- * Read a single 512 byte sector from the SD card
- * \param   lba         Logical sectornumber to read from
- * \param   buffer      Pointer to buffer for received data
- * \param   fCallback   Callback function name
- * \param   pArgument   Callback argument
- * \return 0 on success, -1 on error
+ * The card holds its data out line low while it is busy programming
+ * \return SD_OK, or SD_ERROR on timeout
+ *
+ */
+static char sd_wait_ready(void)
+{
+    unsigned int tmout = GetTickCount() + 1000;    // 1 second timeout
+
+    while (spi_com(SPI_MSD_MODE,0xff,0) != 0xff)
+    {
+        if (GetTickCount() > tmout)
+            return SD_ERROR;
+    }
+    return SD_OK;
+}
+
+/**
+ * Read SD sectors.
+ *
+ * Read count consecutive 512 byte sectors from the SD card. More than one
+ * goes out as a single CMD18 (READ_MULTIPLE_BLOCK), so the card streams
+ * them back to back instead of seeing a command and access time for each.
+ * \param   lba         Logical sectornumber to start reading from
+ * \param   buffer      Pointer to buffer for count * 512 bytes of data
+ * \param   count       Number of sectors to read
+ * \return 0 on success, SD_ERROR on error
  *
 */
-char sd_readsector(unsigned int lba,
-		unsigned char *buffer,
-                     void *pArgument)
+char sd_readsectors(unsigned int lba, unsigned char *buffer, unsigned int count)
 {
+    char res = SD_OK;
+    unsigned char multi = (count > 1);
 
-	Dbprintf("SDrd %d", lba);
+    SpiBegin(SPI_MSD_MODE);
 
-    if(sdhc_card)
-    	 // on new High Capacity cards, the lba is sent
-    	sd_command(SD_READ_SINGLE_BLOCK,lba);
-    else
-    	sd_command(SD_READ_SINGLE_BLOCK,lba<<9);
-    	// send read command and logical sector address
-    	// the address sent to the card is the BYTE address
-    	// so the lba needs to be multiplied by 512
+    // on new High Capacity cards, the lba is sent, on the others the
+    // BYTE address, so the lba needs to be multiplied by 512
+    sd_command(multi ? SD_READ_MULTI_BLOCK : SD_READ_SINGLE_BLOCK,
+               sdhc_card ? lba : lba<<9);
 
     if (sd_get_response() != 0) // if no valid token
     {
@@ -465,28 +480,60 @@ char sd_readsector(unsigned int lba,
         return SD_ERROR;   // return error code
     }
 
-    if (sd_get_datatoken() != SD_STARTBLOCK_READ) // if no valid token
+    while (count--)
     {
-        sd_send_dummys(); // cleanup and
-        return SD_ERROR;   // return error code
-    }
+        if (sd_get_datatoken() != SD_STARTBLOCK_READ) // if no valid token
+        {
+            res = SD_ERROR;
+            break;
+        }
 
-    for (unsigned int i=0; i<512 ; i++)             // read sector data
-        *buffer++ = spi_com(SPI_MSD_MODE,0xff,0);
+        SpiTransfer(NULL, buffer, 512);    // read sector data, clocking out 0xff
+        buffer += 512;
 
-    spi_com(SPI_MSD_MODE,0xff,0);    // ignore dummy checksum
-    spi_com(SPI_MSD_MODE,0xff,0);    // ignore dummy checksum
+        spi_com(SPI_MSD_MODE,0xff,0);    // ignore dummy checksum
+        spi_com(SPI_MSD_MODE,0xff,0);    // ignore dummy checksum
+    }
+
+    if (multi)
+    {
+        sd_command(SD_STOP_MULTI_TRANS,0);
+        spi_com(SPI_MSD_MODE,0xff,0);    // stuff byte after CMD12
+        if (sd_get_response() != 0)
+            res = SD_ERROR;
+        if (sd_wait_ready() != SD_OK)
+            res = SD_ERROR;
+    }
 
     sd_send_dummys();     // cleanup
 
-    return SD_OK;                       // return success
+    return res;
+}
+
+/**
+ * Read SD sector.
+ *
+ * Read a single 512 byte sector from the SD card
+ * \param   lba         Logical sectornumber to read from
+ * \param   buffer      Pointer to buffer for received data
+ * \param   pArgument   Callback argument
+ * \return 0 on success, -1 on error
+ *
+*/
+char sd_readsector(unsigned int lba,
+		unsigned char *buffer,
+                     void *pArgument)
+{
+    return sd_readsectors(lba, buffer, 1);
 }
 
 
 /**
  * Read part of a SD sector.
  *
- * Read part of a single 512 byte sector from the SD card
+ * Read part of a single 512 byte sector from the SD card. Goes through
+ * the sector cache, so a run of small reads from one sector only reads
+ * it from the card once.
  * \param  block   Logical sectornumber to read from
  * \param  loffset Offset to first byte we should read
  * \param  nbytes  Number of bytes to read
@@ -496,40 +543,33 @@ char sd_readsector(unsigned int lba,
 */
 unsigned char sd_read_n(unsigned int block,unsigned int loffset, unsigned int nbytes, unsigned char * buffer)
 {
-    sd_readsector(block,sd_sectorbuffer, 0);
-    memcpy(buffer,&sd_sectorbuffer[loffset],nbytes);
-    return 0;
+    return sd_cache_read_part(block, loffset, nbytes, buffer) == SD_OK;
 }
 
 
 /**
- * Write SD sector.
+ * Write SD sectors.
  *
- * Write a single 512 byte sector to the SD card
+ * Write count consecutive 512 byte sectors to the SD card, with a single
+ * CMD25 (WRITE_MULTIPLE_BLOCK) when there is more than one, so the card
+ * can program them as one stream.
  *
- * \param   lba         Logical sectornumber to write to
- * \param   buffer      Pointer to buffer with data to send
- * \param   fCallback   Callback function name
- * \param   pArgument   Callback argument
- * \return 0 on success, -1 on error
+ * \param   lba         Logical sectornumber to start writing to
+ * \param   buffer      Pointer to count * 512 bytes of data to send
+ * \param   count       Number of sectors to write
+ * \return 0 on success, SD_ERROR on error
 */
-char sd_writesector(unsigned int lba,
-		unsigned char *buffer,
-                      void *pArgument)
+char sd_writesectors(unsigned int lba, const unsigned char *buffer, unsigned int count)
 {
-	unsigned int i;
-    unsigned int tmout;
+    char res = SD_OK;
+    unsigned char multi = (count > 1);
 
-    Dbprintf("SDwr %d", lba);
+    SpiBegin(SPI_MSD_MODE);
 
-    if(sdhc_card)
-    	 // on new High Capacity cards, the lba is sent
-    	sd_command(SD_WRITE_BLOCK,lba);
-    else
-    	sd_command(SD_WRITE_BLOCK,lba<<9);
-    	// send read command and logical sector address
-    	// the address sent to the card is the BYTE address
-    	// so the lba needs to be multiplied by 512
+    // on new High Capacity cards, the lba is sent, on the others the
+    // BYTE address, so the lba needs to be multiplied by 512
+    sd_command(multi ? SD_WRITE_MULTI_BLOCK : SD_WRITE_BLOCK,
+               sdhc_card ? lba : lba<<9);
 
     if (sd_get_response() != 0) // if no valid token
     {
@@ -537,44 +577,57 @@ char sd_writesector(unsigned int lba,
         return SD_ERROR;   // return error code
     }
 
-    spi_com(SPI_MSD_MODE,0xfe,0);    // send data token
-
-    for (i=0;i<512;i++)             // write sector data
+    while (count--)
     {
-    	spi_com(SPI_MSD_MODE,*buffer++,0);
-    }
+        // send data token
+        spi_com(SPI_MSD_MODE,multi ? SD_STARTBLOCK_MWRITE : SD_STARTBLOCK_WRITE,0);
 
-    spi_com(SPI_MSD_MODE,0xff,0);    // send dummy checksum
-    spi_com(SPI_MSD_MODE,0xff,0);    // send dummy checksum
+        SpiWrite(buffer, 512);          // write sector data
+        buffer += 512;
 
-    if ( (sd_get_response()&0x0F) != 0x05) // if no valid token
-    {
-        sd_send_dummys(); // cleanup and
-        return SD_ERROR;   // return error code
-    }
+        spi_com(SPI_MSD_MODE,0xff,0);    // send dummy checksum, once the data is out
+        spi_com(SPI_MSD_MODE,0xff,0);    // send dummy checksum
 
-    //
-    // wait while the card is busy
-    // writing the data
-    //
-    tmout = timeval + 1000;
-
-    // wait for the SO pin to go high
-    while (1)
-    {
-    	unsigned char b = spi_com(SPI_MSD_MODE,0xff,0);
-
-        if (b == 0xff) break;   // check SO high
+        if ((sd_get_response()&0x0F) != 0x05) // if data not accepted
+        {
+            res = SD_ERROR;
+            break;
+        }
 
-        if (timeval > tmout)    // if timeout
+        // wait while the card is busy writing the data
+        if (sd_wait_ready() != SD_OK)
         {
-            sd_send_dummys();   // cleanup and
-            return SD_ERROR;    // return failure
+            res = SD_ERROR;
+            break;
         }
+    }
 
+    if (multi)
+    {
+        spi_com(SPI_MSD_MODE,SD_STOPTRAN_MWRITE,0);
+        spi_com(SPI_MSD_MODE,0xff,0);    // one byte before the card goes busy
+        if (sd_wait_ready() != SD_OK)
+            res = SD_ERROR;
     }
+
     sd_send_dummys(); // cleanup
 
-    return SD_OK;   // return success
+    return res;
 }
 
+/**
+ * Write SD sector.
+ *
+ * Write a single 512 byte sector to the SD card
+ *
+ * \param   lba         Logical sectornumber to write to
+ * \param   buffer      Pointer to buffer with data to send
+ * \param   pArgument   Callback argument
+ * \return 0 on success, -1 on error
+*/
+char sd_writesector(unsigned int lba,
+		unsigned char *buffer,
+                      void *pArgument)
+{
+    return sd_writesectors(lba, buffer, 1);
+}
@@ -45,6 +45,7 @@
 #define SD_STARTBLOCK_READ          0xFE    //!< data token single block read
 #define SD_STARTBLOCK_WRITE         0xFE    //!< data token single block write
 #define SD_STARTBLOCK_MWRITE        0xFC    //!< data token multi block write
+#define SD_STOPTRAN_MWRITE          0xFD    //!< stop token multi block write
 
 // SD function return codes
 enum {
@@ -58,10 +59,14 @@ enum {
     SD_E_INIT           //!< Card init error
 };
 
+extern unsigned int sd_numsectors;
+
 unsigned char sd_card_detect(void);
 char sd_init(void);
 unsigned int sd_info(void);
 char sd_readsector(unsigned int lba, unsigned char *buffer, void *pArgument);
 unsigned char sd_read_n(unsigned int block,unsigned int loffset, unsigned int nbytes, unsigned char * buffer);
 char sd_writesector(unsigned int lba, unsigned char *buffer, void *pArgument);
+char sd_readsectors(unsigned int lba, unsigned char *buffer, unsigned int count);
+char sd_writesectors(unsigned int lba, const unsigned char *buffer, unsigned int count);
 #endif /*SDCARD_H_*/
@@ -0,0 +1,286 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Sector cache between FatFs and the microSD driver, see sdcache.h
+//-----------------------------------------------------------------------------
+
+#include "proxmark3.h"
+#include "apps.h"
+#include "msd.h"
+#include "sdcache.h"
+
+typedef struct {
+    unsigned int lba;
+    unsigned int used;          //!< LRU stamp, 0 for an empty line
+    unsigned char dirty;        //!< newer than the card
+    unsigned char ahead;        //!< read ahead and not asked for yet
+} sd_cache_line_t;
+
+static sd_cache_line_t lines[SD_CACHE_SECTORS];
+static unsigned char data[SD_CACHE_SECTORS][512] __attribute__((aligned(4)));
+static unsigned int stamp;
+static unsigned int lastRead = 0xffffffff;  //!< previous single sector read
+
+sd_cache_stats_t sd_cache_stats = { SD_CACHE_SECTORS };
+
+static int sd_cache_find(unsigned int lba)
+{
+    int i;
+
+    for (i = 0; i < SD_CACHE_SECTORS; i++)
+        if (lines[i].used && lines[i].lba == lba)
+            return i;
+    return -1;
+}
+
+static void sd_cache_touch(int i)
+{
+    lines[i].used = ++stamp;
+}
+
+static char sd_cache_writeback(int i)
+{
+    if (!lines[i].used || !lines[i].dirty)
+        return SD_OK;
+    if (sd_writesectors(lines[i].lba, data[i], 1) != SD_OK)
+        return SD_ERROR;
+    lines[i].dirty = 0;
+    sd_cache_stats.writebacks++;
+    return SD_OK;
+}
+
+/**
+ * Make room for n sectors in adjacent lines.
+ *
+ * Picks the run whose most recently used line is the oldest, and writes
+ * back what is dirty in it.
+ * \return index of the first line, -1 if a write back failed
+ */
+static int sd_cache_evict(int n)
+{
+    int i, j, best = 0;
+    unsigned int newest, bestNewest = 0xffffffff;
+
+    for (i = 0; i + n <= SD_CACHE_SECTORS; i++)
+    {
+        newest = 0;
+        for (j = i; j < i + n; j++)
+            if (lines[j].used > newest)
+                newest = lines[j].used;
+        if (newest < bestNewest)
+        {
+            bestNewest = newest;
+            best = i;
+        }
+    }
+
+    for (j = best; j < best + n; j++)
+    {
+        if (sd_cache_writeback(j) != SD_OK)
+            return -1;
+        lines[j].used = 0;
+        lines[j].ahead = 0;
+    }
+    return best;
+}
+
+/**
+ * Bring one sector into the cache.
+ *
+ * When the sector follows the previous one read, the ones after it (up to
+ * SD_CACHE_READAHEAD, and only as long as they are not cached already)
+ * come along in the same multiple block read.
+ * \return line index, -1 on error
+ */
+static int sd_cache_load(unsigned int lba)
+{
+    int i, n = 1, first;
+
+    if (lba == lastRead + 1)
+    {
+        while (n < SD_CACHE_READAHEAD && lba + n < sd_numsectors
+               && sd_cache_find(lba + n) < 0)
+            n++;
+    }
+
+    first = sd_cache_evict(n);
+    if (first < 0)
+        return -1;
+    if (sd_readsectors(lba, data[first], n) != SD_OK)
+        return -1;
+
+    for (i = 0; i < n; i++)
+    {
+        lines[first + i].lba = lba + i;
+        lines[first + i].dirty = 0;
+        lines[first + i].ahead = (i > 0);
+        sd_cache_touch(first + i);
+    }
+    sd_cache_stats.ahead += n - 1;
+    return first;
+}
+
+/**
+ * Look a sector up, loading it on a miss.
+ *
+ * \return line index, -1 on error
+ */
+static int sd_cache_get(unsigned int lba)
+{
+    int i = sd_cache_find(lba);
+
+    if (i >= 0)
+    {
+        sd_cache_stats.hits++;
+        if (lines[i].ahead)
+        {
+            lines[i].ahead = 0;
+            sd_cache_stats.ahead_hits++;
+        }
+    }
+    else
+    {
+        sd_cache_stats.misses++;
+        i = sd_cache_load(lba);
+        if (i < 0)
+            return -1;
+    }
+    sd_cache_touch(i);
+    lastRead = lba;
+    return i;
+}
+
+/**
+ * Read sectors through the cache.
+ *
+ * \param   lba         Logical sectornumber to start reading from
+ * \param   buffer      Pointer to buffer for count * 512 bytes of data
+ * \param   count       Number of sectors to read
+ * \return 0 on success, SD_ERROR on error
+ */
+char sd_cache_read(unsigned int lba, unsigned char *buffer, unsigned int count)
+{
+    int i;
+
+    if (count == 1)
+    {
+        i = sd_cache_get(lba);
+        if (i < 0)
+            return SD_ERROR;
+        memcpy(buffer, data[i], 512);
+        return SD_OK;
+    }
+
+    if (sd_readsectors(lba, buffer, count) != SD_OK)
+        return SD_ERROR;
+    sd_cache_stats.direct_reads += count;
+
+    // what the cache holds is at least as new as the card
+    for (i = 0; i < SD_CACHE_SECTORS; i++)
+        if (lines[i].used && lines[i].dirty && lines[i].lba - lba < count)
+            memcpy(buffer + (lines[i].lba - lba) * 512, data[i], 512);
+    return SD_OK;
+}
+
+/**
+ * Read part of a sector through the cache.
+ *
+ * \param   lba         Logical sectornumber to read from
+ * \param   offset      Offset of the first byte to read
+ * \param   nbytes      Number of bytes to read, offset + nbytes <= 512
+ * \param   buffer      Pointer to buffer for received data
+ * \return 0 on success, SD_ERROR on error
+ */
+char sd_cache_read_part(unsigned int lba, unsigned int offset, unsigned int nbytes, unsigned char *buffer)
+{
+    int i;
+
+    if (offset + nbytes > 512)
+        return SD_ERROR;
+    i = sd_cache_get(lba);
+    if (i < 0)
+        return SD_ERROR;
+    memcpy(buffer, data[i] + offset, nbytes);
+    return SD_OK;
+}
+
+/**
+ * Write sectors through the cache.
+ *
+ * A single sector stays in the cache until it is evicted or synced.
+ * \param   lba         Logical sectornumber to start writing to
+ * \param   buffer      Pointer to count * 512 bytes of data to send
+ * \param   count       Number of sectors to write
+ * \return 0 on success, SD_ERROR on error
+ */
+char sd_cache_write(unsigned int lba, const unsigned char *buffer, unsigned int count)
+{
+    int i;
+
+    if (count == 1)
+    {
+        i = sd_cache_find(lba);
+        if (i < 0)
+        {
+            i = sd_cache_evict(1);
+            if (i < 0)
+                return SD_ERROR;
+            lines[i].lba = lba;
+            lines[i].ahead = 0;
+        }
+        memcpy(data[i], buffer, 512);
+        lines[i].dirty = 1;
+        sd_cache_touch(i);
+        sd_cache_stats.writes++;
+        return SD_OK;
+    }
+
+    if (sd_writesectors(lba, buffer, count) != SD_OK)
+        return SD_ERROR;
+    sd_cache_stats.direct_writes += count;
+
+    // the card has the newest data now, keep the cached copies in line
+    for (i = 0; i < SD_CACHE_SECTORS; i++)
+    {
+        if (lines[i].used && lines[i].lba - lba < count)
+        {
+            memcpy(data[i], buffer + (lines[i].lba - lba) * 512, 512);
+            lines[i].dirty = 0;
+        }
+    }
+    return SD_OK;
+}
+
+char sd_cache_sync(void)
+{
+    char res = SD_OK;
+    int i;
+
+    sd_cache_stats.syncs++;
+    for (i = 0; i < SD_CACHE_SECTORS; i++)
+        if (sd_cache_writeback(i) != SD_OK)
+            res = SD_ERROR;
+    return res;
+}
+
+void sd_cache_invalidate(void)
+{
+    memset(lines, 0, sizeof(lines));
+    lastRead = 0xffffffff;
+}
+
+void sd_cache_stats_send(int reset)
+{
+    UsbCommand ack = {CMD_ACK, {sizeof(sd_cache_stats), 0, 0}};
+
+    memcpy(ack.d.asBytes, &sd_cache_stats, sizeof(sd_cache_stats));
+    UsbSendPacket((uint8_t *)&ack, sizeof(UsbCommand));
+
+    if (reset)
+    {
+        memset(&sd_cache_stats, 0, sizeof(sd_cache_stats));
+        sd_cache_stats.lines = SD_CACHE_SECTORS;
+    }
+}
@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Sector cache between FatFs (diskio.c) and the microSD driver (msd.c).
+//
+// FatFs keeps only one sector of metadata in its window, so walking a FAT
+// chain next to a directory, or updating both FAT copies, keeps trading
+// sectors with the card. The cache holds a few sectors, LRU, and keeps
+// single sector writes until they are evicted or FatFs syncs (f_sync,
+// f_close). A miss right after the previous sector fetches the next ones
+// with the same CMD18. Multi sector transfers (file data, within a
+// cluster) go straight to the card; the cached copies of what they cover
+// are kept coherent.
+//-----------------------------------------------------------------------------
+
+#ifndef __SDCACHE_H
+#define __SDCACHE_H
+
+#include "sd_cache_stats.h"
+
+// Sectors held; each costs 512 bytes of RAM
+#define SD_CACHE_SECTORS	4
+// Sectors fetched by a sequential miss, the missed one included
+#define SD_CACHE_READAHEAD	2
+
+extern sd_cache_stats_t sd_cache_stats;
+
+// Same results as sd_readsectors() / sd_writesectors()
+char sd_cache_read(unsigned int lba, unsigned char *buffer, unsigned int count);
+char sd_cache_write(unsigned int lba, const unsigned char *buffer, unsigned int count);
+
+// nbytes from offset into sector lba, without a sector buffer of one's own
+char sd_cache_read_part(unsigned int lba, unsigned int offset, unsigned int nbytes, unsigned char *buffer);
+
+// Write out every dirty sector
+char sd_cache_sync(void);
+
+// Forget everything, dirty or not: the card was (re)initialized
+void sd_cache_invalidate(void);
+
+// Answer CMD_SD_CACHE_STATS; clears the counters if reset is set
+void sd_cache_stats_send(int reset);
+
+#endif /* __SDCACHE_H */
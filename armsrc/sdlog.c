@@ -0,0 +1,187 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Standalone capture logging to the microSD card, see sdlog.h
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include "proxmark3.h"
+#include "string.h"
+#include "printf.h"
+#include "ff.h"
+#include "sdlog.h"
+
+// Bytes that go to the card per f_write(). Two sectors: a whole number of
+// them at a sector aligned file offset goes to the card straight from our
+// buffer (as one multiple block write inside a cluster), without FatFs
+// copying it through its own sector buffer.
+#define SDLOG_CHUNK		1024
+// One sample is at most "-128\n"; formatting stops after crossing the chunk
+// end, and what spilled over becomes the start of the next chunk
+#define SDLOG_SPILL		8
+
+static FATFS fs;
+static FIL fil;
+// TAGS.TXT, which may be written to while a log is running
+static FIL tags;
+static char name[13];
+static int nextNum;
+
+static uint8_t buf[SDLOG_CHUNK + SDLOG_SPILL];
+static int fill;
+
+static const uint8_t *src;
+static int srcLen, srcPos, srcText;
+static void (*srcDone)(void);
+static int running;
+
+// (Re)mount every time, the card may have been swapped since the last log;
+// FatFs only initializes the card on the first access after a mount.
+static int SdLogOpen(const char *prefix, const char *ext)
+{
+	FRESULT res;
+	int i, n;
+
+	f_mount(0, &fs);
+	for(i = 0; i < 1000; i++) {
+		n = (nextNum + i) % 1000;
+		sprintf(name, "%s%03d.%s", prefix, n, ext);
+		res = f_open(&fil, name, FA_WRITE | FA_CREATE_NEW);
+		if(res == FR_OK) {
+			nextNum = n + 1;
+			return TRUE;
+		}
+		if(res != FR_EXIST) break;
+	}
+	name[0] = '\0';
+	return FALSE;
+}
+
+static int SdLogStart(const char *prefix, const char *ext, const uint8_t *data, int len,
+	int text, void (*done)(void))
+{
+	SdLogFlush();
+	if(!SdLogOpen(prefix, ext)) return FALSE;
+
+	src = data;
+	srcLen = len;
+	srcPos = 0;
+	srcText = text;
+	srcDone = done;
+	fill = 0;
+	running = TRUE;
+	return TRUE;
+}
+
+int SdLogSamples(const uint8_t *samples, int len, void (*done)(void))
+{
+	return SdLogStart("LF", "TXT", samples, len, TRUE, done);
+}
+
+int SdLogTrace(const uint8_t *trace, int len, void (*done)(void))
+{
+	return SdLogStart("HF", "TRC", trace, len, FALSE, done);
+}
+
+// Samples as `data samples' has them, (int)b - 128, one per line
+static void SdLogFormat(void)
+{
+	uint8_t *p = buf + fill;
+	int v;
+
+	while(p < buf + SDLOG_CHUNK && srcPos < srcLen) {
+		v = src[srcPos++] - 128;
+		if(v < 0) {
+			*p++ = '-';
+			v = -v;
+		}
+		if(v >= 100) {
+			*p++ = '1';
+			v -= 100;
+			*p++ = '0' + v / 10;
+		} else if(v >= 10) {
+			*p++ = '0' + v / 10;
+		}
+		*p++ = '0' + v % 10;
+		*p++ = '\n';
+	}
+	fill = p - buf;
+}
+
+static void SdLogCopy(void)
+{
+	int n = SDLOG_CHUNK - fill;
+
+	if(n > srcLen - srcPos) n = srcLen - srcPos;
+	memcpy(buf + fill, src + srcPos, n);
+	srcPos += n;
+	fill += n;
+}
+
+static void SdLogEnd(void)
+{
+	void (*done)(void) = srcDone;
+
+	running = FALSE;
+	srcDone = NULL;
+	if(done) done();
+}
+
+int SdLogPoll(void)
+{
+	UINT n, wr;
+	FRESULT res;
+
+	if(!running) return FALSE;
+
+	if(srcText)
+		SdLogFormat();
+	else
+		SdLogCopy();
+
+	n = fill < SDLOG_CHUNK ? fill : SDLOG_CHUNK;
+	res = f_write(&fil, buf, n, &wr);
+	if(res != FR_OK || wr != n) {
+		f_close(&fil);
+		SdLogEnd();
+		return FALSE;
+	}
+	fill -= n;
+	memcpy(buf, buf + n, fill);
+
+	if(srcPos < srcLen || fill > 0) return TRUE;
+
+	f_close(&fil);
+	SdLogEnd();
+	return FALSE;
+}
+
+void SdLogFlush(void)
+{
+	while(SdLogPoll())
+		WDT_HIT();
+}
+
+int SdLogTagId(const char *line)
+{
+	UINT wr;
+	int len = strlen(line);
+
+	// a remount would invalidate the running log's file
+	if(!running) f_mount(0, &fs);
+	if(f_open(&tags, "TAGS.TXT", FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return FALSE;
+	if(f_lseek(&tags, tags.fsize) != FR_OK
+		|| f_write(&tags, line, len, &wr) != FR_OK || wr != len
+		|| f_write(&tags, "\n", 1, &wr) != FR_OK || wr != 1) {
+		f_close(&tags);
+		return FALSE;
+	}
+	return f_close(&tags) == FR_OK;
+}
+
+const char *SdLogName(void)
+{
+	return name;
+}
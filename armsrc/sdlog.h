@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Standalone capture logging to the microSD card.
+//
+// Each capture goes to a file of its own on the card, named after the first
+// free number: LFnnn.TXT for LF samples, one decimal value per line the way
+// `data load' reads them (and `data samples' shows them), HFnnn.TRC for a
+// 14443A trace in the BigBuf layout `hf 14a list <file>' reads. Tag IDs that
+// were read are appended to TAGS.TXT, one line each.
+//
+// Samples are turned into file data in the background: SdLogPoll(),
+// called from the main loop, formats (or copies) up to two sectors' worth
+// into a buffer and writes it to the card, one chunk per call. The write
+// waits for the card, so a call takes a few ms. The capture buffer must
+// stay untouched until done() is called.
+//-----------------------------------------------------------------------------
+
+#ifndef __SDLOG_H
+#define __SDLOG_H
+
+#include <stdint.h>
+
+// Start logging len LF samples (ADC bytes, 128 is the zero line) to a new
+// LFnnn.TXT. Returns FALSE, without calling done, if there is no card or
+// the file can not be created.
+int SdLogSamples(const uint8_t *samples, int len, void (*done)(void));
+
+// Same for a 14443A trace, stored as it is in HFnnn.TRC
+int SdLogTrace(const uint8_t *trace, int len, void (*done)(void));
+
+// Append a line to TAGS.TXT; a running log carries on
+int SdLogTagId(const char *line);
+
+// Do the next step of the running log. Returns TRUE while there is more.
+int SdLogPoll(void);
+
+// Block until the running log (if any) is on the card
+void SdLogFlush(void);
+
+// Name of the file the last log went to
+const char *SdLogName(void);
+
+#endif /* __SDLOG_H */
@@ -0,0 +1,64 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Timing statistics of the DMA driven snoop loops, read back with `hw stats'
+//-----------------------------------------------------------------------------
+
+#include "proxmark3.h"
+#include "apps.h"
+#include "util.h"
+#include "snoopstats.h"
+
+snoop_stats_t snoop_stats;
+
+static uint32_t startTick;
+
+void SnoopStatsStart(uint32_t cmd, int dmaSize, int step)
+{
+	memset(&snoop_stats, 0, sizeof(snoop_stats));
+	snoop_stats.cmd = cmd;
+	snoop_stats.flags = SNOOP_STATS_RUNNING;
+	snoop_stats.dma_size = dmaSize;
+	snoop_stats.step = step;
+
+	// TC0 is what the loop cost is measured on
+	StartCountUS();
+	startTick = GetTickCount();
+}
+
+void SnoopStatsStop(int maxBehindBy)
+{
+	snoop_stats.elapsed_ms = GetTickCount() - startTick;
+	snoop_stats.max_behind = maxBehindBy;
+	snoop_stats.flags &= ~SNOOP_STATS_RUNNING;
+}
+
+// DMA ring size for a snoop: what the client asked for, rounded down to a
+// power of two within SNOOP_DMA_MIN..SNOOP_DMA_MAX, or the mode's default
+int SnoopDmaSize(int requested, int dflt)
+{
+	int size = SNOOP_DMA_MAX;
+
+	if(requested <= 0) return dflt;
+	while(size > SNOOP_DMA_MIN && size > requested)
+		size >>= 1;
+	return size;
+}
+
+// The block is bigger than one packet, so the client asks for it 48 bytes
+// at a time, the same way it fetches BigBuf.
+void SnoopStatsSend(uint32_t offset)
+{
+	UsbCommand ack = {CMD_ACK, {offset, sizeof(snoop_stats), 0}};
+	int len = 0;
+
+	if(offset < sizeof(snoop_stats)) {
+		len = sizeof(snoop_stats) - offset;
+		if(len > sizeof(ack.d.asBytes)) len = sizeof(ack.d.asBytes);
+		memcpy(ack.d.asBytes, ((uint8_t *)&snoop_stats) + offset, len);
+	}
+
+	UsbSendPacket((uint8_t *)&ack, sizeof(UsbCommand));
+}
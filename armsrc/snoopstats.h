@@ -0,0 +1,82 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Per-iteration instrumentation of the DMA driven snoop loops. The hooks
+// are inline and only touch a static block and TC0, so they cost a few
+// cycles out of the ~226 we have per sample at 48 MHz.
+//-----------------------------------------------------------------------------
+
+#ifndef __SNOOPSTATS_H
+#define __SNOOPSTATS_H
+
+#include "proxmark3.h"
+#include "snoop_stats.h"
+
+extern snoop_stats_t snoop_stats;
+
+void SnoopStatsStart(uint32_t cmd, int dmaSize, int step);
+void SnoopStatsStop(int maxBehindBy);
+void SnoopStatsSend(uint32_t offset);
+int SnoopDmaSize(int requested, int dflt);
+
+// Least trace a snoop keeps when the client asks for a big DMA ring
+#define SNOOP_TRACE_MIN			1024
+
+// TC0 free runs from 0 to 0xBFFF, and TC1 counts its periods (see
+// StartCountUS); together they wrap after 0x10000 * 0xC000 ticks, ~36 min
+#define SNOOP_STATS_TC0_TOP		0xC000
+#define SNOOP_STATS_TICKS_TOP	(0x10000u * SNOOP_STATS_TC0_TOP)
+
+// TC0 ticks on 32 bits. TC1 is read again after TC0, in case TC0 wrapped
+// in between.
+static inline uint32_t SnoopStatsTicks(void)
+{
+	uint32_t hi, lo;
+
+	do {
+		hi = AT91C_BASE_TC1->TC_CV;
+		lo = AT91C_BASE_TC0->TC_CV;
+	} while(hi != AT91C_BASE_TC1->TC_CV);
+	return hi * SNOOP_STATS_TC0_TOP + lo;
+}
+
+// The loop found nothing new in the DMA ring
+static inline void SnoopStatsIdle(void)
+{
+	snoop_stats.idle++;
+}
+
+// The loop is about to decode; behindBy is how far it lags the DMA.
+// Returns the start mark for SnoopStatsEnd().
+static inline uint32_t SnoopStatsBegin(int behindBy)
+{
+	int b = 0;
+
+	while(behindBy > 1 && b < SNOOP_STATS_BUCKETS-1) {
+		behindBy >>= 1;
+		b++;
+	}
+	snoop_stats.hist[b]++;
+
+	return SnoopStatsTicks();
+}
+
+static inline void SnoopStatsEnd(uint32_t mark)
+{
+	uint32_t now = SnoopStatsTicks();
+	uint32_t cost = now - mark;
+
+	if(now < mark) cost += SNOOP_STATS_TICKS_TOP;
+	snoop_stats.busy_ticks += cost;
+	if(cost > snoop_stats.max_cost) snoop_stats.max_cost = cost;
+	snoop_stats.iterations++;
+}
+
+static inline void SnoopStatsFrame(void)
+{
+	snoop_stats.frames++;
+}
+
+#endif /* __SNOOPSTATS_H */
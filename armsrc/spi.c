@@ -1,6 +1,14 @@
 #include <proxmark3.h>
 #include "apps.h"
 
+// Channel SetupSpi() last put the controller in, so that transfers on the
+// same channel don't redo the PIO/PMC/mode setup for every word
+static int spiChannel = -1;
+// Channel runs more than 8 bits per transfer, so the PDC moves halfwords
+static int spiWide;
+// A SpiWrite() block may still be going out
+static int spiTxBusy;
+
 //-----------------------------------------------------------------------------
 // Set up the Serial Peripheral Interface as master
 // Used to talk to the attached peripherals (FPGA, LCD, uSD)
@@ -92,8 +100,141 @@ void SetupSpi(int mode)
 			break;
 		default:						// Disable SPI
 			AT91C_BASE_SPI->SPI_CR = AT91C_SPI_SPIDIS;
+			mode = -1;
 			break;
 	}
+
+	spiChannel = mode;
+	spiWide = (mode == SPI_FPGA_MODE || mode == SPI_LCD_MODE);
+}
+
+//-----------------------------------------------------------------------------
+// SPI sessions. SpiBegin() selects a channel, after which any number of
+// single word (SpiXfer, SpiSend) and PDC block (SpiWrite, SpiTransfer)
+// transfers go out without touching the setup again; SpiEnd() returns once
+// the last of them is on the wire. Changing channels in between is fine, it
+// only costs a SetupSpi(). Block lengths are counted in transfers: bytes on
+// the 8 bit channels (microSD), halfwords on the LCD and FPGA ones.
+//-----------------------------------------------------------------------------
+void SpiBegin(int channel)
+{
+	SpiWait();
+
+	// appmain resets the controller and LCDGetId() disables it, neither
+	// goes through SetupSpi()
+	if (channel != spiChannel || !(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_SPIENS))
+		SetupSpi(channel);
+}
+
+void SpiEnd(void)
+{
+	SpiWait();
+	AT91C_BASE_SPI->SPI_CR = AT91C_SPI_SPIEN | AT91C_SPI_LASTXFER;
+}
+
+// Wait for SpiWrite() blocks to finish, and drop what came in meanwhile
+void SpiWait(void)
+{
+	volatile uint32_t r;
+
+	if (!spiTxBusy) return;
+
+	while (AT91C_BASE_PDC_SPI->PDC_TCR || AT91C_BASE_PDC_SPI->PDC_TNCR);
+	while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY));
+	AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_TXTDIS;
+
+	r = AT91C_BASE_SPI->SPI_RDR;		// clears RDRF
+	r = AT91C_BASE_SPI->SPI_SR;		// clears OVRES
+	(void)r;
+	spiTxBusy = 0;
+}
+
+// One word out and one back
+unsigned int SpiXfer(unsigned int dout)
+{
+	volatile uint32_t r;
+
+	SpiWait();
+
+	// A SpiSend() may still be shifting out; its answer must not be
+	// taken for ours
+	while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY));
+	if (AT91C_BASE_SPI->SPI_SR & AT91C_SPI_RDRF) {
+		r = AT91C_BASE_SPI->SPI_RDR;
+		(void)r;
+	}
+
+	AT91C_BASE_SPI->SPI_TDR = dout;
+	while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_RDRF));
+	return AT91C_BASE_SPI->SPI_RDR & 0xffff;
+}
+
+// One word out, without waiting for it to go
+void SpiSend(unsigned int dout)
+{
+	SpiWait();
+	while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY));
+	AT91C_BASE_SPI->SPI_TDR = dout;
+}
+
+// Transmit a block by PDC, ignoring what comes back. Returns as soon as the
+// PDC has started on buf, which also means it is done reading the block
+// queued before it: two buffers are enough to keep the bus busy while the
+// next one gets filled. buf itself has to stay put until the next
+// SpiWrite(), or whatever transfer follows, has returned.
+void SpiWrite(const void *buf, int n)
+{
+	if (n <= 0) return;
+
+	if (!spiTxBusy) {
+		while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY));
+		AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_TXTDIS | AT91C_PDC_RXTDIS;
+		AT91C_BASE_PDC_SPI->PDC_TPR = (uint32_t)buf;
+		AT91C_BASE_PDC_SPI->PDC_TCR = n;
+		AT91C_BASE_PDC_SPI->PDC_TNCR = 0;
+		AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_TXTEN;
+		spiTxBusy = 1;
+		return;
+	}
+
+	// Chain it behind the block in flight
+	AT91C_BASE_PDC_SPI->PDC_TNPR = (uint32_t)buf;
+	AT91C_BASE_PDC_SPI->PDC_TNCR = n;
+	while (AT91C_BASE_PDC_SPI->PDC_TNCR);
+}
+
+// Transmit and receive a block by PDC, and wait for it. With tx NULL the
+// block clocked out is all ones, the way microSD cards want to be read;
+// tx may also be the same buffer as rx.
+void SpiTransfer(const void *tx, void *rx, int n)
+{
+	volatile uint32_t r;
+
+	if (n <= 0) return;
+
+	SpiWait();
+	if (!tx) {
+		memset(rx, 0xff, spiWide ? 2*n : n);
+		tx = rx;
+	}
+
+	while (!(AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TXEMPTY));
+	if (AT91C_BASE_SPI->SPI_SR & AT91C_SPI_RDRF) {
+		r = AT91C_BASE_SPI->SPI_RDR;
+		(void)r;
+	}
+
+	AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_TXTDIS | AT91C_PDC_RXTDIS;
+	AT91C_BASE_PDC_SPI->PDC_RPR = (uint32_t)rx;
+	AT91C_BASE_PDC_SPI->PDC_RCR = n;
+	AT91C_BASE_PDC_SPI->PDC_RNCR = 0;
+	AT91C_BASE_PDC_SPI->PDC_TPR = (uint32_t)tx;
+	AT91C_BASE_PDC_SPI->PDC_TCR = n;
+	AT91C_BASE_PDC_SPI->PDC_TNCR = 0;
+	AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_RXTEN | AT91C_PDC_TXTEN;
+
+	while (AT91C_BASE_PDC_SPI->PDC_RCR);
+	AT91C_BASE_PDC_SPI->PDC_PTCR = AT91C_PDC_TXTDIS | AT91C_PDC_RXTDIS;
 }
 
 //-----------------------------------------------------------------------------
@@ -104,15 +245,9 @@ unsigned int spi_com(unsigned int channel, unsigned int dout, unsigned char last
 {
 	unsigned int din;
 
-    SetupSpi(channel);		// enable relevant channel
-
-    while ( !( AT91C_BASE_SPI->SPI_SR & AT91C_SPI_TDRE ) ); // wait for SPI ready state
-
-    AT91C_BASE_SPI->SPI_TDR = dout;	// send data
-
-    while ( !( AT91C_BASE_SPI->SPI_SR & AT91C_SPI_RDRF ) );   // wait for incoming data
+    SpiBegin(channel);		// enable relevant channel, if it isn't yet
 
-    din = AT91C_BASE_SPI->SPI_RDR ;	// receive data
+    din = SpiXfer(dout);
 
     if (last) AT91C_BASE_SPI->SPI_CR = AT91C_SPI_SPIEN | AT91C_SPI_LASTXFER;
 
@@ -0,0 +1,122 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Background sends on the USB IN endpoint, see usbstream.h
+//-----------------------------------------------------------------------------
+
+#include "proxmark3.h"
+#include "apps.h"
+#include "usbstream.h"
+
+// A UsbCommand is the 16 byte header followed by 48 bytes of payload
+#define STREAM_HDR_LEN		16
+#define STREAM_CHUNK_LEN	48
+#define STREAM_PKT_LEN		(STREAM_HDR_LEN + STREAM_CHUNK_LEN)
+
+static struct {
+	int active;
+	int inFlight;			// a packet is in the FIFO, waiting for TXCOMP
+	const uint8_t *data;
+	int len;
+	int sent;				// payload bytes of the chunks before this one
+	int pos;				// position within the current UsbCommand
+	uint32_t hdr[4];		// cmd, arg[0..2] of the current UsbCommand
+	uint32_t id;			// goes in the top half of arg[1]
+	void (*done)(void);
+} stream;
+
+static void NextChunk(void)
+{
+	int chunk = stream.len - stream.sent;
+
+	if(chunk > STREAM_CHUNK_LEN) chunk = STREAM_CHUNK_LEN;
+	stream.hdr[2] = chunk | stream.id;
+	stream.pos = 0;
+}
+
+int UsbStreamStart(uint32_t cmd, uint32_t start, const uint8_t *data, int len, uint16_t id,
+	void (*done)(void))
+{
+	if(stream.active) return FALSE;
+
+	stream.id = (uint32_t)id << 16;
+	stream.data = data;
+	stream.len = len;
+	stream.sent = 0;
+	stream.hdr[0] = cmd;
+	stream.hdr[1] = start;
+	stream.hdr[3] = len;
+	stream.done = done;
+	stream.inFlight = FALSE;
+	NextChunk();
+	stream.active = TRUE;
+	UsbSendFlushHook = UsbStreamFlush;
+
+	// The command handler that started us returns to the main loop, which
+	// polls; get the first packet going now anyway
+	UsbStreamPoll();
+	return TRUE;
+}
+
+int UsbStreamPoll(void)
+{
+	const uint8_t *payload;
+	int i, chunk;
+
+	if(!stream.active) return FALSE;
+
+	if(stream.inFlight) {
+		if(!(AT91C_BASE_UDP->UDP_CSR[2] & AT91C_UDP_TXCOMP))
+			return TRUE;
+		AT91C_BASE_UDP->UDP_CSR[2] &= ~AT91C_UDP_TXCOMP;
+		while(AT91C_BASE_UDP->UDP_CSR[2] & AT91C_UDP_TXCOMP)
+			;
+		stream.inFlight = FALSE;
+	}
+
+	if(stream.pos == STREAM_PKT_LEN) {
+		stream.sent += stream.hdr[2] & 0xffff;
+		stream.hdr[1] += stream.hdr[2] & 0xffff;
+		if(stream.sent >= stream.len) {
+			stream.active = FALSE;
+			UsbSendFlushHook = NULL;
+			if(stream.done) stream.done();
+			return FALSE;
+		}
+		NextChunk();
+	}
+
+	// Eight bytes of the UsbCommand: header words, then the payload read
+	// in place, zero padded after the end of the last chunk
+	payload = stream.data + stream.sent;
+	chunk = stream.hdr[2] & 0xffff;
+	for(i = 0; i < 8; i++, stream.pos++) {
+		if(stream.pos < STREAM_HDR_LEN)
+			AT91C_BASE_UDP->UDP_FDR[2] = ((uint8_t *)stream.hdr)[stream.pos];
+		else if(stream.pos - STREAM_HDR_LEN < chunk)
+			AT91C_BASE_UDP->UDP_FDR[2] = payload[stream.pos - STREAM_HDR_LEN];
+		else
+			AT91C_BASE_UDP->UDP_FDR[2] = 0;
+	}
+	AT91C_BASE_UDP->UDP_CSR[2] |= AT91C_UDP_TXPKTRDY;
+	stream.inFlight = TRUE;
+
+	return TRUE;
+}
+
+void UsbStreamFlush(void)
+{
+	while(UsbStreamPoll())
+		WDT_HIT();
+}
+
+void UsbStreamCancel(void)
+{
+	// the UsbCommand that is partly out has to be completed, or the host
+	// would take the next one's bytes for the rest of it
+	if(stream.active)
+		stream.len = stream.sent + (stream.hdr[2] & 0xffff);
+	UsbStreamFlush();
+}
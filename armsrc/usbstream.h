@@ -0,0 +1,41 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Background sends on the USB IN endpoint, straight out of a buffer.
+//
+// UsbSendPacket() busy-waits for every 8 byte packet, i.e. a millisecond
+// per packet at our polling interval, and needs the data copied into a
+// UsbCommand first. A stream instead builds the UsbCommand framing on the
+// fly around the caller's buffer and is moved along by UsbStreamPoll(),
+// which only ever loads the FIFO when the endpoint is free and returns
+// right away otherwise. The main loop polls it; so can a long running mode
+// that wants to keep working while a buffer drains.
+//-----------------------------------------------------------------------------
+
+#ifndef __USBSTREAM_H
+#define __USBSTREAM_H
+
+#include <stdint.h>
+
+// Send len bytes from data as a train of UsbCommands {cmd, {offset of the
+// chunk, bytes in it | id << 16, len}, up to 48 bytes}, offset counting
+// from start; id lets the host tell this stream from one it gave up on.
+// The buffer must stay untouched until done() is called (from
+// UsbStreamPoll(), done may be NULL). Returns FALSE if a stream is already
+// running.
+int UsbStreamStart(uint32_t cmd, uint32_t start, const uint8_t *data, int len, uint16_t id,
+	void (*done)(void));
+
+// Load the next packet if the endpoint is free. Returns TRUE while the
+// stream is still going.
+int UsbStreamPoll(void);
+
+// Block until the current stream (if any) is out
+void UsbStreamFlush(void);
+
+// End the current stream (if any) after the UsbCommand that is going out
+void UsbStreamCancel(void);
+
+#endif /* __USBSTREAM_H */
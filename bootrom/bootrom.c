@@ -7,11 +7,20 @@
 //-----------------------------------------------------------------------------
 
 #include <proxmark3.h>
+#include "crc32.h"
 
 struct common_area common_area __attribute__((section(".commonarea")));
 unsigned int start_addr, end_addr, bootrom_unlocked;
 extern char _bootrom_start, _bootrom_end, _flash_start, _flash_end;
 
+/* Page being streamed in with CMD_STREAM_WRITE. It is collected in RAM and
+ * only copied to the write buffer of the flash controller once complete, so
+ * the next page comes in over USB while this one is being programmed.
+ */
+static uint32_t stream_page[AT91C_IFLASH_PAGE_SIZE/4];
+static unsigned int stream_addr, stream_fill, stream_busy_addr;
+static unsigned int stream_status, stream_error_addr;
+
 static void ConfigClocks(void)
 {
     // we are using a 16 MHz crystal as the basis for everything
@@ -78,6 +87,127 @@ static void Fatal(void)
     for(;;);
 }
 
+/* Wait for the flash controller to finish, return its status. The error bits
+ * are cleared by reading the status, so this is the only chance to see them.
+ */
+static uint32_t flash_wait(void)
+{
+    uint32_t sr;
+
+    while(!((sr = AT91C_BASE_EFC0->EFC_FSR) & AT91C_MC_FRDY))
+        ;
+    return sr;
+}
+
+static void stream_fail(unsigned int err, unsigned int addr)
+{
+    if(!stream_status) stream_error_addr = addr;
+    stream_status |= err;
+}
+
+static void stream_program(void)
+{
+    volatile uint32_t *p = (volatile uint32_t *)&_flash_start;
+    int i;
+
+    /* The previous page has to be done before the write buffer is touched */
+    if(flash_wait() & (AT91C_MC_LOCKE | AT91C_MC_PROGE))
+        stream_fail(STREAM_WRITE_ERR_FLASH, stream_busy_addr);
+
+    if(stream_addr < start_addr || stream_addr + AT91C_IFLASH_PAGE_SIZE > end_addr) {
+        stream_fail(STREAM_WRITE_ERR_RANGE, stream_addr);
+        return;
+    }
+
+    for(i = 0; i < AT91C_IFLASH_PAGE_SIZE/4; i++) {
+        p[i] = stream_page[i];
+    }
+    AT91C_BASE_EFC0->EFC_FCR = MC_FLASH_COMMAND_KEY |
+        MC_FLASH_COMMAND_PAGEN((stream_addr-(int)&_flash_start)/AT91C_IFLASH_PAGE_SIZE) |
+        AT91C_MC_FCMD_START_PROG;
+    stream_busy_addr = stream_addr;
+}
+
+static void stream_word(unsigned int addr, uint32_t w)
+{
+    if(stream_fill && addr != stream_addr + stream_fill) {
+        stream_fail(STREAM_WRITE_ERR_ORDER, stream_addr);
+        stream_fill = 0;
+    }
+    if(!stream_fill) {
+        if(addr & (AT91C_IFLASH_PAGE_SIZE-1)) {
+            stream_fail(STREAM_WRITE_ERR_ORDER, addr);
+            return;
+        }
+        stream_addr = addr;
+    }
+
+    stream_page[stream_fill/4] = w;
+    stream_fill += 4;
+    if(stream_fill == AT91C_IFLASH_PAGE_SIZE) {
+        stream_program();
+        stream_fill = 0;
+    }
+}
+
+/* Let the last streamed page finish before anybody looks at the flash */
+static void stream_sync(void)
+{
+    if(stream_fill) {
+        stream_fail(STREAM_WRITE_ERR_ORDER, stream_addr);
+        stream_fill = 0;
+    }
+    if(flash_wait() & (AT91C_MC_LOCKE | AT91C_MC_PROGE))
+        stream_fail(STREAM_WRITE_ERR_FLASH, stream_busy_addr);
+}
+
+static void flash_crc32(UsbCommand *c)
+{
+    unsigned int start = c->arg[0], length = c->arg[1];
+    int i, n;
+
+    stream_sync();
+
+    if(start < (unsigned int)&_flash_start || start > (unsigned int)&_flash_end ||
+        length > (unsigned int)&_flash_end - start) {
+        c->cmd = CMD_NACK;
+        UsbSendPacket((uint8_t *)c, sizeof(*c));
+        return;
+    }
+
+    if(!(c->arg[2] & FLASH_CRC32_PAGES)) {
+        c->cmd = CMD_ACK;
+        c->arg[0] = update_crc32(0, (const uint8_t *)start, length);
+        c->arg[1] = stream_status;
+        c->arg[2] = stream_error_addr;
+        stream_status = stream_error_addr = 0;
+        UsbSendPacket((uint8_t *)c, sizeof(*c));
+        return;
+    }
+
+    if((start | length) & (AT91C_IFLASH_PAGE_SIZE-1)) {
+        c->cmd = CMD_NACK;
+        UsbSendPacket((uint8_t *)c, sizeof(*c));
+        return;
+    }
+
+    while(length) {
+        c->cmd = CMD_ACK;
+        c->arg[0] = start;
+        for(n = 0; n < 12 && length; n++) {
+            c->d.asDwords[n] = update_crc32(0, (const uint8_t *)start, AT91C_IFLASH_PAGE_SIZE);
+            start += AT91C_IFLASH_PAGE_SIZE;
+            length -= AT91C_IFLASH_PAGE_SIZE;
+        }
+        for(i = n; i < 12; i++) {
+            c->d.asDwords[i] = 0;
+        }
+        c->arg[1] = n;
+        c->arg[2] = 0;
+        UsbSendPacket((uint8_t *)c, sizeof(*c));
+    }
+}
+
 void UsbPacketReceived(uint8_t *packet, int len)
 {
     int i, dont_ack=0;
@@ -93,7 +223,7 @@ void UsbPacketReceived(uint8_t *packet, int len)
             dont_ack = 1;
             c->cmd = CMD_DEVICE_INFO;
             c->arg[0] = DEVICE_INFO_FLAG_BOOTROM_PRESENT | DEVICE_INFO_FLAG_CURRENT_MODE_BOOTROM |
-                DEVICE_INFO_FLAG_UNDERSTANDS_START_FLASH;
+                DEVICE_INFO_FLAG_UNDERSTANDS_START_FLASH | DEVICE_INFO_FLAG_UNDERSTANDS_STREAM_WRITE;
             if(common_area.flags.osimage_present) c->arg[0] |= DEVICE_INFO_FLAG_OSIMAGE_PRESENT;
             UsbSendPacket(packet, len);
             break;
@@ -138,7 +268,21 @@ void UsbPacketReceived(uint8_t *packet, int len)
             }
             break;
 
+        case CMD_STREAM_WRITE:
+            dont_ack = 1;
+            for(i = 0; i < c->arg[1]/4 && i < 12; i++) {
+                stream_word(c->arg[0] + 4*i, c->d.asDwords[i]);
+            }
+            break;
+
+        case CMD_FLASH_CRC32:
+            dont_ack = 1;
+            flash_crc32(c);
+            break;
+
         case CMD_HARDWARE_RESET:
+            /* Do not cut a streamed page short */
+            flash_wait();
             USB_D_PLUS_PULLUP_OFF();
             AT91C_BASE_RSTC->RSTC_RCR = RST_CONTROL_KEY | AT91C_RSTC_PROCRST;
             break;
@@ -146,6 +290,7 @@ void UsbPacketReceived(uint8_t *packet, int len)
         case CMD_START_FLASH:
             if(c->arg[2] == START_FLASH_MAGIC) bootrom_unlocked = 1;
             else bootrom_unlocked = 0;
+            stream_fill = stream_status = 0;
             {
                 int prot_start = (int)&_bootrom_start;
                 int prot_end = (int)&_bootrom_end;
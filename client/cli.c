@@ -12,10 +12,7 @@
 #include "proxusb.h"
 #include "cmdmain.h"
 
-#define HANDLE_ERROR if (error_occured) { \
-  error_occured = 0;\
-  break;\
-}
+#define HANDLE_ERROR if (ProxmarkError()) break;
 
 int main(int argc, char **argv)
 {
@@ -34,7 +31,7 @@ int main(int argc, char **argv)
   else
     SetLogFilename("cli.log");
 
-  return_on_error = 1;
+  ProxmarkReturnOnError(true);
 
   while (1) {
     while (!OpenProxmark(0)) { sleep(1); }
@@ -19,6 +19,7 @@
 #include "cmdparser.h"
 #include "cmdmain.h"
 #include "cmddata.h"
+#include "manchester.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -153,20 +154,15 @@ int CmdAutoCorr(const char *Cmd)
 int CmdBitsamples(const char *Cmd)
 {
   int cnt = 0;
-  int n = 3072;
+  uint8_t got[12288];
+  int n = GetFromBigBuf(got, sizeof(got), 0);
 
-  for (int i = 0; i < n; i += 12) {
-    UsbCommand c = {CMD_DOWNLOAD_RAW_ADC_SAMPLES_125K, {i, 0, 0}};
-    SendCommand(&c);
-    WaitForResponse(CMD_DOWNLOADED_RAW_ADC_SAMPLES_125K);
-
-    for (int j = 0; j < 48; j++) {
-      for (int k = 0; k < 8; k++) {
-        if(sample_buf[j] & (1 << (7 - k))) {
-          GraphBuffer[cnt++] = 1;
-        } else {
-          GraphBuffer[cnt++] = 0;
-        }
+  for (int j = 0; j < n; j++) {
+    for (int k = 0; k < 8; k++) {
+      if(got[j] & (1 << (7 - k))) {
+        GraphBuffer[cnt++] = 1;
+      } else {
+        GraphBuffer[cnt++] = 0;
       }
     }
   }
@@ -470,16 +466,13 @@ int CmdSamples(const char *Cmd)
   if (n > 16000) n = 16000;
 
   PrintAndLog("Reading %d samples\n", n);
-  for (int i = 0; i < n; i += 12) {
-    UsbCommand c = {CMD_DOWNLOAD_RAW_ADC_SAMPLES_125K, {i, 0, 0}};
-    SendCommand(&c);
-    WaitForResponse(CMD_DOWNLOADED_RAW_ADC_SAMPLES_125K);
-    for (int j = 0; j < 48; j++) {
-      GraphBuffer[cnt++] = ((int)sample_buf[j]) - 128;
-    }
+  uint8_t got[n*4];
+  n = GetFromBigBuf(got, sizeof(got), 0);
+  for (cnt = 0; cnt < n; cnt++) {
+    GraphBuffer[cnt] = ((int)got[cnt]) - 128;
   }
   PrintAndLog("Done!\n");
-  GraphTraceLen = n*4;
+  GraphTraceLen = n;
   RepaintGraphWindow();
   return 0;
 }
@@ -494,7 +487,7 @@ int CmdLoad(const char *Cmd)
 
   GraphTraceLen = 0;
   char line[80];
-  while (fgets(line, sizeof (line), f)) {
+  while (GraphTraceLen < MAX_GRAPH_TRACE_LEN && fgets(line, sizeof (line), f)) {
     GraphBuffer[GraphTraceLen] = atoi(line);
     GraphTraceLen++;
   }
@@ -531,196 +524,57 @@ int CmdLtrim(const char *Cmd)
  */
 int CmdManchesterDemod(const char *Cmd)
 {
-  int i, j, invert= 0;
-  int bit;
-  int clock;
-  int lastval = 0;
-  int low = 0;
-  int high = 0;
-  int hithigh, hitlow, first;
-  int lc = 0;
-  int bitidx = 0;
-  int bit2idx = 0;
-  int warnings = 0;
-
-  /* check if we're inverting output */
-  if (*Cmd == 'i')
-  {
-    PrintAndLog("Inverting output");
-    invert = 1;
-    ++Cmd;
-    do
-      ++Cmd;
-    while(*Cmd == ' '); // in case a 2nd argument was given
-  }
-
-  /* Holds the decoded bitstream: each clock period contains 2 bits       */
-  /* later simplified to 1 bit after manchester decoding.                 */
-  /* Add 10 bits to allow for noisy / uncertain traces without aborting   */
-  /* int BitStream[GraphTraceLen*2/clock+10]; */
-
-  /* But it does not work if compiling on WIndows: therefore we just allocate a */
-  /* large array */
-  uint8_t BitStream[MAX_GRAPH_TRACE_LEN];
-
-  /* Detect high and lows */
-  for (i = 0; i < GraphTraceLen; i++)
-  {
-    if (GraphBuffer[i] > high)
-      high = GraphBuffer[i];
-    else if (GraphBuffer[i] < low)
-      low = GraphBuffer[i];
-  }
-
-  /* Get our clock */
-  clock = GetClock(Cmd, high, 1);
-
-  int tolerance = clock/4;
-
-  /* Detect first transition */
-  /* Lo-Hi (arbitrary)       */
-  /* skip to the first high */
-  for (i= 0; i < GraphTraceLen; i++)
-    if (GraphBuffer[i] == high)
-      break;
-  /* now look for the first low */
-  for (; i < GraphTraceLen; i++)
-  {
-    if (GraphBuffer[i] == low)
-    {
-      lastval = i;
+  static uint32_t levels[MAN_WORDS(MAX_GRAPH_TRACE_LEN)];
+  static uint32_t bits[MAN_WORDS(MAX_GRAPH_TRACE_LEN)];
+  int i, j, n, clock = 0, invert = 0, encoding = MAN_MANCHESTER;
+  man_stats_t st;
+  char line[16 * 2 + 1];
+
+  /* options: invert the output, biphase instead of Manchester */
+  for (;;) {
+    while (*Cmd == ' ') ++Cmd;
+    if (*Cmd == 'i') {
+      PrintAndLog("Inverting output");
+      invert = 1;
+    } else if (*Cmd == 'b') {
+      encoding = MAN_BIPHASE;
+    } else {
       break;
     }
+    ++Cmd;
   }
+  sscanf(Cmd, "%i", &clock);
 
-  /* If we're not working with 1/0s, demod based off clock */
-  if (high != 1)
-  {
-    bit = 0; /* We assume the 1st bit is zero, it may not be
-              * the case: this routine (I think) has an init problem.
-              * Ed.
-              */
-    for (; i < (int)(GraphTraceLen / clock); i++)
-    {
-      hithigh = 0;
-      hitlow = 0;
-      first = 1;
-
-      /* Find out if we hit both high and low peaks */
-      for (j = 0; j < clock; j++)
-      {
-        if (GraphBuffer[(i * clock) + j] == high)
-          hithigh = 1;
-        else if (GraphBuffer[(i * clock) + j] == low)
-          hitlow = 1;
-
-        /* it doesn't count if it's the first part of our read
-           because it's really just trailing from the last sequence */
-        if (first && (hithigh || hitlow))
-          hithigh = hitlow = 0;
-        else
-          first = 0;
-
-        if (hithigh && hitlow)
-          break;
-      }
-
-      /* If we didn't hit both high and low peaks, we had a bit transition */
-      if (!hithigh || !hitlow)
-        bit ^= 1;
-
-      BitStream[bit2idx++] = bit ^ invert;
+  /* Slice the graph into levels, then get our clock from the runs between
+   * them unless we were given one */
+  ManLevels(GraphBuffer, GraphTraceLen, levels);
+  if (clock <= 0) {
+    clock = ManClock(levels, GraphTraceLen, &st);
+    if (!clock) {
+      PrintAndLog("Error: no clock found, the stream is probably not Manchester encoded.");
+      return 0;
     }
+    PrintAndLog("Auto-detected clock rate: %d", clock);
   }
 
-  /* standard 1/0 bitstream */
-  else
-  {
-
-    /* Then detect duration between 2 successive transitions */
-    for (bitidx = 1; i < GraphTraceLen; i++)
-    {
-      if (GraphBuffer[i-1] != GraphBuffer[i])
-      {
-      lc = i-lastval;
-      lastval = i;
-
-      // Error check: if bitidx becomes too large, we do not
-      // have a Manchester encoded bitstream or the clock is really
-      // wrong!
-      if (bitidx > (GraphTraceLen*2/clock+8) ) {
-        PrintAndLog("Error: the clock you gave is probably wrong, aborting.");
-        return 0;
-      }
-      // Then switch depending on lc length:
-      // Tolerance is 1/4 of clock rate (arbitrary)
-      if (abs(lc-clock/2) < tolerance) {
-        // Short pulse : either "1" or "0"
-        BitStream[bitidx++]=GraphBuffer[i-1];
-      } else if (abs(lc-clock) < tolerance) {
-        // Long pulse: either "11" or "00"
-        BitStream[bitidx++]=GraphBuffer[i-1];
-        BitStream[bitidx++]=GraphBuffer[i-1];
-      } else {
-        // Error
-          warnings++;
-        PrintAndLog("Warning: Manchester decode error for pulse width detection.");
-        PrintAndLog("(too many of those messages mean either the stream is not Manchester encoded, or clock is wrong)");
-
-          if (warnings > 10)
-          {
-            PrintAndLog("Error: too many detection errors, aborting.");
-            return 0;
-          }
-        }
-      }
-    }
-
-    // At this stage, we now have a bitstream of "01" ("1") or "10" ("0"), parse it into final decoded bitstream
-    // Actually, we overwrite BitStream with the new decoded bitstream, we just need to be careful
-    // to stop output at the final bitidx2 value, not bitidx
-    for (i = 0; i < bitidx; i += 2) {
-      if ((BitStream[i] == 0) && (BitStream[i+1] == 1)) {
-        BitStream[bit2idx++] = 1 ^ invert;
-    } else if ((BitStream[i] == 1) && (BitStream[i+1] == 0)) {
-      BitStream[bit2idx++] = 0 ^ invert;
-    } else {
-      // We cannot end up in this state, this means we are unsynchronized,
-      // move up 1 bit:
-      i++;
-        warnings++;
-      PrintAndLog("Unsynchronized, resync...");
-      PrintAndLog("(too many of those messages mean the stream is not Manchester encoded)");
-
-        if (warnings > 10)
-        {
-          PrintAndLog("Error: too many decode errors, aborting.");
-          return 0;
-        }
-      }
-    }
+  n = ManDecode(levels, GraphTraceLen, clock, encoding, bits, MAX_GRAPH_TRACE_LEN, &st);
+  PrintAndLog("%d of %d pulses within a quarter clock (jitter %d.%02d samples), %d resyncs",
+    st.fit, st.runs, st.jitter / 16, st.jitter % 16 * 100 / 16, st.errors);
+  if (st.fit < st.runs / 2) {
+    PrintAndLog("Error: the clock you gave is probably wrong, or the stream is not %s encoded, aborting.",
+      encoding == MAN_BIPHASE ? "biphase" : "Manchester");
+    return 0;
   }
 
-  PrintAndLog("Manchester decoded bitstream");
+  PrintAndLog("%s decoded bitstream", encoding == MAN_BIPHASE ? "Biphase" : "Manchester");
   // Now output the bitstream to the scrollback by line of 16 bits
-  for (i = 0; i < (bit2idx-16); i+=16) {
-    PrintAndLog("%i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i",
-      BitStream[i],
-      BitStream[i+1],
-      BitStream[i+2],
-      BitStream[i+3],
-      BitStream[i+4],
-      BitStream[i+5],
-      BitStream[i+6],
-      BitStream[i+7],
-      BitStream[i+8],
-      BitStream[i+9],
-      BitStream[i+10],
-      BitStream[i+11],
-      BitStream[i+12],
-      BitStream[i+13],
-      BitStream[i+14],
-      BitStream[i+15]);
+  for (i = 0; i + 16 <= n; i += 16) {
+    for (j = 0; j < 16; j++) {
+      line[2 * j] = '0' + (MAN_BIT(bits, i + j) ^ invert);
+      line[2 * j + 1] = ' ';
+    }
+    line[31] = 0;
+    PrintAndLog("%s", line);
   }
   return 0;
 }
@@ -871,7 +725,7 @@ static command_t CommandTable[] =
   {"hpf",           CmdHpf,             1, "Remove DC offset from trace"},
   {"load",          CmdLoad,            1, "<filename> -- Load trace (to graph window"},
   {"ltrim",         CmdLtrim,           1, "<samples> -- Trim samples from left of trace"},
-  {"mandemod",      CmdManchesterDemod, 1, "[i] [clock rate] -- Manchester demodulate binary stream (option 'i' to invert output)"},
+  {"mandemod",      CmdManchesterDemod, 1, "[i] [b] [clock rate] -- Manchester demodulate binary stream (option 'i' to invert output, 'b' for biphase)"},
   {"manmod",        CmdManchesterMod,   1, "[clock rate] -- Manchester modulate a binary stream"},
   {"norm",          CmdNorm,            1, "Normalize max/min to +/-500"},
   {"plot",          CmdPlot,            1, "Show graph window"},
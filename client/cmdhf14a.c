@@ -28,7 +28,26 @@ static int CmdHelp(const char *Cmd);
 int CmdHF14AList(const char *Cmd)
 {
   uint8_t got[1920];
-  GetFromBigBuf(got, sizeof(got));
+
+  if (*Cmd) {
+    // a trace the standalone mode logged to the microSD card (HFnnn.TRC),
+    // which ends where the recorded frames end
+    FILE *f = fopen(Cmd, "rb");
+    if (!f) {
+      PrintAndLog("couldn't open '%s'", Cmd);
+      return 0;
+    }
+    memset(got, 0x44, sizeof(got));
+    size_t n = fread(got, 1, sizeof(got), f);
+    if (ferror(f) || n < 9) {
+      PrintAndLog("couldn't read a trace from '%s'", Cmd);
+      fclose(f);
+      return 0;
+    }
+    fclose(f);
+  } else {
+    GetFromBigBuf(got, sizeof(got), 0);
+  }
 
   PrintAndLog("recorded activity:");
   PrintAndLog(" ETU     :rssi: who bytes");
@@ -222,7 +241,7 @@ int CmdHF14ASnoop(const char *Cmd)
 static command_t CommandTable[] = 
 {
   {"help",   CmdHelp,          1, "This help"},
-  {"list",   CmdHF14AList,     0, "List ISO 14443a history"},
+  {"list",   CmdHF14AList,     0, "[filename] -- List ISO 14443a history (from a trace file)"},
   {"reader", CmdHF14AReader,   0, "Act like an ISO14443 Type A reader"},
   {"sim",    CmdHF14ASim,      0, "<UID> -- Fake ISO 14443a tag"},
   {"snoop",  CmdHF14ASnoop,    0, "Eavesdrop ISO 14443 Type A"},
@@ -20,6 +20,7 @@
 #include "ui.h"
 #include "cmdparser.h"
 #include "cmdhf14b.h"
+#include "snoop_stats.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -144,7 +145,7 @@ demodError:
 int CmdHF14BList(const char *Cmd)
 {
   uint8_t got[960];
-  GetFromBigBuf(got, sizeof(got));
+  GetFromBigBuf(got, sizeof(got), 0);
 
   PrintAndLog("recorded activity:");
   PrintAndLog(" time  :rssi: who bytes");
@@ -239,7 +240,13 @@ int CmdHFSimlisten(const char *Cmd)
 
 int CmdHF14BSnoop(const char *Cmd)
 {
-  UsbCommand c = {CMD_SNOOP_ISO_14443};
+  // Optional DMA ring size, the firmware rounds it down to a power of two
+  UsbCommand c = {CMD_SNOOP_ISO_14443, {strtol(Cmd, NULL, 0), 0, 0}};
+
+  if (c.arg[0] != 0 && (c.arg[0] < SNOOP_DMA_MIN || c.arg[0] > SNOOP_DMA_MAX)) {
+    PrintAndLog("Usage: hf 14b snoop [DMA ring size, %d-%d bytes]", SNOOP_DMA_MIN, SNOOP_DMA_MAX);
+    return 0;
+  }
   SendCommand(&c);
   return 0;
 }
@@ -274,7 +281,7 @@ static command_t CommandTable[] =
   {"read",        CmdHF14BRead,   0, "Read HF tag (ISO 14443)"},
   {"sim",         CmdHF14Sim,     0, "Fake ISO 14443 tag"},
   {"simlisten",   CmdHFSimlisten, 0, "Get HF samples as fake tag"},
-  {"snoop",       CmdHF14BSnoop,  0, "Eavesdrop ISO 14443"},
+  {"snoop",       CmdHF14BSnoop,  0, "[dma size] Eavesdrop ISO 14443"},
   {"sri512read",  CmdSri512Read,  0, "<int> -- Read contents of a SRI512 tag"},
   {"srix4kread",  CmdSrix4kRead,  0, "<int> -- Read contents of a SRIX4K tag"},
   {NULL, NULL, 0, NULL}
@@ -19,13 +19,14 @@
 #include "cmdparser.h"
 #include "cmdhficlass.h"
 #include "common.h"
+#include "snoop_stats.h"
 
 static int CmdHelp(const char *Cmd);
 
 int CmdHFiClassList(const char *Cmd)
 {
   uint8_t got[1920];
-  GetFromBigBuf(got, sizeof(got));
+  GetFromBigBuf(got, sizeof(got), 0);
 
   PrintAndLog("recorded activity:");
   PrintAndLog(" ETU     :rssi: who bytes");
@@ -165,7 +166,13 @@ int CmdHFiClassList(const char *Cmd)
 
 int CmdHFiClassSnoop(const char *Cmd)
 {
-  UsbCommand c = {CMD_SNOOP_ICLASS};
+  // Optional DMA ring size, the firmware rounds it down to a power of two
+  UsbCommand c = {CMD_SNOOP_ICLASS, {strtol(Cmd, NULL, 0), 0, 0}};
+
+  if (c.arg[0] != 0 && (c.arg[0] < SNOOP_DMA_MIN || c.arg[0] > SNOOP_DMA_MAX)) {
+    PrintAndLog("Usage: hf iclass snoop [DMA ring size, %d-%d bytes]", SNOOP_DMA_MIN, SNOOP_DMA_MAX);
+    return 0;
+  }
   SendCommand(&c);
   return 0;
 }
@@ -174,7 +181,7 @@ static command_t CommandTable[] =
 {
   {"help",    CmdHelp,        1, "This help"},
   {"list",    CmdHFiClassList,   0, "List iClass history"},
-  {"snoop",   CmdHFiClassSnoop,  0, "Eavesdrop iClass communication"},
+  {"snoop",   CmdHFiClassSnoop,  0, "[dma size] Eavesdrop iClass communication"},
   {NULL, NULL, 0, NULL}
 };
 
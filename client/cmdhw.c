@@ -16,6 +16,9 @@
 #include "proxusb.h"
 #include "cmdparser.h"
 #include "cmdhw.h"
+#include "cmdmain.h"
+#include "snoop_stats.h"
+#include "sd_cache_stats.h"
 
 /* low-level hardware control */
 
@@ -111,6 +114,112 @@ int CmdSetMux(const char *Cmd)
   return 0;
 }
 
+// DMA bytes the FPGA delivers per 64/fc: one in the 14443A sniffer mode,
+// which iClass uses too, an I/Q pair from the 14443B correlator
+static int SnoopStatsBytesPer64fc(uint32_t cmd)
+{
+  return cmd == CMD_SNOOP_ISO_14443 ? 2 : 1;
+}
+
+static const char *SnoopStatsName(uint32_t cmd)
+{
+  switch (cmd) {
+    case CMD_SNOOP_ISO_14443:  return "14443B snoop";
+    case CMD_SNOOP_ISO_14443a: return "14443A snoop";
+    case CMD_SNOOP_ICLASS:     return "iClass snoop";
+    default:                   return "unknown";
+  }
+}
+
+/*
+ * Timing statistics of the last hf snoop: how much of the per-sample time
+ * budget the decoders used, and how far the loop lagged behind the DMA.
+ */
+int CmdStats(const char *Cmd)
+{
+  snoop_stats_t s;
+  uint32_t offset = 0, len;
+  UsbCommand *resp;
+
+  do {
+    UsbCommand c = {CMD_SNOOP_STATS, {offset, 0, 0}};
+    SendCommand(&c);
+    resp = WaitForResponseTimeout(CMD_ACK, 1500);
+    if (resp == NULL || resp->arg[0] != offset || resp->arg[1] != sizeof(s)) {
+      PrintAndLog("No (or incompatible) statistics from the device");
+      return 0;
+    }
+    len = sizeof(s) - offset;
+    if (len > sizeof(resp->d.asBytes)) len = sizeof(resp->d.asBytes);
+    memcpy(((uint8_t *)&s) + offset, resp->d.asBytes, len);
+    offset += len;
+  } while (offset < sizeof(s));
+
+  if (s.cmd == 0) {
+    PrintAndLog("No snoop has run since power up");
+    return 0;
+  }
+
+  int perSample = SnoopStatsBytesPer64fc(s.cmd);
+  double budget = (double)s.step / perSample * 64 * 1e6 / 13.56e6;
+  double avg = s.iterations ? (double)s.busy_ticks * SNOOP_STATS_TICK_NS / 1000 / s.iterations : 0;
+  uint32_t total = 0;
+  int i;
+
+  PrintAndLog("%s%s, %u ms, DMA ring %u bytes", SnoopStatsName(s.cmd),
+    (s.flags & SNOOP_STATS_RUNNING) ? " (still running)" : "", s.elapsed_ms, s.dma_size);
+  if (s.flags & SNOOP_STATS_BLEW)
+    PrintAndLog("  ended because it fell behind the DMA");
+  if (s.flags & SNOOP_STATS_TRACE_FULL)
+    PrintAndLog("  ended because the trace buffer filled up");
+  PrintAndLog("  samples decoded: %u (%u idle polls)", s.iterations * s.step / perSample, s.idle);
+  PrintAndLog("  frames:          %u (%.1f/s)", s.frames,
+    s.elapsed_ms ? s.frames * 1000.0 / s.elapsed_ms : 0);
+  PrintAndLog("  decode cost:     avg %.2f us, max %.2f us, budget %.2f us per iteration",
+    avg, s.max_cost * SNOOP_STATS_TICK_NS / 1000.0, budget);
+  PrintAndLog("  max behind:      %u bytes", s.max_behind);
+
+  for (i = 0; i < SNOOP_STATS_BUCKETS; i++)
+    total += s.hist[i];
+  for (i = 0; i < SNOOP_STATS_BUCKETS; i++) {
+    if (s.hist[i] == 0) continue;
+    if (i == SNOOP_STATS_BUCKETS - 1)
+      PrintAndLog("  behindBy >= %-5u %10u %5.1f%%", 1 << i, s.hist[i], 100.0 * s.hist[i] / total);
+    else
+      PrintAndLog("  behindBy %5u-%-5u %10u %5.1f%%", 1 << i, (2 << i) - 1, s.hist[i], 100.0 * s.hist[i] / total);
+  }
+  return 0;
+}
+
+/*
+ * Counters of the microSD sector cache since power up (or the last
+ * `hw sdstats reset').
+ */
+int CmdSdStats(const char *Cmd)
+{
+  UsbCommand c = {CMD_SD_CACHE_STATS, {strcmp(Cmd, "reset") == 0, 0, 0}};
+  sd_cache_stats_t s;
+  UsbCommand *resp;
+  uint32_t reads;
+
+  SendCommand(&c);
+  resp = WaitForResponseTimeout(CMD_ACK, 1500);
+  if (resp == NULL || resp->arg[0] != sizeof(s)) {
+    PrintAndLog("No (or incompatible) statistics from the device");
+    return 0;
+  }
+  memcpy(&s, resp->d.asBytes, sizeof(s));
+
+  reads = s.hits + s.misses;
+  PrintAndLog("sector cache, %u sectors", s.lines);
+  PrintAndLog("  single reads:  %u, %u hits (%.1f%%), %u misses",
+    reads, s.hits, reads ? 100.0 * s.hits / reads : 0, s.misses);
+  PrintAndLog("  read ahead:    %u sectors, %u of them used", s.ahead, s.ahead_hits);
+  PrintAndLog("  single writes: %u, %u written back, %u syncs", s.writes, s.writebacks, s.syncs);
+  PrintAndLog("  direct:        %u sectors read, %u written", s.direct_reads, s.direct_writes);
+  return 0;
+}
+
 int CmdTune(const char *Cmd)
 {
   UsbCommand c = {CMD_MEASURE_ANTENNA_TUNING};
@@ -136,6 +245,8 @@ static command_t CommandTable[] =
   {"reset",         CmdReset,       0, "Reset the Proxmark3"},
   {"setlfdivisor",  CmdSetDivisor,  0, "<19 - 255> -- Drive LF antenna at 12Mhz/(divisor+1)"},
   {"setmux",        CmdSetMux,      0, "<loraw|hiraw|lopkd|hipkd> -- Set the ADC mux to a specific value"},
+  {"sdstats",       CmdSdStats,     0, "['reset'] -- Show (and clear) the microSD sector cache counters"},
+  {"stats",         CmdStats,       0, "Show timing statistics of the last hf snoop"},
   {"tune",          CmdTune,        0, "Measure antenna tuning"},
   {"version",       CmdVersion,     0, "Show version inforation about the connected Proxmark"},
   {NULL, NULL, 0, NULL}
@@ -21,6 +21,8 @@ int CmdReadmem(const char *Cmd);
 int CmdReset(const char *Cmd);
 int CmdSetDivisor(const char *Cmd);
 int CmdSetMux(const char *Cmd);
+int CmdSdStats(const char *Cmd);
+int CmdStats(const char *Cmd);
 int CmdTune(const char *Cmd);
 int CmdVersion(const char *Cmd);
 
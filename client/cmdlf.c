@@ -23,6 +23,11 @@
 #include "cmdlfhid.h"
 #include "cmdlfti.h"
 #include "cmdlfem4x.h"
+#include "cmdlft55xx.h"
+#include "lfsamples.h"
+#include "lfsim.h"
+#include "pskdemod.h"
+#include "lfsearch.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -127,130 +132,65 @@ int CmdFlexdemod(const char *Cmd)
 
 int CmdIndalaDemod(const char *Cmd)
 {
-  // Usage: recover 64bit UID by default, specify "224" as arg to recover a 224bit UID
-
-  int state = -1;
-  int count = 0;
-  int i, j;
-  // worst case with GraphTraceLen=64000 is < 4096
-  // under normal conditions it's < 2048
-  uint8_t rawbits[4096];
-  int rawbit = 0;
-  int worst = 0, worstPos = 0;
-  PrintAndLog("Expecting a bit less than %d raw bits", GraphTraceLen / 32);
-  for (i = 0; i < GraphTraceLen-1; i += 2) {
-    count += 1;
-    if ((GraphBuffer[i] > GraphBuffer[i + 1]) && (state != 1)) {
-      if (state == 0) {
-        for (j = 0; j <  count - 8; j += 16) {
-          rawbits[rawbit++] = 0;
-        }
-        if ((abs(count - j)) > worst) {
-          worst = abs(count - j);
-          worstPos = i;
-        }
-      }
-      state = 1;
-      count = 0;
-    } else if ((GraphBuffer[i] < GraphBuffer[i + 1]) && (state != 0)) {
-      if (state == 1) {
-        for (j = 0; j <  count - 8; j += 16) {
-          rawbits[rawbit++] = 1;
-        }
-        if ((abs(count - j)) > worst) {
-          worst = abs(count - j);
-          worstPos = i;
-        }
-      }
-      state = 0;
-      count = 0;
-    }
-  }
-  PrintAndLog("Recovered %d raw bits", rawbit);
-  PrintAndLog("worst metric (0=best..7=worst): %d at pos %d", worst, worstPos);
-
-  // Finding the start of a UID
-  int uidlen, long_wait;
-  if (strcmp(Cmd, "224") == 0) {
-    uidlen = 224;
-    long_wait = 30;
-  } else {
-    uidlen = 64;
-    long_wait = 29;
-  }
-  int start;
-  int first = 0;
-  for (start = 0; start <= rawbit - uidlen; start++) {
-    first = rawbits[start];
-    for (i = start; i < start + long_wait; i++) {
-      if (rawbits[i] != first) {
-        break;
-      }
-    }
-    if (i == (start + long_wait)) {
-      break;
-    }
+  // Usage: recover 64bit UID by default, specify "224" as arg to recover a 224bit UID,
+  // and a number up to PSK_MAX_CANDIDATES to list that many likely UIDs
+  static int soft[MAX_GRAPH_TRACE_LEN / INDALA_CLOCK];
+  static uint32_t rawbits[PSK_WORDS(MAX_GRAPH_TRACE_LEN / INDALA_CLOCK)];
+  psk_format_t f = { INDALA_PREAMBLE_64, 32, 64, 2 };
+  psk_candidate_t cand[PSK_MAX_CANDIDATES];
+  psk_stats_t st;
+  char args[64], *tok;
+  char showbits[PSK_MAX_FRAME + 1];
+  int rawbit, found, frames, want = 1;
+  int i, bit, uidlen;
+
+  strncpy(args, Cmd, sizeof(args) - 1);
+  args[sizeof(args) - 1] = '\0';
+  for (tok = strtok(args, " "); tok; tok = strtok(NULL, " ")) {
+    if (strcmp(tok, "224") == 0)
+      f.frameLen = 224;
+    else if (atoi(tok) >= 1 && atoi(tok) <= PSK_MAX_CANDIDATES)
+      want = atoi(tok);
   }
-  if (start == rawbit - uidlen + 1) {
-    PrintAndLog("nothing to wait for");
+  uidlen = f.frameLen;
+  if (uidlen == 224)
+    f.preamble = INDALA_PREAMBLE_224;
+
+  PrintAndLog("Expecting a bit less than %d raw bits", GraphTraceLen / INDALA_CLOCK);
+  rawbit = PskDemod(GraphBuffer, GraphTraceLen, INDALA_CARRIER, INDALA_CLOCK,
+    soft, sizeof(soft) / sizeof(soft[0]), &st);
+  PrintAndLog("Recovered %d raw bits, from sample %d on", rawbit, st.offset);
+  PrintAndLog("%d of %d phase changes on a bit boundary, %d%% of the signal in phase",
+    st.onTime, st.flips, st.lock);
+  if (uidlen > rawbit) {
+    PrintAndLog("Warning: not enough raw bits to get a full UID");
     return 0;
   }
 
-  // Inverting signal if needed
-  if (first == 1) {
-    for (i = start; i < rawbit; i++) {
-      rawbits[i] = !rawbits[i];
-    }
-  }
-
-  // Dumping UID
-  uint8_t bits[224];
-  char showbits[225];
-  showbits[uidlen]='\0';
-  int bit;
-  i = start;
-  int times = 0;
-  if (uidlen > rawbit) {
-    PrintAndLog("Warning: not enough raw bits to get a full UID");
-    for (bit = 0; bit < rawbit; bit++) {
-      bits[bit] = rawbits[i++];
-      // As we cannot know the parity, let's use "." and "/"
-      showbits[bit] = '.' + bits[bit];
-    }
-    showbits[bit+1]='\0';
-    PrintAndLog("Partial UID=%s", showbits);
+  // Finding the start of a UID, at every bit at once
+  PskPack(soft, rawbit, rawbits);
+  found = PskSearch(soft, rawbits, rawbit, st.level, &f, cand, want, &frames);
+  if (!found) {
+    PrintAndLog("no %d bit UID found", uidlen);
     return 0;
-  } else {
-    for (bit = 0; bit < uidlen; bit++) {
-      bits[bit] = rawbits[i++];
-      showbits[bit] = '0' + bits[bit];
-    }
-    times = 1;
   }
-  PrintAndLog("UID=%s", showbits);
-
-  // Checking UID against next occurences
-  for (; i + uidlen <= rawbit;) {
-    int failed = 0;
-    for (bit = 0; bit < uidlen; bit++) {
-      if (bits[bit] != rawbits[i++]) {
-        failed = 1;
-        break;
-      }
-    }
-    if (failed == 1) {
-      break;
-    }
-    times += 1;
+
+  // Dumping UIDs, the most likely first
+  showbits[uidlen] = '\0';
+  for (i = 0; i < found; i++) {
+    for (bit = 0; bit < uidlen; bit++)
+      showbits[bit] = '0' + PSK_BIT(cand[i].bits, bit);
+    PrintAndLog("%sUID=%s", i ? "or " : "", showbits);
+    PrintAndLog("  read %d of %d times, weakest bit at %d%% of a typical one%s", cand[i].votes,
+      frames, cand[i].margin, cand[i].voted ? ", sum of all frames" : "");
   }
-  PrintAndLog("Occurences: %d (expected %d)", times, (rawbit - start) / uidlen);
 
   // Remodulating for tag cloning
   GraphTraceLen = 32*uidlen;
   i = 0;
   int phase = 0;
   for (bit = 0; bit < uidlen; bit++) {
-    if (bits[bit] == 0) {
+    if (PSK_BIT(cand[0].bits, bit) == 0) {
       phase = 0;
     } else {
       phase = 1;
@@ -269,17 +209,64 @@ int CmdIndalaDemod(const char *Cmd)
 int CmdLFRead(const char *Cmd)
 {
   UsbCommand c = {CMD_ACQUIRE_RAW_ADC_SAMPLES_125K};
-  // 'h' means higher-low-frequency, 134 kHz
-  if(*Cmd == 'h') {
-    c.arg[0] = 1;
-  } else if (*Cmd == '\0') {
-    c.arg[0] = 0;
-  } else {
-    PrintAndLog("use 'read' or 'read h'");
-    return 0;
+  UsbCommand *resp;
+  char args[64], *tok;
+  int encoding = LF_SAMPLES_8BIT, decimation = 1, threshold = 0;
+  int bytes, n;
+  uint8_t *got;
+
+  strncpy(args, Cmd, sizeof(args) - 1);
+  args[sizeof(args) - 1] = '\0';
+  for (tok = strtok(args, " "); tok; tok = strtok(NULL, " ")) {
+    if (!strcmp(tok, "h")) {
+      // 'h' means higher-low-frequency, 134 kHz
+      c.arg[0] = 1;
+    } else if (!strcmp(tok, "4")) {
+      encoding = LF_SAMPLES_4BIT;
+    } else if (!strcmp(tok, "1")) {
+      encoding = LF_SAMPLES_1BIT;
+    } else if (!strcmp(tok, "z")) {
+      encoding = LF_SAMPLES_ZC;
+    } else if (tok[0] == 'd' && atoi(tok + 1) >= 1 && atoi(tok + 1) <= LF_SAMPLES_MAX_DECIMATION) {
+      decimation = atoi(tok + 1);
+    } else if (tok[0] == 't' && atoi(tok + 1) >= 1 && atoi(tok + 1) <= 255) {
+      threshold = atoi(tok + 1);
+    } else {
+      PrintAndLog("Usage: lf read [h] [4|1|z] [d<n>] [t<threshold>]");
+      PrintAndLog("  h: 134 kHz instead of 125 kHz");
+      PrintAndLog("  4: 4 bit samples, 1: 1 bit samples, z: zero crossing run lengths");
+      PrintAndLog("  d<n>: keep every nth sample only (1..%d)", LF_SAMPLES_MAX_DECIMATION);
+      PrintAndLog("  t<threshold>: ADC level that splits 0 from 1 in '1' and 'z' (default %d)",
+        LF_SAMPLES_DEFAULT_THRESHOLD);
+      return 0;
+    }
   }
+
+  c.arg[1] = encoding | (threshold << 8);
+  c.arg[2] = decimation;
   SendCommand(&c);
-  WaitForResponse(CMD_ACK);
+  resp = WaitForResponse(CMD_ACK);
+
+  // a plain capture is fetched with 'data samples', as it always was
+  if (encoding == LF_SAMPLES_8BIT && decimation == 1)
+    return 0;
+
+  // a packed one only makes sense unpacked, so bring it over right away
+  bytes = resp ? resp->arg[0] : 0;
+  if (bytes <= 0 || bytes > 0x10000) {
+    PrintAndLog("no packed capture, does the firmware know about them?");
+    return 0;
+  }
+  got = malloc(bytes);
+  if (!got)
+    return 0;
+  n = GetFromBigBuf(got, bytes, 0);
+  GraphTraceLen = LfSamplesDecode(encoding, decimation, resp->arg[1], got, n,
+    GraphBuffer, MAX_GRAPH_TRACE_LEN);
+  free(got);
+
+  PrintAndLog("%d samples from %d bytes", GraphTraceLen, n);
+  RepaintGraphWindow();
   return 0;
 }
 
@@ -298,6 +285,35 @@ static void ChkBitstream(const char *str)
   }
 }
 
+/* Run every LF decoder on the graph at once, without touching it, and
+ * report the tag most likely to be there
+ */
+int CmdLFSearch(const char *Cmd)
+{
+  lf_found_t found[LF_MAX_DECODERS];
+  lf_result_t *r;
+  int n, i;
+
+  if (GraphTraceLen == 0) {
+    PrintAndLog("nothing in the graph; 'lf read' and 'data samples' first");
+    return 0;
+  }
+
+  n = LfSearch(GraphBuffer, GraphTraceLen, found);
+  if (n == 0) {
+    PrintAndLog("No known LF tag found in %d samples", GraphTraceLen);
+    return 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    r = &found[i].result;
+    PrintAndLog("%s %s ID %s, %s", i ? "   or" : "Found", found[i].decoder->name, r->id, r->info);
+    PrintAndLog("      read %d times, %d%% sure, %s -- see '%s'", r->frames, r->quality,
+      r->checked ? "check passed" : "no check in the format", found[i].decoder->command);
+  }
+  return n;
+}
+
 int CmdLFSim(const char *Cmd)
 {
   int i;
@@ -333,15 +349,118 @@ int CmdLFSimBidir(const char *Cmd)
   return 0;
 }
 
+/* Have the device simulate a tag from a descriptor (see lfsim.h): only the
+ * bits go over USB and the device works out the waveform as it goes. One
+ * repeat of it is shown in the graph. Returns 0 if it can't be done.
+ */
+int SimulateLFDesc(uint32_t arg0, uint32_t arg1, uint32_t arg2, const uint8_t *bits)
+{
+  UsbCommand c = {CMD_SIMULATE_TAG_125K_DESC, {arg0, arg1, arg2}};
+  lf_sim_t sim;
+  lf_sim_state_t st;
+  int i, n;
+
+  if (!LfSimInit(&sim, arg0, arg1, arg2, bits)) {
+    PrintAndLog("Can't simulate that");
+    return 0;
+  }
+
+  /* show what we're sending */
+  ClearGraph(0);
+  n = sim.bits * sim.clock;
+  if (n > MAX_GRAPH_TRACE_LEN)
+    n = MAX_GRAPH_TRACE_LEN;
+  LfSimStart(&st, &sim);
+  for (i = 0; i < n; i++)
+    GraphBuffer[i] = LfSimNext(&st);
+  GraphTraceLen = n;
+  RepaintGraphWindow();
+
+  memcpy(c.d.asBytes, bits, (sim.bits + 7) / 8);
+  PrintAndLog("Starting simulator...");
+  SendCommand(&c);
+  return 1;
+}
+
+/* '0'/'1' string to bits for SimulateLFDesc(), MSB first; returns how many */
+static int ParseSimBits(const char *s, uint8_t *bits)
+{
+  int n;
+
+  memset(bits, 0, LF_SIM_MAX_BITS / 8);
+  for (n = 0; s[n] == '0' || s[n] == '1'; n++) {
+    if (n == LF_SIM_MAX_BITS)
+      return -1;
+    if (s[n] == '1')
+      bits[n / 8] |= 0x80 >> (n % 8);
+  }
+  return n;
+}
+
+/* simulate an LF tag from its bits, modulation, encoding and clock */
+int CmdLFSimDesc(const char *Cmd)
+{
+  char mod[8], enc[8], data[LF_SIM_MAX_BITS + 2];
+  uint8_t bits[LF_SIM_MAX_BITS / 8];
+  int clock = 0, gap = 0, fc0 = 0, fc1 = 0, n, modulation, encoding, invert;
+
+  if (sscanf(Cmd, "%7s %7s %i %385s %i %i %i", mod, enc, &clock, data, &gap, &fc0, &fc1) < 4) {
+    PrintAndLog("Usage: lf simdesc <ask|fsk|psk>[i] <nrz|man|bi> <clock> <bitstream> [gap] [fc0] [fc1]");
+    PrintAndLog("       'i' inverts the coil; fc0/fc1 default to 10/8 for fsk, fc0 to 2 for psk");
+    PrintAndLog("       While a simulation runs, this one takes over after its current repeat.");
+    return 0;
+  }
+
+  invert = strlen(mod) == 4 && mod[3] == 'i';
+  mod[3] = '\0';
+  if (!strcmp(mod, "fsk")) {
+    modulation = LF_SIM_FSK;
+    if (!fc0) fc0 = 10;
+    if (!fc1) fc1 = 8;
+  } else if (!strcmp(mod, "psk")) {
+    modulation = LF_SIM_PSK;
+    if (!fc0) fc0 = 2;
+  } else {
+    modulation = LF_SIM_ASK;
+  }
+
+  if (!strcmp(enc, "man"))
+    encoding = LF_SIM_MANCHESTER;
+  else if (!strcmp(enc, "bi"))
+    encoding = LF_SIM_BIPHASE;
+  else
+    encoding = LF_SIM_NRZ;
+
+  n = ParseSimBits(data, bits);
+  if (n < 0) {
+    PrintAndLog("At most %d bits", LF_SIM_MAX_BITS);
+    return 0;
+  }
+
+  SimulateLFDesc(LF_SIM_ARG0(modulation, encoding, invert),
+    LF_SIM_ARG1(clock, fc0, fc1), LF_SIM_ARG2(n, gap), bits);
+  return 0;
+}
+
 /* simulate an LF Manchester encoded tag with specified bitstream, clock rate and inter-id gap */
 int CmdLFSimManchester(const char *Cmd)
 {
   static int clock, gap;
   static char data[1024], gapstring[8];
+  uint8_t bits[LF_SIM_MAX_BITS / 8];
+  int n;
 
   /* get settings/bits */
   sscanf(Cmd, "%i %s %i", &clock, &data[0], &gap);
 
+  /* short enough to send as a descriptor */
+  n = ParseSimBits(data, bits);
+  if (n > 0 && clock <= 0xffff && gap <= 0xffff) {
+    SimulateLFDesc(LF_SIM_ARG0(LF_SIM_ASK, LF_SIM_MANCHESTER, 0),
+      LF_SIM_ARG1(clock, 0, 0), LF_SIM_ARG2(n, gap), bits);
+    return 0;
+  }
+
   /* clear our graph */
   ClearGraph(0);
 
@@ -444,11 +563,14 @@ static command_t CommandTable[] =
   {"em4x",        CmdLFEM4X,          1, "{ EM4X RFIDs... }"},
   {"flexdemod",   CmdFlexdemod,       1, "Demodulate samples for FlexPass"},
   {"hid",         CmdLFHID,           1, "{ HID RFIDs... }"},
-  {"indalademod", CmdIndalaDemod,     1, "['224'] -- Demodulate samples for Indala 64 bit UID (option '224' for 224 bit)"},
-  {"read",        CmdLFRead,          0, "['h'] -- Read 125/134 kHz LF ID-only tag (option 'h' for 134)"},
+  {"indalademod", CmdIndalaDemod,     1, "['224'] [n] -- Demodulate samples for Indala 64 bit UID (option '224' for 224 bit, n: list up to n likely UIDs)"},
+  {"read",        CmdLFRead,          0, "['h'] [4|1|z] [d<n>] -- Read 125/134 kHz LF ID-only tag (option 'h' for 134), packed for a longer capture"},
+  {"search",      CmdLFSearch,        1, "Try every LF demodulator on the graph at once and report the tag found"},
   {"sim",         CmdLFSim,           0, "[GAP] -- Simulate LF tag from buffer with optional GAP (in microseconds)"},
   {"simbidir",    CmdLFSimBidir,      0, "Simulate LF tag (with bidirectional data transmission between reader and tag)"},
+  {"simdesc",     CmdLFSimDesc,       0, "<ask|fsk|psk> <nrz|man|bi> <Clock> <Bitstream> [GAP] [fc0] [fc1] -- Simulate LF tag from its bits, without uploading a waveform"},
   {"simman",      CmdLFSimManchester, 0, "<Clock> <Bitstream> [GAP] Simulate arbitrary Manchester LF tag"},
+  {"t55xx",       CmdLFT55XX,         1, "{ T55x7 RFIDs... }"},
   {"ti",          CmdLFTI,            1, "{ TI RFIDs... }"},
   {"vchdemod",    CmdVchDemod,        1, "['clone'] -- Demodulate samples for VeriChip"},
   {NULL, NULL, 0, NULL}
@@ -11,15 +11,21 @@
 #ifndef CMDLF_H__
 #define CMDLF_H__
 
+#include <stdint.h>
+
 int CmdLF(const char *Cmd);
 
 int CmdLFCommandRead(const char *Cmd);
 int CmdFlexdemod(const char *Cmd);
 int CmdIndalaDemod(const char *Cmd);
 int CmdLFRead(const char *Cmd);
+int CmdLFSearch(const char *Cmd);
 int CmdLFSim(const char *Cmd);
 int CmdLFSimBidir(const char *Cmd);
 int CmdLFSimManchester(const char *Cmd);
+int CmdLFSimDesc(const char *Cmd);
+
+int SimulateLFDesc(uint32_t arg0, uint32_t arg1, uint32_t arg2, const uint8_t *bits);
 int CmdVchDemod(const char *Cmd);
 
 #endif
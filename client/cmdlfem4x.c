@@ -9,6 +9,7 @@
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "proxusb.h"
 #include "ui.h"
@@ -17,6 +18,9 @@
 #include "cmddata.h"
 #include "cmdlf.h"
 #include "cmdlfem4x.h"
+#include "em410xdemod.h"
+#include "manchester.h"
+#include "lfsim.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -30,62 +34,32 @@ static int CmdHelp(const char *Cmd);
  */
 int CmdEM410xRead(const char *Cmd)
 {
-  int i, j, clock, header, rows, bit, hithigh, hitlow, first, bit2idx, high, low;
+  int i, clock = 0, header, rows, bit2idx;
   int parity[4];
   char id[11];
   int retested = 0;
-  uint8_t BitStream[MAX_GRAPH_TRACE_LEN];
-  high = low = 0;
-
-  /* Detect high and lows and clock */
-  for (i = 0; i < GraphTraceLen; i++)
-  {
-    if (GraphBuffer[i] > high)
-      high = GraphBuffer[i];
-    else if (GraphBuffer[i] < low)
-      low = GraphBuffer[i];
+  static uint32_t levels[MAN_WORDS(MAX_GRAPH_TRACE_LEN)];
+  static uint32_t bits[MAN_WORDS(MAX_GRAPH_TRACE_LEN)];
+  man_stats_t st;
+
+  /* get clock, from the graph unless we were given one */
+  sscanf(Cmd, "%i", &clock);
+  ManLevels(GraphBuffer, GraphTraceLen, levels);
+  if (clock <= 0) {
+    clock = ManClock(levels, GraphTraceLen, &st);
+    if (clock == 0) {
+      PrintAndLog("Could not detect a clock rate, give one");
+      return 0;
+    }
+    PrintAndLog("Auto-detected clock rate: %d", clock);
   }
 
-  /* get clock */
-  clock = GetClock(Cmd, high, 0);
-
   /* parity for our 4 columns */
   parity[0] = parity[1] = parity[2] = parity[3] = 0;
   header = rows = 0;
 
   /* manchester demodulate */
-  bit = bit2idx = 0;
-  for (i = 0; i < (int)(GraphTraceLen / clock); i++)
-  {
-    hithigh = 0;
-    hitlow = 0;
-    first = 1;
-
-    /* Find out if we hit both high and low peaks */
-    for (j = 0; j < clock; j++)
-    {
-      if (GraphBuffer[(i * clock) + j] == high)
-        hithigh = 1;
-      else if (GraphBuffer[(i * clock) + j] == low)
-        hitlow = 1;
-
-      /* it doesn't count if it's the first part of our read
-       because it's really just trailing from the last sequence */
-      if (first && (hithigh || hitlow))
-        hithigh = hitlow = 0;
-      else
-        first = 0;
-
-      if (hithigh && hitlow)
-        break;
-    }
-
-    /* If we didn't hit both high and low peaks, we had a bit transition */
-    if (!hithigh || !hitlow)
-      bit ^= 1;
-
-    BitStream[bit2idx++] = bit;
-  }
+  bit2idx = ManDecode(levels, GraphTraceLen, clock, MAN_MANCHESTER, bits, MAX_GRAPH_TRACE_LEN, &st);
 
 retest:
   /* We go till 5 before the graph ends because we'll get that far below */
@@ -95,17 +69,17 @@ retest:
     if (header == 9 && rows < 10)
     {
       /* Confirm parity is correct */
-      if ((BitStream[i] ^ BitStream[i+1] ^ BitStream[i+2] ^ BitStream[i+3]) == BitStream[i+4])
+      if ((MAN_BIT(bits, i) ^ MAN_BIT(bits, i+1) ^ MAN_BIT(bits, i+2) ^ MAN_BIT(bits, i+3)) == MAN_BIT(bits, i+4))
       {
         /* Read another byte! */
-        sprintf(id+rows, "%x", (8 * BitStream[i]) + (4 * BitStream[i+1]) + (2 * BitStream[i+2]) + (1 * BitStream[i+3]));
+        sprintf(id+rows, "%x", (8 * MAN_BIT(bits, i)) + (4 * MAN_BIT(bits, i+1)) + (2 * MAN_BIT(bits, i+2)) + (1 * MAN_BIT(bits, i+3)));
         rows++;
 
         /* Keep parity info */
-        parity[0] ^= BitStream[i];
-        parity[1] ^= BitStream[i+1];
-        parity[2] ^= BitStream[i+2];
-        parity[3] ^= BitStream[i+3];
+        parity[0] ^= MAN_BIT(bits, i);
+        parity[1] ^= MAN_BIT(bits, i+1);
+        parity[2] ^= MAN_BIT(bits, i+2);
+        parity[3] ^= MAN_BIT(bits, i+3);
 
         /* Move 4 bits ahead */
         i += 4;
@@ -127,9 +101,9 @@ retest:
     else if (rows == 10)
     {
       /* We need to make sure our 4 bits of parity are correct and we have a stop bit */
-      if (BitStream[i] == parity[0] && BitStream[i+1] == parity[1] &&
-        BitStream[i+2] == parity[2] && BitStream[i+3] == parity[3] &&
-        BitStream[i+4] == 0)
+      if (MAN_BIT(bits, i) == parity[0] && MAN_BIT(bits, i+1) == parity[1] &&
+        MAN_BIT(bits, i+2) == parity[2] && MAN_BIT(bits, i+3) == parity[3] &&
+        MAN_BIT(bits, i+4) == 0)
       {
         /* Sweet! */
         PrintAndLog("EM410x Tag ID: %s", id);
@@ -152,7 +126,7 @@ retest:
     else if (header < 9)
     {
       /* Need 9 consecutive 1's */
-      if (BitStream[i] == 1)
+      if (MAN_BIT(bits, i) == 1)
         header++;
 
       /* We don't have a header, not enough consecutive 1 bits */
@@ -166,8 +140,8 @@ retest:
     return 0;
 
   /* if this didn't work, try flipping bits */
-  for (i = 0; i < bit2idx; i++)
-    BitStream[i] ^= 1;
+  for (i = 0; i < MAN_WORDS(bit2idx); i++)
+    bits[i] = ~bits[i];
 
   goto retest;
 }
@@ -182,78 +156,96 @@ retest:
  */
 int CmdEM410xSim(const char *Cmd)
 {
-  int i, n, j, h, binary[4], parity[4];
+  int i, n, j, nbits, binary[4], parity[4];
+  uint8_t bits[8];
 
   /* clock is 64 in EM410x tags */
   int clock = 64;
 
-  /* clear our graph */
-  ClearGraph(0);
-
-  /* write it out a few times */
-  for (h = 0; h < 4; h++)
-  {
-    /* write 9 start bits */
-    for (i = 0; i < 9; i++)
-      AppendGraph(0, clock, 1);
-
-    /* for each hex char */
-    parity[0] = parity[1] = parity[2] = parity[3] = 0;
-    for (i = 0; i < 10; i++)
-    {
-      /* read each hex char */
-      sscanf(&Cmd[i], "%1x", &n);
-      for (j = 3; j >= 0; j--, n/= 2)
-        binary[j] = n % 2;
-
-      /* append each bit */
-      AppendGraph(0, clock, binary[0]);
-      AppendGraph(0, clock, binary[1]);
-      AppendGraph(0, clock, binary[2]);
-      AppendGraph(0, clock, binary[3]);
-
-      /* append parity bit */
-      AppendGraph(0, clock, binary[0] ^ binary[1] ^ binary[2] ^ binary[3]);
-
-      /* keep track of column parity */
-      parity[0] ^= binary[0];
-      parity[1] ^= binary[1];
-      parity[2] ^= binary[2];
-      parity[3] ^= binary[3];
-    }
+  memset(bits, 0, sizeof(bits));
+  nbits = 0;
+#define EM410X_SIM_BIT(b) { if (b) bits[nbits / 8] |= 0x80 >> (nbits % 8); nbits++; }
 
-    /* parity columns */
-    AppendGraph(0, clock, parity[0]);
-    AppendGraph(0, clock, parity[1]);
-    AppendGraph(0, clock, parity[2]);
-    AppendGraph(0, clock, parity[3]);
+  /* write 9 start bits */
+  for (i = 0; i < 9; i++)
+    EM410X_SIM_BIT(1);
 
-    /* stop bit */
-    AppendGraph(0, clock, 0);
+  /* for each hex char */
+  parity[0] = parity[1] = parity[2] = parity[3] = 0;
+  for (i = 0; i < 10; i++)
+  {
+    /* read each hex char */
+    sscanf(&Cmd[i], "%1x", &n);
+    for (j = 3; j >= 0; j--, n/= 2)
+      binary[j] = n % 2;
+
+    /* append each bit */
+    EM410X_SIM_BIT(binary[0]);
+    EM410X_SIM_BIT(binary[1]);
+    EM410X_SIM_BIT(binary[2]);
+    EM410X_SIM_BIT(binary[3]);
+
+    /* append parity bit */
+    EM410X_SIM_BIT(binary[0] ^ binary[1] ^ binary[2] ^ binary[3]);
+
+    /* keep track of column parity */
+    parity[0] ^= binary[0];
+    parity[1] ^= binary[1];
+    parity[2] ^= binary[2];
+    parity[3] ^= binary[3];
   }
 
-  /* modulate that biatch */
-  CmdManchesterMod("");
+  /* parity columns */
+  EM410X_SIM_BIT(parity[0]);
+  EM410X_SIM_BIT(parity[1]);
+  EM410X_SIM_BIT(parity[2]);
+  EM410X_SIM_BIT(parity[3]);
 
-  /* booyah! */
-  RepaintGraphWindow();
-  
-  CmdLFSim("");
+  /* stop bit */
+  EM410X_SIM_BIT(0);
+#undef EM410X_SIM_BIT
+
+  /* the device Manchester encodes and repeats it */
+  SimulateLFDesc(LF_SIM_ARG0(LF_SIM_ASK, LF_SIM_MANCHESTER, 0),
+    LF_SIM_ARG1(clock, 0, 0), LF_SIM_ARG2(nbits, 0), bits);
   return 0;
 }
 
-/* Function is equivalent of loread + losamples + em410xread
- * looped until an EM410x tag is detected */
+/* Have the device read and decode EM410x tags itself, only the IDs come back
+ * (see CMD_LF_TAG_ID); stops when the button is pressed
+ */
 int CmdEM410xWatch(const char *Cmd)
 {
-  do
-  {
-    CmdLFRead("");
-    CmdSamples("2000");
-  } while ( ! CmdEM410xRead(""));
+  UsbCommand c = {CMD_EM410X_DEMOD};
+  SendCommand(&c);
   return 0;
 }
 
+/* Run the graph through the same EM410x demodulator the device uses for
+ * em410xwatch, and list the IDs it finds
+ */
+int CmdEM410xDemod(const char *Cmd)
+{
+  em410x_demod_t d;
+  int i, found = 0;
+  uint64_t last = 0;
+
+  Em410xDemodInit(&d, atoi(Cmd));
+  for (i = 0; i < GraphTraceLen; i++) {
+    if (!Em410xDemodSample(&d, GraphBuffer[i] + 128))
+      continue;
+    if (found && d.id == last)
+      continue;
+    PrintAndLog("EM410x Tag ID: %02x%08x at %d (swing %d)",
+      (uint32_t)(d.id >> 32), (uint32_t)d.id, i, d.rssi);
+    last = d.id;
+    found++;
+  }
+  if (!found)
+    PrintAndLog("No EM410x tag found");
+  return found;
+}
+
 /* Read the transmitted data of an EM4x50 tag
  * Format:
  *
@@ -403,6 +395,7 @@ static command_t CommandTable[] =
 {
   {"help",        CmdHelp,        1, "This help"},
   {"em410xread",  CmdEM410xRead,  1, "[clock rate] -- Extract ID from EM410x tag"},
+  {"em410xdemod", CmdEM410xDemod, 1, "[clock rate] -- Extract ID from EM410x tag, as the device does"},
   {"em410xsim",   CmdEM410xSim,   0, "<UID> -- Simulate EM410x tag"},
   {"em410xwatch", CmdEM410xWatch, 0, "Watches for EM410x tags"},
   {"em4x50read",  CmdEM4x50Read,  1, "Extract data from EM4x50 tag"},
@@ -14,6 +14,7 @@
 int CmdLFEM4X(const char *Cmd);
 
 int CmdEM410xRead(const char *Cmd);
+int CmdEM410xDemod(const char *Cmd);
 int CmdEM410xSim(const char *Cmd);
 int CmdEM410xWatch(const char *Cmd);
 int CmdEM4x50Read(const char *Cmd);
@@ -79,7 +79,38 @@ int CmdHIDClone(const char *Cmd)
 
 int CmdHIDBrute(const char *Cmd)
 {
-  UsbCommand c={CMD_HID_BRUTE};
+  UsbCommand c = {CMD_HID_BRUTE, {HID_BRUTE_READ, 0, 0}};
+  unsigned int hi = 0, start = 0, end = 0, dwell = 0;
+  int step = 0, n;
+  char mode = 0;
+
+  sscanf(Cmd, " %c", &mode);
+  if (mode == 'r') {
+    n = sscanf(Cmd, " r %x %x %x %d %u", &hi, &start, &end, &step, &dwell);
+    c.arg[0] = HID_BRUTE_RANGE;
+  } else if (mode == 'f') {
+    n = sscanf(Cmd, " f %u %u %u %d %u", &hi, &start, &end, &step, &dwell);
+    c.arg[0] = HID_BRUTE_FC;
+  } else {
+    sscanf(Cmd, "%u", &dwell);
+    n = 3;
+  }
+  if (n < 3 || hi > (mode == 'f' ? 0xff : 0xfff) || dwell > 0xffff) {
+    PrintAndLog("Usage: lf hid brute [dwell]");
+    PrintAndLog("       lf hid brute r <hi> <start> <end> [step] [dwell]");
+    PrintAndLog("       lf hid brute f <fc> <start> <end> [step] [dwell]");
+    PrintAndLog("  Simulates each ID for dwell ms (default %d) until the button is pressed.", HID_BRUTE_DWELL_MS);
+    PrintAndLog("  Without r or f it reads a card and counts down from it once the button");
+    PrintAndLog("  is pressed; r sweeps the low word of IDs (hex) with high word hi, f the");
+    PrintAndLog("  card numbers (decimal) of 26 bit IDs with facility code fc.");
+    return 0;
+  }
+
+  c.arg[0] |= dwell << 16;
+  c.arg[1] = start;
+  c.arg[2] = end;
+  c.d.asDwords[0] = step;
+  c.d.asDwords[1] = hi;
   SendCommand(&c);
   return 0;
 }
@@ -91,7 +122,7 @@ static command_t CommandTable[] =
   {"fskdemod",  CmdHIDDemodFSK, 0, "Realtime HID FSK demodulator"},
   {"sim",       CmdHIDSim,      0, "<ID> -- HID tag simulator"},
   {"clone",     CmdHIDClone,    0, "<ID> -- Clone HID to T55x7 (tag must be in antenna)"},
-  {"brute",  		CmdHIDBrute, 		0, "Find valid ID by brute forcing from a read card"},
+  {"brute",  		CmdHIDBrute, 		0, "[r|f ...] -- Find valid ID by brute forcing from a read card or over a range"},
   {NULL, NULL, 0, NULL}
 };
 
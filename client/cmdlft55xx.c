@@ -0,0 +1,193 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Low frequency T55x7 commands
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "proxusb.h"
+#include "ui.h"
+#include "cmdparser.h"
+#include "cmdmain.h"
+#include "cmdlft55xx.h"
+#include "t55xx.h"
+
+// How long a card may take: every block written and read back, twice over
+// for each retry
+#define T55XX_CARD_TIMEOUT(n, retries)	((n) * ((retries) + 1) * 600 + 1000)
+
+static int CmdHelp(const char *Cmd);
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Have the device write and check a card; *ok is set to the mask of blocks
+// that read back (T55XX_UNVERIFIED for none checked). Returns 0 if there was
+// no answer.
+static int T55xxWrite(uint32_t *blocks, int n, int retries, int verify, uint32_t *ok, uint32_t *writes, uint32_t *ms)
+{
+  UsbCommand c = {CMD_T55XX_WRITE_CARD, {n | (retries << 8) | (verify ? 0 : T55XX_WRITE_NO_VERIFY), 0, 0}};
+  UsbCommand *r;
+
+  memcpy(c.d.asDwords, blocks, n * sizeof(blocks[0]));
+  SendCommand(&c);
+  r = WaitForResponseTimeout(CMD_ACK, T55XX_CARD_TIMEOUT(n, retries));
+  if (r == NULL) {
+    PrintAndLog("No answer from the device");
+    return 0;
+  }
+  *ok = r->arg[0];
+  *writes = r->arg[1];
+  *ms = r->arg[2];
+  return 1;
+}
+
+// One line about how a card went; returns 1 if it is good
+static int T55xxReport(uint32_t ok, int n, uint32_t writes, uint32_t ms)
+{
+  uint32_t all = (1 << n) - 1;
+
+  if (ok == T55XX_UNVERIFIED) {
+    PrintAndLog("  %d blocks written in %d writes, not read back, %d.%03ds", n, writes, ms / 1000, ms % 1000);
+    return 1;
+  }
+  if ((ok & all) == all) {
+    PrintAndLog("  %d blocks written in %d writes, all read back, %d.%03ds", n, writes, ms / 1000, ms % 1000);
+    return 1;
+  }
+  PrintAndLog("  FAILED: blocks %02x did not read back after %d writes, %d.%03ds", all & ~ok, writes, ms / 1000, ms % 1000);
+  return 0;
+}
+
+int CmdT55xxWrite(const char *Cmd)
+{
+  uint32_t blocks[T55XX_BLOCKS], ok, writes = 0, ms = 0;
+  int n = 0, verify = 1, len;
+  unsigned int b;
+
+  while (*Cmd == ' ') Cmd++;
+  if (*Cmd == 'n' && (Cmd[1] == ' ' || !Cmd[1])) {
+    verify = 0;
+    Cmd++;
+  }
+  while (n < T55XX_BLOCKS && sscanf(Cmd, " %x%n", &b, &len) == 1) {
+    blocks[n++] = b;
+    Cmd += len;
+  }
+  if (n == 0) {
+    PrintAndLog("Usage: lf t55xx write [n] <block 0> [<block 1> ... <block 7>]");
+    PrintAndLog("  Writes the blocks (hex, the configuration first) to the card at the");
+    PrintAndLog("  antenna and reads them back, n to only write. e.g. an HID card:");
+    PrintAndLog("    lf t55xx write 00107060 1d555955 5569a959 599a5656");
+    return 0;
+  }
+
+  if (T55xxWrite(blocks, n, T55XX_DEFAULT_RETRIES, verify, &ok, &writes, &ms))
+    T55xxReport(ok, n, writes, ms);
+  return 0;
+}
+
+// The blocks for an ID of a CSV line, or 0 if there is none
+static int T55xxLineBlocks(const char *line, int em, uint32_t *blocks)
+{
+  unsigned long long id = 0;
+  int digits = 0, v;
+
+  while (*line == ' ' || *line == '\t') line++;
+  for (; *line && *line != ',' && *line != ';' && *line != '\r' && *line != '\n'; line++) {
+    if (*line >= '0' && *line <= '9') v = *line - '0';
+    else if (*line >= 'a' && *line <= 'f') v = *line - 'a' + 10;
+    else if (*line >= 'A' && *line <= 'F') v = *line - 'A' + 10;
+    else if (*line == ' ' || *line == '\t') continue;
+    else return 0;
+    id = (id << 4) | v;
+    digits++;
+  }
+  if (digits == 0 || digits > (em ? 10 : 11))
+    return 0;
+  if (em)
+    return T55xxEm410xBlocks(blocks, id);
+  return T55xxHidBlocks(blocks, id >> 32, (uint32_t)id);
+}
+
+int CmdT55xxBatch(const char *Cmd)
+{
+  char type[8] = "", file[256] = "", line[256];
+  uint32_t blocks[T55XX_BLOCKS], ok, writes, ms;
+  int retries = T55XX_DEFAULT_RETRIES, em, n, card = 0, good = 0;
+  double start, t, total = 0;
+  FILE *f;
+
+  if (sscanf(Cmd, "%7s %255s %d", type, file, &retries) < 2 ||
+      (strcmp(type, "hid") && strcmp(type, "em"))) {
+    PrintAndLog("Usage: lf t55xx batch <hid|em> <file> [retries]");
+    PrintAndLog("  Writes one card for each ID (hex, the first field of each line) in the");
+    PrintAndLog("  file, waiting for enter between two cards, and reads each one back.");
+    PrintAndLog("  Blocks that did not read back are written again, %d times by default.", T55XX_DEFAULT_RETRIES);
+    return 0;
+  }
+  em = !strcmp(type, "em");
+  if (retries < 0) retries = 0;
+  if (retries > 255) retries = 255;
+
+  f = fopen(file, "r");
+  if (!f) {
+    PrintAndLog("couldn't open '%s'", file);
+    return 0;
+  }
+
+  start = now();
+  while (fgets(line, sizeof(line), f)) {
+    n = T55xxLineBlocks(line, em, blocks);
+    if (n == 0) continue;
+    line[strcspn(line, ",;\r\n")] = 0;
+
+    card++;
+    PrintAndLog("Card %d, ID %s: put it on the antenna and press enter (q to stop)", card, line);
+    fflush(stdout);
+    if (!fgets(line, sizeof(line), stdin) || line[0] == 'q')
+      break;
+
+    t = now();
+    if (!T55xxWrite(blocks, n, retries, 1, &ok, &writes, &ms))
+      break;
+    good += T55xxReport(ok, n, writes, ms);
+    total += now() - t;
+  }
+  fclose(f);
+
+  if (card)
+    PrintAndLog("%d of %d cards good, %.2fs a card, %.0fs in all", good, card,
+      total / card, now() - start);
+  return 0;
+}
+
+static command_t CommandTable[] =
+{
+  {"help",      CmdHelp,        1, "This help"},
+  {"write",     CmdT55xxWrite,  0, "[n] <block 0> [<block 1> ...] -- Write and read back a T55x7 card"},
+  {"batch",     CmdT55xxBatch,  0, "<hid|em> <file> [retries] -- Write a T55x7 card for each ID in a CSV file"},
+  {NULL, NULL, 0, NULL}
+};
+
+int CmdLFT55XX(const char *Cmd)
+{
+  CmdsParse(CommandTable, Cmd);
+  return 0;
+}
+
+int CmdHelp(const char *Cmd)
+{
+  CmdsHelp(CommandTable);
+  return 0;
+}
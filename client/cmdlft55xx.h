@@ -0,0 +1,17 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Low frequency T55x7 commands
+//-----------------------------------------------------------------------------
+
+#ifndef CMDLFT55XX_H__
+#define CMDLFT55XX_H__
+
+int CmdLFT55XX(const char *Cmd);
+
+int CmdT55xxWrite(const char *Cmd);
+int CmdT55xxBatch(const char *Cmd);
+
+#endif
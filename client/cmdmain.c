@@ -109,10 +109,37 @@ void UsbCommandReceived(UsbCommand *UC)
       return;
     }
 
+    case CMD_DOWNLOADED_BIGBUF:
+      if (BigBufStreamReceived(UC))
+        received_command = UC->cmd;
+      return;
+
     case CMD_DEBUG_PRINT_INTEGERS:
       PrintAndLog("#db# %08x, %08x, %08x       \r\n", UC->arg[0], UC->arg[1], UC->arg[2]);
       return;
 
+    case CMD_LF_TAG_ID: {
+      // a tag the device decoded itself (lf hid fskdemod, lf em4x em410xwatch)
+      uint32_t ms = UC->d.asDwords[0];
+      if (UC->arg[0] == LF_TAG_HID)
+        PrintAndLog("#db# TAG ID: %x%08x (%d)   [swing %d, %d.%03ds]",
+          UC->arg[1], UC->arg[2], (UC->arg[2] >> 1) & 0xffff,
+          UC->d.asDwords[1], ms / 1000, ms % 1000);
+      else if (UC->arg[0] == LF_TAG_EM410X)
+        PrintAndLog("#db# EM410x Tag ID: %02x%08x   [swing %d, %d.%03ds]",
+          UC->arg[1], UC->arg[2], UC->d.asDwords[1], ms / 1000, ms % 1000);
+      return;
+    }
+
+    case CMD_HID_BRUTE_STATUS: {
+      // lf hid brute progress, once a second and when it is over
+      uint32_t ms = UC->d.asDwords[0];
+      PrintAndLog("#db# %s %x%08x (%d), %d tried   [%d.%03ds]",
+        UC->d.asDwords[1] ? "Stopped at" : "Trying", UC->arg[0], UC->arg[1],
+        (UC->arg[1] >> 1) & 0xffff, UC->arg[2], ms / 1000, ms % 1000);
+      return;
+    }
+
     case CMD_MEASURED_ANTENNA_TUNING: {
       int peakv, peakf;
       int vLf125, vLf134, vHf;
@@ -151,7 +178,8 @@ void UsbCommandReceived(UsbCommand *UC)
     case CMD_ACQUIRE_RAW_ADC_SAMPLES_125K:
     case CMD_DOWNLOADED_SIM_SAMPLES_125K:
       if (UC->cmd != CMD_ACK) goto unexpected_response;
-      // got ACK
+      // got ACK, which for a capture says how big it came out
+      memcpy(&current_response, UC, sizeof(UsbCommand));
       received_command = UC->cmd;
       return;
     default:
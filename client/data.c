@@ -17,19 +17,52 @@
 
 uint8_t sample_buf[SAMPLE_BUFFER_SIZE];
 
-void GetFromBigBuf(uint8_t *dest, int bytes)
+// The download in progress, filled in by BigBufStreamReceived() as the
+// CMD_DOWNLOADED_BIGBUF packets come in
+static uint8_t *stream_dest;
+static uint32_t stream_start, stream_size;
+static uint32_t stream_got;
+// Every download gets a new one, which the device puts in each chunk, so
+// that the rest of one that timed out is not taken for part of the next
+static uint16_t stream_id;
+
+// Fetch bytes of BigBuf, starting at offset. The device streams them back
+// without waiting for a request per packet. Returns the number of bytes
+// received, less than asked for if the range runs past the end of BigBuf.
+int GetFromBigBuf(uint8_t *dest, int bytes, int offset)
 {
-  int n = bytes/4;
+  UsbCommand c = {CMD_DOWNLOAD_BIGBUF, {offset, bytes, ++stream_id}};
 
-  if (n % 48 != 0) {
-    PrintAndLog("bad len in GetFromBigBuf");
-    return;
-  }
+  stream_dest = dest;
+  stream_start = offset;
+  stream_size = bytes;
+  stream_got = 0;
+  SendCommand(&c);
+
+  // One UsbCommand (48 bytes) goes out as 8 packets, one per millisecond
+  if (WaitForResponseTimeout(CMD_DOWNLOADED_BIGBUF, 1000 + bytes / 48 * 8 * 2) == NULL)
+    PrintAndLog("timeout downloading BigBuf, got %d of %d bytes", stream_got, bytes);
+
+  stream_dest = NULL;
+  return stream_got;
+}
+
+// Called for every CMD_DOWNLOADED_BIGBUF: arg[0] is the offset of the
+// chunk, arg[1] its length with the download's id in the top half, arg[2]
+// the length of the whole download. Returns true once the last chunk is in.
+bool BigBufStreamReceived(UsbCommand *UC)
+{
+  uint32_t at = UC->arg[0] - stream_start;
+  uint32_t len = UC->arg[1] & 0xffff;
 
-  for (int i = 0; i < n; i += 12) {
-    UsbCommand c = {CMD_DOWNLOAD_RAW_ADC_SAMPLES_125K, {i, 0, 0}};
-    SendCommand(&c);
-    WaitForResponse(CMD_DOWNLOADED_RAW_ADC_SAMPLES_125K);
-    memcpy(dest+(i*4), sample_buf, 48);
+  if (stream_dest == NULL || (UC->arg[1] >> 16) != stream_id)
+    return false;
+  if (len > sizeof(UC->d.asBytes) || at > stream_size || len > stream_size - at) {
+    PrintAndLog("bad chunk in BigBuf download (offset %d, %d bytes)", UC->arg[0], len);
+    return false;
   }
+  memcpy(stream_dest + at, UC->d.asBytes, len);
+  stream_got += len;
+
+  return stream_got >= UC->arg[2];
 }
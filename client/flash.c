@@ -11,23 +11,32 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include "sleep.h"
 #include "proxusb.h"
 #include "flash.h"
 #include "elf.h"
 #include "proxendian.h"
+#include "crc32.h"
+#include "flashdiff.h"
 
 // FIXME: what the fuckity fuck
 unsigned int current_command = CMD_UNKNOWN;
 
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 #define FLASH_START            0x100000
 #define FLASH_SIZE             (256*1024)
 #define FLASH_END              (FLASH_START + FLASH_SIZE)
 #define BOOTLOADER_SIZE        0x2000
 #define BOOTLOADER_END         (FLASH_START + BOOTLOADER_SIZE)
 
-#define BLOCK_SIZE             0x100
-
 static const uint8_t elf_ident[] = {
 	0x7f, 'E', 'L', 'F',
 	ELFCLASS32,
@@ -265,14 +274,14 @@ fail:
 }
 
 // Get the state of the proxmark, backwards compatible
-static int get_proxmark_state(uint32_t *state)
+static int get_proxmark_state(flash_device_t *dev, uint32_t *state)
 {
 	UsbCommand c;
 	c.cmd = CMD_DEVICE_INFO;
-	SendCommand(&c);
+	SendCommandTo(dev->unit, &c);
 
 	UsbCommand resp;
-	ReceiveCommand(&resp);
+	ReceiveCommandFrom(dev->unit, &resp);
 
 	// Three outcomes:
 	// 1. The old bootrom code will ignore CMD_DEVICE_INFO, but respond with an ACK
@@ -290,7 +299,7 @@ static int get_proxmark_state(uint32_t *state)
 			*state = resp.arg[0];
 			break;
 		default:
-			fprintf(stderr, "Error: Couldn't get proxmark state, bad response type: 0x%04x\n", resp.cmd);
+			fprintf(dev->out, "Error: Couldn't get proxmark state, bad response type: 0x%04x\n", resp.cmd);
 			return -1;
 			break;
 	}
@@ -299,11 +308,11 @@ static int get_proxmark_state(uint32_t *state)
 }
 
 // Enter the bootloader to be able to start flashing
-static int enter_bootloader(void)
+static int enter_bootloader(flash_device_t *dev)
 {
 	uint32_t state;
 
-	if (get_proxmark_state(&state) < 0)
+	if (get_proxmark_state(dev, &state) < 0)
 		return -1;
 
 	if (state & DEVICE_INFO_FLAG_CURRENT_MODE_BOOTROM) {
@@ -312,7 +321,7 @@ static int enter_bootloader(void)
 	}
 
 	if (state & DEVICE_INFO_FLAG_CURRENT_MODE_OS) {
-		fprintf(stderr,"Entering bootloader...\n");
+		fprintf(dev->out,"Entering bootloader...\n");
 		UsbCommand c;
 		memset(&c, 0, sizeof (c));
 
@@ -322,52 +331,59 @@ static int enter_bootloader(void)
 			// New style handover: Send CMD_START_FLASH, which will reset the board
 			// and enter the bootrom on the next boot.
 			c.cmd = CMD_START_FLASH;
-			SendCommand(&c);
-			fprintf(stderr,"(Press and release the button only to abort)\n");
+			SendCommandTo(dev->unit, &c);
+			fprintf(dev->out,"(Press and release the button only to abort)\n");
 		} else {
 			// Old style handover: Ask the user to press the button, then reset the board
 			c.cmd = CMD_HARDWARE_RESET;
-			SendCommand(&c);
-			fprintf(stderr,"Press and hold down button NOW if your bootloader requires it.\n");
+			SendCommandTo(dev->unit, &c);
+			fprintf(dev->out,"Press and hold down button NOW if your bootloader requires it.\n");
 		}
-		fprintf(stderr,"Waiting for Proxmark to reappear on USB...");
+		fprintf(dev->out,"Waiting for Proxmark to reappear on USB...");
 
-		CloseProxmark();
+		// it comes back at the same port, with the same serial number
+		CloseProxmarkUnit(dev->unit);
 		sleep(1);
-		while (!OpenProxmark(0)) {
+		for (int i = 0; !ReopenProxmarkUnit(dev->unit, 0); i++) {
+			if (i == PROX_REOPEN_SECONDS) {
+				fprintf(dev->out, " not found.\nError: it did not come back within %d seconds\n",
+				        PROX_REOPEN_SECONDS);
+				return -1;
+			}
 			sleep(1);
-			fprintf(stderr, ".");
+			fprintf(dev->out, ".");
 		}
-		fprintf(stderr," Found.\n");
+		fprintf(dev->out," Found.\n");
 
 		return 0;
 	}
 
-	fprintf(stderr, "Error: Unknown Proxmark mode\n");
+	fprintf(dev->out, "Error: Unknown Proxmark mode\n");
 	return -1;
 }
 
-static int wait_for_ack(void)
+static int wait_for_ack(flash_device_t *dev)
 {
 	UsbCommand ack;
-	ReceiveCommand(&ack);
+	ReceiveCommandFrom(dev->unit, &ack);
 	if (ack.cmd != CMD_ACK) {
-		printf("Error: Unexpected reply 0x%04x (expected ACK)\n", ack.cmd);
+		fprintf(dev->out, "Error: Unexpected reply 0x%04x (expected ACK)\n", ack.cmd);
 		return -1;
 	}
 	return 0;
 }
 
 // Go into flashing mode
-int flash_start_flashing(int enable_bl_writes)
+int flash_start_flashing(flash_device_t *dev, int enable_bl_writes)
 {
 	uint32_t state;
 
-	if (enter_bootloader() < 0)
+	if (enter_bootloader(dev) < 0)
 		return -1;
 
-	if (get_proxmark_state(&state) < 0)
+	if (get_proxmark_state(dev, &state) < 0)
 		return -1;
+	dev->bootloader_flags = state;
 
 	if (state & DEVICE_INFO_FLAG_UNDERSTANDS_START_FLASH) {
 		// This command is stupid. Why the heck does it care which area we're
@@ -383,17 +399,17 @@ int flash_start_flashing(int enable_bl_writes)
 			c.arg[1] = FLASH_END;
 			c.arg[2] = 0;
 		}
-		SendCommand(&c);
-		return wait_for_ack();
+		SendCommandTo(dev->unit, &c);
+		return wait_for_ack(dev);
 	} else {
-		fprintf(stderr, "Note: Your bootloader does not understand the new START_FLASH command\n");
-		fprintf(stderr, "      It is recommended that you update your bootloader\n\n");
+		fprintf(dev->out, "Note: Your bootloader does not understand the new START_FLASH command\n");
+		fprintf(dev->out, "      It is recommended that you update your bootloader\n\n");
 	}
 
 	return 0;
 }
 
-static int write_block(uint32_t address, uint8_t *data, uint32_t length)
+static int write_block(flash_device_t *dev, uint32_t address, uint8_t *data, uint32_t length)
 {
 	uint8_t block_buf[BLOCK_SIZE];
 
@@ -404,22 +420,179 @@ static int write_block(uint32_t address, uint8_t *data, uint32_t length)
 	for (int i = 0; i < 240; i += 48) {
 		memcpy(c.d.asBytes, block_buf + i, 48);
 		c.arg[0] = i / 4;
-		SendCommand(&c);
-		if (wait_for_ack() < 0)
+		SendCommandTo(dev->unit, &c);
+		if (wait_for_ack(dev) < 0)
 			return -1;
 	}
 
 	c.cmd = CMD_FINISH_WRITE;
 	c.arg[0] = address;
 	memcpy(c.d.asBytes, block_buf+240, 16);
-	SendCommand(&c);
-	return wait_for_ack();
+	SendCommandTo(dev->unit, &c);
+	return wait_for_ack(dev);
+}
+
+// CRC32 of a flash range, and whatever went wrong with the streamed writes
+// since the last time we asked
+static int get_flash_crc(flash_device_t *dev, uint32_t address, uint32_t length, uint32_t *crc,
+                         uint32_t *status, uint32_t *error_addr)
+{
+	UsbCommand c = {CMD_FLASH_CRC32, {address, length, 0}};
+
+	SendCommandTo(dev->unit, &c);
+	ReceiveCommandFrom(dev->unit, &c);
+	if (c.cmd != CMD_ACK) {
+		fprintf(dev->out, "Error: Unexpected reply 0x%04x to CRC request\n", c.cmd);
+		return -1;
+	}
+	*crc = c.arg[0];
+	if (status)
+		*status = c.arg[1];
+	if (error_addr)
+		*error_addr = c.arg[2];
+	return 0;
+}
+
+// CRC32 of each flash page in a range
+static int get_page_crcs(flash_device_t *dev, uint32_t address, uint32_t blocks, uint32_t *crcs)
+{
+	UsbCommand c = {CMD_FLASH_CRC32, {address, blocks * BLOCK_SIZE, FLASH_CRC32_PAGES}};
+	uint32_t got = 0;
+
+	SendCommandTo(dev->unit, &c);
+	while (got < blocks) {
+		ReceiveCommandFrom(dev->unit, &c);
+		if (c.cmd != CMD_ACK || c.arg[0] != address + got * BLOCK_SIZE
+			|| !c.arg[1] || c.arg[1] > 12 || got + c.arg[1] > blocks)
+		{
+			fprintf(dev->out, "Error: Bad reply 0x%04x to page CRC request\n", c.cmd);
+			return -1;
+		}
+		memcpy(crcs + got, c.d.asDwords, c.arg[1] * sizeof(uint32_t));
+		got += c.arg[1];
+	}
+	return 0;
+}
+
+// Send a run of whole pages. Nothing comes back until the next CRC request,
+// so this goes as fast as the bootloader takes the packets off the bus; it
+// programs one page while the next one is coming in.
+static void stream_blocks(flash_device_t *dev, uint32_t address, uint8_t *data, uint32_t length)
+{
+	UsbCommand c = {CMD_STREAM_WRITE};
+
+	while (length) {
+		uint32_t n = length < sizeof(c.d.asBytes) ? length : sizeof(c.d.asBytes);
+
+		c.arg[0] = address;
+		c.arg[1] = n;
+		memcpy(c.d.asBytes, data, n);
+		SendCommandTo(dev->unit, &c);
+
+		// one dot per page, as write_block() does
+		if ((address & (BLOCK_SIZE-1)) + n >= BLOCK_SIZE)
+			fprintf(dev->out, ".");
+		address += n;
+		data += n;
+		length -= n;
+	}
+}
+
+static const char *stream_error(uint32_t status)
+{
+	if (status & STREAM_WRITE_ERR_FLASH)
+		return "flash programming error";
+	if (status & STREAM_WRITE_ERR_RANGE)
+		return "write outside the flash area";
+	return "write out of sequence";
+}
+
+// Write a segment with the streaming protocol. Only the pages whose CRC
+// differs from what is in flash are sent, and the result is checked by CRC
+// instead of an ACK per packet.
+static int write_segment_stream(flash_device_t *dev, flash_seg_t *seg)
+{
+	uint32_t blocks, length, crc, want, status, error_addr, changed_blocks;
+	uint32_t pos = 0, first, count;
+	uint32_t *crcs = NULL;
+	uint8_t *data, *changed = NULL;
+	double start;
+	int res = -1;
+
+	// the bootloader only takes whole pages, pad the way write_block() does
+	data = flash_seg_pages(seg, &blocks);
+	if (!data) {
+		fprintf(dev->out, " Out of memory\n");
+		return -1;
+	}
+	length = blocks * BLOCK_SIZE;
+	want = update_crc32(0, data, length);
+	dev->stats.blocks += blocks;
+
+	if (get_flash_crc(dev, seg->start, length, &crc, NULL, NULL) < 0)
+		goto out;
+	if (crc == want) {
+		fprintf(dev->out, " unchanged\n");
+		res = 0;
+		goto out;
+	}
+
+	crcs = malloc(blocks * sizeof(uint32_t));
+	changed = malloc(blocks);
+	if (!crcs || !changed) {
+		fprintf(dev->out, " Out of memory\n");
+		goto out;
+	}
+	if (get_page_crcs(dev, seg->start, blocks, crcs) < 0)
+		goto out;
+	changed_blocks = flash_diff_pages(data, blocks, crcs, changed);
+
+	start = now();
+	while (flash_next_run(changed, blocks, &pos, &first, &count))
+		stream_blocks(dev, seg->start + first * BLOCK_SIZE, data + first * BLOCK_SIZE,
+		              count * BLOCK_SIZE);
+
+	if (get_flash_crc(dev, seg->start, length, &crc, &status, &error_addr) < 0)
+		goto out;
+	dev->stats.written += changed_blocks;
+	dev->stats.write_time += now() - start;
+	if (status) {
+		fprintf(dev->out, " ERROR\n");
+		fprintf(dev->out, "Error: %s at 0x%08x\n", stream_error(status), error_addr);
+		goto out;
+	}
+	if (crc != want) {
+		fprintf(dev->out, " ERROR\n");
+		fprintf(dev->out, "Error: Flash CRC 0x%08x after writing, expected 0x%08x\n", crc, want);
+		goto out;
+	}
+	fprintf(dev->out, " OK (%d of %d blocks written)\n", changed_blocks, blocks);
+	res = 0;
+
+out:
+	free(changed);
+	free(crcs);
+	free(data);
+	return res;
 }
 
 // Write a file's segments to Flash
-int flash_write(flash_file_t *ctx)
+int flash_write(flash_device_t *dev, flash_file_t *ctx)
 {
-	fprintf(stderr, "Writing segments for file: %s\n", ctx->filename);
+	fprintf(dev->out, "Writing segments for file: %s\n", ctx->filename);
+	if (dev->bootloader_flags & DEVICE_INFO_FLAG_UNDERSTANDS_STREAM_WRITE) {
+		for (int i = 0; i < ctx->num_segs; i++) {
+			flash_seg_t *seg = &ctx->segments[i];
+
+			fprintf(dev->out, " 0x%08x..0x%08x [0x%x / %d blocks]",
+			        seg->start, seg->start + seg->length - 1, seg->length,
+			        (seg->length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+			if (write_segment_stream(dev, seg) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
 	for (int i = 0; i < ctx->num_segs; i++) {
 		flash_seg_t *seg = &ctx->segments[i];
 
@@ -427,21 +600,22 @@ int flash_write(flash_file_t *ctx)
 		uint32_t blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
 		uint32_t end = seg->start + length;
 
-		fprintf(stderr, " 0x%08x..0x%08x [0x%x / %d blocks]",
+		fprintf(dev->out, " 0x%08x..0x%08x [0x%x / %d blocks]",
 		        seg->start, end - 1, length, blocks);
 
 		int block = 0;
 		uint8_t *data = seg->data;
 		uint32_t baddr = seg->start;
+		double start = now();
 
 		while (length) {
 			uint32_t block_size = length;
 			if (block_size > BLOCK_SIZE)
 				block_size = BLOCK_SIZE;
 
-			if (write_block(baddr, data, block_size) < 0) {
-				fprintf(stderr, " ERROR\n");
-				fprintf(stderr, "Error writing block %d of %d\n", block, blocks);
+			if (write_block(dev, baddr, data, block_size) < 0) {
+				fprintf(dev->out, " ERROR\n");
+				fprintf(dev->out, "Error writing block %d of %d\n", block, blocks);
 				return -1;
 			}
 
@@ -449,13 +623,32 @@ int flash_write(flash_file_t *ctx)
 			baddr += block_size;
 			length -= block_size;
 			block++;
-			fprintf(stderr, ".");
+			fprintf(dev->out, ".");
 		}
-		fprintf(stderr, " OK\n");
+		fprintf(dev->out, " OK\n");
+		dev->stats.blocks += blocks;
+		dev->stats.written += blocks;
+		dev->stats.write_time += now() - start;
 	}
 	return 0;
 }
 
+// What the delta writes saved, over all files
+void flash_print_stats(flash_device_t *dev)
+{
+	uint32_t skipped = dev->stats.blocks - dev->stats.written;
+
+	if (!dev->stats.blocks)
+		return;
+	fprintf(dev->out, "Wrote %d of %d blocks, %d bytes unchanged and skipped",
+	        dev->stats.written, dev->stats.blocks, skipped * BLOCK_SIZE);
+	// at the rate the written blocks went at
+	if (skipped && dev->stats.written)
+		fprintf(dev->out, ", about %.1f s saved",
+		        skipped * dev->stats.write_time / dev->stats.written);
+	fprintf(dev->out, "\n");
+}
+
 // free a file context
 void flash_free(flash_file_t *ctx)
 {
@@ -471,8 +664,8 @@ void flash_free(flash_file_t *ctx)
 }
 
 // just reset the unit
-int flash_stop_flashing(void) {
+int flash_stop_flashing(flash_device_t *dev) {
 	UsbCommand c = {CMD_HARDWARE_RESET};
-	SendCommand(&c);
+	SendCommandTo(dev->unit, &c);
 	return 0;
 }
@@ -9,9 +9,13 @@
 #ifndef __FLASH_H__
 #define __FLASH_H__
 
+#include <stdio.h>
 #include <stdint.h>
 #include "elf.h"
 
+// Flash page size, the unit the bootloader writes
+#define BLOCK_SIZE             0x100
+
 typedef struct {
 	void *data;
 	uint32_t start;
@@ -25,11 +29,29 @@ typedef struct {
 	flash_seg_t *segments;
 } flash_file_t;
 
+// Totals over all flash_write() calls on a device
+typedef struct {
+	uint32_t blocks;		// pages in the images written
+	uint32_t written;		// pages that had to be sent
+	double write_time;		// seconds spent sending and checking those
+} flash_stats_t;
+
+struct prox_unit;
+
+// A unit being flashed; several can be flashed at once, from one thread each
+typedef struct {
+	struct prox_unit *unit;		// opened with OpenProxmarkUnit()
+	FILE *out;					// where progress and errors go
+	uint32_t bootloader_flags;	// what the bootloader said it can do
+	flash_stats_t stats;
+} flash_device_t;
+
 int flash_load(flash_file_t *ctx, const char *name, int can_write_bl);
-int flash_start_flashing(int enable_bl_writes);
-int flash_write(flash_file_t *ctx);
+int flash_start_flashing(flash_device_t *dev, int enable_bl_writes);
+int flash_write(flash_device_t *dev, flash_file_t *ctx);
 void flash_free(flash_file_t *ctx);
-int flash_stop_flashing(void);
+int flash_stop_flashing(flash_device_t *dev);
+void flash_print_stats(flash_device_t *dev);
 
 #endif
 
@@ -0,0 +1,114 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Working out which flash pages an image changes, by page CRC32. The
+// flasher compares against the CRCs the bootloader reports for what is in
+// flash; the same comparison between two sets of ELF files tells offline
+// what flashing one over the other is going to write.
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include "flashdiff.h"
+#include "crc32.h"
+
+uint8_t *flash_seg_pages(flash_seg_t *seg, uint32_t *blocks)
+{
+	uint8_t *data;
+
+	*blocks = (seg->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	data = malloc(*blocks * BLOCK_SIZE);
+	if (!data)
+		return NULL;
+	memset(data, 0xFF, *blocks * BLOCK_SIZE);
+	memcpy(data, seg->data, seg->length);
+	return data;
+}
+
+void flash_image_crcs(flash_file_t *files, int num_files, uint32_t start,
+                      uint32_t blocks, uint32_t *crcs)
+{
+	uint8_t erased[BLOCK_SIZE];
+	uint32_t erased_crc;
+
+	memset(erased, 0xFF, sizeof(erased));
+	erased_crc = update_crc32(0, erased, BLOCK_SIZE);
+	for (uint32_t b = 0; b < blocks; b++)
+		crcs[b] = erased_crc;
+
+	for (int i = 0; i < num_files; i++) {
+		for (int j = 0; j < files[i].num_segs; j++) {
+			flash_seg_t *seg = &files[i].segments[j];
+			uint32_t n;
+			uint8_t *data = flash_seg_pages(seg, &n);
+
+			if (!data)
+				continue;
+			for (uint32_t b = 0; b < n; b++) {
+				uint32_t page = (seg->start - start) / BLOCK_SIZE + b;
+
+				if (seg->start >= start && page < blocks)
+					crcs[page] = update_crc32(0, data + b * BLOCK_SIZE, BLOCK_SIZE);
+			}
+			free(data);
+		}
+	}
+}
+
+uint32_t flash_diff_pages(const uint8_t *data, uint32_t blocks,
+                          const uint32_t *crcs, uint8_t *changed)
+{
+	uint32_t n = 0;
+
+	for (uint32_t b = 0; b < blocks; b++) {
+		changed[b] = crcs[b] != update_crc32(0, data + b * BLOCK_SIZE, BLOCK_SIZE);
+		n += changed[b];
+	}
+	return n;
+}
+
+int flash_next_run(const uint8_t *changed, uint32_t blocks, uint32_t *pos,
+                   uint32_t *first, uint32_t *count)
+{
+	uint32_t b = *pos;
+
+	while (b < blocks && !changed[b])
+		b++;
+	if (b == blocks) {
+		*pos = b;
+		return 0;
+	}
+	*first = b;
+	while (b < blocks && changed[b])
+		b++;
+	*count = b - *first;
+	*pos = b;
+	return 1;
+}
+
+uint32_t flash_diff_files(flash_file_t *files, int num_files, uint32_t start,
+                          uint32_t blocks, const uint32_t *crcs, uint32_t *total)
+{
+	uint32_t n = 0;
+
+	*total = 0;
+	for (int i = 0; i < num_files; i++) {
+		for (int j = 0; j < files[i].num_segs; j++) {
+			flash_seg_t *seg = &files[i].segments[j];
+			uint32_t first = (seg->start - start) / BLOCK_SIZE, pages;
+			uint8_t *data = flash_seg_pages(seg, &pages);
+			uint8_t *changed = malloc(pages);
+
+			if (data && changed && seg->start >= start && first + pages <= blocks)
+				n += flash_diff_pages(data, pages, crcs + first, changed);
+			else
+				n += pages;
+			*total += pages;
+			free(changed);
+			free(data);
+		}
+	}
+	return n;
+}
@@ -0,0 +1,38 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Working out which flash pages an image changes, by page CRC32
+//-----------------------------------------------------------------------------
+
+#ifndef __FLASHDIFF_H__
+#define __FLASHDIFF_H__
+
+#include <stdint.h>
+#include "flash.h"
+
+// A segment padded with 0xFF to whole pages, the way it is written.
+// Returns a malloc()ed buffer and the number of pages in *blocks.
+uint8_t *flash_seg_pages(flash_seg_t *seg, uint32_t *blocks);
+
+// CRC32 of each page from start on, as the given files would leave them
+// in otherwise erased flash
+void flash_image_crcs(flash_file_t *files, int num_files, uint32_t start,
+                      uint32_t blocks, uint32_t *crcs);
+
+// Mark the pages of data that differ from crcs; returns how many do
+uint32_t flash_diff_pages(const uint8_t *data, uint32_t blocks,
+                          const uint32_t *crcs, uint8_t *changed);
+
+// Next run of changed pages at or after *pos, as first page and count;
+// returns 0 when there are no more
+int flash_next_run(const uint8_t *changed, uint32_t blocks, uint32_t *pos,
+                   uint32_t *first, uint32_t *count);
+
+// Pages the files would have to write over flash holding the page CRCs
+// crcs (counted from start, blocks of them), and the total in *total
+uint32_t flash_diff_files(flash_file_t *files, int num_files, uint32_t start,
+                          uint32_t blocks, const uint32_t *crcs, uint32_t *total);
+
+#endif
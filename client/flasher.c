@@ -9,25 +9,149 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "sleep.h"
 #include "proxusb.h"
 #include "flash.h"
 
 static void usage(char *argv0)
 {
-	fprintf(stderr, "Usage:   %s [-b] image.elf [image.elf...]\n\n", argv0);
-	fprintf(stderr, "\t-b\tEnable flashing of bootloader area (DANGEROUS)\n\n");
+	fprintf(stderr, "Usage:   %s [-b] [-s serial | --all] image.elf [image.elf...]\n\n", argv0);
+	fprintf(stderr, "\t-b\tEnable flashing of bootloader area (DANGEROUS)\n");
+	fprintf(stderr, "\t-s\tFlash the unit with this USB serial number, or at this location\n");
+	fprintf(stderr, "\t--all\tFlash every attached unit at once\n\n");
 	fprintf(stderr, "Example: %s path/to/osimage.elf path/to/fpgaimage.elf\n", argv0);
 }
 
 #define MAX_FILES 4
 
+static int can_write_bl = 0;
+static int num_files = 0;
+static flash_file_t files[MAX_FILES];
+
+// Same steps for one unit or many
+static int flash_unit(flash_device_t *dev)
+{
+	int res;
+
+	res = flash_start_flashing(dev, can_write_bl);
+	if (res < 0)
+		return -1;
+
+	fprintf(dev->out, "\nFlashing...\n");
+
+	for (int i = 0; i < num_files; i++) {
+		res = flash_write(dev, &files[i]);
+		if (res < 0)
+			return -1;
+		fprintf(dev->out, "\n");
+	}
+
+	flash_print_stats(dev);
+
+	fprintf(dev->out, "Resetting hardware...\n");
+
+	res = flash_stop_flashing(dev);
+	if (res < 0)
+		return -1;
+
+	CloseProxmarkUnit(dev->unit);
+	return 0;
+}
+
+typedef struct {
+	struct prox_unit unit;
+	flash_device_t dev;
+	pthread_t thread;
+	int res;
+} unit_job_t;
+
+static void *flash_unit_thread(void *arg)
+{
+	unit_job_t *job = arg;
+
+	job->res = -1;
+	if (ClaimProxmark(&job->unit, 1))
+		job->res = flash_unit(&job->dev);
+	else
+		usb_close(job->unit.handle);
+	return NULL;
+}
+
+// One thread per unit. Each one writes what it has to say to a file of its
+// own, which is shown once it is done, so the output does not get mixed up.
+static int flash_all_units(void)
+{
+	static unit_job_t jobs[MAX_PROX_UNITS];
+	struct prox_unit units[MAX_PROX_UNITS];
+	int num_units, failed = 0;
+	char line[256];
+
+	num_units = ListProxmarks(units, MAX_PROX_UNITS, 1);
+	if (!num_units) {
+		fprintf(stderr, "No Proxmark found on USB\n");
+		return -1;
+	}
+	for (int i = 0; i < num_units; i++) {
+		for (int j = 0; j < i; j++) {
+			// they are told apart by the port they are on, where it is known
+			if (strcmp(units[i].serial_number, units[j].serial_number) ||
+			    (units[i].port_path && units[j].port_path))
+				continue;
+			fprintf(stderr, "Error: %s and %s both have serial number %s; they could not be told\n"
+			                "       apart after the reset into the bootloader\n",
+			        units[j].location, units[i].location, units[i].serial_number);
+			for (int k = 0; k < num_units; k++)
+				usb_close(units[k].handle);
+			return -1;
+		}
+	}
+
+	fprintf(stderr, "Flashing %d units...\n", num_units);
+	for (int i = 0; i < num_units; i++) {
+		unit_job_t *job = &jobs[i];
+
+		job->unit = units[i];
+		job->dev.unit = &job->unit;
+		job->dev.out = tmpfile();
+		if (!job->dev.out)
+			job->dev.out = stderr;
+		if (pthread_create(&job->thread, NULL, flash_unit_thread, job)) {
+			fprintf(stderr, "Error: could not start a thread for %s\n", units[i].serial_number);
+			usb_close(job->unit.handle);
+			job->dev.out = NULL;
+		}
+	}
+
+	for (int i = 0; i < num_units; i++) {
+		unit_job_t *job = &jobs[i];
+
+		if (!job->dev.out) {
+			failed++;
+			continue;
+		}
+		pthread_join(job->thread, NULL);
+		fprintf(stderr, "\n=== SN %s [%s]: %s ===\n", units[i].serial_number, units[i].location,
+		        job->res < 0 ? "FAILED" : "OK");
+		if (job->dev.out != stderr) {
+			rewind(job->dev.out);
+			while (fgets(line, sizeof(line), job->dev.out))
+				fputs(line, stderr);
+			fclose(job->dev.out);
+		}
+		if (job->res < 0)
+			failed++;
+	}
+
+	fprintf(stderr, "\n%d of %d units flashed\n", num_units - failed, num_units);
+	return failed ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
-	int can_write_bl = 0;
-	int num_files = 0;
+	int all_units = 0;
+	const char *serial = NULL;
 	int res;
-	flash_file_t files[MAX_FILES];
 
 	memset(files, 0, sizeof(files));
 
@@ -40,11 +164,19 @@ int main(int argc, char **argv)
 		if (argv[i][0] == '-') {
 			if (!strcmp(argv[i], "-b")) {
 				can_write_bl = 1;
+			} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+				serial = argv[++i];
+			} else if (!strcmp(argv[i], "--all")) {
+				all_units = 1;
 			} else {
 				usage(argv[0]);
 				return -1;
 			}
 		} else {
+			if (num_files == MAX_FILES) {
+				usage(argv[0]);
+				return -1;
+			}
 			res = flash_load(&files[num_files], argv[i], can_write_bl);
 			if (res < 0) {
 				fprintf(stderr, "Error while loading %s\n", argv[i]);
@@ -57,35 +189,34 @@ int main(int argc, char **argv)
 
 	usb_init();
 
-	fprintf(stderr, "Waiting for Proxmark to appear on USB...");
-	while (!OpenProxmark(0)) {
-		sleep(1);
-		fprintf(stderr, ".");
+	if (all_units) {
+		res = flash_all_units();
+	} else {
+		struct prox_unit unit;
+		flash_device_t dev = {&unit, stderr};
+
+		fprintf(stderr, "Waiting for Proxmark to appear on USB...");
+		res = 0;
+		for (int i = 0; !OpenProxmarkUnit(&unit, serial, 0); i++) {
+			if (i == PROX_REOPEN_SECONDS) {
+				fprintf(stderr, " not found.\n");
+				res = -1;
+				break;
+			}
+			sleep(1);
+			fprintf(stderr, ".");
+		}
+		if (res == 0) {
+			fprintf(stderr, " Found.\n");
+			res = flash_unit(&dev);
+		}
 	}
-	fprintf(stderr, " Found.\n");
-
-	res = flash_start_flashing(can_write_bl);
-	if (res < 0)
-		return -1;
-
-	fprintf(stderr, "\nFlashing...\n");
 
-	for (int i = 0; i < num_files; i++) {
-		res = flash_write(&files[i]);
-		if (res < 0)
-			return -1;
+	for (int i = 0; i < num_files; i++)
 		flash_free(&files[i]);
-		fprintf(stderr, "\n");
-	}
-
-	fprintf(stderr, "Resetting hardware...\n");
-
-	res = flash_stop_flashing();
 	if (res < 0)
 		return -1;
 
-	CloseProxmark();
-
 	fprintf(stderr, "All done.\n\n");
 	fprintf(stderr, "Have a nice day!\n");
 
@@ -16,7 +16,7 @@ int ClearGraph(int redraw);
 int DetectClock(int peak);
 int GetClock(const char *str, int peak, int verbose);
 
-#define MAX_GRAPH_TRACE_LEN (1024*128)
+#define MAX_GRAPH_TRACE_LEN (1024*512)
 extern int GraphBuffer[MAX_GRAPH_TRACE_LEN];
 extern int GraphTraceLen;
 
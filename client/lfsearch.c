@@ -0,0 +1,247 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Every LF demodulator on one capture at once, see lfsearch.h
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "graph.h"
+#include "lfsearch.h"
+#include "em410xdemod.h"
+#include "hidfsk.h"
+#include "pskdemod.h"
+
+// Different IDs a decoder keeps count of, to report the one read most
+#define LF_MAX_IDS		8
+
+typedef struct {
+	uint32_t hi, lo;
+	int frames;
+} lf_tally_t;
+
+// Count one more frame of hi, lo; returns the entry of the ID read most
+// often so far
+static lf_tally_t *LfTally(lf_tally_t *t, int *count, uint32_t hi, uint32_t lo)
+{
+	lf_tally_t *best = t;
+	int i;
+
+	for (i = 0; i < *count; i++)
+		if (t[i].hi == hi && t[i].lo == lo)
+			break;
+	if (i == *count && *count < LF_MAX_IDS) {
+		t[i].hi = hi;
+		t[i].lo = lo;
+		t[i].frames = 0;
+		(*count)++;
+	}
+	if (i < *count)
+		t[i].frames++;
+	for (i = 1; i < *count; i++)
+		if (t[i].frames > best->frames)
+			best = &t[i];
+	return best;
+}
+
+// A graph sample as the ADC had it
+static uint8_t LfAdc(int v)
+{
+	v += 128;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Only frames that pass the row and column parity come out of the
+// demodulator
+static int DecodeEM410x(const int *samples, int n, lf_result_t *r)
+{
+	em410x_demod_t d;
+	lf_tally_t ids[LF_MAX_IDS], *best = NULL;
+	int i, count = 0, frames = 0, swing = 0;
+
+	Em410xDemodInit(&d, EM410X_DEFAULT_CLOCK);
+	for (i = 0; i < n; i++) {
+		if (!Em410xDemodSample(&d, LfAdc(samples[i])))
+			continue;
+		best = LfTally(ids, &count, d.id >> 32, d.id);
+		if (d.rssi > swing)
+			swing = d.rssi;
+		frames++;
+	}
+	if (!best)
+		return 0;
+
+	sprintf(r->id, "%02x%08x", best->hi, best->lo);
+	sprintf(r->info, "swing %d", swing);
+	r->frames = best->frames;
+	r->checked = 1;
+	r->quality = 100 * best->frames / frames;
+	return 1;
+}
+
+// The only check a HID frame has is the parity of the 26 bit format
+static int DecodeHID(const int *samples, int n, lf_result_t *r)
+{
+	hid_fsk_t d;
+	lf_tally_t ids[LF_MAX_IDS], *best = NULL;
+	uint32_t w;
+	int i, count = 0, frames = 0;
+
+	HidFskInit(&d);
+	for (i = 0; i < n; i++) {
+		if (!HidFskSample(&d, LfAdc(samples[i])))
+			continue;
+		best = LfTally(ids, &count, d.tagHi, d.tagLo);
+		frames++;
+	}
+	if (!best)
+		return 0;
+
+	sprintf(r->id, "%x%08x", best->hi, best->lo);
+	r->frames = best->frames;
+	r->quality = 100 * best->frames / frames;
+	if ((best->hi & 0xfff) == 0x20 && (best->lo >> 26) == 1) {
+		// even parity over the first 13 bits, odd over the last 13
+		w = best->lo & 0x3ffffff;
+		r->checked = !(__builtin_popcount(w >> 13) & 1) && (__builtin_popcount(w & 0x1fff) & 1);
+		sprintf(r->info, "26 bit, facility %d, card %d%s", (w >> 17) & 0xff, (w >> 1) & 0xffff,
+			r->checked ? "" : ", bad parity");
+	} else {
+		sprintf(r->info, "card %d", (best->lo >> 1) & 0xffff);
+	}
+	return 1;
+}
+
+// Indala frames carry no check; the weakest bit of the best reading says
+// how far it can be trusted. A run of equal bits comes close enough to a
+// preamble, so it is only taken from a trace that looks like PSK at RF/32,
+// with most of its phase changes on a bit boundary, and seen more than once.
+static int DecodeIndala(const int *samples, int n, lf_result_t *r)
+{
+	static int soft[MAX_GRAPH_TRACE_LEN / INDALA_CLOCK];
+	static uint32_t bits[PSK_WORDS(MAX_GRAPH_TRACE_LEN / INDALA_CLOCK)];
+	static const psk_format_t formats[] = {
+		{ INDALA_PREAMBLE_64, 32, 64, 2 },
+		{ INDALA_PREAMBLE_224, 32, 224, 2 },
+	};
+	psk_candidate_t c;
+	psk_stats_t st;
+	int bit, f, frames, nbits;
+	char *p;
+
+	if (n > MAX_GRAPH_TRACE_LEN)
+		n = MAX_GRAPH_TRACE_LEN;
+	nbits = PskDemod(samples, n, INDALA_CARRIER, INDALA_CLOCK, soft, sizeof(soft) / sizeof(soft[0]), &st);
+	if (2 * st.onTime < st.flips)
+		return 0;
+	PskPack(soft, nbits, bits);
+	for (f = 0; f < 2; f++) {
+		if (!PskSearch(soft, bits, nbits, st.level, &formats[f], &c, 1, &frames))
+			continue;
+		if (c.votes < 2 && !c.voted)
+			continue;
+		break;
+	}
+	if (f == 2)
+		return 0;
+
+	for (p = r->id, bit = 0; bit < formats[f].frameLen; bit += 4, p++)
+		sprintf(p, "%x", PSK_BIT(c.bits, bit) << 3 | PSK_BIT(c.bits, bit + 1) << 2 |
+			PSK_BIT(c.bits, bit + 2) << 1 | PSK_BIT(c.bits, bit + 3));
+	sprintf(r->info, "%d bit, %d of %d phase changes on time", formats[f].frameLen, st.onTime, st.flips);
+	r->frames = c.votes;
+	r->checked = 0;
+	r->quality = c.margin > 100 ? 100 : c.margin;
+	return 1;
+}
+
+static const lf_decoder_t em410xDecoder = { "EM410x", "lf em4x em410xdemod", DecodeEM410x };
+static const lf_decoder_t hidDecoder = { "HID Prox", "lf hid fskdemod", DecodeHID };
+static const lf_decoder_t indalaDecoder = { "Indala", "lf indalademod", DecodeIndala };
+
+static const lf_decoder_t *decoders[LF_MAX_DECODERS] = {
+	&em410xDecoder,
+	&hidDecoder,
+	&indalaDecoder,
+};
+static int numDecoders = 3;
+
+int LfRegisterDecoder(const lf_decoder_t *d)
+{
+	int i;
+
+	for (i = 0; i < numDecoders; i++)
+		if (decoders[i] == d)
+			return 1;
+	if (numDecoders == LF_MAX_DECODERS)
+		return 0;
+	decoders[numDecoders++] = d;
+	return 1;
+}
+
+typedef struct {
+	const lf_decoder_t *decoder;
+	const int *samples;
+	int n;
+	pthread_t thread;
+	int started;
+	int found;
+	lf_result_t result;
+} lf_job_t;
+
+static void *LfSearchThread(void *arg)
+{
+	lf_job_t *job = arg;
+
+	job->found = job->decoder->decode(job->samples, job->n, &job->result);
+	return NULL;
+}
+
+// Whether a is the more likely tag
+static int LfBetter(const lf_found_t *a, const lf_found_t *b)
+{
+	if (a->result.checked != b->result.checked)
+		return a->result.checked;
+	if (a->result.quality != b->result.quality)
+		return a->result.quality > b->result.quality;
+	return a->result.frames > b->result.frames;
+}
+
+int LfSearch(const int *samples, int n, lf_found_t *found)
+{
+	lf_job_t jobs[LF_MAX_DECODERS];
+	lf_found_t t;
+	int i, j, count = 0;
+
+	// one thread per decoder, all of them reading the same samples
+	for (i = 0; i < numDecoders; i++) {
+		lf_job_t *job = &jobs[i];
+
+		memset(job, 0, sizeof(*job));
+		job->decoder = decoders[i];
+		job->samples = samples;
+		job->n = n;
+		job->started = !pthread_create(&job->thread, NULL, LfSearchThread, job);
+		if (!job->started)
+			LfSearchThread(job);
+	}
+
+	for (i = 0; i < numDecoders; i++) {
+		lf_job_t *job = &jobs[i];
+
+		if (job->started)
+			pthread_join(job->thread, NULL);
+		if (!job->found)
+			continue;
+		t.decoder = job->decoder;
+		t.result = job->result;
+		for (j = count; j > 0 && LfBetter(&t, &found[j - 1]); j--)
+			found[j] = found[j - 1];
+		found[j] = t;
+		count++;
+	}
+	return count;
+}
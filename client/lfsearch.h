@@ -0,0 +1,54 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Every LF demodulator on one capture at once, for `lf search'.
+//
+// A decoder takes the samples as the graph holds them, read only, and says
+// whether it found a tag in them. All registered decoders run at the same
+// time, one thread each, on the same buffer, so none of them gets to see
+// what another one did to the graph the way running the commands one after
+// another does. The results are ranked: an ID that passed a checksum or
+// parity check first, then the more certain one, then the one read more
+// often.
+//
+// The EM410x, HID and Indala decoders are built in; anything else can
+// LfRegisterDecoder() itself before the search runs.
+//-----------------------------------------------------------------------------
+
+#ifndef LFSEARCH_H__
+#define LFSEARCH_H__
+
+#define LF_MAX_DECODERS		16
+
+typedef struct {
+	char id[64];			// the tag ID, as the decoder's own command prints it
+	char info[64];			// anything else worth knowing about it
+	int frames;				// times it was read
+	int checked;			// it passed a checksum or parity check
+	int quality;			// how sure the decoder is, 0..100
+} lf_result_t;
+
+typedef struct {
+	const char *name;
+	const char *command;	// the command that reads this tag on its own
+	// Look for a tag in n samples; returns 1 and fills in r if there is one.
+	// Runs in a thread of its own, at the same time as all the others.
+	int (*decode)(const int *samples, int n, lf_result_t *r);
+} lf_decoder_t;
+
+typedef struct {
+	const lf_decoder_t *decoder;
+	lf_result_t result;
+} lf_found_t;
+
+// Add a decoder to the ones `lf search' runs; returns 0 if there is no
+// room left for it.
+int LfRegisterDecoder(const lf_decoder_t *d);
+
+// Run every decoder on n samples; returns the number of them that found a
+// tag, their results in found, the most likely first.
+int LfSearch(const int *samples, int n, lf_found_t *found);
+
+#endif
@@ -16,7 +16,12 @@
 #include <unistd.h>
 #include <usb.h>
 #include <strings.h>
+#include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <dirent.h>
+#endif
 
 #include "sleep.h"
 #include "proxusb.h"
@@ -28,64 +33,88 @@
 #define ETIMEDOUT 116
 #endif
 
-usb_dev_handle *devh = NULL;
-static unsigned int claimed_iface = 0;
-unsigned char return_on_error = 0;
-unsigned char error_occured = 0;
+// The unit SendCommand() and friends talk to
+static struct prox_unit unit;
+static const char *selected_serial = NULL;
 extern unsigned int current_command;
 
-void SendCommand(UsbCommand *c)
+// libusb-0.1 keeps the bus list in globals, so only one thread at a time
+// may walk it
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool OpenUnit(struct prox_unit *u, const char *serial, int verbose, bool ask);
+
+bool ReopenProxmarkUnit(struct prox_unit *u, int timeout)
+{
+  struct prox_unit old = *u;
+  const char *id = old.port_path ? old.location : old.serial_number;
+
+  if (u->handle) {
+    usb_close(u->handle);
+    u->handle = NULL;
+  }
+  for (int i = 0; !OpenUnit(u, id[0] ? id : NULL, 0, false); i++) {
+    if (i >= timeout) {
+      *u = old;
+      u->handle = NULL;
+      return false;
+    }
+    sleep(1);
+  }
+  u->return_on_error = old.return_on_error;
+  u->error = old.error;
+  return true;
+}
+
+// A transfer on u failed: note it, and unless told to return, wait for the
+// unit to come back
+static void UnitFailed(struct prox_unit *u)
+{
+  u->error = true;
+  if (u->return_on_error)
+    return;
+
+  fprintf(stderr, "Trying to reopen device...\n");
+  if (!ReopenProxmarkUnit(u, PROX_REOPEN_SECONDS))
+    fprintf(stderr, "Proxmark at %s did not come back\n", u->location);
+  printf(PROXPROMPT);
+  fflush(NULL);
+}
+
+void SendCommandTo(struct prox_unit *u, UsbCommand *c)
 {
   int ret;
 
 #if 0
   printf("Sending %d bytes\n", sizeof(UsbCommand));
 #endif
-  current_command = c->cmd;
-  ret = usb_bulk_write(devh, 0x01, (char*)c, sizeof(UsbCommand), 1000);
-  if (ret<0) {
-    error_occured = 1;
-    if (return_on_error)
-      return;
-
-    fprintf(stderr, "write failed: %s!\nTrying to reopen device...\n",
-      usb_strerror());
-
-    if (devh) {
-      usb_close(devh);
-      devh = NULL;
-    }
-    while(!OpenProxmark(0)) { sleep(1); }
-    printf(PROXPROMPT);
-    fflush(NULL);
-
+  // one that did not come back may have been plugged in again since
+  if (!u->handle && !ReopenProxmarkUnit(u, 0)) {
+    u->error = true;
+    fprintf(stderr, "Proxmark at %s is not connected\n", u->location);
     return;
   }
+  ret = usb_bulk_write(u->handle, 0x01, (char*)c, sizeof(UsbCommand), 1000);
+  if (ret<0) {
+    fprintf(stderr, "write failed: %s!\n", usb_strerror());
+    UnitFailed(u);
+  }
 }
 
-bool ReceiveCommandPoll(UsbCommand *c)
+bool ReceiveCommandPollFrom(struct prox_unit *u, UsbCommand *c)
 {
   int ret;
 
   memset(c, 0, sizeof (UsbCommand));
-  ret = usb_bulk_read(devh, 0x82, (char*)c, sizeof(UsbCommand), 500);
+  if (!u->handle) {
+    u->error = true;
+    return false;
+  }
+  ret = usb_bulk_read(u->handle, 0x82, (char*)c, sizeof(UsbCommand), 500);
   if (ret<0) {
     if (ret != -ETIMEDOUT) {
-      error_occured = 1;
-      if (return_on_error)
-        return false;
-
-      fprintf(stderr, "read failed: %s(%d)!\nTrying to reopen device...\n",
-        usb_strerror(), ret);
-
-      if (devh) {
-        usb_close(devh);
-        devh = NULL;
-      }
-      while(!OpenProxmark(0)) { sleep(1); }
-      printf(PROXPROMPT);
-      fflush(NULL);
-
+      fprintf(stderr, "read failed: %s(%d)!\n", usb_strerror(), ret);
+      UnitFailed(u);
       return false;
     }
   } else {
@@ -98,24 +127,86 @@ bool ReceiveCommandPoll(UsbCommand *c)
   return ret > 0;
 }
 
-void ReceiveCommand(UsbCommand *c)
+void ReceiveCommandFrom(struct prox_unit *u, UsbCommand *c)
 {
 //  printf("%s()\n", __FUNCTION__);
   int retval = 0;
   do {
-    retval = ReceiveCommandPoll(c);
+    retval = ReceiveCommandPollFrom(u, c);
     if (retval != 1) printf("ReceiveCommandPoll returned %d\n", retval);
   } while(retval<0);
 //  printf("recv %x\n", c->cmd);
 }
 
-usb_dev_handle* findProxmark(int verbose, unsigned int *iface)
+void SendCommand(UsbCommand *c)
+{
+  current_command = c->cmd;
+  SendCommandTo(&unit, c);
+}
+
+bool ReceiveCommandPoll(UsbCommand *c)
+{
+  return ReceiveCommandPollFrom(&unit, c);
+}
+
+void ReceiveCommand(UsbCommand *c)
+{
+  ReceiveCommandFrom(&unit, c);
+}
+
+#ifdef __linux__
+static int ReadSysfsInt(const char *dev, const char *name)
+{
+  char path[300];
+  FILE *f;
+  int v = -1;
+
+  snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", dev, name);
+  f = fopen(path, "r");
+  if (!f)
+    return -1;
+  if (fscanf(f, "%d", &v) != 1)
+    v = -1;
+  fclose(f);
+  return v;
+}
+#endif
+
+// Where u is plugged in. The device number libusb-0.1 gives changes every
+// time it comes on the bus, the port it is on does not; only sysfs says
+// which port that is.
+static void UnitLocation(struct prox_unit *u, struct usb_bus *bus, struct usb_device *dev)
+{
+#ifdef __linux__
+  DIR *d = opendir("/sys/bus/usb/devices");
+  struct dirent *e;
+
+  while (d && (e = readdir(d))) {
+    // interfaces have a colon in their names, root hubs have no port
+    if (!isdigit((unsigned char)e->d_name[0]) || strchr(e->d_name, ':'))
+      continue;
+    if (ReadSysfsInt(e->d_name, "busnum") == atoi(bus->dirname) &&
+        ReadSysfsInt(e->d_name, "devnum") == dev->devnum) {
+      snprintf(u->location, sizeof(u->location), "%s", e->d_name);
+      u->port_path = true;
+      break;
+    }
+  }
+  if (d)
+    closedir(d);
+  if (u->port_path)
+    return;
+#endif
+  snprintf(u->location, sizeof(u->location), "%s/%s", bus->dirname, dev->filename);
+}
+
+int ListProxmarks(struct prox_unit *units, int max, int verbose)
 {
   struct usb_bus *busses, *bus;
   usb_dev_handle *handle = NULL;
-  struct prox_unit units[50];
   int iUnit = 0;
 
+  pthread_mutex_lock(&bus_lock);
   usb_find_busses();
   usb_find_devices();
 
@@ -124,99 +215,162 @@ usb_dev_handle* findProxmark(int verbose, unsigned int *iface)
   for (bus = busses; bus; bus = bus->next) {
     struct usb_device *dev;
     
-    for (dev = bus->devices; dev; dev = dev->next) {
+    for (dev = bus->devices; dev && iUnit < max; dev = dev->next) {
       struct usb_device_descriptor *desc = &(dev->descriptor);
 
       if ((desc->idProduct == 0x4b8f) && (desc->idVendor == 0x9ac4)) {
         handle = usb_open(dev);
         if (!handle) {
           if (verbose)
-            fprintf(stderr, "open fabiled: %s!\n", usb_strerror());
-          //return NULL;
+            fprintf(stderr, "open failed: %s!\n", usb_strerror());
           continue;
         }
-        *iface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
 
-        struct prox_unit unit = {handle, {0}};
-        usb_get_string_simple(handle, desc->iSerialNumber, unit.serial_number, sizeof(unit.serial_number));
-        units[iUnit++] = unit;
-
-        //return handle;
+        struct prox_unit *u = &units[iUnit++];
+        memset(u, 0, sizeof(*u));
+        u->handle = handle;
+        u->iface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
+        usb_get_string_simple(handle, desc->iSerialNumber, u->serial_number, sizeof(u->serial_number));
+        UnitLocation(u, bus, dev);
       }
     }
   }
+  pthread_mutex_unlock(&bus_lock);
 
-  if (iUnit > 0) {
-    int iSelection = 0;
-
-    fprintf(stdout, "\nConnected units:\n");
-
-    for (int i = 0; i < iUnit; i++) {
-      struct usb_device * dev = usb_device(units[i].handle);
-      fprintf(stdout, "\t%d. SN: %s [%s/%s]\n", i+1, units[i].serial_number, dev->bus->dirname, dev->filename);
-    }
-    if (iUnit > 1) {
-      while (iSelection < 1 || iSelection > iUnit) {
-        fprintf(stdout, "Which unit do you want to connect to? ");
-        fscanf(stdin, "%d", &iSelection);
-        }
-      }
-    else
-      iSelection = 1;
-    iSelection --;
-
-    for (int i = 0; i < iUnit; i++) {
-      if (iSelection == i) continue;
-      usb_close(units[i].handle);
-      units[i].handle = NULL;
-    }
-
-    return units[iSelection].handle;
-  }
-
-  return NULL;
+  return iUnit;
 }
 
-usb_dev_handle* OpenProxmark(int verbose)
+bool ClaimProxmark(struct prox_unit *u, int verbose)
 {
   int ret;
-  usb_dev_handle *handle = NULL;
-  unsigned int iface;
-
-  handle = findProxmark(verbose, &iface);
-  if (!handle)
-    return NULL;
 
 #ifdef __linux__
   /* detach kernel driver first */
-  ret = usb_detach_kernel_driver_np(handle, iface);
+  ret = usb_detach_kernel_driver_np(u->handle, u->iface);
   /* don't complain if no driver attached */
   if (ret<0 && ret != -61 && verbose)
     fprintf(stderr, "detach kernel driver failed: (%d) %s!\n", ret, usb_strerror());
 #endif
 
   // Needed for Windows. Optional for Mac OS and Linux
-  ret = usb_set_configuration(handle, 1);
+  ret = usb_set_configuration(u->handle, 1);
   if (ret < 0) {
     if (verbose)
       fprintf(stderr, "configuration set failed: %s!\n", usb_strerror());
-    return NULL;
+    return false;
   }
 
-  ret = usb_claim_interface(handle, iface);
+  ret = usb_claim_interface(u->handle, u->iface);
   if (ret < 0) {
     if (verbose)
       fprintf(stderr, "claim failed: %s!\n", usb_strerror());
-    return NULL;
+    return false;
+  }
+  return true;
+}
+
+static bool OpenUnit(struct prox_unit *u, const char *serial, int verbose, bool ask)
+{
+  struct prox_unit units[MAX_PROX_UNITS];
+  int match[MAX_PROX_UNITS];
+  int iUnit, nMatch = 0, iSelection = -1;
+
+  u->handle = NULL;
+  iUnit = ListProxmarks(units, MAX_PROX_UNITS, verbose);
+
+  for (int i = 0; i < iUnit; i++) {
+    if (!serial || !strcmp(units[i].serial_number, serial) || !strcmp(units[i].location, serial))
+      match[nMatch++] = i;
+  }
+  if (serial && iUnit && !nMatch && verbose)
+    fprintf(stderr, "No unit with serial number or location %s\n", serial);
+
+  if (nMatch == 1) {
+    iSelection = match[0];
+  } else if (nMatch > 1 && ask) {
+    // nothing to tell them apart by, ask
+    int i = 0;
+
+    fprintf(stdout, "\nConnected units:\n");
+
+    for (int j = 0; j < nMatch; j++)
+      fprintf(stdout, "\t%d. SN: %s [%s]\n", j+1, units[match[j]].serial_number, units[match[j]].location);
+
+    while (i < 1 || i > nMatch) {
+      fprintf(stdout, "Which unit do you want to connect to? ");
+      if (fscanf(stdin, "%d", &i) != 1)
+        break;
+    }
+    if (i >= 1 && i <= nMatch)
+      iSelection = match[i-1];
+  }
+
+  for (int i = 0; i < iUnit; i++) {
+    if (iSelection == i) continue;
+    usb_close(units[i].handle);
+  }
+  if (iSelection < 0)
+    return false;
+
+  *u = units[iSelection];
+  if (!ClaimProxmark(u, verbose)) {
+    usb_close(u->handle);
+    u->handle = NULL;
+    return false;
   }
-  claimed_iface = iface;
-  devh = handle;
-  return handle;
+  return true;
+}
+
+bool OpenProxmarkUnit(struct prox_unit *u, const char *serial, int verbose)
+{
+  return OpenUnit(u, serial, verbose, true);
+}
+
+void CloseProxmarkUnit(struct prox_unit *u)
+{
+  if (!u->handle)
+    return;
+  usb_release_interface(u->handle, u->iface);
+  usb_close(u->handle);
+  u->handle = NULL;
+}
+
+void SelectProxmark(const char *serial)
+{
+  selected_serial = serial;
+}
+
+usb_dev_handle* OpenProxmark(int verbose)
+{
+  const char *serial = selected_serial;
+
+  if (!serial)
+    serial = getenv("PROXMARK3_SERIAL");
+  if (serial && !serial[0])
+    serial = NULL;
+
+  bool return_on_error = unit.return_on_error;
+
+  if (!OpenProxmarkUnit(&unit, serial, verbose))
+    return NULL;
+  unit.return_on_error = return_on_error;
+  return unit.handle;
 }
 
 void CloseProxmark(void)
 {
-  usb_release_interface(devh, claimed_iface);
-  usb_close(devh);
-  devh = NULL;
+  CloseProxmarkUnit(&unit);
+}
+
+void ProxmarkReturnOnError(bool on)
+{
+  unit.return_on_error = on;
+}
+
+bool ProxmarkError(void)
+{
+  bool error = unit.error;
+
+  unit.error = false;
+  return error;
 }
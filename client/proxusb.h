@@ -16,19 +16,51 @@
 #include <usb.h>
 #include "usb_cmd.h"
 
-extern unsigned char return_on_error;
-extern unsigned char error_occured;
+#define MAX_PROX_UNITS 50
+// How long a unit that went away gets to come back
+#define PROX_REOPEN_SECONDS 30
 
+// One attached Proxmark. Any number of them can be open at a time, each
+// one driven from its own thread.
+struct prox_unit {
+  usb_dev_handle *handle;
+  unsigned int iface;
+  char serial_number[256];
+  char location[64];      // where it is plugged in: the port path, e.g. 1-1.2,
+                          // where the system tells, else bus/device
+  bool port_path;         // location is a port path, the same after a reset
+  bool return_on_error;   // a failed transfer only sets error, it does not
+                          // wait for the unit to come back
+  bool error;             // a transfer failed
+};
+
+// Open every attached unit, without claiming it; returns how many
+int ListProxmarks(struct prox_unit *units, int max, int verbose);
+bool ClaimProxmark(struct prox_unit *unit, int verbose);
+// Open and claim the unit with this serial number or location, or with
+// serial NULL any unit; if that leaves more than one, the user picks
+bool OpenProxmarkUnit(struct prox_unit *unit, const char *serial, int verbose);
+// Open the unit again after it went away, e.g. reset into the bootloader:
+// the one at the same port, or with the same serial number where the port
+// is not known. Gives up after timeout seconds, leaving it closed.
+bool ReopenProxmarkUnit(struct prox_unit *unit, int timeout);
+void CloseProxmarkUnit(struct prox_unit *unit);
+void SendCommandTo(struct prox_unit *unit, UsbCommand *c);
+bool ReceiveCommandPollFrom(struct prox_unit *unit, UsbCommand *c);
+void ReceiveCommandFrom(struct prox_unit *unit, UsbCommand *c);
+
+// The same, on the unit that OpenProxmark() opened: the one SelectProxmark()
+// named, else the one in $PROXMARK3_SERIAL, else the only one or the one the
+// user picks
+void SelectProxmark(const char *serial);
 void SendCommand(UsbCommand *c);
 bool ReceiveCommandPoll(UsbCommand *c);
 void ReceiveCommand(UsbCommand *c);
-struct usb_dev_handle* FindProxmark(int verbose, unsigned int *iface);
 struct usb_dev_handle* OpenProxmark(int verbose);
 void CloseProxmark(void);
-
-struct prox_unit {
-  usb_dev_handle *handle;
-  char serial_number[256];
-};
+// Have its failed transfers return rather than wait for it to come back
+void ProxmarkReturnOnError(bool on);
+// Whether a transfer failed since the last call
+bool ProxmarkError(void);
 
 #endif
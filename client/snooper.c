@@ -13,17 +13,14 @@
 #include "proxusb.h"
 #include "cmdmain.h"
 
-#define HANDLE_ERROR if (error_occured) { \
-  error_occured = 0;\
-  break;\
-}
+#define HANDLE_ERROR if (ProxmarkError()) break;
 
 int main()
 {
   usb_init();
   SetLogFilename("snooper.log");
 
-  return_on_error = 1;
+  ProxmarkReturnOnError(true);
 
   while(1) {
     while (!OpenProxmark(0)) { sleep(1); }
@@ -0,0 +1,29 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// CRC32
+//-----------------------------------------------------------------------------
+
+#include "crc32.h"
+
+// Four bits at a time: small enough for the bootrom, and still a lot
+// faster than going bit by bit
+static const uint32_t crc32_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t update_crc32(uint32_t crc, const uint8_t *data, int len)
+{
+	crc = ~crc;
+	while(len-- > 0) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0xf];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0xf];
+	}
+	return ~crc;
+}
@@ -0,0 +1,18 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// CRC32
+//-----------------------------------------------------------------------------
+
+#ifndef __CRC32_H
+#define __CRC32_H
+
+#include <stdint.h>
+
+// IEEE 802.3 CRC32, the one zlib computes. Start with crc = 0 and feed the
+// result of one call into the next to checksum a buffer in pieces.
+uint32_t update_crc32(uint32_t crc, const uint8_t *data, int len);
+
+#endif
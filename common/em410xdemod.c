@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Streaming EM410x demodulator, see em410xdemod.h
+//-----------------------------------------------------------------------------
+
+#include "em410xdemod.h"
+
+void Em410xDemodInit(em410x_demod_t *d, int clock)
+{
+	d->clock = clock > 0 ? clock : EM410X_DEFAULT_CLOCK;
+	d->winMax = 0;
+	d->winMin = 255;
+	d->winLen = 0;
+	d->swing = 0;
+	d->hi = 0;
+	d->lo = 0;
+	d->level = 0;
+	d->since = 0;
+	d->lastHalf = 0;
+	d->phase = 0;
+	d->shift[0] = d->shift[1] = 0;
+	d->bits[0] = d->bits[1] = 0;
+	d->id = 0;
+	d->rssi = 0;
+}
+
+// The 64 bits of a frame, first one in bit 63
+static int Em410xFrame(uint64_t f, uint64_t *id)
+{
+	int row, nibble, colParity = 0;
+	uint64_t v = 0;
+
+	if((f >> 55) != 0x1ff || (f & 1)) return 0;
+
+	for(row = 0; row < 10; row++) {
+		nibble = (f >> (51 - 5 * row)) & 0xf;
+		if(((nibble ^ (nibble >> 1) ^ (nibble >> 2) ^ (nibble >> 3)) & 1) != ((f >> (50 - 5 * row)) & 1))
+			return 0;
+		colParity ^= nibble;
+		v = (v << 4) | nibble;
+	}
+	if(((f >> 1) & 0xf) != colParity) return 0;
+
+	*id = v;
+	return 1;
+}
+
+static int Em410xHalfBit(em410x_demod_t *d, int h)
+{
+	int p = d->phase;
+	uint64_t id;
+
+	d->phase ^= 1;
+	if(h == d->lastHalf) {
+		// not Manchester in this pairing
+		d->bits[p] = 0;
+		d->lastHalf = h;
+		return 0;
+	}
+
+	d->shift[p] = (d->shift[p] << 1) | d->lastHalf;
+	d->lastHalf = h;
+	if(d->bits[p] < 64) {
+		d->bits[p]++;
+		if(d->bits[p] < 64) return 0;
+	}
+
+	if(!Em410xFrame(d->shift[p], &id) && !Em410xFrame(~d->shift[p], &id))
+		return 0;
+	d->id = id;
+	d->rssi = d->swing;
+	return 1;
+}
+
+int Em410xDemodSample(em410x_demod_t *d, uint8_t sample)
+{
+	int n, old, frame = 0;
+
+	if(sample > d->winMax) d->winMax = sample;
+	if(sample < d->winMin) d->winMin = sample;
+	if(++d->winLen >= 4 * d->clock) {
+		d->swing = d->winMax - d->winMin;
+		d->hi = d->winMin + d->swing * 3 / 4;
+		d->lo = d->winMin + d->swing / 4;
+		d->winMax = 0;
+		d->winMin = 255;
+		d->winLen = 0;
+	}
+
+	if(d->since < 0xffff) d->since++;
+	if(d->swing < EM410X_MIN_SWING) {
+		d->bits[0] = d->bits[1] = 0;
+		return 0;
+	}
+	if(d->level ? sample >= d->lo : sample <= d->hi)
+		return 0;
+
+	// the level before this change lasted one or two half bits
+	old = d->level;
+	d->level = !old;
+	n = (d->since + d->clock / 4) / (d->clock / 2);
+	d->since = 0;
+	if(n < 1 || n > 2) {
+		d->bits[0] = d->bits[1] = 0;
+		return 0;
+	}
+	while(n--)
+		frame |= Em410xHalfBit(d, old);
+	return frame;
+}
@@ -0,0 +1,60 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Streaming EM410x demodulator (ASK, Manchester, RF/64 by default).
+//
+// Takes the ADC samples one at a time, the way the device reads them out of
+// its DMA ring; the client runs the same code over the graph. The envelope
+// swings hard on every level change of the tag's modulation and decays in
+// between, so a level change is a sample beyond 3/4 of the swing seen in the
+// last few bit periods, towards the other side. The time between two level
+// changes is one or two half bits; the half bits are paired up into bits
+// both ways, since there is no telling from a run of ones where a bit
+// starts, and both polarities are tried on each 64 bit window:
+//
+//   1111 1111 1           <-- header
+//   XXXX P                <-- 10 rows of 4 ID bits and even parity
+//   ....
+//   CCCC                  <-- column parity
+//   0                     <-- stop bit
+//-----------------------------------------------------------------------------
+
+#ifndef __EM410XDEMOD_H
+#define __EM410XDEMOD_H
+
+#include <stdint.h>
+
+#define EM410X_DEFAULT_CLOCK	64
+
+// Less swing than this (in ADC counts) is taken as no tag at all
+#define EM410X_MIN_SWING		32
+
+typedef struct {
+	uint16_t clock;			// samples per bit
+	// level changes
+	uint8_t winMax, winMin;	// peaks of the bit periods being looked at
+	uint16_t winLen;
+	uint8_t swing;			// peak to peak of the last ones looked at
+	uint8_t hi, lo;			// thresholds from it
+	uint8_t level;
+	uint16_t since;			// samples since the last level change
+	// half bits
+	uint8_t lastHalf;
+	uint8_t phase;			// which of the two pairings the next half bit completes
+	// bits, for either pairing
+	uint64_t shift[2];
+	uint8_t bits[2];
+	// last frame found
+	uint64_t id;			// 40 bits
+	uint8_t rssi;			// swing while it came in
+} em410x_demod_t;
+
+void Em410xDemodInit(em410x_demod_t *d, int clock);
+
+// Feed one ADC sample; returns 1 when it completed a frame, whose ID is
+// then in d->id (and its signal strength in d->rssi) until the next one.
+int Em410xDemodSample(em410x_demod_t *d, uint8_t sample);
+
+#endif /* __EM410XDEMOD_H */
@@ -0,0 +1,204 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Streaming HID Prox FSK demodulator, see hidfsk.h
+//-----------------------------------------------------------------------------
+
+#include "hidfsk.h"
+
+// 111000, the start of frame marker (invalid Manchester, no transitions)
+#define HID_SOF		0x38
+// Bits between two of them: with the marker, 96 half bits a frame
+#define HID_FRAME_BITS	45
+
+void HidFskInit(hid_fsk_t *d)
+{
+	d->max = 0;
+	d->min = 255;
+	d->level = 0;
+	d->cycle = 0;
+	d->fc = 0;
+	d->run = 0;
+	d->started = 0;
+	d->window = 0;
+	d->have = 0;
+	d->found = 0;
+	d->phase = 0;
+	d->bits = 0;
+	d->hi = 0;
+	d->lo = 0;
+	d->tagHi = 0;
+	d->tagLo = 0;
+	d->rssi = 0;
+}
+
+// Out of sync within a frame: go back to looking for a start of frame
+// marker, in the half bits after the first one of the bad bit.
+static void HidFskLost(hid_fsk_t *d, int keep)
+{
+	d->found = 0;
+	d->have = keep;
+	d->bits = 0;
+	d->hi = 0;
+	d->lo = 0;
+}
+
+// 01 pattern represents a 1 and 10 represents a 0; a frame runs from one
+// start of frame marker to the next, which only counts on a bit boundary.
+static int HidFskHalfBit(hid_fsk_t *d, int b)
+{
+	int ok;
+
+	d->window = (d->window << 1) | b;
+	if(d->have < 6) d->have++;
+
+	if(!d->found) {
+		if(d->have == 6 && (d->window & 0x3f) == HID_SOF) {
+			d->found = 1;
+			d->phase = 0;
+			d->max = 0;
+			d->min = 255;
+		}
+		return 0;
+	}
+
+	d->phase++;
+	if(d->phase == 2) {
+		switch(d->window & 3) {
+			case 2:
+				d->hi = (d->hi << 1) | (d->lo >> 31);
+				d->lo = (d->lo << 1) | 0;
+				d->phase = 0;
+				if(d->bits < 0xff) d->bits++;
+				return 0;
+			case 1:
+				d->hi = (d->hi << 1) | (d->lo >> 31);
+				d->lo = (d->lo << 1) | 1;
+				d->phase = 0;
+				if(d->bits < 0xff) d->bits++;
+				return 0;
+			case 3:
+				// could be the next start of frame marker, see what follows
+				return 0;
+			default:
+				HidFskLost(d, 1);
+				return 0;
+		}
+	}
+	if(d->phase < 6) return 0;
+
+	if((d->window & 0x3f) != HID_SOF) {
+		HidFskLost(d, 5);
+		return 0;
+	}
+
+	// end of this frame is the start of the next one; a short one is what
+	// is left of a frame the tag was half way through when it showed up
+	d->phase = 0;
+	ok = d->bits == HID_FRAME_BITS && (d->hi | d->lo);
+	if(ok) {
+		d->tagHi = d->hi;
+		d->tagLo = d->lo;
+		d->rssi = d->max - d->min;
+	}
+	d->max = 0;
+	d->min = 255;
+	d->bits = 0;
+	d->hi = 0;
+	d->lo = 0;
+	return ok;
+}
+
+int HidFskSample(hid_fsk_t *d, uint8_t sample)
+{
+	int level, fc, n, frame = 0;
+
+	// we don't care about actual value, only if it's more or less than a
+	// threshold essentially we capture zero crossings
+	level = sample >= 127;
+	if(sample > d->max) d->max = sample;
+	if(sample < d->min) d->min = sample;
+	if(d->cycle < 0xffff) d->cycle++;
+	if(d->level || !level) {
+		d->level = level;
+		return 0;
+	}
+	d->level = level;
+
+	// count cycles between consecutive lo-hi transitions, there should be either 8 (fc/8)
+	// or 10 (fc/10) cycles but in practice due to noise etc we may end up with with anywhere
+	// between 7 to 11 cycles so fuzz it by treat anything <9 as 8 and anything else as 10
+	fc = d->cycle <= 8;
+	d->cycle = 0;
+
+	if(!d->started) {
+		d->started = 1;
+		d->fc = fc;
+		d->run = 1;
+		return 0;
+	}
+	if(fc == d->fc) {
+		if(d->run < 0xffff) d->run++;
+		return 0;
+	}
+
+	// a bit time is five fc/10 or six fc/8 cycles so figure out how many bits a pattern width represents,
+	// an extra fc/8 pattern preceeds every 4 bits (about 200 cycles) just to complicate things but it gets
+	// swallowed up by rounding
+	// expected results are 1 or 2 bits, any more and it's an invalid manchester encoding
+	// special start of frame markers use invalid manchester states (no transitions) by using sequences
+	// like 111000, and when a logic 0 is immediately followed by the start of the next transmisson
+	// a pattern of 4 bit duration lengths is created
+	if(d->fc) {
+		n = (d->run + 1) / 6;			// fc/8 in sets of 6
+	} else {
+		n = (d->run + 1) / 5;			// fc/10 in sets of 5
+	}
+	if(n == 0) n = 1;
+	if(n > 4) n = 0;					// this shouldn't happen, don't stuff any bits
+	while(n--)
+		frame |= HidFskHalfBit(d, d->fc);
+
+	d->fc = fc;
+	d->run = 0;
+	return frame;
+}
+
+static void HidFskHalf(uint8_t *bits, int n, int b)
+{
+	if(b)
+		bits[n / 8] |= 0x80 >> (n % 8);
+	else
+		bits[n / 8] &= ~(0x80 >> (n % 8));
+}
+
+// Bit i of the ID (43 is the first one out), after the 8 half bits of the
+// marker and the 0
+static void HidFskBit(uint8_t *bits, int i, int b)
+{
+	HidFskHalf(bits, 8 + 2 * (43 - i), !b);
+	HidFskHalf(bits, 9 + 2 * (43 - i), b);
+}
+
+void HidFskPatch(uint8_t *bits, uint32_t hi, uint32_t lo, uint32_t oldHi, uint32_t oldLo)
+{
+	uint32_t d;
+	int i;
+
+	for(i = 0, d = (hi ^ oldHi) & 0xfff; d; i++, d >>= 1)
+		if(d & 1) HidFskBit(bits, 32 + i, (hi >> i) & 1);
+	for(i = 0, d = lo ^ oldLo; d; i++, d >>= 1)
+		if(d & 1) HidFskBit(bits, i, (lo >> i) & 1);
+}
+
+void HidFskBits(uint8_t *bits, uint32_t hi, uint32_t lo)
+{
+	static const uint8_t sof[] = { 1, 1, 1, 0, 0, 0, 1, 0 };
+	int i;
+
+	for(i = 0; i < 8; i++)
+		HidFskHalf(bits, i, sof[i]);
+	HidFskPatch(bits, hi, lo, ~hi, ~lo);
+}
@@ -0,0 +1,67 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Streaming HID Prox FSK demodulator, and the frames to simulate a tag with.
+//
+// Takes the 125kHz ADC samples one at a time, as they come out of the DMA
+// ring, and runs the same four steps CmdHIDdemodFSK() used to run over a
+// full BigBuf: zero crossings, fc/8 vs fc/10 cycles, runs of cycles into
+// Manchester half bits, and half bits into the tag ID between two start of
+// frame markers. Each step keeps just enough state to carry on with the
+// next sample, so there is no need to stop sampling to decode.
+//
+// A frame is 96 Manchester half bits of RF/50, fc/8 for a 1 and fc/10 for a
+// 0: the start of frame marker 111000 (no transitions, so it can not be
+// mistaken for data), a 0, and the 44 bit ID MSB first, 1 as 01 and 0 as
+// 10. For the simulator (see lfsim.h) that is an FSK descriptor of those
+// half bits, NRZ with a clock of 50.
+//-----------------------------------------------------------------------------
+
+#ifndef __HIDFSK_H
+#define __HIDFSK_H
+
+#include <stdint.h>
+
+typedef struct {
+	// zero crossings
+	uint8_t max, min;		// peaks of the samples since the last frame
+	uint8_t level;			// last sample, thresholded
+	uint16_t cycle;			// samples since the last lo-hi transition
+	// cycle counts
+	uint8_t fc;				// 1 for fc/8, 0 for fc/10, of the current run
+	uint16_t run;			// length of the current run, less one
+	uint8_t started;		// seen the first cycle
+	// half bits
+	uint8_t window;			// the last half bits, newest in bit 0
+	uint8_t have;			// how many of them are valid, up to 6
+	uint8_t found;			// in a frame, after a start of frame marker
+	uint8_t phase;			// half bits since the last bit boundary
+	uint8_t bits;			// bits of this frame so far
+	// tag ID
+	uint32_t hi, lo;		// being shifted in
+	uint32_t tagHi, tagLo;	// of the last complete frame
+	uint8_t rssi;			// and the peak to peak of the samples it came in
+} hid_fsk_t;
+
+void HidFskInit(hid_fsk_t *d);
+
+// Feed one sample; returns 1 when it completed a frame, whose ID is then
+// in d->tagHi, d->tagLo (and its signal strength in d->rssi) until the
+// next one.
+int HidFskSample(hid_fsk_t *d, uint8_t sample);
+
+#define HID_FSK_HALF_BITS	96
+#define HID_FSK_CLOCK		50
+#define HID_FSK_FC0			10
+#define HID_FSK_FC1			8
+
+// The half bits of a frame, MSB first
+void HidFskBits(uint8_t *bits, uint32_t hi, uint32_t lo);
+
+// Change bits from the frame of oldHi, oldLo to that of hi, lo, rewriting
+// only the half bits of the ID bits that differ
+void HidFskPatch(uint8_t *bits, uint32_t hi, uint32_t lo, uint32_t oldHi, uint32_t oldLo);
+
+#endif /* __HIDFSK_H */
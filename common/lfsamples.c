@@ -0,0 +1,156 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Packed LF captures, see lfsamples.h
+//-----------------------------------------------------------------------------
+
+#include "lfsamples.h"
+
+void LfSamplesInit(lf_samples_t *s, int encoding, int threshold, int decimation,
+	uint8_t *dest, int size)
+{
+	if(decimation < 1) decimation = 1;
+	if(decimation > LF_SAMPLES_MAX_DECIMATION) decimation = LF_SAMPLES_MAX_DECIMATION;
+	if(encoding > LF_SAMPLES_ZC) encoding = LF_SAMPLES_8BIT;
+
+	s->dest = dest;
+	s->size = size;
+	s->len = 0;
+	s->samples = 0;
+	s->encoding = encoding;
+	s->threshold = threshold ? threshold : LF_SAMPLES_DEFAULT_THRESHOLD;
+	s->decimation = decimation;
+	s->skip = 0;
+	s->level = 0;
+	s->run = 0;
+	s->pending = 0;
+	s->acc = 0;
+}
+
+int LfSamplesPut(lf_samples_t *s, uint8_t sample)
+{
+	int b;
+
+	if(s->samples >= LF_SAMPLES_MAX) return 0;
+	if(s->skip) {
+		s->skip--;
+		s->samples++;
+		return 1;
+	}
+
+	switch(s->encoding) {
+		case LF_SAMPLES_4BIT:
+			if(!s->pending) {
+				if(s->len >= s->size) return 0;
+				s->acc = sample & 0xf0;
+				s->pending = 1;
+			} else {
+				s->dest[s->len++] = s->acc | (sample >> 4);
+				s->pending = 0;
+			}
+			break;
+
+		case LF_SAMPLES_1BIT:
+			if(!s->pending && s->len >= s->size) return 0;
+			s->acc = (s->acc << 1) | (sample >= s->threshold);
+			if(++s->pending == 8) {
+				s->dest[s->len++] = s->acc;
+				s->pending = 0;
+			}
+			break;
+
+		case LF_SAMPLES_ZC:
+			// one byte is always kept free for LfSamplesFlush()
+			b = sample >= s->threshold;
+			if(b != s->level) {
+				if(s->len + 2 > s->size) return 0;
+				s->dest[s->len++] = s->run;
+				s->level = b;
+				s->run = 1;
+			} else if(s->run == 255) {
+				if(s->len + 3 > s->size) return 0;
+				s->dest[s->len++] = 255;
+				s->dest[s->len++] = 0;
+				s->run = 1;
+			} else {
+				s->run++;
+			}
+			break;
+
+		default:
+			if(s->len >= s->size) return 0;
+			s->dest[s->len++] = sample;
+			break;
+	}
+
+	s->skip = s->decimation - 1;
+	s->samples++;
+	return 1;
+}
+
+int LfSamplesFlush(lf_samples_t *s)
+{
+	switch(s->encoding) {
+		case LF_SAMPLES_4BIT:
+			if(s->pending) s->dest[s->len++] = s->acc;
+			break;
+		case LF_SAMPLES_1BIT:
+			if(s->pending) s->dest[s->len++] = s->acc << (8 - s->pending);
+			break;
+		case LF_SAMPLES_ZC:
+			if(s->run) s->dest[s->len++] = s->run;
+			break;
+	}
+	s->pending = 0;
+	s->run = 0;
+
+	return s->len;
+}
+
+int LfSamplesDecode(int encoding, int decimation, uint32_t samples,
+	const uint8_t *in, int len, int *out, int max)
+{
+	int n = 0, i, j, k, v, level = 0;
+
+	if(decimation < 1) decimation = 1;
+	if(samples < (uint32_t)max) max = samples;
+
+// Put one kept sample, decimation times
+#define LF_OUT(x) { \
+		v = (x); \
+		for(k = 0; k < decimation; k++) { \
+			if(n >= max) return n; \
+			out[n++] = v; \
+		} \
+	}
+
+	for(i = 0; i < len; i++) {
+		switch(encoding) {
+			case LF_SAMPLES_4BIT:
+				LF_OUT((in[i] & 0xf0) + 8 - 128);
+				LF_OUT(((in[i] & 0x0f) << 4) + 8 - 128);
+				break;
+
+			case LF_SAMPLES_1BIT:
+				for(j = 7; j >= 0; j--)
+					LF_OUT((in[i] >> j) & 1 ? 127 : -128);
+				break;
+
+			case LF_SAMPLES_ZC:
+				for(j = 0; j < in[i]; j++)
+					LF_OUT(level ? 127 : -128);
+				level = !level;
+				break;
+
+			default:
+				LF_OUT(in[i] - 128);
+				break;
+		}
+	}
+
+#undef LF_OUT
+
+	return n;
+}
@@ -0,0 +1,81 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Packed LF captures.
+//
+// A raw capture keeps one 8 bit ADC sample per byte, so BigBuf holds 32000
+// samples, a quarter of a second at 125kHz. The other encodings trade
+// resolution for length:
+//
+//   LF_SAMPLES_4BIT   top nibble of each sample, two to a byte, first one in
+//                     the high nibble (2x)
+//   LF_SAMPLES_1BIT   above/below a threshold, eight to a byte, MSB first (8x)
+//   LF_SAMPLES_ZC     the same levels, stored as the length of each run
+//                     between zero crossings, one byte per run; runs start
+//                     below the threshold and alternate, a run longer than
+//                     255 goes in as 255 and an empty run of the other level
+//                     (4x for FSK up to 30x and more for slow ASK)
+//
+// and any of them can keep only every Nth sample on top of that. The device
+// encodes as it samples (armsrc/lfops.c); the client expands a capture back
+// into the graph at the original sample rate, repeating decimated samples.
+//-----------------------------------------------------------------------------
+
+#ifndef __LFSAMPLES_H
+#define __LFSAMPLES_H
+
+#include <stdint.h>
+
+#define LF_SAMPLES_8BIT		0
+#define LF_SAMPLES_4BIT		1
+#define LF_SAMPLES_1BIT		2
+#define LF_SAMPLES_ZC		3
+
+// CMD_ACQUIRE_RAW_ADC_SAMPLES_125K: arg[1] is the encoding, with the
+// threshold for the 1 bit and ZC encodings in bits 8..15 (0 for the
+// default), arg[2] the decimation (0 or 1 for none).
+#define LF_SAMPLES_ENCODING(x)		((x) & 0xff)
+#define LF_SAMPLES_THRESHOLD(x)		(((x) >> 8) & 0xff)
+#define LF_SAMPLES_DEFAULT_THRESHOLD	128
+#define LF_SAMPLES_MAX_DECIMATION	255
+
+// A capture stops once it covers this many samples, however much room it
+// has left, which is as much as the client's graph takes.
+#define LF_SAMPLES_MAX		(512 * 1024)
+
+typedef struct {
+	uint8_t *dest;
+	int size;				// bytes at dest
+	int len;				// bytes used so far
+	uint32_t samples;		// ADC samples taken, before decimation
+	uint8_t encoding;
+	uint8_t threshold;
+	uint8_t decimation;
+	uint8_t skip;			// samples left to drop before the next one is kept
+	uint8_t level;			// ZC: level of the current run
+	uint8_t run;			// ZC: its length so far
+	uint8_t pending;		// 4 and 1 bit: samples in the byte being filled
+	uint8_t acc;			// and the byte itself
+} lf_samples_t;
+
+void LfSamplesInit(lf_samples_t *s, int encoding, int threshold, int decimation,
+	uint8_t *dest, int size);
+
+// One ADC sample; returns 0 once the capture is full and the sample could
+// not be kept.
+int LfSamplesPut(lf_samples_t *s, uint8_t sample);
+
+// Write out what is still held back (the last run, a part filled byte);
+// returns the number of bytes in the capture.
+int LfSamplesFlush(lf_samples_t *s);
+
+// Expand a capture of len bytes into graph samples (-128..127, as the graph
+// takes them) at the original rate; samples is the count the device took,
+// as it was reported in the ACK. Levels come back as -128 and 127. Returns
+// the number written to out, at most max.
+int LfSamplesDecode(int encoding, int decimation, uint32_t samples,
+	const uint8_t *in, int len, int *out, int max);
+
+#endif /* __LFSAMPLES_H */
@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// LF tag simulation from a descriptor, see lfsim.h
+//-----------------------------------------------------------------------------
+
+#include "lfsim.h"
+
+// us to carrier cycles at 125kHz
+#define LF_SIM_US_TO_CYCLES(us)	(((us) + 4) / 8)
+
+int LfSimInit(lf_sim_t *s, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+	const uint8_t *data)
+{
+	int i;
+
+	s->modulation = arg0 & 0xff;
+	s->encoding = (arg0 >> 8) & 0xff;
+	s->invert = (arg0 >> 16) & 1;
+	s->clock = arg1 & 0xffff;
+	s->fc0 = (arg1 >> 16) & 0xff;
+	s->fc1 = (arg1 >> 24) & 0xff;
+	s->bits = arg2 & 0xffff;
+	s->gap = arg2 >> 16;
+
+	if(s->modulation > LF_SIM_PSK || s->encoding > LF_SIM_BIPHASE) return 0;
+	if(s->bits < 1 || s->bits > LF_SIM_MAX_BITS) return 0;
+	// a half bit has to be at least a cycle
+	if(s->clock < 2) return 0;
+	if(s->modulation == LF_SIM_FSK && (s->fc0 < 2 || s->fc1 < 2)) return 0;
+	if(s->modulation == LF_SIM_PSK && s->fc0 < 2) return 0;
+
+	for(i = 0; i < (s->bits + 7) / 8; i++)
+		s->data[i] = data[i];
+	return 1;
+}
+
+void LfSimStart(lf_sim_state_t *st, const lf_sim_t *s)
+{
+	st->sim = s;
+	st->tab = 0;
+	st->period = 0;
+	st->next = 0;
+	st->bit = 0;
+	st->cycle = 0;
+	st->sub = 0;
+	st->level = 0;
+	st->phase = 0;
+	st->gap = LF_SIM_US_TO_CYCLES(s->gap);
+	st->gapLeft = 0;
+}
+
+void LfSimStartRaw(lf_sim_state_t *st, const uint8_t *tab, int period, int gap)
+{
+	st->sim = 0;
+	st->tab = tab;
+	st->period = period > 0 ? period : 1;
+	st->next = 0;
+	st->bit = 0;
+	st->cycle = 0;
+	st->gap = LF_SIM_US_TO_CYCLES(gap);
+	st->gapLeft = 0;
+}
+
+static int LfSimDesc(lf_sim_state_t *st)
+{
+	const lf_sim_t *s = st->sim;
+	int b, second, level, out, fc;
+
+	b = (s->data[st->bit >> 3] >> (7 - (st->bit & 7))) & 1;
+	second = st->cycle >= s->clock / 2;
+	switch(s->encoding) {
+		case LF_SIM_MANCHESTER:
+			level = second ? b : !b;
+			break;
+		case LF_SIM_BIPHASE:
+			if(st->cycle == 0) st->phase = !st->level;
+			level = st->phase ^ (second && !b);
+			break;
+		default:
+			level = b;
+			break;
+	}
+
+	switch(s->modulation) {
+		case LF_SIM_FSK:
+			// start a new subcarrier period when the frequency changes
+			if(level != st->level) st->sub = 0;
+			fc = level ? s->fc1 : s->fc0;
+			out = st->sub < (fc + 2) / 4;
+			if(++st->sub >= fc) st->sub = 0;
+			break;
+		case LF_SIM_PSK:
+			out = (st->sub < s->fc0 / 2) ^ level;
+			if(++st->sub >= s->fc0) st->sub = 0;
+			break;
+		default:
+			out = level;
+			break;
+	}
+	st->level = level;
+
+	if(++st->cycle >= s->clock) {
+		st->cycle = 0;
+		if(++st->bit >= s->bits) st->bit = 0;
+	}
+
+	return out ^ s->invert;
+}
+
+// The next descriptor takes over after the current one's last cycle; the
+// subcarrier carries on where it is, or a reader would see a glitch in it
+static void LfSimSwitch(lf_sim_state_t *st)
+{
+	uint8_t sub = st->sub, level = st->level;
+	uint16_t gap = st->gap;
+
+	LfSimStart(st, st->next);
+	st->sub = sub;
+	st->level = level;
+	st->gapLeft = gap;
+}
+
+int LfSimNext(lf_sim_state_t *st)
+{
+	int out;
+
+	// shorted between repeats
+	if(st->gapLeft) {
+		st->gapLeft--;
+		return 0;
+	}
+
+	if(st->sim) {
+		out = LfSimDesc(st);
+	} else {
+		out = st->tab[st->bit] != 0;
+		if(++st->bit >= st->period) st->bit = 0;
+	}
+
+	if(st->bit == 0 && st->cycle == 0) {
+		// that was the last cycle of this repeat
+		if(st->next)
+			LfSimSwitch(st);
+		else
+			st->gapLeft = st->gap;
+	}
+	return out;
+}
+
+uint32_t LfSimWord(lf_sim_state_t *st)
+{
+	uint32_t w = 0;
+	int i;
+
+	for(i = 0; i < 32; i++)
+		w = (w << 1) | LfSimNext(st);
+	return w;
+}
@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// LF tag simulation from a descriptor.
+//
+// `lf sim' uploads the waveform itself, one byte per carrier cycle: 4096
+// bytes in 48 byte packets for the 64 bits of an EM410x tag. A descriptor
+// is just the bits and how to put them on the air, small enough for a
+// single packet; the device works out the coil state for each carrier cycle
+// as it goes and BigBuf is left alone.
+//
+//   encoding    how a bit becomes levels
+//     NRZ         the level is the bit
+//     MANCHESTER  1 is low then high, 0 high then low (as `data mandemod')
+//     BIPHASE     the level changes at every bit boundary, and in the
+//                 middle of a 0
+//   modulation  how a level is put on the carrier
+//     ASK         the coil is open for high, shorted for low
+//     FSK         a subcarrier of fc1 carrier cycles for high, fc0 for low,
+//                 open for the first quarter of each period (HID: fc/8,
+//                 fc/10 and RF/50 for each Manchester half bit)
+//     PSK         a subcarrier of fc0 cycles, inverted while the level is
+//                 high
+//
+// clock is the length of a bit in carrier cycles. The bits go out MSB
+// first and repeat; gap is a time in us that the coil is kept shorted
+// between two repeats.
+//
+// The device does not look at every carrier cycle itself: LfSimWord() works
+// out the coil states for the next 32 of them at a time, and the SSC shifts
+// them out on the reader's clock (armsrc/lfops.c). The same goes for an
+// uploaded waveform (`lf sim'), which is just another source of coil states.
+//-----------------------------------------------------------------------------
+
+#ifndef __LFSIM_H
+#define __LFSIM_H
+
+#include <stdint.h>
+
+#define LF_SIM_ASK			0
+#define LF_SIM_FSK			1
+#define LF_SIM_PSK			2
+
+#define LF_SIM_NRZ			0
+#define LF_SIM_MANCHESTER	1
+#define LF_SIM_BIPHASE		2
+
+// As many bits as the data of one UsbCommand holds
+#define LF_SIM_MAX_BITS		(48 * 8)
+
+// CMD_SIMULATE_TAG_125K_DESC, with the bits in d.asBytes:
+//   arg[0]  modulation in bits 0..7, encoding in 8..15, bit 16 inverts
+//           the coil
+//   arg[1]  clock in bits 0..15, fc0 in 16..23, fc1 in 24..31
+//   arg[2]  number of bits in bits 0..15, gap in 16..31
+#define LF_SIM_ARG0(modulation, encoding, invert) \
+	((modulation) | ((encoding) << 8) | ((invert) ? 0x10000 : 0))
+#define LF_SIM_ARG1(clock, fc0, fc1)	((clock) | ((fc0) << 16) | ((fc1) << 24))
+#define LF_SIM_ARG2(bits, gap)			((bits) | ((gap) << 16))
+
+typedef struct {
+	uint8_t modulation;
+	uint8_t encoding;
+	uint8_t invert;
+	uint8_t fc0, fc1;		// subcarrier periods, in carrier cycles
+	uint16_t clock;			// carrier cycles per bit
+	uint16_t bits;
+	uint16_t gap;			// us
+	uint8_t data[LF_SIM_MAX_BITS / 8];
+} lf_sim_t;
+
+// Where a simulation is up to
+typedef struct {
+	const lf_sim_t *sim;	// or NULL for a waveform:
+	const uint8_t *tab;		// coil state for each cycle, period of them
+	uint16_t period;
+	const lf_sim_t *next;	// takes over from sim once its bits are out
+	uint16_t bit;			// (cycle of the waveform)
+	uint16_t cycle;			// carrier cycle within the bit
+	uint8_t sub;			// carrier cycle within the subcarrier period
+	uint8_t level;			// level of the last cycle
+	uint8_t phase;			// BIPHASE: level at the start of the bit
+	uint16_t gap;			// carrier cycles between repeats
+	uint16_t gapLeft;		// of the current one
+} lf_sim_state_t;
+
+// Fill in s from the arguments of CMD_SIMULATE_TAG_125K_DESC; returns 0
+// if they make no sense.
+int LfSimInit(lf_sim_t *s, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+	const uint8_t *data);
+
+void LfSimStart(lf_sim_state_t *st, const lf_sim_t *s);
+
+// Play period bytes from tab, one per carrier cycle (0 for shorted), with
+// gap us in between, the way `lf sim' uploads them
+void LfSimStartRaw(lf_sim_state_t *st, const uint8_t *tab, int period, int gap);
+
+// The coil for the next carrier cycle: 1 open, 0 shorted
+int LfSimNext(lf_sim_state_t *st);
+
+// The coil for the next 32 carrier cycles, the first one in bit 31
+uint32_t LfSimWord(lf_sim_state_t *st);
+
+#endif /* __LFSIM_H */
@@ -0,0 +1,264 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Manchester and biphase decoding on packed bits, see manchester.h
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "manchester.h"
+
+int ManLevels(const int *samples, int n, uint32_t *levels)
+{
+	int i, high, low, hi, lo, level;
+	uint32_t w = 0;
+
+	if(n <= 0) return 0;
+
+	high = low = samples[0];
+	for(i = 1; i < n; i++) {
+		if(samples[i] > high) high = samples[i];
+		if(samples[i] < low) low = samples[i];
+	}
+	hi = low + (high - low) * 3 / 4;
+	lo = low + (high - low) / 4;
+
+	level = samples[0] > (high + low) / 2;
+	for(i = 0; i < n; i++) {
+		if(level ? samples[i] <= lo : samples[i] > hi)
+			level = !level;
+		w |= (uint32_t)level << (i & 31);
+		if((i & 31) == 31) {
+			levels[i >> 5] = w;
+			w = 0;
+		}
+	}
+	if(n & 31)
+		levels[n >> 5] = w;
+	return MAN_WORDS(n);
+}
+
+// Edges in word k of the levels: bit i is set if sample 32k + i is not at
+// the level of the one before it
+static uint32_t ManEdges(const uint32_t *levels, int k, int n)
+{
+	uint32_t w = levels[k], before = k ? levels[k - 1] >> 31 : w & 1;
+	uint32_t e = w ^ ((w << 1) | before);
+
+	if(32 * k + 32 > n)
+		e &= (1u << (n - 32 * k)) - 1;
+	return e;
+}
+
+typedef struct {
+	const uint32_t *levels;
+	int n;
+	int word;				// word of the edges
+	uint32_t edges;			// its edges still to go
+	int pos;				// sample of the last edge, -1 before the first
+} man_runs_t;
+
+static void ManRunsInit(man_runs_t *r, const uint32_t *levels, int n)
+{
+	r->levels = levels;
+	r->n = n;
+	r->word = 0;
+	r->edges = n > 0 ? ManEdges(levels, 0, n) : 0;
+	r->pos = -1;
+}
+
+// The length of the next run and its level; 0 once there are no more. The
+// runs before the first edge and after the last one are cut short by the
+// ends of the trace, and left out.
+static int ManNextRun(man_runs_t *r, int *level)
+{
+	int at, prev;
+
+	for(;;) {
+		while(!r->edges) {
+			if(++r->word >= MAN_WORDS(r->n)) return 0;
+			r->edges = ManEdges(r->levels, r->word, r->n);
+		}
+		at = 32 * r->word + __builtin_ctz(r->edges);
+		r->edges &= r->edges - 1;
+		prev = r->pos;
+		r->pos = at;
+		if(prev >= 0) {
+			*level = MAN_BIT(r->levels, prev);
+			return at - prev;
+		}
+	}
+}
+
+// How many half bits a run is, or 0 if it is none of 1 or 2 to within a
+// quarter clock; *dev gets how far off it is, in half samples
+static int ManHalves(int len, int clock, int *dev)
+{
+	int n = (2 * len + clock / 2) / clock;
+
+	*dev = 2 * len - n * clock;
+	if(*dev < 0) *dev = -*dev;
+	if(n < 1 || n > 2 || *dev >= clock / 2) return 0;
+	return n;
+}
+
+static void ManStatsInit(man_stats_t *st, int clock)
+{
+	st->clock = clock;
+	st->runs = 0;
+	st->fit = 0;
+	st->jitter = 0;
+	st->errors = 0;
+	st->phase = 0;
+}
+
+static void ManFit(man_stats_t *st, int halves, int dev)
+{
+	st->runs++;
+	if(!halves) return;
+	st->fit++;
+	st->jitter += dev;
+}
+
+static void ManFitDone(man_stats_t *st)
+{
+	// half samples to 1/16 samples
+	if(st->fit) st->jitter = st->jitter * 8 / st->fit;
+}
+
+int ManClock(const uint32_t *levels, int n, man_stats_t *st)
+{
+	int hist[MAN_MAX_RUN + 1];
+	man_runs_t r;
+	int len, level, dev, halves, i, c, best = 0, peak = 0, half, sum = 0, cnt = 0, clock;
+
+	memset(hist, 0, sizeof(hist));
+	ManRunsInit(&r, levels, n);
+	while((len = ManNextRun(&r, &level)))
+		if(len <= MAN_MAX_RUN) hist[len]++;
+
+	// the most common length, give or take a sample, leaving out glitches
+	for(i = 3; i < MAN_MAX_RUN; i++) {
+		c = hist[i - 1] + hist[i] + hist[i + 1];
+		if(c > best) {
+			best = c;
+			peak = i;
+		}
+	}
+	ManStatsInit(st, 0);
+	if(!peak) return 0;
+
+	// that is a half bit, unless there are plenty of runs half as long
+	half = peak;
+	for(i = peak / 2 - peak / 8; i <= peak / 2 + peak / 8; i++)
+		if(i >= 3) cnt += hist[i];
+	if(cnt >= best / 4)
+		half = peak / 2;
+
+	// the average length of a half bit, the long runs counting twice
+	cnt = 0;
+	for(i = half - half / 4; i <= half + half / 4 && i <= MAN_MAX_RUN; i++) {
+		sum += i * hist[i];
+		cnt += hist[i];
+	}
+	for(i = 2 * half - half / 2; i <= 2 * half + half / 2 && i <= MAN_MAX_RUN; i++) {
+		sum += i * hist[i];
+		cnt += 2 * hist[i];
+	}
+	if(!cnt) return 0;
+	clock = 2 * ((2 * sum + cnt) / (2 * cnt));
+	if(clock < 2) return 0;
+
+	ManStatsInit(st, clock);
+	ManRunsInit(&r, levels, n);
+	while((len = ManNextRun(&r, &level))) {
+		halves = ManHalves(len, clock, &dev);
+		ManFit(st, halves, dev);
+	}
+	ManFitDone(st);
+	return clock;
+}
+
+// Whether halves a, b can be a bit after prev, the second half of the bit
+// before it (-1 if not known)
+static int ManPair(int encoding, int prev, int a, int b)
+{
+	if(encoding == MAN_BIPHASE)
+		return a != prev;
+	return a != b;
+}
+
+int ManDecode(const uint32_t *levels, int n, int clock, int encoding,
+	uint32_t *bits, int max, man_stats_t *st)
+{
+	man_runs_t r;
+	int len, level, dev, halves, i, k, errors[2] = { 0, 0 };
+	int h[3] = { 0, 0, 0 }, have = 0, idx = 0;
+	int skip, pending, prev, bit, nbits = 0;
+
+	ManStatsInit(st, clock);
+	if(clock < 2) return 0;
+
+	// which pairing breaks the encoding less often
+	ManRunsInit(&r, levels, n);
+	while((len = ManNextRun(&r, &level))) {
+		halves = ManHalves(len, clock, &dev);
+		ManFit(st, halves, dev);
+		if(!halves) {
+			have = 0;
+			continue;
+		}
+		for(i = 0; i < halves; i++, idx++) {
+			h[0] = h[1];
+			h[1] = h[2];
+			h[2] = level;
+			if(have < 3) have++;
+			// the pair that starts at the half before this one
+			if(have >= 2)
+				errors[(idx - 1) & 1] += !ManPair(encoding, have == 3 ? h[0] : -1, h[1], h[2]);
+		}
+	}
+	ManFitDone(st);
+	st->phase = errors[1] < errors[0];
+
+	// and pair them up that way, moving up a half bit where it breaks
+	skip = st->phase;
+	pending = prev = -1;
+	ManRunsInit(&r, levels, n);
+	while((len = ManNextRun(&r, &level))) {
+		halves = ManHalves(len, clock, &dev);
+		if(!halves) {
+			if(pending >= 0 || prev >= 0) st->errors++;
+			pending = prev = -1;
+			continue;
+		}
+		for(k = 0; k < halves; k++) {
+			if(skip) {
+				skip = 0;
+				prev = level;
+				continue;
+			}
+			if(pending < 0) {
+				pending = level;
+				continue;
+			}
+			if(!ManPair(encoding, prev, pending, level)) {
+				st->errors++;
+				prev = pending;
+				pending = level;
+				continue;
+			}
+
+			// 01 is a 1 in Manchester; in biphase no change is a 1
+			bit = encoding == MAN_BIPHASE ? pending == level : level;
+			if(nbits >= max) return nbits;
+			if(!(nbits & 31)) bits[nbits >> 5] = 0;
+			bits[nbits >> 5] |= (uint32_t)bit << (nbits & 31);
+			nbits++;
+			prev = level;
+			pending = -1;
+		}
+	}
+	return nbits;
+}
@@ -0,0 +1,67 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Manchester and biphase decoding of a whole trace, on packed bits.
+//
+// The samples are first sliced into levels, 32 to a word, the first one in
+// bit 0. Everything after that works a word at a time: the edges of 32
+// samples are the word XORed with itself one sample later, and the run of
+// one level up to the next edge is the number of trailing zeros, so a long
+// run costs a word, not a sample, per 32 samples. Each run is one or two
+// half bits long, and the half bits are paired up into bits, the pairing
+// that breaks the encoding least often taken:
+//
+//   Manchester   a change in the middle of every bit, 01 is a 1, 10 a 0
+//   biphase      a change at the start of every bit, and in the middle of
+//                a 0
+//
+// The clock, if not given, comes from the lengths of the runs, and how well
+// they fit it is kept as a measure of how much the result can be trusted.
+// Nothing is allocated: the levels and the bits go into buffers of the
+// caller's, MAN_WORDS(n) words for n samples.
+//-----------------------------------------------------------------------------
+
+#ifndef __MANCHESTER_H
+#define __MANCHESTER_H
+
+#include <stdint.h>
+
+#define MAN_MANCHESTER		0
+#define MAN_BIPHASE			1
+
+// Words of packed bits it takes to hold n
+#define MAN_WORDS(n)		(((n) + 31) / 32)
+// Bit i of packed bits
+#define MAN_BIT(v, i)		(((v)[(i) >> 5] >> ((i) & 31)) & 1)
+
+// Longest run looked at when recovering the clock
+#define MAN_MAX_RUN			512
+
+typedef struct {
+	int clock;				// samples per bit
+	int runs;				// of one level, between two edges
+	int fit;				// of them, within a quarter clock of a half or whole bit
+	int jitter;				// mean distance of those from it, in 1/16 samples
+	int errors;				// places where the encoding broke, and the half
+							// bits were paired up again
+	int phase;				// the pairing taken, 0 or 1
+} man_stats_t;
+
+// Slice n samples into levels: above or below the middle of their range,
+// with a quarter of it either way as hysteresis, so that a 0/1 trace comes
+// out as it is. Returns the number of words written.
+int ManLevels(const int *samples, int n, uint32_t *levels);
+
+// The clock of n samples of levels, rounded to an even number; 0 if there
+// are no runs that look like half bits. st gets how well the runs fit it.
+int ManClock(const uint32_t *levels, int n, man_stats_t *st);
+
+// Decode n samples of levels with the given clock into at most max bits;
+// returns the number of bits. st gets the clock, how well the runs fit it,
+// the pairing of half bits taken and how many times it broke.
+int ManDecode(const uint32_t *levels, int n, int clock, int encoding,
+	uint32_t *bits, int max, man_stats_t *st);
+
+#endif /* __MANCHESTER_H */
@@ -0,0 +1,398 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// PSK1 demodulation and framed ID search, see pskdemod.h
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include "pskdemod.h"
+
+// Bits it takes to count up to 32 preamble bits wrong
+#define PSK_COUNTER_BITS	6
+// Frames that read differently it keeps count of
+#define PSK_TABLE			32
+
+// Cosine of a quarter turn in 16 steps, 256 for 1
+static const int16_t pskCos[17] = {
+	256, 255, 251, 245, 237, 226, 213, 198, 181, 162, 142, 121, 98, 74, 50, 25, 0
+};
+
+// Cosine of i/64 of a turn
+static int PskCos(int i)
+{
+	i &= 63;
+	if(i > 32) i = 64 - i;
+	return i <= 16 ? pskCos[i] : -pskCos[32 - i];
+}
+
+// One run of the loop over the trace, a bit ending every clock samples from
+// offset on. With hist, the places the phase changes go into it, modulo the
+// clock; with soft, the bits go there. Returns the number of bits.
+static int PskLoop(const int *samples, int n, int carrier, int clock, int offset,
+	int *hist, int *soft, int max, psk_stats_t *st)
+{
+	uint32_t ph = 0, step = (uint32_t)(0x100000000ULL / carrier);
+	int i, k, x, m, I = 0, Q = 0, cyc = 0, prev = 0, c = 0, bits = 0;
+	int64_t sumI = 0, sumQ = 0;
+
+	for(i = 0; i < n; i++) {
+		k = ph >> 26;
+		x = samples[i];
+		m = x * PskCos(k);
+		I += m;
+		Q += x * PskCos(k - 16);
+		cyc += m;
+		ph += step;
+
+		if(++c == carrier) {
+			// the sign of a whole subcarrier cycle flips where the phase does
+			if(cyc && prev && (cyc < 0) != (prev < 0)) {
+				st->flips++;
+				m = (i + 1 - carrier) % clock;
+				if(hist) {
+					hist[m]++;
+				} else {
+					m = (m - offset + clock) % clock;
+					if(m <= clock / 8 || clock - m <= clock / 8)
+						st->onTime++;
+				}
+			}
+			if(cyc) prev = cyc;
+			cyc = 0;
+			c = 0;
+		}
+
+		if((i + 1 - offset) % clock)
+			continue;
+		// the first bit is only part of one before the offset
+		if(i + 1 - offset >= clock && bits < max) {
+			if(soft) soft[bits] = I;
+			bits++;
+			sumI += abs(I);
+			sumQ += abs(Q);
+		}
+		// steer the reference towards the subcarrier, whichever way up
+		// the bit has it
+		if(I || Q)
+			ph -= (int32_t)((int64_t)(I < 0 ? -Q : Q) * (1 << 28) / (abs(I) + abs(Q)));
+		I = Q = 0;
+	}
+
+	st->lock = sumI ? 100 - (int)(100 * sumQ / sumI) : 0;
+	if(st->lock < 0) st->lock = 0;
+	return bits;
+}
+
+int PskDemod(const int *samples, int n, int carrier, int clock, int *soft, int max,
+	psk_stats_t *st)
+{
+	int hist[PSK_MAX_CLOCK];
+	int i, best = -1, o = 0, h;
+	int64_t level = 0;
+
+	memset(st, 0, sizeof(*st));
+	st->carrier = carrier;
+	st->clock = clock;
+	if(carrier < 2 || clock < carrier || clock > PSK_MAX_CLOCK || n < clock)
+		return 0;
+
+	// bit boundaries first, from where the phase changes
+	memset(hist, 0, sizeof(hist));
+	PskLoop(samples, n, carrier, clock, 0, hist, NULL, 0, st);
+	for(i = 0; i < clock; i++) {
+		h = hist[(i + clock - 1) % clock] + hist[i] + hist[(i + 1) % clock];
+		if(h > best) {
+			best = h;
+			o = i;
+		}
+	}
+
+	// then the bits, with the loop dumping on them
+	st->offset = o;
+	st->flips = 0;
+	st->bits = PskLoop(samples, n, carrier, clock, o, NULL, soft, max, st);
+	for(i = 0; i < st->bits; i++)
+		level += abs(soft[i]);
+	st->level = st->bits ? level / st->bits : 0;
+	return st->bits;
+}
+
+void PskPack(const int *soft, int n, uint32_t *bits)
+{
+	uint32_t w = 0;
+	int i;
+
+	for(i = 0; i < n; i++) {
+		w |= (uint32_t)(soft[i] > 0) << (i & 31);
+		if((i & 31) == 31) {
+			bits[i >> 5] = w;
+			w = 0;
+		}
+	}
+	if(n & 31)
+		bits[n >> 5] = w;
+}
+
+typedef struct {
+	const int *soft;
+	const uint32_t *bits;
+	int n;
+	int words;
+	int level;
+	const psk_format_t *f;
+	// frames that read differently, and how often
+	psk_candidate_t table[PSK_TABLE];
+	int count;
+	int frames;
+	// the bit by bit sum of the frames starting at phase, modulo the frame
+	int phase;
+	int64_t vote[PSK_MAX_FRAME];
+	int voteFrames;
+	int votePos;
+} psk_search_t;
+
+// Bits a..a+31, bit a in bit 0
+static uint32_t PskWindow(const psk_search_t *s, int a)
+{
+	int w = a >> 5, b = a & 31;
+	uint32_t x = w < s->words ? s->bits[w] >> b : 0;
+
+	if(b && w + 1 < s->words)
+		x |= s->bits[w + 1] << (32 - b);
+	return x;
+}
+
+// The alignments whose count in the sliced counters is at most t
+static uint32_t PskAtMost(const uint32_t *c, int t)
+{
+	uint32_t lt = 0, eq = 0xffffffff, tk;
+	int k;
+
+	for(k = PSK_COUNTER_BITS - 1; k >= 0; k--) {
+		tk = (t >> k) & 1 ? 0xffffffff : 0;
+		lt |= eq & ~c[k] & tk;
+		eq &= ~(c[k] ^ tk);
+	}
+	return lt | eq;
+}
+
+// Every alignment that matches the preamble or its inverse, 32 at a time
+static void PskScan(psk_search_t *s, void (*hit)(psk_search_t *, int, int, int))
+{
+	const psk_format_t *f = s->f;
+	uint32_t c[PSK_COUNTER_BITS], x, t, near, far, m;
+	int a0, i, j, k, d, last = s->n - f->frameLen;
+
+	for(a0 = 0; a0 <= last; a0 += 32) {
+		memset(c, 0, sizeof(c));
+		for(j = 0; j < f->preambleLen; j++) {
+			// bit i of x: alignment a0 + i has bit j of the preamble wrong
+			x = PskWindow(s, a0 + j);
+			if((f->preamble >> (31 - j)) & 1)
+				x = ~x;
+			for(k = 0; x && k < PSK_COUNTER_BITS; k++) {
+				t = c[k] & x;
+				c[k] ^= x;
+				x = t;
+			}
+		}
+		near = PskAtMost(c, f->maxErrors);
+		far = ~PskAtMost(c, f->preambleLen - f->maxErrors - 1);
+		m = near | far;
+		if(last - a0 < 31)
+			m &= (2u << (last - a0)) - 1;
+
+		while(m) {
+			i = __builtin_ctz(m);
+			m &= m - 1;
+			for(d = 0, k = 0; k < PSK_COUNTER_BITS; k++)
+				d |= ((c[k] >> i) & 1) << k;
+			if((far >> i) & 1)
+				hit(s, a0 + i, 1, f->preambleLen - d);
+			else
+				hit(s, a0 + i, 0, d);
+		}
+	}
+}
+
+// The frame at bit a, the right way up
+static void PskFrame(const psk_search_t *s, int a, int inverted, uint32_t *frame)
+{
+	int w, left;
+
+	for(w = 0; w < PSK_FRAME_WORDS; w++) {
+		left = s->f->frameLen - 32 * w;
+		if(left <= 0) {
+			frame[w] = 0;
+			continue;
+		}
+		frame[w] = PskWindow(s, a + 32 * w) ^ (inverted ? 0xffffffff : 0);
+		if(left < 32)
+			frame[w] &= (1u << left) - 1;
+	}
+}
+
+static psk_candidate_t *PskFind(psk_search_t *s, const uint32_t *frame)
+{
+	int i;
+
+	for(i = 0; i < s->count; i++)
+		if(!memcmp(s->table[i].bits, frame, sizeof(s->table[i].bits)))
+			return &s->table[i];
+	return NULL;
+}
+
+// A new entry for frame, if there is room; the last one is kept for the vote
+static psk_candidate_t *PskAdd(psk_search_t *s, const uint32_t *frame, int a, int inverted, int room)
+{
+	psk_candidate_t *c;
+
+	if(s->count >= room)
+		return NULL;
+	c = &s->table[s->count++];
+	memset(c, 0, sizeof(*c));
+	memcpy(c->bits, frame, sizeof(c->bits));
+	c->pos = a;
+	c->inverted = inverted;
+	return c;
+}
+
+static void PskCollect(psk_search_t *s, int a, int inverted, int errors)
+{
+	uint32_t frame[PSK_FRAME_WORDS];
+	psk_candidate_t *c;
+	int k, v, weakest = -1;
+
+	s->frames++;
+	PskFrame(s, a, inverted, frame);
+	c = PskFind(s, frame);
+	if(!c) c = PskAdd(s, frame, a, inverted, PSK_TABLE - 1);
+	if(!c) return;
+
+	for(k = 0; k < s->f->frameLen; k++) {
+		v = abs(s->soft[a + k]);
+		if(weakest < 0 || v < weakest) weakest = v;
+	}
+	weakest = (int)((int64_t)weakest * 100 / s->level);
+	c->votes++;
+	c->errors += errors;
+	if(weakest > c->margin) c->margin = weakest;
+}
+
+static void PskVote(psk_search_t *s, int a, int inverted, int errors)
+{
+	int k;
+
+	if(a % s->f->frameLen != s->phase)
+		return;
+	if(!s->voteFrames++)
+		s->votePos = a;
+	for(k = 0; k < s->f->frameLen; k++)
+		s->vote[k] += inverted ? -s->soft[a + k] : s->soft[a + k];
+}
+
+// Whether a is more likely than b: the sum of the frames first, then the
+// frames that read like it, the fewest preamble bits wrong in them and the
+// strongest weakest bit
+static int PskBetter(const psk_candidate_t *a, const psk_candidate_t *b)
+{
+	int64_t ea = (int64_t)a->errors * b->votes, eb = (int64_t)b->errors * a->votes;
+
+	if(a->voted != b->voted) return a->voted;
+	if(a->votes != b->votes) return a->votes > b->votes;
+	if(ea != eb) return ea < eb;
+	return a->margin > b->margin;
+}
+
+static void PskSort(psk_search_t *s)
+{
+	psk_candidate_t t;
+	int i, j;
+
+	for(i = 1; i < s->count; i++) {
+		t = s->table[i];
+		for(j = i; j > 0 && PskBetter(&t, &s->table[j - 1]); j--)
+			s->table[j] = s->table[j - 1];
+		s->table[j] = t;
+	}
+}
+
+// Leave out, of the sorted table, the frames that start a few bits off a
+// better one: those are it read shifted, through a preamble whose zeros
+// match with the allowed errors
+static void PskDropShifted(psk_search_t *s)
+{
+	int len = s->f->frameLen, i, j, n = 0, d;
+
+	for(i = 0; i < s->count; i++) {
+		for(j = 0; j < n; j++) {
+			d = abs(s->table[i].pos % len - s->table[j].pos % len);
+			if(d > len - d) d = len - d;
+			if(d > 0 && d <= s->f->maxErrors)
+				break;
+		}
+		if(j == n)
+			s->table[n++] = s->table[i];
+	}
+	s->count = n;
+}
+
+int PskSearch(const int *soft, const uint32_t *bits, int n, int level,
+	const psk_format_t *f, psk_candidate_t *c, int max, int *frames)
+{
+	psk_search_t s;
+	uint32_t frame[PSK_FRAME_WORDS];
+	psk_candidate_t *v;
+	int k, errors = 0;
+	int64_t a, weakest = -1;
+
+	*frames = 0;
+	if(f->preambleLen < 1 || f->preambleLen > 32 || f->frameLen < f->preambleLen ||
+		f->frameLen > PSK_MAX_FRAME || 2 * f->maxErrors >= f->preambleLen)
+		return 0;
+
+	memset(&s, 0, sizeof(s));
+	s.soft = soft;
+	s.bits = bits;
+	s.n = n;
+	s.words = PSK_WORDS(n);
+	s.level = level > 0 ? level : 1;
+	s.f = f;
+
+	PskScan(&s, PskCollect);
+	*frames = s.frames;
+	if(!s.count)
+		return 0;
+	PskSort(&s);
+
+	// add up the frames in line with the best one, bit by bit
+	s.phase = s.table[0].pos % f->frameLen;
+	PskScan(&s, PskVote);
+	memset(frame, 0, sizeof(frame));
+	for(k = 0; k < f->frameLen; k++) {
+		a = s.vote[k] < 0 ? -s.vote[k] : s.vote[k];
+		if(s.vote[k] > 0)
+			frame[k >> 5] |= 1u << (k & 31);
+		if(weakest < 0 || a < weakest)
+			weakest = a;
+		if(k < f->preambleLen && ((f->preamble >> (31 - k)) & 1) != (s.vote[k] > 0))
+			errors++;
+	}
+	v = PskFind(&s, frame);
+	if(!v) {
+		v = PskAdd(&s, frame, s.votePos, 0, PSK_TABLE);
+		v->errors = errors;
+	}
+	v->voted = 1;
+	weakest = weakest * 100 / ((int64_t)s.level * s.voteFrames);
+	if(weakest > v->margin) v->margin = weakest;
+	PskSort(&s);
+	PskDropShifted(&s);
+
+	if(max > s.count) max = s.count;
+	memcpy(c, s.table, max * sizeof(*c));
+	return max;
+}
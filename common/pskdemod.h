@@ -0,0 +1,95 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// PSK1 demodulation of a whole trace, and a search for framed IDs in it.
+//
+// The tag flips the phase of a subcarrier (RF/2 for Indala, which is every
+// other sample) where a bit differs from the one before. A Costas loop locks
+// a reference onto the subcarrier and follows its phase drift over the
+// whole trace; mixed with it, the subcarrier comes out as a baseband level
+// whose sign is the bit. The bit boundaries are where that sign flips most
+// often, modulo the clock, and the level summed over each bit is a soft bit:
+// its sign the bit, its size how sure it is.
+//
+// The search packs the signs 32 to a word, the first one in bit 0, and
+// matches the preamble at 32 alignments at once: for each preamble bit the
+// words of the bits 0..31 places further on are XORed with it and added up
+// in counters sliced across 32 words, one bit of each count in every word.
+// Every alignment that matches the preamble, or its inverse (the phase is
+// only known up to a half turn), to within a few bits starts a frame. Frames
+// that read the same are counted together, and the frames in line with the
+// best one are added up bit by bit, which repairs an ID no frame of a noisy
+// trace read cleanly. Nothing is allocated.
+//-----------------------------------------------------------------------------
+
+#ifndef __PSKDEMOD_H
+#define __PSKDEMOD_H
+
+#include <stdint.h>
+
+// Longest bit the timing recovery looks at, in samples
+#define PSK_MAX_CLOCK		128
+// Longest frame the search takes, in bits
+#define PSK_MAX_FRAME		224
+#define PSK_FRAME_WORDS		((PSK_MAX_FRAME + 31) / 32)
+// Candidates it reports at most
+#define PSK_MAX_CANDIDATES	8
+
+// Words of packed bits it takes to hold n
+#define PSK_WORDS(n)		(((n) + 31) / 32)
+// Bit i of packed bits
+#define PSK_BIT(v, i)		(((v)[(i) >> 5] >> ((i) & 31)) & 1)
+
+// Indala: RF/2 subcarrier, RF/32 bits. A 64 bit ID starts with 101 and 29
+// zeros, a 224 bit one with a one, 30 zeros and another one.
+#define INDALA_CARRIER		2
+#define INDALA_CLOCK		32
+#define INDALA_PREAMBLE_64	0xa0000000
+#define INDALA_PREAMBLE_224	0x80000001
+
+typedef struct {
+	int carrier;			// samples per subcarrier cycle
+	int clock;				// samples per bit
+	int offset;				// sample the first whole bit starts at
+	int bits;
+	int flips;				// phase changes the loop saw
+	int onTime;				// of them, within an eighth of a bit of a boundary
+	int level;				// mean size of a soft bit
+	int lock;				// percent of the signal in phase with the reference
+} psk_stats_t;
+
+typedef struct {
+	uint32_t preamble;		// first bit out in bit 31
+	int preambleLen;		// bits of it, up to 32
+	int frameLen;			// bits from one preamble to the next, up to PSK_MAX_FRAME
+	int maxErrors;			// preamble bits a frame may get wrong
+} psk_format_t;
+
+typedef struct {
+	uint32_t bits[PSK_FRAME_WORDS];	// the frame, preamble first, first bit in bit 0
+	int pos;				// bit the first frame that read like this starts at
+	int inverted;			// it matched the inverse of the preamble
+	int votes;				// frames that read exactly like this
+	int errors;				// preamble bits wrong, over all of them
+	int margin;				// weakest bit, in percent of a typical one
+	int voted;				// the bit by bit sum of all frames in line with the best
+} psk_candidate_t;
+
+// Demodulate n samples with the given subcarrier period and clock into at
+// most max soft bits; returns the number of bits. st gets the timing and
+// how well the loop held on.
+int PskDemod(const int *samples, int n, int carrier, int clock, int *soft, int max,
+	psk_stats_t *st);
+
+// The signs of n soft bits, packed into PSK_WORDS(n) words.
+void PskPack(const int *soft, int n, uint32_t *bits);
+
+// Look for frames of format f in n bits; returns the number of candidates
+// written to c, at most max, the most likely first, and the frames found in
+// *frames. level is the one PskDemod() reported.
+int PskSearch(const int *soft, const uint32_t *bits, int n, int level,
+	const psk_format_t *f, psk_candidate_t *c, int max, int *frames);
+
+#endif /* __PSKDEMOD_H */
@@ -0,0 +1,234 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// T55x7 blocks and read back check, see t55xx.h
+//-----------------------------------------------------------------------------
+
+#include "t55xx.h"
+
+// RF/n of the rate field
+static const uint8_t T55xxRates[] = { 8, 16, 32, 40, 50, 64, 100, 128 };
+
+int T55xxDemodInit(t55xx_demod_t *d, uint32_t config, uint32_t want)
+{
+	d->modulation = T55XX_MODULATION(config);
+	d->clock = T55xxRates[T55XX_RATE(config)];
+	d->want = want;
+	d->winMax = 0;
+	d->winMin = 255;
+	d->winLen = 0;
+	d->swing = 0;
+	d->hi = 0;
+	d->lo = 0;
+	d->level = 0;
+	d->since = 0;
+	d->cycle = 0;
+	d->fc = 0;
+	d->run = 0;
+	d->started = 0;
+	d->halves = 0;
+	d->phase = 0;
+	d->shift[0] = d->shift[1] = 0;
+	d->bits[0] = d->bits[1] = 0;
+
+	switch(d->modulation) {
+		case T55XX_DIRECT:
+		case T55XX_FSK1:
+		case T55XX_FSK2:
+		case T55XX_FSK1A:
+		case T55XX_FSK2A:
+		case T55XX_MANCHESTER:
+		case T55XX_BIPHASE:
+			return 1;
+	}
+	return 0;
+}
+
+static int T55xxBit(t55xx_demod_t *d, int p, int b)
+{
+	d->shift[p] = (d->shift[p] << 1) | b;
+	if(d->bits[p] < 32) {
+		d->bits[p]++;
+		if(d->bits[p] < 32) return 0;
+	}
+	return d->shift[p] == d->want || d->shift[p] == ~d->want;
+}
+
+// Pairs of half bits, both ways. Manchester changes level in the middle of
+// every bit, biphase at the start of every bit and in the middle of a 0.
+static int T55xxHalfBit(t55xx_demod_t *d, int h)
+{
+	int p = d->phase, first, before;
+
+	d->phase ^= 1;
+	d->halves = (d->halves << 1) | h;
+	first = (d->halves >> 1) & 1;
+	before = (d->halves >> 2) & 1;
+
+	if(d->modulation == T55XX_MANCHESTER) {
+		if(first == h) {
+			d->bits[p] = 0;
+			return 0;
+		}
+		return T55xxBit(d, p, first);
+	}
+
+	if(first == before)
+		d->bits[p] = 0;
+	return T55xxBit(d, p, first == h);
+}
+
+static int T55xxAsk(t55xx_demod_t *d, uint8_t sample)
+{
+	int n, old, found = 0;
+
+	// the envelope swings on a level change and decays in between: look at
+	// the peaks over a few bit periods, or for direct modulation over more
+	// than a block, which may be all but one long run
+	if(sample > d->winMax) d->winMax = sample;
+	if(sample < d->winMin) d->winMin = sample;
+	if(++d->winLen >= (d->modulation == T55XX_DIRECT ? 40 : 4) * d->clock) {
+		d->swing = d->winMax - d->winMin;
+		d->hi = d->winMin + d->swing * 3 / 4;
+		d->lo = d->winMin + d->swing / 4;
+		d->winMax = 0;
+		d->winMin = 255;
+		d->winLen = 0;
+	}
+
+	if(d->since < 0xffff) d->since++;
+	if(d->swing < T55XX_MIN_SWING) {
+		d->bits[0] = d->bits[1] = 0;
+		return 0;
+	}
+	if(d->level ? sample >= d->lo : sample <= d->hi)
+		return 0;
+
+	// the level before this change lasted this many bits, or half bits
+	old = d->level;
+	d->level = !old;
+	if(d->modulation == T55XX_DIRECT) {
+		n = (d->since + d->clock / 2) / d->clock;
+		d->since = 0;
+		if(n < 1 || n > 32) {
+			d->bits[0] = 0;
+			return 0;
+		}
+		while(n--)
+			found |= T55xxBit(d, 0, old);
+		return found;
+	}
+
+	n = (d->since + d->clock / 4) / (d->clock / 2);
+	d->since = 0;
+	if(n < 1 || n > 2) {
+		d->bits[0] = d->bits[1] = 0;
+		return 0;
+	}
+	while(n--)
+		found |= T55xxHalfBit(d, old);
+	return found;
+}
+
+static int T55xxFsk(t55xx_demod_t *d, uint8_t sample)
+{
+	int level, fc, len, n, found = 0;
+
+	// subcarrier cycles from one rising edge to the next: fc/5 or fc/8 for
+	// FSK1, fc/8 or fc/10 for FSK2
+	level = sample >= 127;
+	if(d->cycle < 0xff) d->cycle++;
+	if(d->level || !level) {
+		d->level = level;
+		return 0;
+	}
+	d->level = level;
+
+	if(d->modulation == T55XX_FSK1 || d->modulation == T55XX_FSK1A)
+		fc = d->cycle <= 6;
+	else
+		fc = d->cycle <= 8;
+	len = d->cycle;
+	d->cycle = 0;
+
+	if(!d->started) {
+		d->started = 1;
+		d->fc = fc;
+		d->run = len;
+		return 0;
+	}
+	if(fc == d->fc) {
+		if(d->run < 0xffff - 0xff) d->run += len;
+		return 0;
+	}
+
+	// a run of one frequency is a whole number of bits
+	n = (d->run + d->clock / 2) / d->clock;
+	if(n < 1) n = 1;
+	if(n > 32) {
+		d->bits[0] = 0;
+		n = 0;
+	}
+	while(n--)
+		found |= T55xxBit(d, 0, d->fc);
+
+	d->fc = fc;
+	d->run = len;
+	return found;
+}
+
+int T55xxDemodSample(t55xx_demod_t *d, uint8_t sample)
+{
+	switch(d->modulation) {
+		case T55XX_FSK1:
+		case T55XX_FSK2:
+		case T55XX_FSK1A:
+		case T55XX_FSK2A:
+			return T55xxFsk(d, sample);
+		default:
+			return T55xxAsk(d, sample);
+	}
+}
+
+// Each ID bit goes in as a pair of FSK2a bits, 1 as 10 and 0 as 01
+static uint32_t T55xxHidBits(uint32_t v, int n)
+{
+	uint32_t b = 0;
+	int i;
+
+	for(i = 0; i < n; i++)
+		b |= ((v >> i) & 1 ? 2 : 1) << (2 * i);
+	return b;
+}
+
+int T55xxHidBlocks(uint32_t *blocks, uint32_t hi, uint32_t lo)
+{
+	blocks[0] = T55XX_HID_CONFIG;
+	// the start of frame marker, then the ID
+	blocks[1] = 0x1D000000 | T55xxHidBits(hi & 0xfff, 12);
+	blocks[2] = T55xxHidBits(lo >> 16, 16);
+	blocks[3] = T55xxHidBits(lo & 0xffff, 16);
+	return 4;
+}
+
+int T55xxEm410xBlocks(uint32_t *blocks, uint64_t id)
+{
+	uint64_t f = 0x1ff;
+	int row, nibble, colParity = 0;
+
+	// header, 10 rows of 4 bits and even parity, column parity, stop bit
+	for(row = 0; row < 10; row++) {
+		nibble = (id >> (36 - 4 * row)) & 0xf;
+		f = (f << 5) | (nibble << 1) |
+			((nibble ^ (nibble >> 1) ^ (nibble >> 2) ^ (nibble >> 3)) & 1);
+		colParity ^= nibble;
+	}
+	f = (f << 5) | (colParity << 1);
+
+	blocks[0] = T55XX_EM410X_CONFIG;
+	blocks[1] = f >> 32;
+	blocks[2] = (uint32_t)f;
+	return 3;
+}
@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// T55x7 (T5557, T5567, ATA5577) cards: the blocks that make one look like a
+// HID or EM410x tag, and a check that a block reads back as written.
+//
+// Block 0 is the configuration: data rate, modulation and how many of the
+// data blocks 1..7 the tag sends over and over, starting with block 1. After
+// a direct access read (opcode 10, a 0, the 3 bit address) the tag sends the
+// one block addressed instead, so it has to come out in the modulation of
+// the configuration. The check demodulates the ADC samples one at a time,
+// the way the device reads them out of its DMA ring, into a bit stream, and
+// looks for the block in it. There is no start marker in a repeated block,
+// so any 32 bits in a row will do, either way up since neither the level of
+// the envelope nor FSK1/FSK1a says which way up the bits are; for the
+// half bit encodings both pairings of half bits are tried. PSK is not
+// demodulated, a block can not be checked then.
+//-----------------------------------------------------------------------------
+
+#ifndef __T55XX_H
+#define __T55XX_H
+
+#include <stdint.h>
+
+// Fields of the configuration block
+#define T55XX_RATE(c)			(((c) >> 18) & 7)
+#define T55XX_MODULATION(c)		(((c) >> 12) & 0x1f)
+#define T55XX_MAXBLOCK(c)		(((c) >> 5) & 7)
+
+#define T55XX_DIRECT		0
+#define T55XX_PSK1			1
+#define T55XX_PSK2			2
+#define T55XX_PSK3			3
+#define T55XX_FSK1			4
+#define T55XX_FSK2			5
+#define T55XX_FSK1A			6
+#define T55XX_FSK2A			7
+#define T55XX_MANCHESTER	8
+#define T55XX_BIPHASE		16
+
+// RF/50, FSK2a, blocks 1..3; RF/64, Manchester, blocks 1..2
+#define T55XX_HID_CONFIG		0x00107060
+#define T55XX_EM410X_CONFIG		0x00148040
+
+#define T55XX_BLOCKS			8
+
+// Less swing than this (in ADC counts) is taken as no tag at all
+#define T55XX_MIN_SWING			32
+
+typedef struct {
+	uint8_t modulation;
+	uint16_t clock;			// samples per bit
+	uint32_t want;			// block looked for
+	// ASK: level changes, as in em410xdemod.h
+	uint8_t winMax, winMin;
+	uint16_t winLen;
+	uint8_t swing;
+	uint8_t hi, lo;
+	uint8_t level;
+	uint16_t since;			// samples since the last level change
+	// FSK: subcarrier cycles, as in hidfsk.h
+	uint8_t cycle;			// samples since the last rising edge
+	uint8_t fc;				// short subcarrier cycles in this run
+	uint16_t run;			// samples in it
+	uint8_t started;
+	// half bits
+	uint8_t halves;			// the last few, latest in bit 0
+	uint8_t phase;			// which of the two pairings the next one completes
+	// bits, for either pairing of half bits
+	uint32_t shift[2];
+	uint8_t bits[2];
+} t55xx_demod_t;
+
+// Start looking for block want in a tag sending with configuration config;
+// returns 0 if that can not be demodulated.
+int T55xxDemodInit(t55xx_demod_t *d, uint32_t config, uint32_t want);
+
+// Feed one ADC sample; returns 1 once the block went by.
+int T55xxDemodSample(t55xx_demod_t *d, uint8_t sample);
+
+// The configuration and data blocks to write to look like the HID tag hi,
+// lo (44 bits) or the EM410x tag id (40 bits); return how many, starting
+// with block 0.
+int T55xxHidBlocks(uint32_t *blocks, uint32_t hi, uint32_t lo);
+int T55xxEm410xBlocks(uint32_t *blocks, uint64_t id);
+
+#endif /* __T55XX_H */
@@ -389,10 +389,17 @@ static void HandleRxdSetupData(void)
 	}
 }
 
+// Set by the application while it has a background send going on the IN
+// endpoint (armsrc/usbstream.c), so that we let that finish before putting
+// anything else in the FIFO.
+void (*UsbSendFlushHook)(void);
+
 void UsbSendPacket(uint8_t *packet, int len)
 {
 	int i, thisTime;
 
+	if(UsbSendFlushHook) UsbSendFlushHook();
+
 	while(len > 0) {
 		thisTime = min(len, 8);
 
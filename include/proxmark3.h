@@ -113,6 +113,7 @@
 // USB declarations
 
 void UsbSendPacket(uint8_t *packet, int len);
+extern void (*UsbSendFlushHook)(void);
 int UsbConnected();
 int UsbPoll(int blinkLeds);
 void UsbStart(void);
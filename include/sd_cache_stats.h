@@ -0,0 +1,29 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Counters of the microSD sector cache, as kept by the firmware and read
+// back by the client (`hw sdstats'). Shared so that both sides agree on the
+// layout; it fits in a single UsbCommand.
+//-----------------------------------------------------------------------------
+
+#ifndef __SD_CACHE_STATS_H
+#define __SD_CACHE_STATS_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t lines;			// sectors the cache holds
+	uint32_t hits;			// single sector reads served from the cache
+	uint32_t misses;		// single sector reads that went to the card
+	uint32_t ahead;			// sectors fetched ahead of a sequential miss
+	uint32_t ahead_hits;	// ... that were asked for before being evicted
+	uint32_t writes;		// single sector writes taken into the cache
+	uint32_t writebacks;	// dirty sectors written out (evicted or synced)
+	uint32_t direct_reads;	// sectors of multi sector reads, past the cache
+	uint32_t direct_writes;	// sectors of multi sector writes, past the cache
+	uint32_t syncs;
+} sd_cache_stats_t;
+
+#endif
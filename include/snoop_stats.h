@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Timing statistics of the last DMA driven snoop loop, as kept by the
+// firmware and read back by the client (`hw stats'). Shared so that both
+// sides agree on the layout.
+//-----------------------------------------------------------------------------
+
+#ifndef __SNOOP_STATS_H
+#define __SNOOP_STATS_H
+
+#include <stdint.h>
+
+// behindBy histogram: bucket 0 counts behindBy == 1, bucket n counts
+// 2^n <= behindBy < 2^(n+1), the last bucket everything above.
+#define SNOOP_STATS_BUCKETS		12
+
+// flags
+#define SNOOP_STATS_RUNNING		(1<<0)	// loop has not returned yet
+#define SNOOP_STATS_BLEW		(1<<1)	// ended with `blew circular buffer'
+#define SNOOP_STATS_TRACE_FULL	(1<<2)	// ended because the trace filled up
+
+// DMA ring sizes the client may ask the iClass and 14443B snoops for
+// (arg[0] of CMD_SNOOP_ICLASS / CMD_SNOOP_ISO_14443, 0 for the default).
+// Powers of two; the ring is worked on in halves, and half of the largest
+// ring still decodes within one TC0 period.
+#define SNOOP_DMA_MIN			256
+#define SNOOP_DMA_MAX			8192
+
+// Loop cost is measured on TC0 as set up by StartCountUS(): MCK/32
+#define SNOOP_STATS_TICK_NS		667
+
+typedef struct {
+	uint32_t cmd;			// CMD_SNOOP_* that produced these numbers
+	uint32_t flags;
+	uint32_t dma_size;		// DMA ring size in bytes
+	uint32_t step;			// DMA bytes consumed per loop iteration
+	uint32_t iterations;	// iterations that decoded a sample
+	uint32_t idle;			// iterations that found the ring empty
+	uint32_t frames;		// frames put in the trace
+	uint32_t elapsed_ms;
+	uint32_t busy_ticks;	// sum of per-iteration decode cost
+	uint32_t max_cost;		// worst single iteration, in ticks
+	uint32_t max_behind;
+	uint32_t hist[SNOOP_STATS_BUCKETS];
+} snoop_stats_t;
+
+#endif
@@ -38,6 +38,8 @@ typedef struct {
 #define CMD_FINISH_WRITE							0x0003
 #define CMD_HARDWARE_RESET						0x0004
 #define CMD_START_FLASH								0x0005
+#define CMD_STREAM_WRITE							0x0006
+#define CMD_FLASH_CRC32								0x0007
 #define CMD_NACK											0x00fe
 #define CMD_ACK												0x00ff
 
@@ -50,6 +52,10 @@ typedef struct {
 #define CMD_BUFF_CLEAR								0x0105
 #define CMD_READ_MEM									0x0106
 #define CMD_VERSION										0x0107
+#define CMD_SNOOP_STATS								0x0108
+#define CMD_DOWNLOAD_BIGBUF							0x0109
+#define CMD_DOWNLOADED_BIGBUF						0x010A
+#define CMD_SD_CACHE_STATS						0x010B
 
 // For low-frequency tags
 #define CMD_READ_TI_TYPE														0x0202
@@ -68,9 +74,55 @@ typedef struct {
 #define CMD_SET_ADC_MUX									0x020F
 #define CMD_HID_CLONE_TAG								0x0210
 #define CMD_HID_BRUTE										0x0211
+#define CMD_EM410X_DEMOD								0x0212
+#define CMD_LF_TAG_ID										0x0213
+#define CMD_SIMULATE_TAG_125K_DESC			0x0214
+#define CMD_HID_BRUTE_STATUS				0x0215
+#define CMD_T55XX_WRITE_CARD				0x0216
 
 /* CMD_SET_ADC_MUX: ext1 is 0 for lopkd, 1 for loraw, 2 for hipkd, 3 for hiraw */
 
+/* CMD_LF_TAG_ID: a tag found by CMD_HID_DEMOD_FSK or CMD_EM410X_DEMOD. arg[0]
+ * is the LF_TAG_ type, arg[1] and arg[2] the high and low word of the ID,
+ * d.asDwords[0] the tick count (ms) and d.asDwords[1] the peak to peak ADC
+ * swing it came in with. A tag that stays in the field is sent again every
+ * LF_TAG_REPEAT_MS. */
+#define LF_TAG_HID											1
+#define LF_TAG_EM410X										2
+#define LF_TAG_REPEAT_MS								1000
+
+/* CMD_HID_BRUTE: arg[0] is the HID_BRUTE_ mode in the low half and the ms
+ * to simulate each ID for in the high half (0 for HID_BRUTE_DWELL_MS),
+ * arg[1] and arg[2] the first and last ID, d.asDwords[0] the step between
+ * two of them (signed, 0 for 1) and d.asDwords[1] the high word of the IDs,
+ * or the facility code for HID_BRUTE_FC, which sweeps the card numbers of
+ * 26 bit Wiegand IDs. HID_BRUTE_READ reads a tag first, and once the button
+ * is pressed counts down from the ID before it.
+ * CMD_HID_BRUTE_STATUS: how far it got, every HID_BRUTE_STATUS_MS and when
+ * it is over. arg[0] and arg[1] are the ID being simulated, arg[2] the
+ * number of IDs tried so far, d.asDwords[0] the tick count (ms) and
+ * d.asDwords[1] 1 for the last one. */
+#define HID_BRUTE_READ									0
+#define HID_BRUTE_RANGE									1
+#define HID_BRUTE_FC									2
+#define HID_BRUTE_MODE(x)								((x) & 0xffff)
+#define HID_BRUTE_DWELL(x)								((x) >> 16)
+#define HID_BRUTE_DWELL_MS								100
+#define HID_BRUTE_STATUS_MS								1000
+
+/* CMD_T55XX_WRITE_CARD: write a whole T55x7 card and read it back, see
+ * common/t55xx.h. arg[0] is the number of blocks (1..8) in the low byte,
+ * how many times to write again what did not read back in the next one, and
+ * T55XX_WRITE_NO_VERIFY to only write; d.asDwords holds the blocks, the
+ * configuration first. The CMD_ACK has the blocks that read back as a mask
+ * in arg[0] (T55XX_UNVERIFIED if they could not be read back, as for PSK),
+ * the number of block writes it took in arg[1] and the ms in arg[2]. */
+#define T55XX_WRITE_BLOCKS(x)							((x) & 0xff)
+#define T55XX_WRITE_RETRIES(x)							(((x) >> 8) & 0xff)
+#define T55XX_WRITE_NO_VERIFY							0x10000
+#define T55XX_UNVERIFIED								0xffffffff
+#define T55XX_DEFAULT_RETRIES							2
+
 // For the 13.56 MHz tags
 #define CMD_ACQUIRE_RAW_ADC_SAMPLES_ISO_15693		0x0300
 #define CMD_ACQUIRE_RAW_ADC_SAMPLES_ISO_14443		0x0301
@@ -139,6 +191,9 @@ typedef struct {
 /* Set if this device understands the extend start flash command */
 #define DEVICE_INFO_FLAG_UNDERSTANDS_START_FLASH 	(1<<4)
 
+/* Set if this device understands CMD_STREAM_WRITE and CMD_FLASH_CRC32 */
+#define DEVICE_INFO_FLAG_UNDERSTANDS_STREAM_WRITE	(1<<5)
+
 /* CMD_START_FLASH may have three arguments: start of area to flash,
    end of area to flash, optional magic.
    The bootrom will not allow to overwrite itself unless this magic
@@ -146,4 +201,23 @@ typedef struct {
 
 #define START_FLASH_MAGIC 0x54494f44 // 'DOIT'
 
+/* CMD_STREAM_WRITE: arg[0] is the flash address of the first byte in d,
+   arg[1] the number of bytes (a multiple of 4, at most 48). Pages must come
+   in whole and in order; each one is programmed as soon as it is complete.
+   There is no reply, problems are reported by the next CMD_FLASH_CRC32.
+
+   CMD_FLASH_CRC32: arg[0] start address, arg[1] length. Replies with an
+   ACK carrying the CRC32 of that range in arg[0], the STREAM_WRITE_ERR_*
+   flags collected since the last CMD_FLASH_CRC32 in arg[1] and the address
+   of the first failed page in arg[2].
+   With FLASH_CRC32_PAGES in arg[2] it instead checksums every page in the
+   (page aligned) range and sends them back 12 at a time: one ACK per 12
+   pages with the address of the first one in arg[0], the count in arg[1]
+   and the CRCs in d.asDwords. */
+#define FLASH_CRC32_PAGES			(1<<0)
+
+#define STREAM_WRITE_ERR_RANGE		(1<<0)	// page outside the area given to CMD_START_FLASH
+#define STREAM_WRITE_ERR_ORDER		(1<<1)	// data out of sequence, or a page left incomplete
+#define STREAM_WRITE_ERR_FLASH		(1<<2)	// flash controller reported a lock or programming error
+
 #endif
@@ -0,0 +1,85 @@
+#!/usr/bin/perl
+# Pack a Xilinx .bit file for the ARM's flash: the header sections (a-d)
+# are kept as they are, for `hw version', and the bitstream (section e,
+# some 94% zero bytes) becomes section z, in the zero run format that
+# armsrc/fpgaunpack.c decodes while it clocks the FPGA:
+#
+#   z section:  4 byte length of the bitstream (big endian), then tokens
+#   token:      LLLZZZZZ
+#               L literal bytes follow (L == 7: 7 + the next byte),
+#               then Z zero bytes  (Z == 31: the next two bytes, big endian)
+#
+# usage: fpgacompress.pl fpga.bit fpga.bit.z
+
+use strict;
+
+@ARGV == 2 or die "usage: $0 in.bit out.bit.z\n";
+my ($in, $out) = @ARGV;
+
+open(IN, "<", $in) or die "$in: $!\n";
+binmode(IN);
+my $bit = do { local $/; <IN> };
+close(IN);
+
+my $fixed = "\x00\x09\x0f\xf0\x0f\xf0\x0f\xf0\x0f\xf0\x00\x00\x01";
+substr($bit, 0, length($fixed)) eq $fixed or die "$in: not a .bit file\n";
+
+my $pos = length($fixed);
+my $headers = $fixed;
+my $stream;
+while ($pos < length($bit)) {
+	my $name = substr($bit, $pos, 1);
+	if ($name eq 'e') {
+		my $len = unpack("N", substr($bit, $pos + 1, 4));
+		$stream = substr($bit, $pos + 5, $len);
+		length($stream) == $len or die "$in: bitstream cut short\n";
+		last;
+	}
+	$name =~ /^[a-d]$/ or die "$in: unknown section '$name'\n";
+	my $len = unpack("n", substr($bit, $pos + 1, 2));
+	$headers .= substr($bit, $pos, 3 + $len);
+	$pos += 3 + $len;
+}
+defined($stream) or die "$in: no bitstream\n";
+
+# Split into (literals, zeros) pairs. A single zero byte is cheaper left in
+# the literal run than started as a run of its own.
+my $packed = "";
+my $n = length($stream);
+my $i = 0;
+while ($i < $n) {
+	my $start = $i;
+	while ($i < $n) {
+		my $z = $i;
+		$z++ while ($z < $n && substr($stream, $z, 1) eq "\0");
+		last if ($z > $i + 1 || ($z > $i && $z == $n));
+		$i = ($z > $i) ? $z : $i + 1;
+	}
+	my $lits = substr($stream, $start, $i - $start);
+	my $zeros = 0;
+	$zeros++ while ($i + $zeros < $n && substr($stream, $i + $zeros, 1) eq "\0");
+	$i += $zeros;
+
+	while (length($lits) > 262) {
+		$packed .= pack("CC", 7 << 5, 255) . substr($lits, 0, 262, "");
+	}
+	do {
+		my $z = $zeros > 65535 ? 65535 : $zeros;
+		my $l = length($lits);
+		my $tok = ($l >= 7 ? 7 : $l) << 5 | ($z >= 31 ? 31 : $z);
+		$packed .= pack("C", $tok);
+		$packed .= pack("C", $l - 7) if ($l >= 7);
+		$packed .= $lits;
+		$packed .= pack("n", $z) if ($z >= 31);
+		$lits = "";
+		$zeros -= $z;
+	} while ($zeros > 0);
+}
+
+my $z = pack("N", $n) . $packed;
+open(OUT, ">", $out) or die "$out: $!\n";
+binmode(OUT);
+print OUT $headers, "z", pack("N", length($z)), $z;
+close(OUT);
+
+printf STDERR "%s: %d byte bitstream packed into %d bytes\n", $out, $n, length($z);
@@ -0,0 +1,356 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Replay recorded SSC/DMA sample dumps through the firmware HF decoders on
+// the host, and measure how fast they run.
+//
+// A dump is the raw byte stream the FPGA delivers over the SSC in sniffer
+// mode, exactly as it lands in the DMA ring (for 14443B, interleaved ci/cq
+// pairs). Without a dump file, a pseudo-random stream is used, which keeps
+// the state machines busy resyncing and is a reasonable worst case.
+//
+// Three modes:
+//  - default: call the decoders directly, report samples/s and ns/sample
+//    next to the real-time budget per DMA sample on the device
+//  - -s: run the real Snoop*() loop against the fake PDC and print the
+//    frames it puts in the trace buffer
+//  - -c: decode a made up 14443B exchange both ways and check that every
+//    frame of it comes out; exits non-zero if not
+//
+// The host is a lot faster than a 48 MHz ARM7, so absolute numbers are only
+// good for comparing decoder revisions against each other; the budget line
+// says how much slower the device may be before the ring overflows.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "hostsim.h"
+#include "iso14443crc.h"
+
+typedef struct {
+	const char *name;
+	int (*decode)(const uint8_t *samples, int n);
+	int (*snoop)(const uint8_t **trace, int dmaSize);
+	// DMA bytes the decoder consumes per step, and device time that one
+	// such step represents (ns)
+	int step;
+	double budget_ns;
+} decoder_t;
+
+// 14443A/iClass sniffer: one byte (reader nibble + tag nibble) per 64/fc.
+// 14443B xcorr snoop: one (ci, cq) pair per half bit, i.e. 64/fc.
+#define HALF_BIT_NS	(64 * 1e9 / 13.56e6)
+
+static const decoder_t decoders[] = {
+	{ "14a",    fw14a_decode,    fw14a_snoop,    1, HALF_BIT_NS },
+	{ "iclass", fwiclass_decode, fwiclass_snoop, 1, HALF_BIT_NS },
+	{ "14b",    fw14b_decode,    fw14b_snoop,    2, HALF_BIT_NS },
+	{ NULL, NULL, NULL, 0, 0 }
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t *load_dump(const char *filename, int *len)
+{
+	FILE *f = fopen(filename, "rb");
+	uint8_t *buf;
+	long size;
+
+	if(!f) {
+		perror(filename);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = malloc(size > 0 ? size : 1);
+	if(!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", filename);
+		fclose(f);
+		free(buf);
+		return NULL;
+	}
+	fclose(f);
+	*len = (int)size;
+	return buf;
+}
+
+static uint8_t *random_dump(int len)
+{
+	uint8_t *buf = malloc(len);
+	uint32_t x = 0x2545f491;
+	int i;
+
+	for(i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x >> 24;
+	}
+	return buf;
+}
+
+static void print_frame(const hostsim_frame_t *f)
+{
+	int i;
+
+	printf("%10u %s", f->timestamp, f->fromTag ? "TAG" : "   ");
+	for(i = 0; i < f->len; i++)
+		printf(" %02x", f->data[i]);
+	printf("\n");
+}
+
+static void bench(const decoder_t *d, const uint8_t *samples, int len, int repeat)
+{
+	double start, elapsed, ns_per_step;
+	int frames = 0, i;
+	long total = (long)len * repeat;
+
+	start = now_ns();
+	for(i = 0; i < repeat; i++)
+		frames += d->decode(samples, len);
+	elapsed = now_ns() - start;
+
+	ns_per_step = elapsed / ((double)total / d->step);
+	printf("%-6s %ld samples, %d frames, %.3f ms\n", d->name, total, frames, elapsed / 1e6);
+	printf("       %.2f Msamples/s, %.1f ns per DMA step (budget %.0f ns, %.0fx headroom on this host)\n",
+		total / elapsed * 1e3, ns_per_step, d->budget_ns, d->budget_ns / ns_per_step);
+}
+
+// Same numbers as `hw stats' shows for a run on the device
+static void print_stats(const snoop_stats_t *s)
+{
+	int i;
+
+	printf("  %u iterations, %u idle, max behind %u of %u%s%s\n",
+		s->iterations, s->idle, s->max_behind, s->dma_size,
+		(s->flags & SNOOP_STATS_BLEW) ? ", blew DMA ring" : "",
+		(s->flags & SNOOP_STATS_TRACE_FULL) ? ", trace full" : "");
+	printf("  behindBy:");
+	for(i = 0; i < SNOOP_STATS_BUCKETS; i++)
+		printf(" %u", s->hist[i]);
+	printf("\n");
+}
+
+static void snoop(const decoder_t *d, const uint8_t *samples, int len, int burst, int dmaSize)
+{
+	const uint8_t *trace;
+	int traceLen, frames;
+
+	hostsim_stream(samples, len, burst > 0 ? burst : d->step);
+	traceLen = d->snoop(&trace, dmaSize);
+	frames = hostsim_walk_trace(trace, traceLen, print_frame);
+	printf("%s: %d frames, trace length %d, %d samples lost to DMA overrun\n",
+		d->name, frames, traceLen, hostsim_overruns());
+	print_stats(&snoop_stats);
+}
+
+//-----------------------------------------------------------------------------
+// A 14443B exchange as the xcorr snoop mode delivers it: (ci, cq) pairs, two
+// per ETU. The reader's modulation is in bit 0 of each byte, four samples
+// per ETU; the tag's BPSK subcarrier is the sign of ci and cq, kept odd so
+// that the reader bit reads as an unmodulated field meanwhile.
+//-----------------------------------------------------------------------------
+#define SYN14B_LEN		8192
+#define SYN14B_LEVEL	61
+
+typedef struct {
+	uint8_t buf[SYN14B_LEN];
+	int len;
+} syn14b_t;
+
+static void syn_reader_etus(syn14b_t *s, int bit, int n)
+{
+	for(n *= 4; n > 0 && s->len < SYN14B_LEN; n--)
+		s->buf[s->len++] = bit;
+}
+
+static void syn_tag_etus(syn14b_t *s, int bit, int n)
+{
+	for(n *= 4; n > 0 && s->len < SYN14B_LEN; n--)
+		s->buf[s->len++] = (uint8_t)(bit ? SYN14B_LEVEL : -SYN14B_LEVEL);
+}
+
+// Field on, nobody talking
+static void syn_idle(syn14b_t *s, int etus)
+{
+	syn_reader_etus(s, 1, etus);
+}
+
+// Start bit, eight data bits LSB first, stop bit
+static void syn_char(syn14b_t *s, void (*etus)(syn14b_t *, int, int), uint8_t b)
+{
+	int i;
+
+	etus(s, 0, 1);
+	for(i = 0; i < 8; i++)
+		etus(s, (b >> i) & 1, 1);
+	etus(s, 1, 1);
+}
+
+static void syn_reader(syn14b_t *s, const uint8_t *data, int len)
+{
+	int i;
+
+	// SOF: 10-11 ETU low, 2-3 high
+	syn_reader_etus(s, 0, 11);
+	syn_reader_etus(s, 1, 2);
+	for(i = 0; i < len; i++)
+		syn_char(s, syn_reader_etus, data[i]);
+	// EOF: 10-11 ETU low
+	syn_reader_etus(s, 0, 10);
+	syn_idle(s, 20);
+}
+
+static void syn_tag(syn14b_t *s, const uint8_t *data, int len)
+{
+	int i;
+
+	// TR1: unmodulated subcarrier, which the demodulator takes its phase
+	// reference from; SOF: 10-11 ETU inverted, 2-3 back
+	syn_tag_etus(s, 1, 10);
+	syn_tag_etus(s, 0, 10);
+	syn_tag_etus(s, 1, 2);
+	for(i = 0; i < len; i++)
+		syn_char(s, syn_tag_etus, data[i]);
+	// EOF: 10-11 ETU inverted
+	syn_tag_etus(s, 0, 10);
+	syn_idle(s, 20);
+}
+
+// REQB, the ATQB, HLTB and its answer, each with its CRC
+static const uint8_t syn14b_frames[][14] = {
+	{ 0x05, 0x00, 0x08 },
+	{ 0x50, 0x82, 0x0d, 0xe1, 0x74, 0x20, 0x38, 0x19, 0x22, 0x00, 0x21, 0x85 },
+	{ 0x50, 0x82, 0x0d, 0xe1, 0x74 },
+	{ 0x00 },
+};
+static const int syn14b_lens[] = { 3, 12, 5, 1 };
+#define SYN14B_FRAMES	4
+
+static uint8_t syn14b_want[SYN14B_FRAMES][16];
+static int syn14b_got;
+static int syn14b_bad;
+
+static void syn14b_frame(const hostsim_frame_t *f)
+{
+	int i = syn14b_got++;
+
+	print_frame(f);
+	if(i >= SYN14B_FRAMES || f->fromTag != (i & 1) || f->len != syn14b_lens[i] + 2
+		|| memcmp(f->data, syn14b_want[i], f->len))
+		syn14b_bad++;
+}
+
+static int check14b(void)
+{
+	static syn14b_t s;
+	const decoder_t *d;
+	const uint8_t *trace;
+	int i, frames, traceLen, ok = 1;
+
+	for(d = decoders; strcmp(d->name, "14b"); d++)
+		;
+
+	s.len = 0;
+	syn_idle(&s, 50);
+	for(i = 0; i < SYN14B_FRAMES; i++) {
+		memcpy(syn14b_want[i], syn14b_frames[i], syn14b_lens[i]);
+		ComputeCrc14443(CRC_14443_B, syn14b_want[i], syn14b_lens[i],
+			&syn14b_want[i][syn14b_lens[i]], &syn14b_want[i][syn14b_lens[i] + 1]);
+		if(i & 1)
+			syn_tag(&s, syn14b_want[i], syn14b_lens[i] + 2);
+		else
+			syn_reader(&s, syn14b_want[i], syn14b_lens[i] + 2);
+	}
+	// the snoop works on whole halves of its DMA ring
+	while(s.len < SYN14B_LEN)
+		syn_idle(&s, 1);
+
+	frames = d->decode(s.buf, s.len);
+	printf("14b decode: %d of %d frames  %s\n", frames, SYN14B_FRAMES,
+		frames == SYN14B_FRAMES ? "ok" : "FAIL");
+	ok &= frames == SYN14B_FRAMES;
+
+	syn14b_got = syn14b_bad = 0;
+	hostsim_stream(s.buf, s.len, d->step);
+	traceLen = d->snoop(&trace, 0);
+	hostsim_walk_trace(trace, traceLen, syn14b_frame);
+	printf("14b snoop: %d of %d frames, %d wrong  %s\n", syn14b_got, SYN14B_FRAMES, syn14b_bad,
+		syn14b_got == SYN14B_FRAMES && !syn14b_bad ? "ok" : "FAIL");
+	ok &= syn14b_got == SYN14B_FRAMES && !syn14b_bad;
+
+	return ok ? 0 : 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-p 14a|iclass|14b] [-n repeat] [-r bytes] [-s [-b burst] [-d dmasize]] [-c] [-q] [dumpfile]\n", argv0);
+	fprintf(stderr, "  -p  decoder to run (default: all)\n");
+	fprintf(stderr, "  -n  replay the dump this many times (default 100)\n");
+	fprintf(stderr, "  -r  size of the pseudo-random stream used without a dump (default 1048576)\n");
+	fprintf(stderr, "  -s  run the Snoop loop on the fake PDC and list the decoded frames\n");
+	fprintf(stderr, "  -b  DMA bytes delivered per loop iteration in -s mode; raise it to\n");
+	fprintf(stderr, "      see where the loop falls behind (default: what one iteration eats)\n");
+	fprintf(stderr, "  -d  DMA ring size for the iclass and 14b snoops, as `hf iclass snoop'\n");
+	fprintf(stderr, "      and `hf 14b snoop' take it (default: the firmware's)\n");
+	fprintf(stderr, "  -c  check the 14b decoder and snoop against a made up exchange\n");
+	fprintf(stderr, "  -q  suppress firmware debug output\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *which = NULL;
+	int repeat = 100, randlen = 1 << 20, do_snoop = 0, do_check = 0, burst = 0, dmaSize = 0;
+	uint8_t *samples;
+	int len, opt;
+	const decoder_t *d;
+
+	while((opt = getopt(argc, argv, "p:n:r:sb:d:cqh")) != -1) {
+		switch(opt) {
+			case 'p': which = optarg; break;
+			case 'n': repeat = atoi(optarg); break;
+			case 'r': randlen = atoi(optarg); break;
+			case 's': do_snoop = 1; break;
+			case 'b': burst = atoi(optarg); break;
+			case 'd': dmaSize = atoi(optarg); break;
+			case 'c': do_check = 1; break;
+			case 'q': hostsim_quiet = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if(do_check)
+		return check14b();
+
+	if(optind < argc) {
+		samples = load_dump(argv[optind], &len);
+		if(!samples) return 1;
+	} else {
+		len = randlen;
+		samples = random_dump(len);
+	}
+
+	for(d = decoders; d->name; d++) {
+		if(which && strcmp(which, d->name)) continue;
+		if(do_snoop)
+			snoop(d, samples, len, burst, dmaSize);
+		else
+			bench(d, samples, len, repeat < 1 ? 1 : repeat);
+	}
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,41 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host model of the AT91SAM7 flash and its controller, with the bootloader's
+// USB command handler (bootrom/bootrom.c, unmodified) running on top of it.
+// Packets go in through fakeflash_send(), whatever the bootloader sends back
+// queues up for fakeflash_receive().
+//-----------------------------------------------------------------------------
+
+#ifndef __FAKEFLASH_H
+#define __FAKEFLASH_H
+
+#include <stdint.h>
+#include "usb_cmd.h"
+
+#define FAKEFLASH_START		0x100000
+#define FAKEFLASH_SIZE		(256 * 1024)
+#define FAKEFLASH_PAGE		256
+
+// Map the flash array at its device address (the bootloader reads it
+// through plain pointers) and erase it. Returns the array.
+uint8_t *fakeflash_init(void);
+
+// Hand a packet to the bootloader, as UsbPoll() would
+void fakeflash_send(UsbCommand *c);
+// Next packet the bootloader sent; 0 if there is none
+int fakeflash_receive(UsbCommand *c);
+int fakeflash_pending(void);
+
+typedef struct {
+	unsigned long programmed;	// pages programmed
+	unsigned long resets;		// CMD_HARDWARE_RESET seen
+	int failPage;				// this page fails to program (PROGE), -1 for none
+	int flipPage;				// this page silently gets a bit flipped, -1 for none
+} fakeflash_stats_t;
+
+extern fakeflash_stats_t fakeflash_stats;
+
+#endif
@@ -0,0 +1,308 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host model of a microSD card in SPI mode, see fakesd.h. Implements what
+// msd.c uses: the init sequence (CMD0, CMD8, CMD55/ACMD41, CMD58), CID/CSD,
+// single and multiple block read and write, CMD12 and the stop tran token.
+// Like a real card it answers one byte after the command (Ncr), sends a
+// stuff byte after CMD12 and holds the line low while it is busy, so that
+// a driver that skips any of those gets caught.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "fakesd.h"
+
+fakesd_stats_t fakesd_stats;
+
+static uint8_t *img;
+static uint32_t nsect;
+static int sdhc;
+
+enum { ST_IDLE, ST_READ_MULTI, ST_WRITE_WAIT, ST_WRITE_DATA };
+static int state, multi, appcmd, acmd41, ready;
+static uint32_t addr;				// next sector to read or write
+
+static uint8_t cmd[6];
+static int cmdLen;
+
+static uint8_t out[520];			// bytes queued for the host
+static int outLen, outPos;
+static int busy;				// bytes to hold the line low for
+
+static uint8_t wbuf[514];			// block being written, with CRC
+static int wLen;
+
+void fakesd_attach(uint8_t *image, uint32_t n, int hc)
+{
+	img = image;
+	nsect = n;
+	sdhc = hc;
+	state = ST_IDLE;
+	appcmd = acmd41 = ready = 0;
+	cmdLen = outLen = outPos = busy = 0;
+	memset(&fakesd_stats, 0, sizeof(fakesd_stats));
+}
+
+static void queue(const uint8_t *p, int n)
+{
+	if(outPos == outLen) outPos = outLen = 0;
+	memcpy(out + outLen, p, n);
+	outLen += n;
+}
+
+static void queue1(uint8_t b)
+{
+	queue(&b, 1);
+}
+
+// Ncr, then R1
+static void r1(uint8_t r)
+{
+	queue1(0xff);
+	queue1(r);
+}
+
+// Gap, start token, 512 or 16 bytes of data, CRC
+static void queue_block(const uint8_t *data, int n)
+{
+	queue1(0xff);
+	queue1(0xfe);
+	queue(data, n);
+	queue1(0x00);
+	queue1(0x00);
+}
+
+static void cid_csd(int which)
+{
+	uint8_t reg[16];
+	uint32_t csize;
+
+	memset(reg, 0, sizeof(reg));
+	if(which == 10) {
+		// CID: manufacturer, OEM, name, revision, serial, date
+		memcpy(reg, "\x03" "PM" "HOST1" "\x10" "\x12\x34\x56\x78" "\x00\xa1", 15);
+	} else if(sdhc) {
+		// CSD 2.0: C_SIZE in [69:48], in units of 512K
+		csize = nsect / 1024 - 1;
+		reg[0] = 0x40;
+		reg[7] = (csize >> 16) & 0x3f;
+		reg[8] = csize >> 8;
+		reg[9] = csize;
+	} else {
+		// CSD 1.0 with READ_BL_LEN 9 and C_SIZE_MULT 7: 512 blocks per
+		// C_SIZE unit, C_SIZE in [73:62], C_SIZE_MULT in [49:47]
+		csize = nsect / 512 - 1;
+		reg[5] = 0x09;
+		reg[6] = (csize >> 10) & 0x03;
+		reg[7] = csize >> 2;
+		reg[8] = (csize & 0x03) << 6;
+		reg[9] = 0x03;
+		reg[10] = 0x80;
+	}
+	r1(0x00);
+	queue_block(reg, sizeof(reg));
+}
+
+// Sector the address argument refers to, or -1 when it is off the card
+static long sector(uint32_t arg)
+{
+	uint32_t s;
+
+	if(!sdhc) {
+		if(arg & 511) return -1;
+		s = arg >> 9;
+	} else {
+		s = arg;
+	}
+	return s < nsect ? (long)s : -1;
+}
+
+static void exec(void)
+{
+	int idx = cmd[0] & 0x3f;
+	uint32_t arg = (cmd[1] << 24) | (cmd[2] << 16) | (cmd[3] << 8) | cmd[4];
+	int app = appcmd;
+	long s;
+
+	appcmd = 0;
+	fakesd_stats.cmds[idx]++;
+
+	if(app && idx == 41) {
+		// ready on the second ACMD41, like a card that needs a moment
+		if(++acmd41 >= 2) ready = 1;
+		r1(ready ? 0x00 : 0x01);
+		return;
+	}
+
+	switch(idx) {
+		case 0:
+			ready = acmd41 = 0;
+			state = ST_IDLE;
+			r1(0x01);
+			break;
+		case 8:
+			r1(0x01);
+			queue1(0x00); queue1(0x00); queue1((arg >> 8) & 0x0f); queue1(arg);
+			break;
+		case 55:
+			appcmd = 1;
+			r1(ready ? 0x00 : 0x01);
+			break;
+		case 58:
+			r1(ready ? 0x00 : 0x01);
+			queue1(sdhc ? 0xc0 : 0x80); queue1(0xff); queue1(0x80); queue1(0x00);
+			break;
+		case 9:
+		case 10:
+			cid_csd(idx);
+			break;
+		case 12:
+			// Whatever was going out is cut off; a stuff byte, R1 and a
+			// moment of busy follow
+			outPos = outLen = 0;
+			state = ST_IDLE;
+			queue1(0xff);
+			queue1(0x3a);
+			queue1(0x00);
+			busy = 4;
+			break;
+		case 17:
+		case 18:
+			if(!ready || (s = sector(arg)) < 0) {
+				r1(0x40);
+				break;
+			}
+			r1(0x00);
+			addr = s;
+			if(idx == 17) {
+				queue_block(img + addr * 512, 512);
+				fakesd_stats.blocksRead++;
+			} else {
+				state = ST_READ_MULTI;
+			}
+			break;
+		case 24:
+		case 25:
+			if(!ready || (s = sector(arg)) < 0) {
+				r1(0x40);
+				break;
+			}
+			r1(0x00);
+			addr = s;
+			multi = (idx == 25);
+			state = ST_WRITE_WAIT;
+			break;
+		default:
+			r1(0x04);		// illegal command
+			break;
+	}
+}
+
+// One byte each way
+static uint8_t xfer(uint8_t in)
+{
+	int idle = (outPos == outLen && busy == 0);
+
+	fakesd_stats.bytes++;
+
+	switch(state) {
+		case ST_WRITE_WAIT:
+			if(!idle) break;
+			if(in == (multi ? 0xfc : 0xfe)) {
+				state = ST_WRITE_DATA;
+				wLen = 0;
+			} else if(multi && in == 0xfd) {
+				// stop tran: one byte, then busy
+				state = ST_IDLE;
+				queue1(0xff);
+				busy = 8;
+			}
+			break;
+
+		case ST_WRITE_DATA:
+			wbuf[wLen++] = in;
+			if(wLen == sizeof(wbuf)) {
+				if(addr < nsect) {
+					memcpy(img + addr * 512, wbuf, 512);
+					fakesd_stats.blocksWritten++;
+					queue1(0xff);
+					queue1(0xe5);	// data accepted
+				} else {
+					queue1(0xff);
+					queue1(0xed);	// write error
+				}
+				addr++;
+				busy = 16;
+				state = multi ? ST_WRITE_WAIT : ST_IDLE;
+			}
+			break;
+
+		default:
+			if(cmdLen == 0 && (in & 0xc0) != 0x40)
+				break;
+			cmd[cmdLen++] = in;
+			if(cmdLen == sizeof(cmd)) {
+				cmdLen = 0;
+				exec();
+			}
+			break;
+	}
+
+	if(outPos < outLen)
+		return out[outPos++];
+	if(busy) {
+		busy--;
+		return 0x00;
+	}
+	if(state == ST_READ_MULTI && addr < nsect) {
+		queue_block(img + addr * 512, 512);
+		fakesd_stats.blocksRead++;
+		addr++;
+		return out[outPos++];
+	}
+	return 0xff;
+}
+
+//-----------------------------------------------------------------------------
+// The SPI calls msd.c makes; the card is the only thing on this bus
+//-----------------------------------------------------------------------------
+unsigned int spi_com(unsigned int channel, unsigned int dout, unsigned char last)
+{
+	return xfer(dout);
+}
+
+void SetupSpi(int mode) {}
+void SpiBegin(int channel) {}
+void SpiEnd(void) {}
+void SpiWait(void) {}
+
+unsigned int SpiXfer(unsigned int dout)
+{
+	return xfer(dout);
+}
+
+void SpiSend(unsigned int dout)
+{
+	xfer(dout);
+}
+
+void SpiWrite(const void *buf, int n)
+{
+	const uint8_t *p = buf;
+
+	while(n-- > 0)
+		xfer(*p++);
+}
+
+void SpiTransfer(const void *tx, void *rx, int n)
+{
+	const uint8_t *t = tx;
+	uint8_t *r = rx;
+	int i;
+
+	for(i = 0; i < n; i++)
+		r[i] = xfer(t ? t[i] : 0xff);
+}
@@ -0,0 +1,31 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host model of a microSD card in SPI mode, backed by a disk image in RAM.
+// It sits behind spi_com() and the SPI session calls, so armsrc/msd.c and
+// diskio.c can be run unmodified against it, and counts what went over the
+// bus.
+//-----------------------------------------------------------------------------
+
+#ifndef __FAKESD_H
+#define __FAKESD_H
+
+#include <stdint.h>
+
+// Attach an image of nsect 512 byte sectors. SDHC cards take block
+// addresses, standard capacity ones byte addresses. With an SDHC card,
+// nsect must be a multiple of 1024 (the CSD counts 512K units).
+void fakesd_attach(uint8_t *image, uint32_t nsect, int sdhc);
+
+typedef struct {
+	unsigned long bytes;		// bytes clocked over the bus
+	unsigned long cmds[64];		// commands seen, by index (ACMDs too)
+	unsigned long blocksRead;
+	unsigned long blocksWritten;
+} fakesd_stats_t;
+
+extern fakesd_stats_t fakesd_stats;
+
+#endif
@@ -0,0 +1,311 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Run the flasher (client/flash.c) against the bootloader (bootrom/bootrom.c)
+// on a model of the flash, both unmodified, with the USB link in between
+// replaced by function calls. Writes an image with the old one ACK per
+// packet protocol and with the streaming one, writes it again and with a
+// few bytes changed to see that only the changed pages are programmed, and
+// makes a page fail to program, and one come out wrong, to see that both
+// are caught. Prints the packets each run took in each direction, and how
+// often the flasher turned around from sending to waiting for a reply:
+// with a real device each of those costs a USB round trip.
+//
+// Without arguments a made up FPGA and OS image is used; otherwise the ELF
+// files given, as the flasher would load them. With -o, the images are
+// also written over the older build given there, and the pages programmed
+// must be the ones client/flashdiff.c says differ between the two builds.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "proxusb.h"
+#include "flash.h"
+#include "flashdiff.h"
+#include "crc32.h"
+#include "fakeflash.h"
+
+#define MAX_FILES	4
+
+#define PAGES		(FAKEFLASH_SIZE / FAKEFLASH_PAGE)
+
+static flash_file_t files[MAX_FILES], oldFiles[MAX_FILES];
+static int numFiles, numOldFiles;
+static uint8_t *flash;
+static int verbose, failed;
+
+//-----------------------------------------------------------------------------
+// What client/proxusb.c does over libusb
+//-----------------------------------------------------------------------------
+static int legacy;
+static unsigned long packetsOut, packetsIn, roundTrips;
+static int sending;
+
+void SendCommandTo(struct prox_unit *unit, UsbCommand *c)
+{
+	// The device sends a reply with a busy wait for the host to pick it up;
+	// if the host is busy sending instead, both sides are stuck.
+	if(fakeflash_pending()) {
+		fprintf(stderr, "flashbench: sending 0x%04x with %d replies unread, this would hang\n",
+			c->cmd, fakeflash_pending());
+		exit(1);
+	}
+	packetsOut++;
+	sending = 1;
+	fakeflash_send(c);
+}
+
+bool ReceiveCommandPollFrom(struct prox_unit *unit, UsbCommand *c)
+{
+	memset(c, 0, sizeof(*c));
+	if(!fakeflash_receive(c)) return false;
+	packetsIn++;
+	// an older bootloader, that only knows the ACK per packet protocol
+	if(legacy && c->cmd == CMD_DEVICE_INFO)
+		c->arg[0] &= ~DEVICE_INFO_FLAG_UNDERSTANDS_STREAM_WRITE;
+	return true;
+}
+
+void ReceiveCommandFrom(struct prox_unit *unit, UsbCommand *c)
+{
+	if(sending) roundTrips++;
+	sending = 0;
+	if(!ReceiveCommandPollFrom(unit, c)) {
+		fprintf(stderr, "flashbench: waiting for a reply that never comes\n");
+		exit(1);
+	}
+}
+
+bool OpenProxmarkUnit(struct prox_unit *unit, const char *serial, int verbose)
+{
+	return true;
+}
+
+// the fake bootloader never goes away, so it is always there to reopen
+bool ReopenProxmarkUnit(struct prox_unit *unit, int timeout)
+{
+	return true;
+}
+
+void CloseProxmarkUnit(struct prox_unit *unit) {}
+
+//-----------------------------------------------------------------------------
+// Images
+//-----------------------------------------------------------------------------
+static uint32_t rnd = 0x2545f491;
+
+static uint8_t next_rnd(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd >> 24;
+}
+
+// One segment file; the FPGA image is mostly zeros, the OS image isn't
+static void make_file(const char *name, uint32_t start, uint32_t length, int sparse)
+{
+	flash_file_t *f = &files[numFiles++];
+	uint8_t *data = malloc(length);
+	uint32_t i;
+
+	for(i = 0; i < length; i++)
+		data[i] = (!sparse || next_rnd() < 16) ? next_rnd() : 0;
+
+	f->filename = name;
+	f->num_segs = 1;
+	f->segments = malloc(sizeof(flash_seg_t));
+	f->segments[0].data = data;
+	f->segments[0].start = start;
+	f->segments[0].length = length;
+}
+
+static int flash_matches(void)
+{
+	int i, j;
+
+	for(i = 0; i < numFiles; i++) {
+		for(j = 0; j < files[i].num_segs; j++) {
+			flash_seg_t *seg = &files[i].segments[j];
+			uint8_t *p = flash + (seg->start - FAKEFLASH_START);
+			uint32_t k;
+
+			if(memcmp(p, seg->data, seg->length)) return 0;
+			for(k = seg->length; k % FAKEFLASH_PAGE; k++)
+				if(p[k] != 0xff) return 0;
+		}
+	}
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Runs
+//-----------------------------------------------------------------------------
+static int quiet_stderr(void)
+{
+	int saved = dup(2), null;
+
+	if(verbose) return -1;
+	null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+	close(null);
+	return saved;
+}
+
+static void restore_stderr(int saved)
+{
+	if(saved < 0) return;
+	dup2(saved, 2);
+	close(saved);
+}
+
+static struct prox_unit unit;
+static flash_device_t dev;
+
+// Same sequence as flasher.c
+static int flash_all(flash_file_t *f, int n)
+{
+	int i, res, saved = quiet_stderr();
+
+	memset(&dev, 0, sizeof(dev));
+	dev.unit = &unit;
+	dev.out = stderr;
+	res = flash_start_flashing(&dev, 0);
+	for(i = 0; res >= 0 && i < n; i++)
+		res = flash_write(&dev, &f[i]);
+	if(res >= 0)
+		flash_print_stats(&dev);
+	flash_stop_flashing(&dev);
+
+	restore_stderr(saved);
+	return res;
+}
+
+// Pages that writing the images will program, going by the page CRCs of
+// what is in the flash now
+static uint32_t predict(void)
+{
+	uint32_t crcs[PAGES], total;
+	int i;
+
+	for(i = 0; i < PAGES; i++)
+		crcs[i] = update_crc32(0, flash + i * FAKEFLASH_PAGE, FAKEFLASH_PAGE);
+	return flash_diff_files(files, numFiles, FAKEFLASH_START, PAGES, crcs, &total);
+}
+
+// expectPages < 0: do not check the number of pages programmed
+static void run(const char *what, int useLegacy, int expectOk, long expectPages)
+{
+	int res;
+
+	legacy = useLegacy;
+	packetsOut = packetsIn = roundTrips = 0;
+	fakeflash_stats.programmed = 0;
+	fakeflash_stats.resets = 0;
+
+	res = flash_all(files, numFiles);
+
+	printf("%-30s %-4s %4lu pages programmed, %6u bytes skipped, %5lu packets out, %4lu in, %4lu round trips\n",
+		what, res < 0 ? "fail" : "ok", fakeflash_stats.programmed,
+		(dev.stats.blocks - dev.stats.written) * BLOCK_SIZE, packetsOut, packetsIn, roundTrips);
+
+	if((res >= 0) != expectOk) {
+		printf("FAIL: %s %s\n", what, expectOk ? "did not work" : "was not caught");
+		failed = 1;
+	}
+	if(expectPages >= 0 && fakeflash_stats.programmed != expectPages) {
+		printf("FAIL: %s: %ld pages should have been programmed\n", what, expectPages);
+		failed = 1;
+	}
+	if(expectOk && !flash_matches()) {
+		printf("FAIL: %s: flash does not hold the image\n", what);
+		failed = 1;
+	}
+	if(fakeflash_stats.resets != 1) {
+		printf("FAIL: %s: device was not reset at the end\n", what);
+		failed = 1;
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-v] [-o old.elf ...] [image.elf ...]\n", argv0);
+	fprintf(stderr, "  -v  show what the flasher prints\n");
+	fprintf(stderr, "  -o  older build of the images, to update from (repeat for each file)\n");
+}
+
+int main(int argc, char **argv)
+{
+	flash_seg_t *seg;
+	int opt, i, page;
+
+	while((opt = getopt(argc, argv, "vo:h")) != -1) {
+		switch(opt) {
+			case 'v': verbose = 1; break;
+			case 'o':
+				if(numOldFiles == MAX_FILES || flash_load(&oldFiles[numOldFiles], optarg, 0) < 0)
+					return 1;
+				numOldFiles++;
+				break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if(optind < argc) {
+		for(i = optind; i < argc && numFiles < MAX_FILES; i++) {
+			if(flash_load(&files[numFiles], argv[i], 0) < 0) return 1;
+			numFiles++;
+		}
+	} else {
+		make_file("fpgaimage", 0x102000, 0x29a53, 1);
+		make_file("osimage", 0x12c000, 0x11234, 0);
+	}
+
+	flash = fakeflash_init();
+
+	run("old protocol, erased flash", 1, 1, -1);
+	fakeflash_init();
+	run("streamed, erased flash", 0, 1, predict());
+	run("streamed, same image again", 0, 1, 0);
+
+	if(numOldFiles) {
+		fakeflash_init();
+		if(flash_all(oldFiles, numOldFiles) < 0) {
+			printf("FAIL: could not write the old build\n");
+			return 1;
+		}
+		run("streamed, over the old build", 0, 1, predict());
+	}
+
+	// a few bytes in the last segment, two of them in the same page
+	seg = &files[numFiles - 1].segments[files[numFiles - 1].num_segs - 1];
+	((uint8_t *)seg->data)[seg->length / 3] ^= 0x5a;
+	((uint8_t *)seg->data)[seg->length / 3 + 1] ^= 0xa5;
+	((uint8_t *)seg->data)[seg->length - 1] ^= 0x01;
+	run("streamed, 3 bytes changed", 0, 1, predict());
+
+	page = (seg->start - FAKEFLASH_START + seg->length / 2) / FAKEFLASH_PAGE;
+	fakeflash_init();
+	fakeflash_stats.failPage = page;
+	run("streamed, page fails", 0, 0, -1);
+	fakeflash_stats.failPage = -1;
+
+	fakeflash_init();
+	fakeflash_stats.flipPage = page;
+	run("streamed, page comes out wrong", 0, 0, -1);
+	fakeflash_stats.flipPage = -1;
+
+	for(i = 0; i < numFiles; i++)
+		flash_free(&files[i]);
+	for(i = 0; i < numOldFiles; i++)
+		flash_free(&oldFiles[i]);
+
+	if(!failed) printf("all ok\n");
+	return failed;
+}
@@ -0,0 +1,180 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Check the firmware's FPGA bitstream unpacker (armsrc/fpgaunpack.c) against
+// the .bit file it was packed from by tools/fpgacompress.pl: every word it
+// hands to the download loop must be the next 32 bits of section 'e', and a
+// damaged image must be refused rather than clocked into the FPGA.
+//
+// The Makefile packs ../../fpga/fpga.bit into obj/fpga.bit.z, the same way
+// the armsrc build does; that pair is the default.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../../armsrc/fpgaunpack.h"
+
+static const uint8_t fixed[] = {0x00, 0x09, 0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x00, 0x00, 0x01};
+
+static uint8_t *load(const char *name, long *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf;
+
+	if(!f) {
+		perror(name);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len);
+	if(fread(buf, 1, *len, f) != (size_t)*len) {
+		fprintf(stderr, "%s: read error\n", name);
+		exit(1);
+	}
+	fclose(f);
+	return buf;
+}
+
+// Same walk as bitparse_find_section() in fpgaloader.c
+static const uint8_t *section(const uint8_t *bit, long len, char name, uint32_t *slen)
+{
+	const uint8_t *p = bit + sizeof(fixed), *end = bit + len;
+
+	if(len < (long)sizeof(fixed) || memcmp(bit, fixed, sizeof(fixed))) return NULL;
+	while(p < end) {
+		char n = *p++;
+		if(n == 'e' || n == 'z') {
+			*slen = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+			p += 4;
+		} else {
+			*slen = (p[0] << 8) | p[1];
+			p += 2;
+		}
+		if(n == name) return p;
+		p += *slen;
+	}
+	return NULL;
+}
+
+// The download loop's side: compare what arrives with the plain bitstream
+static const uint8_t *want;
+static uint32_t wantLen, pos, zeroWords;
+static int mismatch;
+
+static void put(uint32_t w)
+{
+	uint32_t v;
+
+	if(pos + 4 > wantLen) {
+		mismatch = 1;
+		return;
+	}
+	v = ((uint32_t)want[pos] << 24) | (want[pos+1] << 16) | (want[pos+2] << 8) | want[pos+3];
+	if(v != w && !mismatch) {
+		fprintf(stderr, "mismatch at byte %u: got %08x, want %08x\n", pos, w, v);
+		mismatch = 1;
+	}
+	if(w == 0) zeroWords++;
+	pos += 4;
+}
+
+static void tail(uint32_t w, int bits)
+{
+	int i;
+
+	for(i = 0; i < bits / 8; i++, pos++) {
+		if(pos >= wantLen || want[pos] != (uint8_t)(w >> (24 - 8 * i)))
+			mismatch = 1;
+	}
+}
+
+static int unpack(const uint8_t *z, int zlen)
+{
+	pos = 0;
+	zeroWords = 0;
+	mismatch = 0;
+	return FpgaUnpack(z, zlen, put, tail);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	const uint8_t *z, *hdr, *phdr;
+	uint8_t *bit, *packed;
+	long bitLen, packedLen;
+	uint32_t zLen, hLen, phLen;
+	double start;
+	const char *bitName = "../../fpga/fpga.bit", *packedName = "obj/fpga.bit.z";
+	int n, i, failed = 0;
+	char c;
+
+	if(argc == 3) {
+		bitName = argv[1];
+		packedName = argv[2];
+	} else if(argc != 1) {
+		fprintf(stderr, "Usage: %s [fpga.bit fpga.bit.z]\n", argv[0]);
+		return 1;
+	}
+	bit = load(bitName, &bitLen);
+	packed = load(packedName, &packedLen);
+
+	want = section(bit, bitLen, 'e', &wantLen);
+	z = section(packed, packedLen, 'z', &zLen);
+	if(!want || !z) {
+		fprintf(stderr, "no bitstream in %s\n", want ? packedName : bitName);
+		return 1;
+	}
+
+	// `hw version' reads these from the packed image
+	for(c = 'a'; c <= 'd'; c++) {
+		hdr = section(bit, bitLen, c, &hLen);
+		phdr = section(packed, packedLen, c, &phLen);
+		if(!hdr != !phdr || (hdr && (hLen != phLen || memcmp(hdr, phdr, hLen)))) {
+			printf("FAIL: header section %c differs\n", c);
+			failed = 1;
+		}
+	}
+
+	start = now_ns();
+	n = unpack(z, zLen);
+	printf("%s: %u bytes -> %s: %u bytes (%.1f%%), %u words, %u of them zero, unpacked in %.2f ms\n",
+		bitName, wantLen, packedName, zLen, 100.0 * zLen / wantLen,
+		wantLen / 4, zeroWords, (now_ns() - start) / 1e6);
+	if(n != (int)wantLen || pos != wantLen || mismatch) {
+		printf("FAIL: unpacked bitstream differs (returned %d, %u bytes out)\n", n, pos);
+		failed = 1;
+	}
+
+	// cut short anywhere, or with a length that does not add up: refused
+	for(i = 4; i < (int)zLen; i += 97) {
+		if(unpack(z, i) >= 0) {
+			printf("FAIL: image cut at %d accepted\n", i);
+			failed = 1;
+			break;
+		}
+	}
+	packed[z - packed + 3] ^= 1;
+	if(unpack(z, zLen) >= 0) {
+		printf("FAIL: wrong length accepted\n");
+		failed = 1;
+	}
+
+	printf("%s\n", failed ? "FAILED" : "bit exact");
+	free(bit);
+	free(packed);
+	return failed;
+}
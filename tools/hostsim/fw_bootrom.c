@@ -0,0 +1,147 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// The bootloader, built from the unmodified source, on a model of the flash.
+//
+// The flash array is mapped at its device address and linked against the
+// _flash_start/_flash_end symbols at the same place (see the Makefile), so
+// the address checks and CRC reads in bootrom.c work as they are. On the
+// chip, writes anywhere in the flash land in the 256 byte write buffer of
+// the controller; bootrom.c always writes it through _flash_start, so the
+// first page of the array stands in for the buffer here and is put back
+// once a page program command has taken its contents.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "proxmark3.h"
+#include "fakeflash.h"
+
+AT91PS_EFC fakeflash_efc(void);
+extern AT91S_RSTC fakeflash_rstc;
+
+#undef AT91C_BASE_EFC0
+#define AT91C_BASE_EFC0		fakeflash_efc()
+#undef AT91C_BASE_RSTC
+#define AT91C_BASE_RSTC		(&fakeflash_rstc)
+
+// BootROM() jumps to the OS image; never called here
+#define asm(...)
+
+#include "../../bootrom/bootrom.c"
+
+AT91S_PIO hostsim_pioa;
+AT91S_RSTC fakeflash_rstc;
+fakeflash_stats_t fakeflash_stats = { 0, 0, -1, -1 };
+
+static uint8_t *flash;
+static uint8_t page0[FAKEFLASH_PAGE];
+static AT91S_EFC efc;
+static uint32_t efcErrors;
+
+uint8_t *fakeflash_init(void)
+{
+	if(!flash) {
+		flash = mmap((void *)FAKEFLASH_START, FAKEFLASH_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if(flash != (uint8_t *)FAKEFLASH_START) {
+			perror("mapping the flash array");
+			exit(1);
+		}
+	}
+	memset(flash, 0xff, FAKEFLASH_SIZE);
+	memcpy(page0, flash, FAKEFLASH_PAGE);
+	memset(&efc, 0, sizeof(efc));
+	efcErrors = 0;
+	return flash;
+}
+
+// Every access to the controller runs the command written before it, so a
+// command takes no time, and the errors it raised show in the status
+// register exactly once, as they do on the chip.
+AT91PS_EFC fakeflash_efc(void)
+{
+	uint32_t fcr = efc.EFC_FCR;
+	int page;
+
+	if(fcr) {
+		efc.EFC_FCR = 0;
+		page = (fcr >> 8) & 0x3ff;
+		if((fcr >> 24) != 0x5a || (fcr & 0xf) != AT91C_MC_FCMD_START_PROG ||
+			(page + 1) * FAKEFLASH_PAGE > FAKEFLASH_SIZE)
+		{
+			fprintf(stderr, "fakeflash: unexpected flash command %08x\n", fcr);
+			exit(1);
+		}
+
+		uint8_t latch[FAKEFLASH_PAGE];
+		memcpy(latch, flash, FAKEFLASH_PAGE);
+		memcpy(flash, page0, FAKEFLASH_PAGE);
+
+		if(page == fakeflash_stats.failPage) {
+			efcErrors = AT91C_MC_PROGE;
+		} else {
+			if(page == fakeflash_stats.flipPage) latch[17] ^= 0x10;
+			memcpy(flash + page * FAKEFLASH_PAGE, latch, FAKEFLASH_PAGE);
+			if(page == 0) memcpy(page0, latch, FAKEFLASH_PAGE);
+			fakeflash_stats.programmed++;
+		}
+	}
+
+	efc.EFC_FSR = AT91C_MC_FRDY | efcErrors;
+	efcErrors = 0;
+	return &efc;
+}
+
+//-----------------------------------------------------------------------------
+// The USB side
+//-----------------------------------------------------------------------------
+#define QUEUE_LEN	128
+
+static UsbCommand queue[QUEUE_LEN];
+static int queueRd, queueWr;
+
+void fakeflash_send(UsbCommand *c)
+{
+	UsbCommand p = *c;
+
+	UsbPacketReceived((uint8_t *)&p, sizeof(p));
+	// the chip would be gone before it got to ACK the reset
+	if(fakeflash_rstc.RSTC_RCR) {
+		fakeflash_rstc.RSTC_RCR = 0;
+		fakeflash_stats.resets++;
+		queueRd = queueWr;
+	}
+}
+
+int fakeflash_receive(UsbCommand *c)
+{
+	if(queueRd == queueWr) return 0;
+	*c = queue[queueRd++ % QUEUE_LEN];
+	return 1;
+}
+
+int fakeflash_pending(void)
+{
+	return queueWr - queueRd;
+}
+
+void UsbSendPacket(uint8_t *packet, int len)
+{
+	if(len != sizeof(UsbCommand) || queueWr - queueRd >= QUEUE_LEN) {
+		fprintf(stderr, "fakeflash: bootloader sent %d bytes with %d packets unread\n",
+			len, queueWr - queueRd);
+		exit(1);
+	}
+	memcpy(&queue[queueWr++ % QUEUE_LEN], packet, len);
+}
+
+void UsbStart(void) {}
+int UsbPoll(int blinkLeds) { return 0; }
+void hostsim_poll(void) {}
+int hostsim_button(void) { return 0; }
@@ -0,0 +1,74 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// iClass decoders, built from the unmodified firmware source.
+//-----------------------------------------------------------------------------
+
+#include "../../armsrc/iclass.c"
+#include "hostsim.h"
+
+// Same sub-sampling and bookkeeping as SnoopIClass(), minus the DMA ring
+int fwiclass_decode(const uint8_t *samples, int n)
+{
+	uint8_t *receivedCmd, *receivedResponse;
+	int frames = 0;
+	int div = 0, decbyte = 0, decbyter = 0;
+	int smpl, i;
+
+	BigBufReset();
+	receivedCmd = BigBufAlloc(BB_RECV_CMD, RECV_CMD_SIZE);
+	receivedResponse = BigBufAlloc(BB_RECV_RES, RECV_RES_SIZE);
+
+	memset(&Demod, 0, sizeof(Demod));
+	Demod.output = receivedResponse;
+	Demod.state = DEMOD_UNSYNCD;
+
+	memset(&Uart, 0, sizeof(Uart));
+	Uart.output = receivedCmd;
+	Uart.byteCntMax = 32;
+	Uart.state = STATE_UNSYNCD;
+
+	for(i = 0; i < n; i++) {
+		smpl = (int8_t)samples[i];
+
+		if(smpl & 0xF) {
+			decbyte ^= (1 << (3 - div));
+		}
+		decbyter <<= 2;
+		decbyter ^= (smpl & 0x30);
+
+		div++;
+
+		if((div + 1) % 2 == 0) {
+			if(MillerDecoding((decbyter & 0xF0) >> 4)) {
+				frames++;
+				Uart.state = STATE_UNSYNCD;
+				Demod.state = DEMOD_UNSYNCD;
+				Uart.byteCnt = 0;
+			}
+			decbyter = 0;
+		}
+
+		if(div > 3) {
+			if(ManchesterDecoding(decbyte & 0x0F)) {
+				frames++;
+				memset(&Demod, 0, sizeof(Demod));
+				Demod.output = receivedResponse;
+				Demod.state = DEMOD_UNSYNCD;
+			}
+			div = 0;
+			decbyte = 0x00;
+		}
+	}
+
+	return frames;
+}
+
+int fwiclass_snoop(const uint8_t **tracep, int dmaSize)
+{
+	SnoopIClass(dmaSize);
+	*tracep = trace;
+	return traceLen;
+}
@@ -0,0 +1,59 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// ISO 14443A decoders, built from the unmodified firmware source so that the
+// static MillerDecoding()/ManchesterDecoding() can be driven from the host.
+//-----------------------------------------------------------------------------
+
+#include "../../armsrc/iso14443a.c"
+#include "hostsim.h"
+
+// Same bookkeeping as SnoopIso14443a(), minus the DMA ring
+int fw14a_decode(const uint8_t *samples, int n)
+{
+	uint8_t *receivedCmd, *receivedResponse;
+	int frames = 0;
+	int smpl, i;
+
+	BigBufReset();
+	receivedCmd = BigBufAlloc(BB_RECV_CMD, RECV_CMD_SIZE);
+	receivedResponse = BigBufAlloc(BB_RECV_RES, RECV_RES_SIZE);
+
+	memset(&Demod, 0, sizeof(Demod));
+	Demod.output = receivedResponse;
+	Demod.state = DEMOD_UNSYNCD;
+
+	memset(&Uart, 0, sizeof(Uart));
+	Uart.output = receivedCmd;
+	Uart.byteCntMax = 32;
+	Uart.state = STATE_UNSYNCD;
+
+	for(i = 0; i < n; i++) {
+		smpl = (int8_t)samples[i];
+
+		if(MillerDecoding((smpl & 0xF0) >> 4)) {
+			frames++;
+			Uart.state = STATE_UNSYNCD;
+			Demod.state = DEMOD_UNSYNCD;
+		}
+
+		if(ManchesterDecoding(smpl & 0x0F)) {
+			frames++;
+			memset(&Demod, 0, sizeof(Demod));
+			Demod.output = receivedResponse;
+			Demod.state = DEMOD_UNSYNCD;
+		}
+	}
+
+	return frames;
+}
+
+// No configurable DMA ring in this mode
+int fw14a_snoop(const uint8_t **tracep, int dmaSize)
+{
+	SnoopIso14443a();
+	*tracep = trace;
+	return traceLen;
+}
@@ -0,0 +1,79 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// ISO 14443B decoders, built from the unmodified firmware source.
+//-----------------------------------------------------------------------------
+
+#include "../../armsrc/iso14443.c"
+#include "hostsim.h"
+
+// Same bookkeeping as SnoopIso14443(), minus the DMA ring. The samples are
+// (ci, cq) pairs.
+int fw14b_decode(const uint8_t *samples, int n)
+{
+	uint8_t *receivedCmd, *receivedResponse;
+	int frames = 0;
+	int ci, cq, i;
+
+	BigBufReset();
+	receivedCmd = BigBufAlloc(BB_RECV_CMD, READER_TAG_BUFFER_SIZE);
+	receivedResponse = BigBufAlloc(BB_RECV_RES, TAG_READER_BUFFER_SIZE);
+
+	memset(&Demod, 0, sizeof(Demod));
+	Demod.output = receivedResponse;
+	Demod.state = DEMOD_UNSYNCD;
+
+	memset(&Uart, 0, sizeof(Uart));
+	Uart.output = receivedCmd;
+	Uart.byteCntMax = 100;
+	Uart.state = STATE_UNSYNCD;
+
+	for(i = 0; i + 1 < n; i += 2) {
+		ci = (int8_t)samples[i];
+		cq = (int8_t)samples[i+1];
+
+#define UART_FRAME_DONE \
+			frames++; \
+			memset(&Uart, 0, sizeof(Uart)); \
+			Uart.output = receivedCmd; \
+			Uart.byteCntMax = 100; \
+			Uart.state = STATE_UNSYNCD; \
+			memset(&Demod, 0, sizeof(Demod)); \
+			Demod.output = receivedResponse; \
+			Demod.state = DEMOD_UNSYNCD;
+
+		if(Handle14443UartBit(ci & 1)) {
+			UART_FRAME_DONE
+		}
+		if(Handle14443UartBit(cq & 1)) {
+			UART_FRAME_DONE
+		}
+
+		if(Handle14443SamplesDemod(ci, cq)) {
+			frames++;
+			memset(&Demod, 0, sizeof(Demod));
+			Demod.output = receivedResponse;
+			Demod.state = DEMOD_UNSYNCD;
+		}
+	}
+
+	return frames;
+}
+
+// SnoopIso14443() keeps its trace in a local, but the trace region is
+// always at the bottom of BigBuf
+int fw14b_snoop(const uint8_t **tracep, int dmaSize)
+{
+	const uint8_t *t = (const uint8_t *)BigBuf;
+	int len = 0;
+
+	SnoopIso14443(dmaSize);
+
+	// Walk the frames up to the 0x44 fill pattern
+	while(len + 9 <= DEMOD_TRACE_SIZE && t[len+8] != 0 && !(t[len] == 0x44 && t[len+1] == 0x44 && t[len+2] == 0x44 && t[len+3] == 0x44))
+		len += 9 + t[len+8];
+	*tracep = t;
+	return len;
+}
@@ -0,0 +1,347 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host implementations of the firmware services that the decoders and sniff
+// loops call into: debug output, FPGA/SSC setup, timers and a fake PDC that
+// streams a recorded sample dump into the DMA ring.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "at91sam7s512.h"
+#include "usb_cmd.h"
+#include "hostsim.h"
+
+AT91S_PDC hostsim_pdc_ssc;
+AT91S_SSC hostsim_ssc;
+AT91S_PIO hostsim_pioa;
+AT91S_TC hostsim_tc0;
+AT91S_TC hostsim_tc1;
+
+int hostsim_quiet = 0;
+
+// The firmware would normally define these in appmain.c
+uint8_t ToSend[512];
+int ToSendMax;
+static int ToSendBit;
+
+//-----------------------------------------------------------------------------
+// Fake SSC receive DMA
+//-----------------------------------------------------------------------------
+static uint8_t *ring;
+static uint8_t *ringWr;
+static int ringLen;
+
+static const uint8_t *src;
+static int srcLen, srcPos, srcBurst = 1;
+static int drainPolls, overruns;
+
+void hostsim_stream(const uint8_t *samples, int len, int burst)
+{
+	src = samples;
+	srcLen = len;
+	srcPos = 0;
+	srcBurst = burst > 0 ? burst : 1;
+	drainPolls = 0;
+	overruns = 0;
+}
+
+int hostsim_overruns(void)
+{
+	return overruns;
+}
+
+//-----------------------------------------------------------------------------
+// Fake SSC transmit DMA: the LF simulator has the SSC shift out 32 carrier
+// cycles per word, from TPR/TCR and then TNPR/TNCR. What goes out is kept
+// for the bench to look at.
+//-----------------------------------------------------------------------------
+static uint32_t *txOut;
+static int txLen, txMax, txBurst = 1, underruns;
+
+void (*hostsim_usb_hook)(void);
+
+void hostsim_capture(uint32_t *out, int words, int burst)
+{
+	txOut = out;
+	txLen = 0;
+	txMax = words;
+	txBurst = burst > 0 ? burst : 1;
+	underruns = 0;
+}
+
+int hostsim_captured(void)
+{
+	return txLen;
+}
+
+int hostsim_underruns(void)
+{
+	return underruns;
+}
+
+// The pointers the firmware hands the PDC are its own, the bench is linked
+// so that they fit in 32 bits
+static void txchain(void)
+{
+	hostsim_pdc_ssc.PDC_TPR = hostsim_pdc_ssc.PDC_TNPR;
+	hostsim_pdc_ssc.PDC_TCR = hostsim_pdc_ssc.PDC_TNCR;
+	hostsim_pdc_ssc.PDC_TNCR = 0;
+}
+
+// A word the PDC had nothing ready for is an underrun: the coil would sit
+// in whatever state the last one left it for another 32 carrier cycles.
+static void txpoll(void)
+{
+	uint32_t *p;
+	int n;
+
+	if(!(hostsim_pdc_ssc.PDC_PTCR & AT91C_PDC_TXTEN)) return;
+
+	for(n = 0; n < txBurst; n++) {
+		if(hostsim_pdc_ssc.PDC_TCR == 0) {
+			if(hostsim_pdc_ssc.PDC_TNCR == 0) {
+				underruns++;
+				continue;
+			}
+			txchain();
+		}
+		p = (uint32_t *)(uintptr_t)hostsim_pdc_ssc.PDC_TPR;
+		if(txLen < txMax) txOut[txLen++] = *p;
+		hostsim_pdc_ssc.PDC_TPR += 4;
+		hostsim_pdc_ssc.PDC_TCR--;
+		if(hostsim_pdc_ssc.PDC_TCR == 0 && hostsim_pdc_ssc.PDC_TNCR != 0)
+			txchain();
+	}
+}
+
+int UsbPoll(int blinkLeds)
+{
+	if(hostsim_usb_hook) hostsim_usb_hook();
+	return 0;
+}
+
+// Move the next burst of samples into the ring, the way the PDC would:
+// count RCR down, and chain to RNPR/RNCR (clearing RNCR) as soon as it
+// reaches zero. If there was nothing to chain to, the PDC stops and the
+// samples are lost until the firmware re-arms the next pointer.
+// Once the dump is used up the FPGA keeps streaming, so feed idle (zero)
+// samples; the sniff loops only look at the button when they got a sample.
+static void chain(void)
+{
+	// The firmware only hands us the low 32 bits of the pointer
+	ringWr = ring + (uint32_t)(hostsim_pdc_ssc.PDC_RNPR - (uint32_t)(uintptr_t)ring);
+	hostsim_pdc_ssc.PDC_RCR = hostsim_pdc_ssc.PDC_RNCR;
+	hostsim_pdc_ssc.PDC_RNCR = 0;
+}
+
+void hostsim_poll(void)
+{
+	uint8_t smpl;
+	int n;
+
+	if(txOut) txpoll();
+	if(!ring) return;
+
+	for(n = 0; n < srcBurst; n++) {
+		if(srcPos < srcLen) {
+			smpl = src[srcPos++];
+		} else {
+			smpl = 0;
+			drainPolls++;
+		}
+		if(hostsim_pdc_ssc.PDC_RCR == 0) {
+			if(hostsim_pdc_ssc.PDC_RNCR == 0) {
+				overruns++;
+				continue;
+			}
+			chain();
+		}
+		*ringWr++ = smpl;
+		hostsim_pdc_ssc.PDC_RCR--;
+		if(hostsim_pdc_ssc.PDC_RCR == 0 && hostsim_pdc_ssc.PDC_RNCR != 0)
+			chain();
+	}
+}
+
+// Pressed once the dump is exhausted and a full ring's worth of idle
+// samples went by, so that everything still buffered has been decoded.
+// When simulating, pressed once the capture is full.
+int hostsim_button(void)
+{
+	if(txOut) return txLen >= txMax;
+	return srcPos >= srcLen && drainPolls > ringLen;
+}
+
+void FpgaSetupSscDma(uint8_t *buf, int len)
+{
+	ring = buf;
+	ringWr = buf;
+	ringLen = len;
+	hostsim_pdc_ssc.PDC_RPR = (uint32_t)(uintptr_t)buf;
+	hostsim_pdc_ssc.PDC_RCR = len;
+	hostsim_pdc_ssc.PDC_RNPR = (uint32_t)(uintptr_t)buf;
+	hostsim_pdc_ssc.PDC_RNCR = len;
+
+	// SnoopIso14443() only hits the watchdog after it consumed a sample, so
+	// have the first burst waiting when the loop starts
+	hostsim_poll();
+}
+
+void FpgaSetupSscDmaHalves(uint8_t *buf, int len)
+{
+	ring = buf;
+	ringWr = buf;
+	ringLen = len;
+	hostsim_pdc_ssc.PDC_RPR = (uint32_t)(uintptr_t)buf;
+	hostsim_pdc_ssc.PDC_RCR = len / 2;
+	hostsim_pdc_ssc.PDC_RNPR = (uint32_t)(uintptr_t)(buf + len / 2);
+	hostsim_pdc_ssc.PDC_RNCR = len / 2;
+}
+
+void FpgaSetupSsc(void) {}
+void FpgaWriteConfWord(uint8_t v) {}
+void FpgaSendCommand(uint16_t cmd, uint16_t v) {}
+void SetAdcMuxFor(uint32_t whichGpio) {}
+int AvgAdc(int ch) { return 0; }
+void LEDsoff() {}
+void SpinDelay(int ms) {}
+void SpinDelayUs(int us) {}
+int UsbConnected() { return 1; }
+// The only packets anything here sends are the tag IDs of the LF read loops
+// and the ProxBrute progress
+void UsbSendPacket(uint8_t *packet, int len)
+{
+	UsbCommand *c = (UsbCommand *)packet;
+
+	if(hostsim_quiet) return;
+	if(c->cmd == CMD_HID_BRUTE_STATUS) {
+		printf("%6u.%03us  %s %x%08x, %u tried\n",
+			c->d.asDwords[0] / 1000, c->d.asDwords[0] % 1000,
+			c->d.asDwords[1] ? "Stopped at" : "Trying", c->arg[0], c->arg[1], c->arg[2]);
+		return;
+	}
+	if(c->cmd != CMD_LF_TAG_ID) return;
+	if(c->arg[0] == LF_TAG_EM410X)
+		printf("%6u.%03us  EM410x Tag ID: %02x%08x (swing %u)\n",
+			c->d.asDwords[0] / 1000, c->d.asDwords[0] % 1000,
+			c->arg[1], c->arg[2], c->d.asDwords[1]);
+	else
+		printf("%6u.%03us  TAG ID: %x%08x (%d) (swing %u)\n",
+			c->d.asDwords[0] / 1000, c->d.asDwords[0] % 1000,
+			c->arg[1], c->arg[2], (c->arg[2] >> 1) & 0xffff, c->d.asDwords[1]);
+}
+
+//-----------------------------------------------------------------------------
+// Debug output goes to stdout
+//-----------------------------------------------------------------------------
+void DbpString(char *str)
+{
+	if(!hostsim_quiet) printf("#db# %s\n", str);
+}
+
+void Dbprintf(const char *fmt, ...)
+{
+	char output_string[128];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(output_string, sizeof(output_string), fmt, ap);
+	va_end(ap);
+
+	DbpString(output_string);
+}
+
+//-----------------------------------------------------------------------------
+// Timers, backed by the host clock
+//-----------------------------------------------------------------------------
+static uint32_t host_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static uint32_t GlobalUsCounter = 0;
+
+void StartTickCount() {}
+void StartCountUS() {}
+uint32_t GetTickCount() { return host_us() / 1000; }
+uint32_t GetCountUS() { return host_us(); }
+
+uint32_t GetDeltaCountUS()
+{
+	uint32_t g_cnt = GetCountUS();
+	uint32_t g_res = g_cnt - GlobalUsCounter;
+	GlobalUsCounter = g_cnt;
+	return g_res;
+}
+
+//-----------------------------------------------------------------------------
+// Same as in appmain.c / util.c
+//-----------------------------------------------------------------------------
+void ToSendReset(void)
+{
+	ToSendMax = -1;
+	ToSendBit = 8;
+}
+
+void ToSendStuffBit(int b)
+{
+	if(ToSendBit >= 8) {
+		ToSendMax++;
+		ToSend[ToSendMax] = 0;
+		ToSendBit = 0;
+	}
+	if(b) {
+		ToSend[ToSendMax] |= (1 << (7 - ToSendBit));
+	}
+	ToSendBit++;
+}
+
+void num_to_bytes(uint64_t n, size_t len, uint8_t* dest)
+{
+	while (len--) {
+		dest[len] = (uint8_t) n;
+		n >>= 8;
+	}
+}
+
+uint64_t bytes_to_num(uint8_t* src, size_t len)
+{
+	uint64_t num = 0;
+	while (len--) {
+		num = (num << 8) | (*src);
+		src++;
+	}
+	return num;
+}
+
+//-----------------------------------------------------------------------------
+// Walk a trace in the LogTrace() layout: 32 bit timestamp (bit 31 set for
+// tag to reader), 32 bit parity (or metric), length byte, data.
+//-----------------------------------------------------------------------------
+int hostsim_walk_trace(const uint8_t *trace, int traceLen, hostsim_frame_cb cb)
+{
+	int i = 0, frames = 0;
+	hostsim_frame_t f;
+
+	while(i + 9 <= traceLen) {
+		f.timestamp = trace[i] | (trace[i+1] << 8) | (trace[i+2] << 16) | ((uint32_t)trace[i+3] << 24);
+		f.fromTag = (f.timestamp & 0x80000000) != 0;
+		f.timestamp &= 0x7fffffff;
+		f.parity = trace[i+4] | (trace[i+5] << 8) | (trace[i+6] << 16) | ((uint32_t)trace[i+7] << 24);
+		f.len = trace[i+8];
+		f.data = trace + i + 9;
+		if(f.len == 0 || i + 9 + f.len > traceLen) break;
+		if(cb) cb(&f);
+		frames++;
+		i += 9 + f.len;
+	}
+	return frames;
+}
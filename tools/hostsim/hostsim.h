@@ -0,0 +1,71 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host side of the firmware shim: BigBuf, fake SSC receive DMA and the
+// decoder entry points exported by the fw_*.c wrappers.
+//-----------------------------------------------------------------------------
+
+#ifndef __HOSTSIM_H
+#define __HOSTSIM_H
+
+#include <stdint.h>
+#include "snoop_stats.h"
+
+// Firmware BigBuf, shared with the armsrc translation units
+extern uint32_t BigBuf[];
+#define HOSTSIM_BIGBUF_SIZE	(8000 * sizeof(uint32_t))
+
+// Sample stream that the fake PDC feeds into whatever ring buffer the
+// firmware handed to FpgaSetupSscDma(). burst is the number of bytes moved
+// per WDT_HIT(), i.e. per iteration of the sniff loop.
+void hostsim_stream(const uint8_t *samples, int len, int burst);
+int hostsim_overruns(void);
+
+// Keep up to words of what the fake SSC transmits while simulating an LF
+// tag, burst words (of 32 carrier cycles) per WDT_HIT(). The hook is
+// called from UsbPoll(), for the bench to send commands meanwhile.
+void hostsim_capture(uint32_t *out, int words, int burst);
+int hostsim_captured(void);
+int hostsim_underruns(void);
+extern void (*hostsim_usb_hook)(void);
+
+extern int hostsim_quiet;
+
+// A decoded frame, as stored in the firmware trace buffer
+typedef struct {
+	uint32_t timestamp;
+	int fromTag;
+	uint32_t parity;
+	int len;
+	const uint8_t *data;
+} hostsim_frame_t;
+
+typedef void (*hostsim_frame_cb)(const hostsim_frame_t *frame);
+
+// Walk a firmware trace buffer (the LogTrace() layout)
+int hostsim_walk_trace(const uint8_t *trace, int traceLen, hostsim_frame_cb cb);
+
+// armsrc/snoopstats.c, filled in by the Snoop*() loops
+extern snoop_stats_t snoop_stats;
+
+// fw_iso14443a.c
+int fw14a_decode(const uint8_t *samples, int n);
+int fw14a_snoop(const uint8_t **trace, int dmaSize);
+// fw_iclass.c
+int fwiclass_decode(const uint8_t *samples, int n);
+int fwiclass_snoop(const uint8_t **trace, int dmaSize);
+// fw_iso14443b.c
+int fw14b_decode(const uint8_t *samples, int n);
+int fw14b_snoop(const uint8_t **trace, int dmaSize);
+// armsrc/lfops.c
+void CmdHIDdemodFSK(int findone, int *high, int *low, int ledcontrol);
+void CmdEM410xdemod(int findone, int *high, int *low, int ledcontrol);
+void SimulateTagLowFrequency(int period, int gap, int ledcontrol);
+void SimulateTagLowFrequencyDesc(uint32_t arg0, uint32_t arg1, uint32_t arg2,
+	uint8_t *data, int ledcontrol);
+void HidBrute(int mode, uint32_t hi, uint32_t start, uint32_t end, int step,
+	int dwell, int ledcontrol, void (*report)(uint32_t hi, uint32_t lo, uint32_t tried, int done));
+
+#endif
@@ -0,0 +1,233 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Run the standalone mode menu, as appmain.c draws it, through the LCD code
+// against the mock LCD controller. After every step the panel contents are
+// compared with a golden image, and the SPI words LCD.c sent are listed next
+// to what it cost when every line of a fill had a window of its own and
+// fills of areas that already had the colour still went out.
+//
+// The golden images are rendered here by a plain reference implementation
+// of LCDFill()/LCDString(). With -w they are also written out as PPM files,
+// and -g compares against a directory of such files instead, so a set that
+// was checked by eye can be kept around.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mocklcd.h"
+#include "../../armsrc/fonts.h"
+
+#define FONT	(&FONT6x8[0][0])	// only FONT6x8 is built
+
+typedef struct {
+	char op;			// 'S' LCDString, 'F' LCDFill, 0 end of step
+	int x, y, w, h;			// w, h only for fills
+	const char *text;
+	unsigned char fcolor, bcolor;	// fcolor is the fill colour
+} lcd_op_t;
+
+#define S(text, x, y, f, b)	{ 'S', x, y, 0, 0, text, f, b }
+#define F(x, y, w, h, c)	{ 'F', x, y, w, h, NULL, c, 0 }
+#define END			{ 0, 0, 0, 0, 0, NULL, 0, 0 }
+
+// Cursor move from line `from' to line `to', as Action_Button() does it
+#define CURSOR(from, to) \
+	F(0, 1+8*((from)-1), 6, 8, WHITE), \
+	F(0, 1+8*8, 132, 8, WHITE), \
+	F(0, 1+8*10, 132, 8, WHITE), \
+	F(0, 1+8*9, 132, 8, WHITE), \
+	S("* ", 1, 1+8*((to)-1), GREEN, WHITE)
+
+static const struct {
+	const char *name;
+	lcd_op_t ops[8];
+} steps[] = {
+	{ "menu", {
+		S("* Read HID tag       ", 1, 1+8*0, GREEN,   WHITE),
+		S("  Replay HID tag     ", 1, 1+8*1, RED,     WHITE),
+		S("  Copy HID to T5557  ", 1, 1+8*2, MAGENTA, WHITE),
+		S("  ProxBrute HID tag  ", 1, 1+8*3, CYAN,    WHITE),
+		S("  Read raw tag       ", 1, 1+8*4, YELLOW,  WHITE),
+		S("  Replay raw tag     ", 1, 1+8*5, BLUE,    WHITE),
+		END } },
+	{ "cursor down", { CURSOR(1, 2), END } },
+	{ "cursor down", { CURSOR(2, 3), END } },
+	{ "cursor down", { CURSOR(3, 4), END } },
+	{ "read HID", {
+		S("Reading HID tag...", 2, 1+8*8, BLACK, WHITE),
+		F(0, 1+8*9, 132, 8, WHITE),
+		F(0, 1+8*10, 132, 8, WHITE),
+		END } },
+	{ "tag read", {
+		S("TAG: 2006EC0C86", 2+6*4, 1+8*9, BLACK, WHITE),
+		S("ID: 01603", 2+6*4, 1+8*10, BLACK, WHITE),
+		S("Press button to start", 2, 1+8*8, BLACK, WHITE),
+		END } },
+	{ "brute next ID", {
+		S("Trying...            ", 2, 1+8*8, BLACK, WHITE),
+		S("TAG: 2006EC0C85", 2+6*4, 1+8*9, BLACK, WHITE),
+		S("ID: 01602", 2+6*4, 1+8*10, BLACK, WHITE),
+		END } },
+	{ "brute next ID", {
+		S("TAG: 2006EC0C84", 2+6*4, 1+8*9, BLACK, WHITE),
+		S("ID: 01602", 2+6*4, 1+8*10, BLACK, WHITE),
+		END } },
+	{ "cursor up", { CURSOR(4, 3), END } },
+	{ "redraw menu line", {
+		S("  Replay HID tag     ", 1, 1+8*1, RED, WHITE),
+		END } },
+	{ NULL, { END } }
+};
+
+static uint8_t golden[LCD_YRES][LCD_XRES];
+
+// Reference renderers: the old algorithms, one pixel at a time, straight
+// into the golden image. They return what the same call used to cost in
+// SPI words: LCDFill() opened a window per line, LCDString() one window for
+// the whole string.
+static unsigned long ref_fill(int xs, int ys, int width, int height, unsigned char color)
+{
+	int x, y;
+
+	for(y = ys; y < ys + height && y < LCD_YRES; y++)
+		for(x = xs; x < xs + width && x < LCD_XRES; x++)
+			golden[y][x] = color;
+	return (unsigned long)height * (7 + width);
+}
+
+static unsigned long ref_string(const char *s, const char *font_style, int x, int y, unsigned char fcolor, unsigned char bcolor)
+{
+	int xme = font_style[0], yme = font_style[1], offset = font_style[2];
+	int len = strlen(s), n, i, px;
+	const char *data;
+
+	if(x + len * xme > LCD_XRES)
+		len = (LCD_XRES - x) / xme;
+	for(n = 0; n < len; n++) {
+		data = (font_style + offset) + (offset * (s[n] - 32));
+		for(i = 0; i < yme; i++, data++)
+			for(px = 0; px < xme; px++)
+				golden[y + i][x + n * xme + px] = (*data & (0x80 >> px)) ? fcolor : bcolor;
+	}
+	return 7 + (unsigned long)len * xme * yme;
+}
+
+static int write_ppm(const char *name, const uint8_t *fb)
+{
+	FILE *f = fopen(name, "wb");
+	int i;
+
+	if(!f) {
+		perror(name);
+		return -1;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", LCD_XRES, LCD_YRES);
+	for(i = 0; i < LCD_XRES * LCD_YRES; i++) {
+		fputc((fb[i] >> 5) * 255 / 7, f);
+		fputc(((fb[i] >> 2) & 7) * 255 / 7, f);
+		fputc((fb[i] & 3) * 255 / 3, f);
+	}
+	fclose(f);
+	return 0;
+}
+
+// Compare the panel with a PPM written by write_ppm()
+static int diff_ppm(const char *name, const uint8_t *fb)
+{
+	static const char hdr[] = "P6\n132 132\n255\n";
+	uint8_t want[3 * LCD_XRES * LCD_YRES], got[sizeof(want)];
+	char buf[sizeof(hdr) - 1];
+	FILE *f = fopen(name, "rb");
+	int i, ok;
+
+	if(!f) {
+		perror(name);
+		return 1;
+	}
+	ok = fread(buf, 1, sizeof(buf), f) == sizeof(buf) && !memcmp(buf, hdr, sizeof(buf))
+		&& fread(want, 1, sizeof(want), f) == sizeof(want);
+	fclose(f);
+	if(!ok) {
+		fprintf(stderr, "%s: not a 132x132 PPM\n", name);
+		return 1;
+	}
+	for(i = 0; i < LCD_XRES * LCD_YRES; i++) {
+		got[3*i]   = (fb[i] >> 5) * 255 / 7;
+		got[3*i+1] = ((fb[i] >> 2) & 7) * 255 / 7;
+		got[3*i+2] = (fb[i] & 3) * 255 / 3;
+	}
+	return memcmp(want, got, sizeof(want)) != 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-w dir | -g dir]\n", argv0);
+	fprintf(stderr, "  -w  also write the golden image of every step to dir/NN.ppm\n");
+	fprintf(stderr, "  -g  compare against dir/NN.ppm instead of the reference renderer\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *writeDir = NULL, *goldenDir = NULL;
+	unsigned long oldWords, newWords, oldTotal = 0, newTotal = 0, mark;
+	char name[512];
+	const lcd_op_t *op;
+	int i, opt, diff, bad = 0;
+
+	while((opt = getopt(argc, argv, "w:g:h")) != -1) {
+		switch(opt) {
+			case 'w': writeDir = optarg; break;
+			case 'g': goldenDir = optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	// LCDInit() clears the panel and puts the id line up; the mock
+	// controller is never read, so it stays at 0
+	mocklcd_reset();
+	LCDInit();
+	memset(golden, 0xFF, sizeof(golden));
+	ref_string(" LCD id: 0", FONT, 1, 1+8*15, 0x00, 0xFF);
+
+	printf("%-20s %8s %8s %6s\n", "step", "before", "sent", "ratio");
+	for(i = 0; steps[i].name; i++) {
+		oldWords = 0;
+		mark = mocklcd_words();
+		for(op = steps[i].ops; op->op; op++) {
+			if(op->op == 'S') {
+				oldWords += ref_string(op->text, FONT, op->x, op->y, op->fcolor, op->bcolor);
+				LCDString((char *)op->text, FONT, op->x, op->y, op->fcolor, op->bcolor);
+			} else {
+				oldWords += ref_fill(op->x, op->y, op->w, op->h, op->fcolor);
+				LCDFill(op->x, op->y, op->w, op->h, op->fcolor);
+			}
+		}
+		newWords = mocklcd_words() - mark;
+
+		snprintf(name, sizeof(name), "%s/%02d.ppm", goldenDir ? goldenDir : writeDir ? writeDir : ".", i);
+		if(goldenDir)
+			diff = diff_ppm(name, mocklcd_fb());
+		else
+			diff = memcmp(golden, mocklcd_fb(), sizeof(golden)) != 0;
+		if(writeDir && write_ppm(name, &golden[0][0]))
+			return 1;
+
+		bad |= diff;
+		if(newWords)
+			printf("%-20s %8lu %8lu %5.1fx", steps[i].name, oldWords, newWords, (double)oldWords / newWords);
+		else
+			printf("%-20s %8lu %8lu %6s", steps[i].name, oldWords, newWords, "-");
+		printf("%s\n", diff ? "  PIXELS DIFFER" : "");
+		oldTotal += oldWords;
+		newTotal += newWords;
+	}
+	printf("%-20s %8lu %8lu %5.1fx\n", "total SPI words", oldTotal, newTotal, (double)oldTotal / newTotal);
+
+	return bad;
+}
@@ -0,0 +1,772 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Replay recorded LF waveforms through the streaming HID FSK and EM410x
+// demodulators (common/hidfsk.c, common/em410xdemod.c) and the packed
+// capture encodings (common/lfsamples.c) on the host.
+//
+// The input is what `data save' writes: one sample per line, -128..127, as
+// in traces/hid-proxCardII-*.pm3. Samples are turned back into what the ADC
+// hands the PDC (+128). Several files, or -n copies of one, are played back
+// to back, the way a tag held at the antenna keeps repeating its frame.
+// -p em picks the EM410x demodulator instead of the HID one.
+//
+// Modes:
+//  - default: feed the demodulator directly, list the tag IDs it finds and
+//    report ns/sample next to the 8us a sample takes at 125kHz
+//  - -s: run the real CmdHIDdemodFSK() (or CmdEM410xdemod()) loop against
+//    the fake PDC; -f stops at the first ID the way the standalone mode does
+//  - -c: pack the stream into a BigBuf sized capture in every encoding
+//    `lf read' offers, unpack it the way the client does, and check what
+//    comes back against the samples that went in
+//  - -m: simulate the first tag found, through the real simulator loop
+//    and a fake SSC, from a descriptor (which is replaced by one for the
+//    next ID half way through) and from an uploaded waveform, and check
+//    that the demodulator reads back what was simulated; for HID, sweep
+//    the IDs after it and a range of 26 bit card numbers with HidBrute()
+//  - -w: check that the T55x7 read back check finds the blocks of a card
+//    written to look like the first tag found, in the trace
+//  - -d: time the Manchester kernel `data mandemod' runs on the graph, and
+//    for EM410x look for the frame of the first tag in what it decodes
+//  - -k: time the PSK demodulator and the Indala ID search `lf indalademod'
+//    runs on the graph, then again with more and more noise added
+//  - -l: run every decoder `lf search' knows on the graph at once, and list
+//    what they found, the most likely first
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "usb_cmd.h"
+#include "hostsim.h"
+#include "../../common/hidfsk.h"
+#include "../../common/em410xdemod.h"
+#include "../../common/lfsim.h"
+#include "../../common/lfsamples.h"
+#include "../../common/t55xx.h"
+#include "../../common/manchester.h"
+#include "../../common/pskdemod.h"
+#include "../../client/lfsearch.h"
+
+#define SAMPLE_NS	(1e9 / 125e3)
+
+static int em;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Append the samples of a `data save' file to buf
+static int load_pm3(const char *filename, uint8_t **buf, int *len, int *size)
+{
+	FILE *f = fopen(filename, "r");
+	char line[80];
+	int v;
+
+	if(!f) {
+		perror(filename);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "%d", &v) != 1) continue;
+		if(*len == *size) {
+			*size = *size ? *size * 2 : 65536;
+			*buf = realloc(*buf, *size);
+		}
+		if(v < -128) v = -128;
+		if(v > 127) v = 127;
+		(*buf)[(*len)++] = v + 128;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int decode_em(const uint8_t *samples, int len, int verbose)
+{
+	em410x_demod_t d;
+	int frames = 0, i;
+
+	Em410xDemodInit(&d, EM410X_DEFAULT_CLOCK);
+	for(i = 0; i < len; i++) {
+		if(!Em410xDemodSample(&d, samples[i])) continue;
+		frames++;
+		if(verbose)
+			printf("%9d  EM410x Tag ID: %02x%08x (swing %d)\n", i,
+				(unsigned int)(d.id >> 32), (unsigned int)d.id, d.rssi);
+	}
+	return frames;
+}
+
+static int decode(const uint8_t *samples, int len, int verbose)
+{
+	hid_fsk_t hid;
+	int frames = 0, i;
+
+	if(em) return decode_em(samples, len, verbose);
+
+	HidFskInit(&hid);
+	for(i = 0; i < len; i++) {
+		if(!HidFskSample(&hid, samples[i])) continue;
+		frames++;
+		if(verbose)
+			printf("%9d  TAG ID: %x%08x (%d)\n", i, (unsigned int)hid.tagHi,
+				(unsigned int)hid.tagLo, (unsigned int)(hid.tagLo >> 1) & 0xFFFF);
+	}
+	return frames;
+}
+
+static void bench(const uint8_t *samples, int len, int repeat)
+{
+	double start, elapsed, ns;
+	int frames = 0, i;
+	long total = (long)len * repeat;
+
+	decode(samples, len, 1);
+
+	start = now_ns();
+	for(i = 0; i < repeat; i++)
+		frames += decode(samples, len, 0);
+	elapsed = now_ns() - start;
+
+	ns = elapsed / total;
+	printf("%-6s %ld samples, %d frames, %.3f ms\n", em ? "em410x" : "hid", total, frames, elapsed / 1e6);
+	printf("       %.2f Msamples/s, %.1f ns per sample (budget %.0f ns, %.0fx headroom on this host)\n",
+		total / elapsed * 1e3, ns, SAMPLE_NS, SAMPLE_NS / ns);
+}
+
+static void snoop(const uint8_t *samples, int len, int burst, int findone)
+{
+	int hi = 0, lo = 0;
+
+	hostsim_stream(samples, len, burst > 0 ? burst : 1);
+	if(em)
+		CmdEM410xdemod(findone, &hi, &lo, 0);
+	else
+		CmdHIDdemodFSK(findone, &hi, &lo, 0);
+	if(findone)
+		printf("found %x%08x\n", (unsigned int)hi, (unsigned int)lo);
+	printf("%d samples lost to DMA overrun\n", hostsim_overruns());
+}
+
+static const char *encodings[] = { "8bit", "4bit", "1bit", "zc" };
+
+// What a sample should come back as, after a trip through the encoding
+static int expect(int encoding, int threshold, uint8_t sample)
+{
+	switch(encoding) {
+		case LF_SAMPLES_4BIT: return (sample & 0xf0) + 8 - 128;
+		case LF_SAMPLES_1BIT:
+		case LF_SAMPLES_ZC: return sample >= threshold ? 127 : -128;
+		default: return sample - 128;
+	}
+}
+
+static int roundtrip(const uint8_t *samples, int len, int encoding, int decimation, int threshold)
+{
+	static uint8_t capture[HOSTSIM_BIGBUF_SIZE];
+	static int graph[LF_SAMPLES_MAX];
+	lf_samples_t enc;
+	int bytes, n, i, bad = 0;
+
+	LfSamplesInit(&enc, encoding, threshold, decimation, capture, sizeof(capture));
+	for(i = 0; i < len; i++)
+		if(!LfSamplesPut(&enc, samples[i])) break;
+	bytes = LfSamplesFlush(&enc);
+
+	n = LfSamplesDecode(encoding, decimation, enc.samples, capture, bytes, graph, LF_SAMPLES_MAX);
+	if(n != (int)enc.samples)
+		bad++;
+	for(i = 0; i < n; i++)
+		if(graph[i] != expect(encoding, enc.threshold, samples[i - i % enc.decimation]))
+			bad++;
+
+	printf("%-5s /%-3d %7u samples in %5d bytes, %5.1fx  %s\n", encodings[encoding], enc.decimation,
+		enc.samples, bytes, (double)enc.samples / bytes, bad ? "MISMATCH" : "ok");
+	return bad;
+}
+
+static int check(const uint8_t *samples, int len, int threshold)
+{
+	static const int decimations[] = { 1, 2, 4, 0 };
+	int encoding, d, bad = 0;
+
+	for(encoding = LF_SAMPLES_8BIT; encoding <= LF_SAMPLES_ZC; encoding++)
+		for(d = 0; decimations[d]; d++)
+			bad += roundtrip(samples, len, encoding, decimations[d], threshold);
+	return bad;
+}
+
+//-----------------------------------------------------------------------------
+// Simulation
+//-----------------------------------------------------------------------------
+
+// Fake SSC words to capture per simulation, about 0.3s of carrier
+#define SIM_WORDS	2400
+
+static uint32_t simOut[SIM_WORDS];
+static uint8_t simSamples[SIM_WORDS * 32];
+
+typedef struct {
+	uint32_t arg0, arg1, arg2;
+	uint8_t bits[LF_SIM_MAX_BITS / 8];
+} sim_desc_t;
+
+static sim_desc_t simNext;
+static int simSwitchAt, simSwitched;
+
+static void put_bit(uint8_t *bits, int *n, int b)
+{
+	if(b) bits[*n / 8] |= 0x80 >> (*n % 8);
+	else bits[*n / 8] &= ~(0x80 >> (*n % 8));
+	(*n)++;
+}
+
+// As `lf em4x em410xsim' and `lf hid sim' would build them
+static void make_desc(sim_desc_t *d, uint32_t hi, uint32_t lo)
+{
+	int n = 0, i, j, col = 0, nib;
+
+	memset(d->bits, 0, sizeof(d->bits));
+	if(em) {
+		uint64_t id = ((uint64_t)hi << 32) | lo;
+		for(i = 0; i < 9; i++) put_bit(d->bits, &n, 1);
+		for(i = 0; i < 10; i++) {
+			nib = (id >> (36 - 4 * i)) & 0xf;
+			for(j = 3; j >= 0; j--) put_bit(d->bits, &n, (nib >> j) & 1);
+			put_bit(d->bits, &n, (nib ^ (nib >> 1) ^ (nib >> 2) ^ (nib >> 3)) & 1);
+			col ^= nib;
+		}
+		for(j = 3; j >= 0; j--) put_bit(d->bits, &n, (col >> j) & 1);
+		put_bit(d->bits, &n, 0);
+		d->arg0 = LF_SIM_ARG0(LF_SIM_ASK, LF_SIM_MANCHESTER, 0);
+		d->arg1 = LF_SIM_ARG1(EM410X_DEFAULT_CLOCK, 0, 0);
+	} else {
+		// HID: the half bits, fc/8 for a 1, so that the start of frame
+		// marker can break the Manchester rules
+		static const int sof[] = { 1, 1, 1, 0, 0, 0, 1, 0 };
+		for(i = 0; i < 8; i++) put_bit(d->bits, &n, sof[i]);
+		for(i = 43; i >= 0; i--) {
+			j = i >= 32 ? (hi >> (i - 32)) & 1 : (lo >> i) & 1;
+			put_bit(d->bits, &n, !j);
+			put_bit(d->bits, &n, j);
+		}
+		d->arg0 = LF_SIM_ARG0(LF_SIM_FSK, LF_SIM_NRZ, 0);
+		d->arg1 = LF_SIM_ARG1(50, 10, 8);
+	}
+	d->arg2 = LF_SIM_ARG2(n, 0);
+}
+
+// A new descriptor sent while the simulation runs
+static void sim_usb(void)
+{
+	if(simSwitched || hostsim_captured() < simSwitchAt) return;
+	simSwitched = 1;
+	SimulateTagLowFrequencyDesc(simNext.arg0, simNext.arg1, simNext.arg2, simNext.bits, 0);
+}
+
+// What the coil did, the way the reader samples it: one sample a carrier
+// cycle, the field stronger with the coil open
+static int sim_samples(void)
+{
+	int i, n = hostsim_captured();
+
+	for(i = 0; i < n * 32; i++)
+		simSamples[i] = (simOut[i / 32] >> (31 - i % 32)) & 1 ? 200 : 60;
+	return n * 32;
+}
+
+// Read back what the descriptor run put out: frames of the first ID, then
+// only of the next one once that took over
+static int sim_check(uint32_t hi, uint32_t lo)
+{
+	hid_fsk_t hid;
+	em410x_demod_t e;
+	uint32_t h, l;
+	int len = sim_samples(), first = 0, second = 0, other = 0, late = 0, ok, i;
+
+	HidFskInit(&hid);
+	Em410xDemodInit(&e, EM410X_DEFAULT_CLOCK);
+	for(i = 0; i < len; i++) {
+		if(em) {
+			if(!Em410xDemodSample(&e, simSamples[i])) continue;
+			h = e.id >> 32;
+			l = (uint32_t)e.id;
+		} else {
+			if(!HidFskSample(&hid, simSamples[i])) continue;
+			h = hid.tagHi;
+			l = hid.tagLo;
+		}
+		if(h == hi && l == lo) {
+			first++;
+			if(second) late++;
+		} else if(h == hi && l == lo + 1) {
+			second++;
+		} else {
+			other++;
+		}
+	}
+
+	ok = first && second && !other && !late;
+	printf("%-10s %6d cycles: %d frames of %x%08x, then %d of %x%08x, %d other, %d underruns  %s\n",
+		"descriptor", len, first, (unsigned int)hi, (unsigned int)lo, second,
+		(unsigned int)hi, (unsigned int)lo + 1, other, hostsim_underruns(), ok ? "ok" : "BAD");
+	return !ok;
+}
+
+// What HidBrute() reported
+static uint32_t bruteLo, bruteTried;
+static int bruteReports, bruteDone;
+
+static void brute_report(uint32_t hi, uint32_t lo, uint32_t tried, int done)
+{
+	bruteLo = lo;
+	bruteTried = tried;
+	bruteReports++;
+	bruteDone += done;
+}
+
+// Sweep IDs with HidBrute() and read back that each came out in turn, for a
+// while each, with nothing in between. For a facility code the card numbers
+// are what counts, and the first ID has to be first, which checks the
+// Wiegand parity.
+static int brute_check(int mode, uint32_t hi, uint32_t start, uint32_t end,
+	int step, int dwell, uint32_t first, int burst)
+{
+	hid_fsk_t hid;
+	uint32_t l, want = start, tried = 0, card;
+	int len, frames = 0, other = 0, ok, i;
+	// which way HidBrute() goes
+	int dir = step ? step : end < start ? -1 : 1;
+
+	bruteReports = bruteDone = 0;
+	hostsim_capture(simOut, SIM_WORDS, burst);
+	HidBrute(mode, hi, start, end, step, dwell, 0, brute_report);
+	len = sim_samples();
+
+	HidFskInit(&hid);
+	for(i = 0; i < len; i++) {
+		if(!HidFskSample(&hid, simSamples[i])) continue;
+		l = hid.tagLo;
+		card = mode == HID_BRUTE_FC ? (l >> 1) & 0xffff : l;
+		if(mode == HID_BRUTE_FC && (hid.tagHi != 0x20 || ((l >> 17) & 0xff) != hi ||
+				(card == start && l != first))) {
+			other++;
+		} else if(mode != HID_BRUTE_FC && hid.tagHi != hi) {
+			other++;
+		} else if(card == want) {
+			frames++;
+		} else if(frames && card == want + dir) {
+			// the next one, after at least a frame of this one
+			tried++;
+			want = card;
+			frames = 1;
+		} else {
+			other++;
+		}
+	}
+	if(frames) tried++;
+
+	ok = tried == bruteTried && want == end && !other && bruteDone == 1 &&
+		(mode == HID_BRUTE_FC ? (bruteLo >> 1) & 0xffff : bruteLo) == end;
+	printf("%-10s %6d cycles: %u IDs %x..%x in order, %d other, %u tried as reported, %d underruns  %s\n",
+		mode == HID_BRUTE_FC ? "brute fc" : "brute", len, tried, (unsigned int)start,
+		(unsigned int)want, other, (unsigned int)bruteTried, hostsim_underruns(), ok ? "ok" : "BAD");
+	return !ok;
+}
+
+// The first tag in the trace
+static int first_tag(const uint8_t *samples, int len, uint32_t *hi, uint32_t *lo)
+{
+	hid_fsk_t hid;
+	em410x_demod_t e;
+	int i;
+
+	HidFskInit(&hid);
+	Em410xDemodInit(&e, EM410X_DEFAULT_CLOCK);
+	for(i = 0; i < len; i++) {
+		if(em && Em410xDemodSample(&e, samples[i])) {
+			*hi = e.id >> 32;
+			*lo = (uint32_t)e.id;
+			return 1;
+		} else if(!em && HidFskSample(&hid, samples[i])) {
+			*hi = hid.tagHi;
+			*lo = hid.tagLo;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int simulate(const uint8_t *samples, int len, int burst)
+{
+	sim_desc_t d;
+	lf_sim_t s;
+	lf_sim_state_t st;
+	uint8_t *tab = (uint8_t *)BigBuf;
+	uint32_t hi = 0, lo = 0;
+	int i, n, bad = 0;
+
+	if(!first_tag(samples, len, &hi, &lo)) {
+		printf("no tag to simulate\n");
+		return 1;
+	}
+	hostsim_quiet = 1;
+
+	// from a descriptor, with the next ID sent half way through
+	make_desc(&d, hi, lo);
+	make_desc(&simNext, hi, lo + 1);
+	simSwitchAt = SIM_WORDS / 2;
+	simSwitched = 0;
+	hostsim_usb_hook = sim_usb;
+	hostsim_capture(simOut, SIM_WORDS, burst);
+	SimulateTagLowFrequencyDesc(d.arg0, d.arg1, d.arg2, d.bits, 0);
+	hostsim_usb_hook = NULL;
+	bad += sim_check(hi, lo);
+
+	if(!em) {
+		// the ProxBrute engine, over the IDs after this one, then over the
+		// card numbers just below 5512 with facility code 113 (2006e22b11)
+		bad += brute_check(HID_BRUTE_RANGE, hi, lo, lo + 5, 1, 50, 0, burst);
+		bad += brute_check(HID_BRUTE_FC, 113, 5512, 5510, 0, 0, 0x06e22b11, burst);
+	}
+
+	// from the same tag as a waveform uploaded to BigBuf (`lf sim'), which
+	// has to come out cycle for cycle. (Not read back: one repeat of an FSK
+	// tag does not end on a whole subcarrier period, so it glitches where
+	// the waveform wraps.)
+	LfSimInit(&s, d.arg0, d.arg1, d.arg2, d.bits);
+	LfSimStart(&st, &s);
+	n = s.bits * s.clock;
+	for(i = 0; i < n; i++)
+		tab[i] = LfSimNext(&st);
+	hostsim_capture(simOut, SIM_WORDS, burst);
+	SimulateTagLowFrequency(n, 0, 0);
+	len = sim_samples();
+	for(i = 0; i < len; i++)
+		if((simSamples[i] == 200) != tab[i % n])
+			break;
+	printf("%-10s %6d cycles: %d of a %d cycle waveform as uploaded, %d underruns  %s\n",
+		"waveform", len, i, n, hostsim_underruns(), i == len ? "ok" : "BAD");
+	bad += i != len;
+
+	hostsim_capture(NULL, 0, 1);
+	return bad;
+}
+
+// Where block want goes by in the samples, or -1
+static int t55xx_find(const uint8_t *samples, int len, uint32_t config, uint32_t want)
+{
+	t55xx_demod_t d;
+	int i;
+
+	T55xxDemodInit(&d, config, want);
+	for(i = 0; i < len; i++)
+		if(T55xxDemodSample(&d, samples[i]))
+			return i;
+	return -1;
+}
+
+// A T55x7 card written with the blocks for the first tag in the trace
+// sends what the tag does, so the read back check has to find each data
+// block in the trace, and not the same block with a bit flipped.
+static int t55xx_check(const uint8_t *samples, int len)
+{
+	uint32_t blocks[T55XX_BLOCKS], hi = 0, lo = 0;
+	int n, i, at, wrong, bad = 0;
+
+	if(!first_tag(samples, len, &hi, &lo)) {
+		printf("no tag to write\n");
+		return 1;
+	}
+	if(em)
+		n = T55xxEm410xBlocks(blocks, ((uint64_t)hi << 32) | lo);
+	else
+		n = T55xxHidBlocks(blocks, hi, lo);
+
+	for(i = 1; i < n; i++) {
+		at = t55xx_find(samples, len, blocks[0], blocks[i]);
+		wrong = t55xx_find(samples, len, blocks[0], blocks[i] ^ (1 << (7 * i)));
+		printf("block %d  %08x  found at sample %d, with a bit flipped %s  %s\n",
+			i, (unsigned int)blocks[i], at, wrong < 0 ? "not found" : "found",
+			at >= 0 && wrong < 0 ? "ok" : "BAD");
+		bad += at < 0 || wrong >= 0;
+	}
+	return bad;
+}
+
+// The Manchester kernel over the trace as the graph holds it: clock
+// recovery and decoding timed, and for EM410x the frame of the tag looked
+// for in the bits, either way up.
+static int manchester(const uint8_t *samples, int len, int repeat, int biphase)
+{
+	static int graph[LF_SAMPLES_MAX];
+	static uint32_t levels[MAN_WORDS(LF_SAMPLES_MAX)], bits[MAN_WORDS(LF_SAMPLES_MAX)];
+	man_stats_t cs, st;
+	uint32_t blocks[T55XX_BLOCKS], hi = 0, lo = 0;
+	uint64_t frame, v = 0;
+	double start, elapsed;
+	int clock = 0, n = 0, i, r, found = -1;
+
+	if(len > LF_SAMPLES_MAX) len = LF_SAMPLES_MAX;
+	for(i = 0; i < len; i++)
+		graph[i] = samples[i] - 128;
+
+	start = now_ns();
+	for(r = 0; r < repeat; r++) {
+		ManLevels(graph, len, levels);
+		clock = ManClock(levels, len, &cs);
+		n = ManDecode(levels, len, clock, biphase ? MAN_BIPHASE : MAN_MANCHESTER,
+			bits, len, &st);
+	}
+	elapsed = (now_ns() - start) / repeat;
+
+	printf("%-10s %d samples: clock %d, %d of %d runs fit (jitter %d.%02d), %d bits, pairing %d, %d errors\n",
+		biphase ? "biphase" : "manchester", len, clock, st.fit, st.runs,
+		st.jitter / 16, st.jitter % 16 * 100 / 16, n, st.phase, st.errors);
+	printf("%-10s %.3f ms, %.1f ns/sample (a sample takes %.0f ns at 125kHz)\n", "",
+		elapsed / 1e6, elapsed / len, SAMPLE_NS);
+
+	if(!em)
+		return 0;
+	if(!first_tag(samples, len, &hi, &lo)) {
+		printf("no EM410x tag to look for\n");
+		return 1;
+	}
+	T55xxEm410xBlocks(blocks, ((uint64_t)hi << 32) | lo);
+	frame = ((uint64_t)blocks[1] << 32) | blocks[2];
+	for(i = 0; i < n && found < 0; i++) {
+		v = (v << 1) | MAN_BIT(bits, i);
+		if(i >= 63 && (v == frame || v == ~frame))
+			found = i - 63;
+	}
+	if(found < 0)
+		printf("%-10s frame of %02x%08x not found  BAD\n", "", (unsigned int)hi, (unsigned int)lo);
+	else
+		printf("%-10s frame of %02x%08x at bit %d  ok\n", "", (unsigned int)hi, (unsigned int)lo, found);
+	return found < 0;
+}
+
+// A frame, first bit as the top bit of the first hex digit
+static void psk_hex(const uint32_t *bits, int len, char *out)
+{
+	int i, nibble = 0;
+
+	for(i = 0; i < len; i++) {
+		nibble = (nibble << 1) | PSK_BIT(bits, i);
+		if((i & 3) == 3) {
+			*out++ = "0123456789abcdef"[nibble];
+			nibble = 0;
+		}
+	}
+	*out = '\0';
+}
+
+static int indala_once(const int *graph, int len, int show, psk_candidate_t *best)
+{
+	static int soft[LF_SAMPLES_MAX / INDALA_CLOCK];
+	static uint32_t bits[PSK_WORDS(LF_SAMPLES_MAX / INDALA_CLOCK)];
+	static const psk_format_t f = { INDALA_PREAMBLE_64, 32, 64, 2 };
+	psk_candidate_t c[PSK_MAX_CANDIDATES];
+	psk_stats_t st;
+	char hex[PSK_MAX_FRAME / 4 + 1];
+	int n, i, found, frames;
+
+	n = PskDemod(graph, len, INDALA_CARRIER, INDALA_CLOCK, soft, sizeof(soft) / sizeof(soft[0]), &st);
+	PskPack(soft, n, bits);
+	found = PskSearch(soft, bits, n, st.level, &f, c, PSK_MAX_CANDIDATES, &frames);
+	if(show) {
+		printf("%d bits from sample %d, %d of %d phase changes on time, lock %d%%, %d frames\n",
+			n, st.offset, st.onTime, st.flips, st.lock, frames);
+		for(i = 0; i < found; i++) {
+			psk_hex(c[i].bits, 64, hex);
+			printf("  %s  %d frames, %d preamble errors, weakest bit %d%%%s\n", hex,
+				c[i].votes, c[i].errors, c[i].margin, c[i].voted ? ", sum of all" : "");
+		}
+	}
+	if(found) *best = c[0];
+	return found;
+}
+
+// The PSK demodulator and the Indala search over the trace as the graph
+// holds it, timed; then with noise of a growing amplitude added, to see how
+// much of it the sum of the frames rides out.
+static int indala(const uint8_t *samples, int len, int repeat)
+{
+	static int graph[LF_SAMPLES_MAX];
+	psk_candidate_t clean, noisy;
+	double start, elapsed;
+	char hex[PSK_MAX_FRAME / 4 + 1];
+	int i, r, amp, bad = 0;
+
+	if(len > LF_SAMPLES_MAX) len = LF_SAMPLES_MAX;
+	for(i = 0; i < len; i++)
+		graph[i] = samples[i] - 128;
+
+	if(!indala_once(graph, len, 1, &clean)) {
+		printf("no Indala ID found  BAD\n");
+		return 1;
+	}
+	start = now_ns();
+	for(r = 0; r < repeat; r++)
+		indala_once(graph, len, 0, &noisy);
+	elapsed = (now_ns() - start) / repeat;
+	printf("%.3f ms, %.1f ns/sample (a sample takes %.0f ns at 125kHz)\n",
+		elapsed / 1e6, elapsed / len, SAMPLE_NS);
+
+	psk_hex(clean.bits, 64, hex);
+	srand(1);
+	for(amp = 32; amp <= 256; amp += 32) {
+		for(i = 0; i < len; i++)
+			graph[i] = samples[i] - 128 + rand() % (2 * amp + 1) - amp;
+		if(!indala_once(graph, len, 0, &noisy)) {
+			printf("noise +-%-3d  nothing found\n", amp);
+			continue;
+		}
+		psk_hex(noisy.bits, 64, hex);
+		i = !memcmp(noisy.bits, clean.bits, sizeof(clean.bits));
+		printf("noise +-%-3d  %s  %d frames read it, weakest bit %d%%%s  %s\n", amp, hex,
+			noisy.votes, noisy.margin, noisy.voted ? ", sum of all" : "", i ? "ok" : "WRONG");
+		if(!i) bad++;
+	}
+	return bad;
+}
+
+// `lf search' on the trace as the graph holds it
+static int search(const uint8_t *samples, int len)
+{
+	static int graph[LF_SAMPLES_MAX];
+	lf_found_t found[LF_MAX_DECODERS];
+	double start;
+	int i, n;
+
+	if(len > LF_SAMPLES_MAX) len = LF_SAMPLES_MAX;
+	for(i = 0; i < len; i++)
+		graph[i] = samples[i] - 128;
+
+	start = now_ns();
+	n = LfSearch(graph, len, found);
+	printf("%d samples, %d decoders found a tag, %.3f ms\n", len, n, (now_ns() - start) / 1e6);
+	for(i = 0; i < n; i++)
+		printf("  %-8s %-20s %s, read %d times, %d%%%s\n", found[i].decoder->name,
+			found[i].result.id, found[i].result.info, found[i].result.frames,
+			found[i].result.quality, found[i].result.checked ? ", check ok" : "");
+	return !n;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-p hid|em] [-n copies] [-r repeat] [-s [-b burst] [-f]] [-c [-t threshold]] [-m [-b burst]] [-w] [-d [-i]] [-k] [-l] [-q] file.pm3...\n", argv0);
+	fprintf(stderr, "  -p  demodulator to run (default hid)\n");
+	fprintf(stderr, "  -n  play the files back to back this many times (default 1)\n");
+	fprintf(stderr, "  -r  decode the whole stream this many times for timing (default 100)\n");
+	fprintf(stderr, "  -s  run CmdHIDdemodFSK() or CmdEM410xdemod() on the fake PDC\n");
+	fprintf(stderr, "  -b  samples delivered per loop iteration in -s mode, words of 32\n");
+	fprintf(stderr, "      carrier cycles sent in -m mode; raise it to see where the loop\n");
+	fprintf(stderr, "      falls behind (default 1)\n");
+	fprintf(stderr, "  -f  stop at the first tag ID, as the standalone mode does\n");
+	fprintf(stderr, "  -c  round trip through the packed capture encodings\n");
+	fprintf(stderr, "  -t  threshold for the 1 bit and zc encodings (default %d)\n", LF_SAMPLES_DEFAULT_THRESHOLD);
+	fprintf(stderr, "  -m  simulate the first tag found and read it back\n");
+	fprintf(stderr, "  -w  look for the T55x7 blocks of the first tag found\n");
+	fprintf(stderr, "  -d  time the Manchester kernel (common/manchester.c) on the trace\n");
+	fprintf(stderr, "  -i  biphase instead of Manchester for -d\n");
+	fprintf(stderr, "  -k  time the PSK demodulator and Indala search (common/pskdemod.c)\n");
+	fprintf(stderr, "  -l  run every decoder of `lf search' (client/lfsearch.c) on the trace\n");
+	fprintf(stderr, "  -q  suppress firmware debug output\n");
+}
+
+int main(int argc, char **argv)
+{
+	int copies = 1, repeat = 100, do_snoop = 0, burst = 0, findone = 0;
+	int do_check = 0, threshold = 0, do_sim = 0, do_t55xx = 0, do_man = 0, biphase = 0;
+	int do_psk = 0, do_search = 0;
+	uint8_t *samples = NULL;
+	int len = 0, size = 0, one, i, opt;
+
+	while((opt = getopt(argc, argv, "p:n:r:sb:fct:mwdiklqh")) != -1) {
+		switch(opt) {
+			case 'p': em = !strcmp(optarg, "em"); break;
+			case 'n': copies = atoi(optarg); break;
+			case 'r': repeat = atoi(optarg); break;
+			case 's': do_snoop = 1; break;
+			case 'b': burst = atoi(optarg); break;
+			case 'f': findone = 1; break;
+			case 'c': do_check = 1; break;
+			case 't': threshold = atoi(optarg); break;
+			case 'm': do_sim = 1; break;
+			case 'w': do_t55xx = 1; break;
+			case 'd': do_man = 1; break;
+			case 'i': biphase = 1; break;
+			case 'k': do_psk = 1; break;
+			case 'l': do_search = 1; break;
+			case 'q': hostsim_quiet = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for(i = optind; i < argc; i++)
+		if(load_pm3(argv[i], &samples, &len, &size)) return 1;
+	if(!len) {
+		fprintf(stderr, "no samples\n");
+		return 1;
+	}
+	one = len;
+	for(i = 1; i < copies; i++) {
+		if(len + one > size) {
+			size = len + one;
+			samples = realloc(samples, size);
+		}
+		memcpy(samples + len, samples, one);
+		len += one;
+	}
+
+	if(do_check) {
+		i = check(samples, len, threshold);
+		free(samples);
+		return i ? 1 : 0;
+	}
+	if(do_sim) {
+		i = simulate(samples, len, burst);
+		free(samples);
+		return i ? 1 : 0;
+	}
+	if(do_t55xx) {
+		i = t55xx_check(samples, len);
+		free(samples);
+		return i ? 1 : 0;
+	}
+	if(do_man) {
+		i = manchester(samples, len, repeat < 1 ? 1 : repeat, biphase);
+		free(samples);
+		return i ? 1 : 0;
+	}
+	if(do_psk) {
+		i = indala(samples, len, repeat < 1 ? 1 : repeat);
+		free(samples);
+		return i ? 1 : 0;
+	}
+	if(do_search) {
+		i = search(samples, len);
+		free(samples);
+		return i;
+	}
+	if(do_snoop)
+		snoop(samples, len, burst, findone);
+	else
+		bench(samples, len, repeat < 1 ? 1 : repeat);
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,94 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host model of the LCD controller, see mocklcd.h. Only the commands that
+// matter for drawing are modelled: the column/page address window and RAM
+// writes, in both the Philips and the Epson command set. Like the real
+// controllers (in the orientation LCDInit() sets up) RAM writes fill the
+// window column first, then wrap to the next page.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "mocklcd.h"
+
+static uint8_t fb[LCD_YRES][LCD_XRES];
+static unsigned long words;
+
+static int cmd, argn;
+static int xs, xe = LCD_XRES - 1, ys, ye = LCD_YRES - 1;
+static int col, page;
+
+void mocklcd_reset(void)
+{
+	memset(fb, 0xFF, sizeof(fb));
+	words = 0;
+	cmd = -1;
+}
+
+unsigned long mocklcd_words(void)
+{
+	return words;
+}
+
+const uint8_t *mocklcd_fb(void)
+{
+	return &fb[0][0];
+}
+
+static void ram_write(int color)
+{
+	if(col < LCD_XRES && page < LCD_YRES)
+		fb[page][col] = color;
+	if(++col > xe) {
+		col = xs;
+		if(++page > ye) page = ys;
+	}
+}
+
+// LCDSend() inverts bit 8, so on the wire it is set for data and clear
+// for commands
+unsigned int spi_com(unsigned int channel, unsigned int dout, unsigned char last)
+{
+	int data = dout & 0xFF;
+
+	words++;
+
+	if(!(dout & 0x100)) {
+		cmd = data;
+		argn = 0;
+		if(cmd == (PRAMWR & 0xFF) || cmd == (ERAMWR & 0xFF)) {
+			col = xs;
+			page = ys;
+		}
+		return 0;
+	}
+
+	if(cmd == (PCASET & 0xFF) || cmd == (ECASET & 0xFF)) {
+		if(argn == 0) xs = data; else xe = data;
+		argn++;
+	} else if(cmd == (PPASET & 0xFF) || cmd == (EPASET & 0xFF)) {
+		if(argn == 0) ys = data; else ye = data;
+		argn++;
+	} else if(cmd == (PRAMWR & 0xFF) || cmd == (ERAMWR & 0xFF)) {
+		ram_write(data);
+	}
+	return 0;
+}
+
+// The LCD is the only thing on this bus, so a session is a no-op and a PDC
+// block is just its words one after the other
+void SetupSpi(int mode) {}
+void SpiBegin(int channel) {}
+void SpiEnd(void) {}
+void SpiWait(void) {}
+
+void SpiWrite(const void *buf, int n)
+{
+	const unsigned short *w = buf;
+
+	while(n--)
+		spi_com(0, *w++, 0);
+}
@@ -0,0 +1,24 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host model of the LCD controller on the SPI bus: takes the 9 bit words
+// armsrc/LCD.c sends through spi_com() and SpiWrite(), keeps a framebuffer
+// and counts the words, so that drawing code can be checked and costed off
+// the device.
+//-----------------------------------------------------------------------------
+
+#ifndef __MOCKLCD_H
+#define __MOCKLCD_H
+
+#include <stdint.h>
+#include "../../armsrc/LCD.h"
+
+// Clear the framebuffer to 0xFF (what LCDInit() fills it with) and the
+// word count
+void mocklcd_reset(void);
+unsigned long mocklcd_words(void);
+const uint8_t *mocklcd_fb(void);	// LCD_YRES rows of LCD_XRES pixels
+
+#endif
@@ -0,0 +1,416 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Run the FatFs disk layer (armsrc/diskio.c, the sector cache in sdcache.c
+// and msd.c) against the fake SD card, backed by a disk image: raw sector
+// reads and writes of every size are checked against the image, then a file
+// is written and read back through FatFs, a directory full of small files
+// is made and read back, and the standalone capture logger (sdlog.c)
+// writes an LF capture, a 14443A trace and tag IDs, which are read back in
+// the formats `data load' and `hf 14a list' expect. Prints the commands and
+// bus bytes each part took, so single and multiple block transfers can be
+// compared, and how many single sector reads the cache answered.
+//
+// Without -i a 64 MB FAT16 image is made up in memory; -o saves the image
+// afterwards, to look at with mtools or fsck.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fakesd.h"
+#include "hostsim.h"
+#include "../../armsrc/ff.h"
+#include "../../armsrc/diskio.h"
+#include "../../armsrc/sdlog.h"
+#include "../../armsrc/sdcache.h"
+
+#define SCRATCH		256		// sectors at the end of the card for the raw tests
+#define FILE_SIZE	(64 * 1024)
+#define FILE_CHUNK	4096
+#define LF_SAMPLES	32000	// all of BigBuf, as `Read raw tag' captures it
+#define TRACE_BYTES	3000
+#define SMALL_FILES	40		// more than one directory sector holds
+
+static uint8_t *image;
+static uint32_t nsect;
+static int failed;
+
+static void check(int ok, const char *what)
+{
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failed = 1;
+	}
+}
+
+static void put16(uint8_t *p, unsigned v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+// A bare FAT16 volume without partition table, the way FatFs (or a
+// camera) would format a small card. Clusters are at least 4K: FatFs only
+// hands runs of sectors within one cluster to disk_read()/disk_write().
+static int format_fat16(uint8_t *img, uint32_t n)
+{
+	uint8_t *bs = img;
+	uint32_t spc, fatsz, clusters, data;
+	const uint32_t rsvd = 1, rootsecs = 32;
+	int i;
+
+	for(spc = 8; spc <= 128; spc <<= 1) {
+		fatsz = 1;
+		for(i = 0; i < 4; i++) {
+			data = n - rsvd - 2 * fatsz - rootsecs;
+			fatsz = ((data / spc + 2) * 2 + 511) / 512;
+		}
+		clusters = (n - rsvd - 2 * fatsz - rootsecs) / spc;
+		if(clusters < 65525) break;
+	}
+	if(clusters < 4085) {
+		fprintf(stderr, "image too small for FAT16\n");
+		return -1;
+	}
+
+	memset(img, 0, (rsvd + 2 * fatsz + rootsecs) * 512);
+	memcpy(bs, "\xeb\x3c\x90" "MSDOS5.0", 11);
+	put16(bs + 11, 512);
+	bs[13] = spc;
+	put16(bs + 14, rsvd);
+	bs[16] = 2;
+	put16(bs + 17, rootsecs * 16);
+	if(n < 65536) put16(bs + 19, n); else put32(bs + 32, n);
+	bs[21] = 0xf8;
+	put16(bs + 22, fatsz);
+	put16(bs + 24, 63);
+	put16(bs + 26, 255);
+	bs[36] = 0x80;
+	bs[38] = 0x29;
+	put32(bs + 39, 0x12345678);
+	memcpy(bs + 43, "PROXMARK3  FAT16   ", 19);
+	bs[510] = 0x55;
+	bs[511] = 0xaa;
+
+	for(i = 0; i < 2; i++) {
+		uint8_t *fat = img + (rsvd + i * fatsz) * 512;
+		put16(fat, 0xfff8);
+		put16(fat + 2, 0xffff);
+	}
+	return 0;
+}
+
+static uint8_t *load_image(const char *name, uint32_t *n)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *img;
+	long size;
+
+	if(!f) {
+		perror(name);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	img = malloc(size);
+	if(!img || fread(img, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", name);
+		fclose(f);
+		free(img);
+		return NULL;
+	}
+	fclose(f);
+	*n = size / 512;
+	return img;
+}
+
+static void fill(uint8_t *p, int len, uint32_t seed)
+{
+	while(len--) {
+		seed = seed * 1103515245 + 12345;
+		*p++ = seed >> 16;
+	}
+}
+
+static fakesd_stats_t mark;
+static sd_cache_stats_t cacheMark;
+
+static void begin(void)
+{
+	mark = fakesd_stats;
+	cacheMark = sd_cache_stats;
+}
+
+static void report(const char *what, int sectors)
+{
+	unsigned long cmds = 0, bytes = fakesd_stats.bytes - mark.bytes;
+	int i;
+
+	for(i = 0; i < 64; i++)
+		cmds += fakesd_stats.cmds[i] - mark.cmds[i];
+	uint32_t hits = sd_cache_stats.hits - cacheMark.hits;
+	uint32_t reads = hits + sd_cache_stats.misses - cacheMark.misses;
+	char hit[16] = "-";
+
+	if(reads)
+		snprintf(hit, sizeof(hit), "%u/%u", hits, reads);
+	printf("%-34s %6d %6lu %6lu %6lu %8lu %7.1f %9s\n", what, sectors, cmds,
+		(fakesd_stats.cmds[18] - mark.cmds[18]) + (fakesd_stats.cmds[25] - mark.cmds[25]),
+		(fakesd_stats.cmds[12] - mark.cmds[12]), bytes,
+		sectors ? (double)bytes / sectors : 0.0, hit);
+}
+
+// Write the scratch area with count sectors per call, read it back with
+// rcount per call, and compare with what the card holds
+static void raw_test(int wcount, int rcount, uint32_t seed)
+{
+	static uint8_t want[SCRATCH * 512], got[SCRATCH * 512];
+	uint32_t first = nsect - SCRATCH;
+	char what[64];
+	int i;
+
+	fill(want, sizeof(want), seed);
+
+	begin();
+	for(i = 0; i < SCRATCH; i += wcount)
+		check(disk_write(0, want + i * 512, first + i, wcount) == RES_OK, "disk_write");
+	check(disk_ioctl(0, CTRL_SYNC, NULL) == RES_OK, "CTRL_SYNC");
+	snprintf(what, sizeof(what), "raw write, %d per call", wcount);
+	report(what, SCRATCH);
+	check(memcmp(image + first * 512, want, sizeof(want)) == 0, "card contents after disk_write");
+
+	memset(got, 0, sizeof(got));
+	begin();
+	for(i = 0; i < SCRATCH; i += rcount)
+		check(disk_read(0, got + i * 512, first + i, rcount) == RES_OK, "disk_read");
+	snprintf(what, sizeof(what), "raw read, %d per call", rcount);
+	report(what, SCRATCH);
+	check(memcmp(got, want, sizeof(want)) == 0, "data read back");
+}
+
+static void fatfs_test(void)
+{
+	static uint8_t want[FILE_SIZE], got[FILE_SIZE];
+	FATFS fs;
+	FIL fil;
+	DIR dir;
+	FILINFO fno;
+	UINT n;
+	int i;
+
+	fill(want, sizeof(want), 0xc0ffee);
+
+	check(f_mount(0, &fs) == FR_OK, "f_mount");
+
+	begin();
+	check(f_open(&fil, "CAPTURE.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK, "f_open for writing");
+	for(i = 0; i < FILE_SIZE; i += FILE_CHUNK) {
+		check(f_write(&fil, want + i, FILE_CHUNK, &n) == FR_OK && n == FILE_CHUNK, "f_write");
+	}
+	check(f_close(&fil) == FR_OK, "f_close");
+	report("FatFs write 64K in 4K chunks", FILE_SIZE / 512);
+
+	begin();
+	check(f_open(&fil, "CAPTURE.BIN", FA_READ) == FR_OK, "f_open for reading");
+	check(f_read(&fil, got, sizeof(got), &n) == FR_OK && n == sizeof(got), "f_read");
+	check(f_close(&fil) == FR_OK, "f_close");
+	report("FatFs read 64K in one go", FILE_SIZE / 512);
+	check(memcmp(got, want, sizeof(want)) == 0, "file read back");
+
+	printf("\nroot directory:\n");
+	if(f_opendir(&dir, "") == FR_OK) {
+		while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0])
+			printf("  %-12s %8lu\n", fno.fname, (unsigned long)fno.fsize);
+	}
+}
+
+// Lots of one sector files: every create and open walks the directory and
+// touches the FAT, which is where the cache earns its keep
+static void small_files_test(void)
+{
+	uint8_t want[512], got[512];
+	FATFS fs;
+	FIL fil;
+	UINT n;
+	char name[16];
+	int i, ok = 1;
+
+	check(f_mount(0, &fs) == FR_OK, "f_mount");
+
+	begin();
+	for(i = 0; i < SMALL_FILES; i++) {
+		fill(want, sizeof(want), i);
+		snprintf(name, sizeof(name), "TAG%03d.BIN", i);
+		ok &= f_open(&fil, name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK
+			&& f_write(&fil, want, sizeof(want), &n) == FR_OK && n == sizeof(want)
+			&& f_close(&fil) == FR_OK;
+	}
+	check(ok, "small files written");
+	report("FatFs create 40 small files", SMALL_FILES);
+
+	begin();
+	for(i = 0; i < SMALL_FILES; i++) {
+		fill(want, sizeof(want), i);
+		snprintf(name, sizeof(name), "TAG%03d.BIN", i);
+		ok &= f_open(&fil, name, FA_READ) == FR_OK
+			&& f_read(&fil, got, sizeof(got), &n) == FR_OK && n == sizeof(got)
+			&& f_close(&fil) == FR_OK
+			&& memcmp(got, want, sizeof(got)) == 0;
+	}
+	check(ok, "small files read back");
+	report("FatFs read 40 small files", SMALL_FILES);
+}
+
+static int logDone;
+
+static void log_done(void)
+{
+	logDone++;
+}
+
+static uint8_t *read_file(const char *name, UINT *len)
+{
+	static uint8_t data[LF_SAMPLES * 5];
+	FIL fil;
+
+	*len = 0;
+	if(f_open(&fil, name, FA_READ) != FR_OK) return NULL;
+	f_read(&fil, data, sizeof(data), len);
+	f_close(&fil);
+	return data;
+}
+
+// Log the captures the way the standalone menu does, one SdLogPoll() per
+// main loop pass, and check the files against what `data load' and
+// `hf 14a list' make of them
+static void sdlog_test(void)
+{
+	static uint8_t samples[LF_SAMPLES], trace[TRACE_BYTES];
+	char name[16], *p, *end;
+	uint8_t *data;
+	UINT len;
+	int i, polls;
+
+	fill(samples, sizeof(samples), 0x5eed);
+	fill(trace, sizeof(trace), 0x7ace);
+
+	begin();
+	logDone = 0;
+	check(SdLogSamples(samples, sizeof(samples), log_done), "SdLogSamples");
+	strcpy(name, SdLogName());
+	for(polls = 0; SdLogPoll(); polls++)
+		;
+	check(logDone == 1, "done() called once");
+	report("sdlog LF capture, text", 0);
+	data = read_file(name, &len);
+	printf("  %s, %u bytes, %d polls\n", name, len, polls);
+	check(data != NULL, "LF log read back");
+	if(data) {
+		// data load: atoi() of every line
+		p = (char *)data;
+		end = p + len;
+		for(i = 0; p < end && i < LF_SAMPLES; i++) {
+			if(atoi(p) != samples[i] - 128) break;
+			while(p < end && *p++ != '\n')
+				;
+		}
+		check(i == LF_SAMPLES && p == end, "LF log has every sample, as data samples would");
+	}
+
+	begin();
+	check(SdLogTrace(trace, sizeof(trace), NULL), "SdLogTrace");
+	strcpy(name, SdLogName());
+	SdLogFlush();
+	report("sdlog 14443A trace, binary", 0);
+	data = read_file(name, &len);
+	printf("  %s, %u bytes\n", name, len);
+	check(data && len == sizeof(trace) && memcmp(data, trace, len) == 0, "trace log read back");
+
+	begin();
+	check(SdLogTagId("HID 2004263F88 07876"), "SdLogTagId");
+	// the second one while a trace is being logged, which goes on
+	check(SdLogTrace(trace, sizeof(trace), NULL), "SdLogTrace");
+	strcpy(name, SdLogName());
+	check(SdLogPoll(), "trace log running");
+	check(SdLogTagId("HID 2004263F89 07876"), "SdLogTagId during a log");
+	SdLogFlush();
+	report("sdlog two tag IDs", 0);
+	data = read_file("TAGS.TXT", &len);
+	check(data && len == 42 && memcmp(data, "HID 2004263F88 07876\nHID 2004263F89 07876\n", len) == 0,
+		"TAGS.TXT");
+	data = read_file(name, &len);
+	check(data && len == sizeof(trace) && memcmp(data, trace, len) == 0,
+		"trace logged around a tag ID read back");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i image] [-o image] [-n sectors] [-s] [-q]\n", argv0);
+	fprintf(stderr, "  -i  disk image to put on the card (default: a fresh FAT16 volume)\n");
+	fprintf(stderr, "  -o  write the image out when done\n");
+	fprintf(stderr, "  -n  size of the made up volume, in sectors (default 131072)\n");
+	fprintf(stderr, "  -s  standard capacity card (byte addressed) instead of SDHC\n");
+	fprintf(stderr, "  -q  suppress firmware debug output\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *in = NULL, *outName = NULL;
+	int opt, hc = 1;
+	DWORD count = 0;
+	FILE *f;
+
+	nsect = 131072;
+	while((opt = getopt(argc, argv, "i:o:n:sqh")) != -1) {
+		switch(opt) {
+			case 'i': in = optarg; break;
+			case 'o': outName = optarg; break;
+			case 'n': nsect = atoi(optarg); break;
+			case 's': hc = 0; break;
+			case 'q': hostsim_quiet = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if(in) {
+		if(!(image = load_image(in, &nsect))) return 1;
+	} else {
+		image = calloc(nsect, 512);
+		if(!image || format_fat16(image, nsect)) return 1;
+	}
+
+	// the CSD can only describe whole units of 512K (SDHC) or 256K
+	nsect &= hc ? ~1023 : ~511;
+	if(nsect < 2 * SCRATCH) {
+		fprintf(stderr, "image too small\n");
+		return 1;
+	}
+	fakesd_attach(image, nsect, hc);
+
+	check(disk_initialize(0) == 0, "disk_initialize");
+	check(disk_ioctl(0, GET_SECTOR_COUNT, &count) == RES_OK && count == nsect, "sector count");
+	if(failed) return 1;
+
+	printf("%-34s %6s %6s %6s %6s %8s %7s %9s\n", "", "sect", "cmds", "multi", "CMD12", "bytes", "/sect", "hits");
+	raw_test(1, 1, 1);
+	raw_test(8, 16, 2);
+	raw_test(SCRATCH / 2, SCRATCH / 4, 3);
+	fatfs_test();
+	small_files_test();
+	sdlog_test();
+
+	if(outName) {
+		if(!(f = fopen(outName, "wb")) || fwrite(image, 512, nsect, f) != nsect) {
+			perror(outName);
+			return 1;
+		}
+		fclose(f);
+	}
+
+	printf("\n%s\n", failed ? "FAILED" : "all ok");
+	free(image);
+	return failed;
+}
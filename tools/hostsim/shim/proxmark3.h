@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Host shim for proxmark3.h, so that unmodified armsrc translation units can
+// be compiled into a host program. Pulls in the real header, then points the
+// peripherals the decoders touch at plain structs in RAM and turns the
+// per-iteration hooks (WDT_HIT, BUTTON_PRESS) into calls into hostsim.c.
+//-----------------------------------------------------------------------------
+
+#ifndef __HOSTSIM_PROXMARK3_H
+#define __HOSTSIM_PROXMARK3_H
+
+#include_next "proxmark3.h"
+
+extern AT91S_PDC hostsim_pdc_ssc;
+extern AT91S_SSC hostsim_ssc;
+extern AT91S_PIO hostsim_pioa;
+extern AT91S_TC hostsim_tc0;
+extern AT91S_TC hostsim_tc1;
+
+void hostsim_poll(void);
+int hostsim_button(void);
+
+#undef AT91C_BASE_PDC_SSC
+#define AT91C_BASE_PDC_SSC	(&hostsim_pdc_ssc)
+#undef AT91C_BASE_SSC
+#define AT91C_BASE_SSC		(&hostsim_ssc)
+#undef AT91C_BASE_PIOA
+#define AT91C_BASE_PIOA		(&hostsim_pioa)
+// Never counts, so the snoop loop cost in snoop_stats reads as zero on the
+// host; decbench measures that instead.
+#undef AT91C_BASE_TC0
+#define AT91C_BASE_TC0		(&hostsim_tc0)
+#undef AT91C_BASE_TC1
+#define AT91C_BASE_TC1		(&hostsim_tc1)
+
+// Every sniff loop hits the watchdog once per iteration; that is where the
+// fake PDC moves the next chunk of the dump into the DMA ring.
+#undef WDT_HIT
+#define WDT_HIT()		hostsim_poll()
+
+// The button ends the sniff loops; it is `pressed' once the dump is drained.
+#undef BUTTON_PRESS
+#define BUTTON_PRESS()	hostsim_button()
+
+#endif
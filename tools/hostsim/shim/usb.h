@@ -0,0 +1,15 @@
+//-----------------------------------------------------------------------------
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Just enough of libusb for client/proxusb.h; flashbench stands in for the
+// USB functions the client calls.
+//-----------------------------------------------------------------------------
+
+#ifndef __HOSTSIM_USB_H
+#define __HOSTSIM_USB_H
+
+typedef struct usb_dev_handle usb_dev_handle;
+
+#endif